@@ -0,0 +1,395 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <brotli/encode.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+
+#include "./Compression.h"
+
+using std::cerr;
+using std::endl;
+using std::shared_ptr;
+using std::string;
+
+namespace searchserver {
+
+///////////////////////////////////////////////////////////////////////////////
+// Constants, internal helper functions
+///////////////////////////////////////////////////////////////////////////////
+
+// zlib's default level, which gets most of the gain for a fraction of
+// the time that the best takes.
+static const int kGzipLevel = 6;
+
+// windowBits for deflateInit2(): the largest window, plus 16 for a
+// gzip rather than a zlib wrapper.
+static const int kGzipWindowBits = 15 + 16;
+
+// Output is grown by this much at a time while deflating.
+static const size_t kDeflateStep = 16384;
+
+// Static files are compressed once, so this can take its time.
+static const int kBrotliStaticQuality = 9;
+
+// What an entry costs against the budget beyond its data: its key, and
+// roughly what the map and list take to hold it.
+static const size_t kEntryOverhead = 128;
+
+// Files queued for compression beyond this many are sent as they are;
+// they will be queued again when next asked for.  Each holds its file
+// open while it waits.
+static const size_t kMaxQueuedFiles = 64;
+
+static bool InitGzip(z_stream *strm) {
+  memset(strm, 0, sizeof(*strm));
+  int res = deflateInit2(strm, kGzipLevel, Z_DEFLATED, kGzipWindowBits, 8,
+                         Z_DEFAULT_STRATEGY);
+  if (res != Z_OK) {
+    cerr << "deflateInit2() failed: " << res << endl;
+    return false;
+  }
+  return true;
+}
+
+// Runs deflate() over what "strm" has as input, appending its output
+// to "*out", until it has taken all of the input (and, with Z_FINISH,
+// ended the stream).  Returns false if zlib fails.
+static bool DeflateInto(z_stream *strm, string *out, int flush) {
+  while (1) {
+    size_t start = out->size();
+    out->resize(start + kDeflateStep);
+    strm->next_out = reinterpret_cast<Bytef *>(&(*out)[start]);
+    strm->avail_out = kDeflateStep;
+    int res = deflate(strm, flush);
+    out->resize(start + kDeflateStep - strm->avail_out);
+    if (res == Z_STREAM_END) {
+      return true;
+    }
+    if ((res != Z_OK) && (res != Z_BUF_ERROR)) {
+      return false;
+    }
+    // Room left over means deflate() had nothing more to give.
+    if ((flush != Z_FINISH) && (strm->avail_in == 0) &&
+        (strm->avail_out != 0)) {
+      return true;
+    }
+  }
+}
+
+// A thread's deflate state, set up on first use and kept until the
+// thread exits.
+struct ThreadGzip {
+  ThreadGzip() { ok = InitGzip(&strm); }
+  ~ThreadGzip() {
+    if (ok) {
+      deflateEnd(&strm);
+    }
+  }
+
+  z_stream strm;
+  bool ok;
+};
+
+static int64_t MtimeNs(const struct stat &st) {
+  return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+         st.st_mtim.tv_nsec;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Compression
+///////////////////////////////////////////////////////////////////////////////
+const char *encoding_name(ContentEncoding encoding) {
+  switch (encoding) {
+    case ContentEncoding::kGzip:
+      return "gzip";
+    case ContentEncoding::kBrotli:
+      return "br";
+    default:
+      return "";
+  }
+}
+
+bool gzip_compress(const struct iovec *iov, size_t iovcnt, string *out) {
+  static thread_local ThreadGzip gzip;
+  if (!gzip.ok || (deflateReset(&gzip.strm) != Z_OK)) {
+    return false;
+  }
+  size_t total = 0;
+  for (size_t i = 0; i < iovcnt; i++) {
+    total += iov[i].iov_len;
+  }
+  out->reserve(out->size() + deflateBound(&gzip.strm, total) + kDeflateStep);
+
+  for (size_t i = 0; i < iovcnt; i++) {
+    gzip.strm.next_in = static_cast<Bytef *>(iov[i].iov_base);
+    gzip.strm.avail_in = iov[i].iov_len;
+    if (!DeflateInto(&gzip.strm, out, Z_NO_FLUSH)) {
+      return false;
+    }
+  }
+  return DeflateInto(&gzip.strm, out, Z_FINISH);
+}
+
+bool brotli_compress(const char *data, size_t len, int quality, string *out) {
+  size_t bound = BrotliEncoderMaxCompressedSize(len);
+  if (bound == 0) {
+    return false;
+  }
+  size_t start = out->size();
+  out->resize(start + bound);
+  size_t encoded = bound;
+  if (!BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW,
+                             BROTLI_MODE_TEXT, len,
+                             reinterpret_cast<const uint8_t *>(data),
+                             &encoded,
+                             reinterpret_cast<uint8_t *>(&(*out)[start]))) {
+    out->resize(start);
+    return false;
+  }
+  out->resize(start + encoded);
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GzipBodyStream
+///////////////////////////////////////////////////////////////////////////////
+GzipBodyStream::GzipBodyStream(shared_ptr<BodyStream> source)
+  : source_(std::move(source)) {
+  ok_ = InitGzip(&strm_);
+}
+
+GzipBodyStream::~GzipBodyStream() {
+  if (ok_) {
+    deflateEnd(&strm_);
+  }
+}
+
+bool GzipBodyStream::Next(string *out) {
+  if (!ok_ || finished_) {
+    return false;
+  }
+  piece_.clear();
+  if (!source_->Next(&piece_)) {
+    finished_ = true;
+    strm_.avail_in = 0;
+    return Deflate(out, Z_FINISH);
+  }
+  strm_.next_in = reinterpret_cast<Bytef *>(&piece_[0]);
+  strm_.avail_in = piece_.size();
+
+  // The first piece is flushed out whole, so that the start of the
+  // body isn't held back waiting for the rest.
+  return Deflate(out, (strm_.total_in == 0) ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+}
+
+bool GzipBodyStream::Deflate(string *out, int flush) {
+  if (!DeflateInto(&strm_, out, flush)) {
+    // What has gone out can't be finished, so cut the body short.
+    cerr << "deflate() failed" << endl;
+    ok_ = false;
+    return false;
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CompressedFileCache
+///////////////////////////////////////////////////////////////////////////////
+CompressedFileCache::CompressedFileCache(size_t budget_bytes,
+                                         size_t max_file_bytes)
+  : budget_bytes_(budget_bytes), max_file_bytes_(max_file_bytes) {
+  pthread_mutex_init(&lock_, nullptr);
+  pthread_cond_init(&cond_, nullptr);
+  pthread_create(&thread_, nullptr, &compress_thread,
+                 static_cast<void *>(this));
+}
+
+CompressedFileCache::~CompressedFileCache() {
+  pthread_mutex_lock(&lock_);
+  stop_ = true;
+  pthread_cond_broadcast(&cond_);
+  pthread_mutex_unlock(&lock_);
+
+  // Waits out the file being compressed, if there is one.
+  pthread_join(thread_, nullptr);
+  pthread_cond_destroy(&cond_);
+  pthread_mutex_destroy(&lock_);
+}
+
+shared_ptr<const string> CompressedFileCache::get(
+    const string &name, shared_ptr<const BodyFile> file,
+    const struct stat &st, ContentEncoding encoding, bool *in_progress) {
+  *in_progress = false;
+  if ((encoding == ContentEncoding::kIdentity) ||
+      (static_cast<size_t>(st.st_size) > max_file_bytes_)) {
+    return nullptr;
+  }
+  string key = string(encoding_name(encoding)) + ":" + name;
+  int64_t mtime_ns = MtimeNs(st);
+
+  pthread_mutex_lock(&lock_);
+  auto it = entries_.find(key);
+  if ((it != entries_.end()) && (it->second.ino == st.st_ino) &&
+      (it->second.size == st.st_size) && (it->second.mtime_ns == mtime_ns)) {
+    lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+    shared_ptr<const string> data = it->second.data;
+    *in_progress = it->second.pending;
+    pthread_mutex_unlock(&lock_);
+    return data;
+  }
+
+  // A new version of the file has to be compressed, if there is room
+  // in the queue.  Its entry stands in for the copy meanwhile, so that
+  // it is only queued once.
+  if (queue_.size() >= kMaxQueuedFiles) {
+    *in_progress = true;
+    pthread_mutex_unlock(&lock_);
+    return nullptr;
+  }
+  if (it != entries_.end()) {
+    erase(it);
+  }
+  size_t cost = key.size() + kEntryOverhead;
+  if (cost > budget_bytes_) {
+    pthread_mutex_unlock(&lock_);
+    return nullptr;
+  }
+  evict(cost);
+  lru_.push_front(key);
+  Entry &entry = entries_[key];
+  entry.ino = st.st_ino;
+  entry.size = st.st_size;
+  entry.mtime_ns = mtime_ns;
+  entry.lru_pos = lru_.begin();
+  used_bytes_ += cost;
+
+  Job job;
+  job.key = key;
+  job.file = std::move(file);
+  job.ino = st.st_ino;
+  job.size = st.st_size;
+  job.mtime_ns = mtime_ns;
+  job.encoding = encoding;
+  queue_.push_back(std::move(job));
+  pending_++;
+  *in_progress = true;
+  pthread_cond_signal(&cond_);
+  pthread_mutex_unlock(&lock_);
+  return nullptr;
+}
+
+size_t CompressedFileCache::size() {
+  pthread_mutex_lock(&lock_);
+  size_t size = used_bytes_;
+  pthread_mutex_unlock(&lock_);
+  return size;
+}
+
+size_t CompressedFileCache::pending() {
+  pthread_mutex_lock(&lock_);
+  size_t pending = pending_;
+  pthread_mutex_unlock(&lock_);
+  return pending;
+}
+
+void *CompressedFileCache::compress_thread(void *arg) {
+  static_cast<CompressedFileCache *>(arg)->compress_loop();
+  return nullptr;
+}
+
+void CompressedFileCache::compress_loop() {
+  pthread_mutex_lock(&lock_);
+  while (!stop_) {
+    if (queue_.empty()) {
+      pthread_cond_wait(&cond_, &lock_);
+      continue;
+    }
+    Job job = std::move(queue_.front());
+    queue_.pop_front();
+
+    // Read the file and compress it, without holding the lock.
+    pthread_mutex_unlock(&lock_);
+    string contents(job.size, '\0');
+    size_t done = 0;
+    while (done < contents.size()) {
+      ssize_t res = pread(job.file->fd(), &contents[done],
+                          contents.size() - done, done);
+      if (res <= 0) {
+        break;
+      }
+      done += res;
+    }
+    job.file.reset();
+    shared_ptr<string> compressed = std::make_shared<string>();
+    // A file that shrank meanwhile is a new version, which the next
+    // request for it will queue.
+    bool ok = (done == contents.size());
+    if (ok && (job.encoding == ContentEncoding::kGzip)) {
+      struct iovec iov = { &contents[0], contents.size() };
+      ok = gzip_compress(&iov, 1, compressed.get());
+    } else if (ok) {
+      ok = brotli_compress(contents.data(), contents.size(),
+                           kBrotliStaticQuality, compressed.get());
+    }
+    if (!ok || (compressed->size() >= contents.size())) {
+      // Not worth sending; remember that, so it isn't tried again.
+      compressed.reset();
+    } else {
+      compressed->shrink_to_fit();
+    }
+    pthread_mutex_lock(&lock_);
+    pending_--;
+
+    // The entry may have been evicted, or replaced by a newer version,
+    // meanwhile; the copy is only wanted if it is still waiting for it.
+    auto it = entries_.find(job.key);
+    if ((it == entries_.end()) || !it->second.pending ||
+        (it->second.ino != job.ino) || (it->second.size != job.size) ||
+        (it->second.mtime_ns != job.mtime_ns)) {
+      continue;
+    }
+    size_t extra = compressed ? compressed->size() : 0;
+    lru_.erase(it->second.lru_pos);
+    used_bytes_ -= job.key.size() + kEntryOverhead;
+    if (job.key.size() + kEntryOverhead + extra > budget_bytes_) {
+      // Too big to keep; the file is sent as it is.
+      compressed.reset();
+      extra = 0;
+    }
+    evict(job.key.size() + kEntryOverhead + extra);
+    lru_.push_front(job.key);
+    it->second.pending = false;
+    it->second.data = compressed;
+    it->second.lru_pos = lru_.begin();
+    used_bytes_ += job.key.size() + kEntryOverhead + extra;
+  }
+  pthread_mutex_unlock(&lock_);
+}
+
+void CompressedFileCache::evict(size_t needed) {
+  while (!lru_.empty() && (used_bytes_ + needed > budget_bytes_)) {
+    erase(entries_.find(lru_.back()));
+  }
+}
+
+void CompressedFileCache::erase(
+    std::unordered_map<string, Entry>::iterator it) {
+  used_bytes_ -= it->first.size() + kEntryOverhead;
+  used_bytes_ -= it->second.data ? it->second.data->size() : 0;
+  lru_.erase(it->second.lru_pos);
+  entries_.erase(it);
+}
+
+}  // namespace searchserver
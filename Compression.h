@@ -0,0 +1,182 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef COMPRESSION_H_
+#define COMPRESSION_H_
+
+extern "C" {
+  #include <pthread.h>  // for the pthread threading/mutex functions
+}
+
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <zlib.h>
+
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "./HttpResponse.h"
+
+namespace searchserver {
+
+// The content codings the server can send a body in.
+enum class ContentEncoding {
+  kIdentity,
+  kGzip,
+  kBrotli,
+};
+
+// Returns the name of "encoding" as it goes in a Content-Encoding
+// header, e.g. "gzip", or "" for kIdentity.
+const char *encoding_name(ContentEncoding encoding);
+
+// Appends the gzip compression of the "iovcnt" buffers at "iov", taken
+// as one, to "*out".  The deflate state belongs to the calling thread
+// and is reset and reused from one call to the next, so compressing
+// doesn't set up (and allocate) a new one each time.  Returns false if
+// zlib fails.
+bool gzip_compress(const struct iovec *iov, size_t iovcnt, std::string *out);
+
+// Appends the brotli compression of "len" bytes at "data" to "*out",
+// at the given "quality" (0-11).  Returns false if that fails.
+bool brotli_compress(const char *data, size_t len, int quality,
+                     std::string *out);
+
+// A BodyStream that gzips another as it goes, so that a streamed body
+// can be compressed without being held in memory.  Each piece of the
+// other stream is compressed as far as zlib will go without flushing,
+// so a piece may produce nothing until more follows.
+class GzipBodyStream : public BodyStream {
+ public:
+  explicit GzipBodyStream(std::shared_ptr<BodyStream> source);
+  virtual ~GzipBodyStream();
+
+  bool Next(std::string *out) override;
+
+ private:
+  // Compresses what strm_ has as input onto the end of "*out", with
+  // zlib's "flush" mode.  Returns false if zlib fails.
+  bool Deflate(std::string *out, int flush);
+
+  std::shared_ptr<BodyStream> source_;
+  z_stream strm_;
+  bool ok_;
+  bool finished_ = false;
+
+  // Holds each piece of source_ while it is compressed.
+  std::string piece_;
+};
+
+// Compressed copies of static files, made the first time they are
+// asked for and kept for as long as the file is unchanged, up to a
+// budget of bytes; beyond that, the least recently used go.
+//
+// Files are compressed on a background thread, so that nobody serving
+// requests waits on one: get() never blocks, and until the copy of a
+// file is ready its callers send it as it is.  Each version of a file
+// is compressed at most once, however many ask for it meanwhile.
+//
+// A CompressedFileCache is thread-safe.
+class CompressedFileCache {
+ public:
+  // Creates a cache of at most "budget_bytes" of compressed data, for
+  // files of at most "max_file_bytes" each, and starts its compression
+  // thread.
+  CompressedFileCache(size_t budget_bytes, size_t max_file_bytes);
+
+  // Stops the compression thread.  Queued files are dropped.
+  virtual ~CompressedFileCache();
+
+  // Returns the "encoding" of the file "name", which is open as "file"
+  // and described by "st", if a copy of this version of it is ready.
+  // Otherwise queues it to be compressed (if it isn't queued already,
+  // and the queue has room; if it hasn't, a later call will queue it),
+  // sets "*in_progress" to true, and returns nullptr.  Also returns
+  // nullptr, with *in_progress false, for a file that is too big,
+  // can't be read, or doesn't get any smaller.
+  std::shared_ptr<const std::string> get(const std::string &name,
+                                         std::shared_ptr<const BodyFile> file,
+                                         const struct stat &st,
+                                         ContentEncoding encoding,
+                                         bool *in_progress);
+
+  // The number of bytes counted against the budget, for tests.
+  size_t size();
+
+  // The number of files queued or being compressed, for tests.
+  size_t pending();
+
+  CompressedFileCache(const CompressedFileCache &other) = delete;
+  CompressedFileCache &operator=(const CompressedFileCache &other) = delete;
+
+ private:
+  // A compressed copy of one version of a file, identified by its
+  // inode, size and modification time.  "pending" is true while the
+  // copy is still queued or being made.
+  struct Entry {
+    ino_t ino;
+    off_t size;
+    int64_t mtime_ns;
+    bool pending = true;
+    std::shared_ptr<const std::string> data;
+    std::list<std::string>::iterator lru_pos;
+  };
+
+  // A queued file.
+  struct Job {
+    std::string key;
+    std::shared_ptr<const BodyFile> file;
+    ino_t ino;
+    off_t size;
+    int64_t mtime_ns;
+    ContentEncoding encoding;
+  };
+
+  // The compression thread's start routine and main loop.
+  static void *compress_thread(void *arg);
+  void compress_loop();
+
+  // Drops the least recently used entries until "needed" more bytes
+  // fit in the budget.  Must hold lock_.
+  void evict(size_t needed);
+
+  // Removes the entry at "it".  Must hold lock_.
+  void erase(std::unordered_map<std::string, Entry>::iterator it);
+
+  const size_t budget_bytes_;
+  const size_t max_file_bytes_;
+
+  // Guards everything below.
+  pthread_mutex_t lock_;
+  pthread_cond_t cond_;
+
+  // Keyed by the encoding's name and the file's name, most recently
+  // used at the front of lru_.
+  std::unordered_map<std::string, Entry> entries_;
+  std::list<std::string> lru_;
+  size_t used_bytes_ = 0;
+
+  // Files waiting for the compression thread, and how many of them
+  // (plus the one it is working on) there are.
+  std::deque<Job> queue_;
+  size_t pending_ = 0;
+
+  bool stop_ = false;
+  pthread_t thread_;
+};
+
+}  // namespace searchserver
+
+#endif  // COMPRESSION_H_
@@ -0,0 +1,268 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include "./ConnectionPoller.h"
+
+using std::cerr;
+using std::endl;
+using std::pair;
+using std::vector;
+
+namespace searchserver {
+
+///////////////////////////////////////////////////////////////////////////////
+// Constants, internal helper functions
+///////////////////////////////////////////////////////////////////////////////
+
+// epoll user data for the eventfd.  Parked connections start above it.
+static const uint64_t kWakeId = 0;
+
+// How many epoll events to pick up per epoll_wait().
+static const int kMaxEvents = 256;
+
+// As in Watchdog: connections are parked from other threads without
+// waking the poller, so it never sleeps longer than this.
+static const int kMaxPollerSleepMs = 1000;
+
+///////////////////////////////////////////////////////////////////////////////
+// ConnectionPoller
+///////////////////////////////////////////////////////////////////////////////
+ConnectionPoller::ConnectionPoller(const TimeoutOptions &timeouts,
+                                   ConnectionStats *stats)
+  : timeouts_(timeouts), stats_(stats), pool_(nullptr),
+    epoll_fd_(-1), wake_fd_(-1), next_id_(kWakeId + 1),
+    wheel_(TimerWheel::NowMs(), kTimeoutTickMs), running_(false),
+    draining_(false) {
+  pthread_mutex_init(&lock_, nullptr);
+}
+
+ConnectionPoller::~ConnectionPoller() {
+  stop();
+
+  // Deleting the tasks closes their connections.
+  for (auto &entry : parked_) {
+    wheel_.cancel(&entry.second->timer);
+    delete entry.second->task;
+    stats_->record_close();
+  }
+  parked_.clear();
+  if (wake_fd_ != -1) {
+    close(wake_fd_);
+  }
+  if (epoll_fd_ != -1) {
+    close(epoll_fd_);
+  }
+  pthread_mutex_destroy(&lock_);
+}
+
+bool ConnectionPoller::start(ThreadPool *pool) {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ == -1) {
+    cerr << "epoll_create1() failed: " << strerror(errno) << endl;
+    return false;
+  }
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd_ == -1) {
+    cerr << "eventfd() failed: " << strerror(errno) << endl;
+    return false;
+  }
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u64 = kWakeId;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev) == -1) {
+    cerr << "epoll_ctl() failed: " << strerror(errno) << endl;
+    return false;
+  }
+
+  pool_ = pool;
+  running_ = true;
+  if (pthread_create(&thread_, nullptr, &poller_thread,
+                     static_cast<void *>(this)) != 0) {
+    running_ = false;
+    return false;
+  }
+  return true;
+}
+
+void ConnectionPoller::stop() {
+  pthread_mutex_lock(&lock_);
+  bool was_running = running_;
+  running_ = false;
+  pthread_mutex_unlock(&lock_);
+  if (!was_running) {
+    return;
+  }
+
+  uint64_t one = 1;
+  if (write(wake_fd_, &one, sizeof(one)) == -1) {
+    // The counter is already non-zero, so the thread will wake anyway.
+  }
+  pthread_join(thread_, nullptr);
+}
+
+void ConnectionPoller::park(ThreadPool::Task *task, int fd, TimeoutKind kind,
+                            uint64_t since_ms, bool served) {
+  pthread_mutex_lock(&lock_);
+  if (!running_ || (draining_ && served && (kind == TimeoutKind::kIdle))) {
+    pthread_mutex_unlock(&lock_);
+    delete task;
+    stats_->record_close();
+    return;
+  }
+
+  uint64_t id = next_id_++;
+  Parked *p = new Parked();
+  p->task = task;
+  p->fd = fd;
+  p->kind = kind;
+  p->served = served;
+  parked_[id].reset(p);
+
+  // One-shot, so that the connection is reported once even if it is
+  // still readable when the poller gets round to removing it.
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+  ev.data.u64 = id;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    cerr << "epoll_ctl() failed: " << strerror(errno) << endl;
+    parked_.erase(id);
+    pthread_mutex_unlock(&lock_);
+    delete task;
+    stats_->record_close();
+    return;
+  }
+
+  uint32_t limit = timeouts_.limit(kind);
+  if (limit != 0) {
+    p->timer.data = id;
+    wheel_.schedule(&p->timer, since_ms + limit);
+  }
+  pthread_mutex_unlock(&lock_);
+}
+
+void ConnectionPoller::drain() {
+  vector<ThreadPool::Task *> idle;
+  pthread_mutex_lock(&lock_);
+  draining_ = true;
+  for (auto it = parked_.begin(); it != parked_.end(); ) {
+    Parked *p = it->second.get();
+    if (!p->served || (p->kind != TimeoutKind::kIdle)) {
+      ++it;
+      continue;
+    }
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, p->fd, nullptr);
+    wheel_.cancel(&p->timer);
+    idle.push_back(p->task);
+    it = parked_.erase(it);
+  }
+  pthread_mutex_unlock(&lock_);
+
+  for (ThreadPool::Task *task : idle) {
+    delete task;
+    stats_->record_close();
+  }
+}
+
+size_t ConnectionPoller::size() {
+  pthread_mutex_lock(&lock_);
+  size_t n = parked_.size();
+  pthread_mutex_unlock(&lock_);
+  return n;
+}
+
+void *ConnectionPoller::poller_thread(void *arg) {
+  static_cast<ConnectionPoller *>(arg)->poller_loop();
+  return nullptr;
+}
+
+void ConnectionPoller::poller_loop() {
+  struct epoll_event events[kMaxEvents];
+  vector<ThreadPool::Task *> ready;
+  vector<TimerWheel::Timer *> expired;
+  vector<pair<ThreadPool::Task *, TimeoutKind>> timed_out;
+
+  while (1) {
+    pthread_mutex_lock(&lock_);
+    bool running = running_;
+    int timeout = wheel_.next_timeout_ms(TimerWheel::NowMs());
+    pthread_mutex_unlock(&lock_);
+    if (!running) {
+      break;
+    }
+    if ((timeout < 0) || (timeout > kMaxPollerSleepMs)) {
+      timeout = kMaxPollerSleepMs;
+    }
+
+    int n = epoll_wait(epoll_fd_, events, kMaxEvents, timeout);
+    if ((n == -1) && (errno != EINTR)) {
+      cerr << "epoll_wait() failed: " << strerror(errno) << endl;
+      break;
+    }
+
+    // Take every connection that became readable or missed its
+    // deadline out of the poller.
+    ready.clear();
+    expired.clear();
+    timed_out.clear();
+    pthread_mutex_lock(&lock_);
+    for (int i = 0; i < n; i++) {
+      uint64_t id = events[i].data.u64;
+      if (id == kWakeId) {
+        uint64_t count;
+        while (read(wake_fd_, &count, sizeof(count)) > 0) { }
+        continue;
+      }
+      auto it = parked_.find(id);
+      if (it == parked_.end()) {
+        continue;
+      }
+      Parked *p = it->second.get();
+      epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, p->fd, nullptr);
+      wheel_.cancel(&p->timer);
+      ready.push_back(p->task);
+      parked_.erase(it);
+    }
+    wheel_.advance(TimerWheel::NowMs(), &expired);
+    for (TimerWheel::Timer *timer : expired) {
+      auto it = parked_.find(timer->data);
+      if (it == parked_.end()) {
+        continue;
+      }
+      Parked *p = it->second.get();
+      epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, p->fd, nullptr);
+      timed_out.emplace_back(p->task, p->kind);
+      parked_.erase(it);
+    }
+    pthread_mutex_unlock(&lock_);
+
+    for (ThreadPool::Task *task : ready) {
+      pool_->dispatch(task);
+    }
+    for (auto &entry : timed_out) {
+      stats_->record_timeout(entry.second);
+      delete entry.first;
+      stats_->record_close();
+    }
+  }
+}
+
+}  // namespace searchserver
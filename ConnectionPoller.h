@@ -0,0 +1,113 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef CONNECTIONPOLLER_H_
+#define CONNECTIONPOLLER_H_
+
+extern "C" {
+  #include <pthread.h>  // for the pthread threading/mutex functions
+}
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+
+#include "./ThreadPool.h"
+#include "./Timeouts.h"
+#include "./TimerWheel.h"
+
+namespace searchserver {
+
+// A ConnectionPoller holds client connections that are waiting for the
+// client to send something, so that no worker thread has to block on
+// them.  Each connection is parked as the Task that serves it; when the
+// client's socket becomes readable (or is closed), the poller's thread
+// dispatches that Task to a ThreadPool, which then has data to read.
+//
+// This way the number of open connections is independent of the number
+// of worker threads, and the pool only needs a thread per core.
+//
+// A parked connection is held to an idle or a header deadline.  If it
+// misses it, its Task is deleted, which must close the connection.
+class ConnectionPoller {
+ public:
+  // Creates a poller whose connections' deadlines come from "timeouts",
+  // and that counts timeouts and closes in "stats".  Ownership of
+  // stats is not taken.
+  ConnectionPoller(const TimeoutOptions &timeouts, ConnectionStats *stats);
+
+  // Stops the poller if need be, and deletes every Task still parked.
+  virtual ~ConnectionPoller();
+
+  // Starts the poller's thread, which dispatches to "pool".  Returns
+  // false if the poller could not be set up.
+  bool start(ThreadPool *pool);
+
+  // Stops the poller's thread; no Task is dispatched after this
+  // returns.  Tasks parked afterwards are simply deleted.
+  void stop();
+
+  // Puts the poller in drain mode: connections parked waiting for a
+  // new request (kIdle) after being served are closed now, and any
+  // parked that way later are closed straight away.  Connections that
+  // are new, or partway through a request, are still dispatched when
+  // it arrives.
+  void drain();
+
+  // Takes ownership of "task", which serves the connection on "fd",
+  // and dispatches it once fd is readable.  The connection is held to
+  // the "kind" deadline, counted from "since_ms" (see TimerWheel::NowMs).
+  // "served" says whether the connection has answered a request yet.
+  // Safe to call from any thread.
+  void park(ThreadPool::Task *task, int fd, TimeoutKind kind,
+            uint64_t since_ms, bool served);
+
+  // The number of parked connections.
+  size_t size();
+
+  ConnectionPoller(const ConnectionPoller &other) = delete;
+  ConnectionPoller &operator=(const ConnectionPoller &other) = delete;
+
+ private:
+  // A parked connection.
+  struct Parked {
+    ThreadPool::Task *task;
+    int fd;
+    TimeoutKind kind;
+    bool served;
+    TimerWheel::Timer timer;
+  };
+
+  static void *poller_thread(void *arg);
+  void poller_loop();
+
+  TimeoutOptions timeouts_;
+  ConnectionStats *stats_;
+  ThreadPool *pool_;
+
+  int epoll_fd_;
+
+  // An eventfd that wakes the poller thread when it is to stop.
+  int wake_fd_;
+
+  // Guards everything below.
+  pthread_mutex_t lock_;
+  std::unordered_map<uint64_t, std::unique_ptr<Parked>> parked_;
+  uint64_t next_id_;
+  TimerWheel wheel_;
+  bool running_;
+  bool draining_;
+  pthread_t thread_;
+};
+
+}  // namespace searchserver
+
+#endif  // CONNECTIONPOLLER_H_
@@ -11,6 +11,7 @@
 
 #include "./CrawlFileTree.h"
 
+#include <ctype.h>
 #include <dirent.h>
 #include <cstdlib>
 #include <sys/stat.h>
@@ -182,25 +183,32 @@ static void handle_file(const string& fpath, WordIndex *index) {
   // Your implementation should also be case in-sensitive and record every word in all lower-case
   
 
-  // read in file into a string
-  string file_contents;
+  // read in file, mapping it if it is big
+  FileView file_contents;
   FileReader reader = FileReader(fpath);
-  bool read_success = reader.read_file(& file_contents);
+  bool read_success = reader.read_view(& file_contents);
 
   if (read_success) {
-    // if successfully read the file
-    // change all string characters into lower case
-    boost::algorithm::to_lower(file_contents);
-    // split the string into tokens
-    vector<string> tokens;
-    boost::split(tokens, file_contents, !boost::is_alpha(), boost::token_compress_on);
-
-    // go through all the tokens and record the index
-    for(auto& word: tokens) {
-      if(word != "") {
-        // std::cout << word << std::endl;
+    // if successfully read the file, go through it a run of letters
+    // at a time, lowercasing each into "word" and recording it; the
+    // contents themselves are never copied
+    std::string_view contents = file_contents.data();
+    string word;
+    size_t i = 0;
+    while (i < contents.size()) {
+      while ((i < contents.size()) &&
+             !isalpha(static_cast<unsigned char>(contents[i]))) {
+        i++;
+      }
+      word.clear();
+      while ((i < contents.size()) &&
+             isalpha(static_cast<unsigned char>(contents[i]))) {
+        word.push_back(tolower(static_cast<unsigned char>(contents[i])));
+        i++;
+      }
+      if (!word.empty()) {
         (*index).record(word, fpath);
-      }      
+      }
     }
   }
 }
@@ -0,0 +1,149 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <netdb.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "./DnsResolver.h"
+#include "./ServerSocket.h"
+
+using std::string;
+
+namespace searchserver {
+
+// Lookups queued beyond this many are dropped; the callers will simply
+// ask again on a later connection.
+static const size_t kMaxQueuedLookups = 1024;
+
+DnsResolver::DnsResolver(size_t max_entries, int ttl_seconds)
+  : max_entries_(max_entries), ttl_seconds_(ttl_seconds), stop_(false) {
+  pthread_mutex_init(&lock_, nullptr);
+  pthread_cond_init(&cond_, nullptr);
+  pthread_create(&thread_, nullptr, &resolver_thread,
+                 static_cast<void *>(this));
+}
+
+DnsResolver::~DnsResolver() {
+  pthread_mutex_lock(&lock_);
+  stop_ = true;
+  pthread_cond_broadcast(&cond_);
+  pthread_mutex_unlock(&lock_);
+
+  // The thread may be stuck in getnameinfo() for a while; that's the
+  // price of a clean shutdown.
+  pthread_join(thread_, nullptr);
+  pthread_cond_destroy(&cond_);
+  pthread_mutex_destroy(&lock_);
+}
+
+bool DnsResolver::lookup(const struct sockaddr *addr, socklen_t len,
+                         string *name) {
+  string key;
+  uint16_t port;
+  format_address(addr, &key, &port);
+
+  pthread_mutex_lock(&lock_);
+  auto it = cache_.find(key);
+  if (it != cache_.end()) {
+    Entry &entry = it->second;
+    if (entry.pending) {
+      pthread_mutex_unlock(&lock_);
+      return false;
+    }
+    if (entry.expires > time(nullptr)) {
+      lru_.splice(lru_.begin(), lru_, entry.lru_pos);
+      *name = entry.name;
+      pthread_mutex_unlock(&lock_);
+      return true;
+    }
+  }
+
+  // A new or stale answer has to be looked up, if there is room in the
+  // queue.
+  if (queue_.size() >= kMaxQueuedLookups) {
+    pthread_mutex_unlock(&lock_);
+    return false;
+  }
+  if (it != cache_.end()) {
+    // Stale; look it up again but keep the slot.
+    it->second.pending = true;
+  } else {
+    evict();
+    lru_.push_front(key);
+    cache_[key].lru_pos = lru_.begin();
+  }
+
+  Request req;
+  req.key = key;
+  memset(&req.addr, 0, sizeof(req.addr));
+  memcpy(&req.addr, addr,
+         std::min(static_cast<size_t>(len), sizeof(req.addr)));
+  req.len = len;
+  queue_.push_back(req);
+  pthread_cond_signal(&cond_);
+  pthread_mutex_unlock(&lock_);
+  return false;
+}
+
+size_t DnsResolver::size() {
+  pthread_mutex_lock(&lock_);
+  size_t n = cache_.size();
+  pthread_mutex_unlock(&lock_);
+  return n;
+}
+
+void *DnsResolver::resolver_thread(void *arg) {
+  static_cast<DnsResolver *>(arg)->resolver_loop();
+  return nullptr;
+}
+
+void DnsResolver::resolver_loop() {
+  pthread_mutex_lock(&lock_);
+  while (!stop_) {
+    if (queue_.empty()) {
+      pthread_cond_wait(&cond_, &lock_);
+      continue;
+    }
+    Request req = queue_.front();
+    queue_.pop_front();
+
+    // Do the slow part without holding the lock.
+    pthread_mutex_unlock(&lock_);
+    char hostname[1024];  // ought to be big enough.
+    if (getnameinfo(reinterpret_cast<struct sockaddr *>(&req.addr), req.len,
+                    hostname, sizeof(hostname), nullptr, 0, 0) != 0) {
+      snprintf(hostname, sizeof(hostname), "[reverse DNS failed]");
+    }
+    pthread_mutex_lock(&lock_);
+
+    // Failures are cached too, so that a dead resolver isn't retried
+    // for every connection.  The entry may have been evicted meanwhile.
+    auto it = cache_.find(req.key);
+    if (it != cache_.end()) {
+      it->second.name = hostname;
+      it->second.expires = time(nullptr) + ttl_seconds_;
+      it->second.pending = false;
+    }
+  }
+  pthread_mutex_unlock(&lock_);
+}
+
+void DnsResolver::evict() {
+  while (!lru_.empty() && (cache_.size() >= max_entries_)) {
+    cache_.erase(lru_.back());
+    lru_.pop_back();
+  }
+}
+
+}  // namespace searchserver
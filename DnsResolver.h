@@ -0,0 +1,104 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef DNSRESOLVER_H_
+#define DNSRESOLVER_H_
+
+extern "C" {
+  #include <pthread.h>  // for the pthread threading/mutex functions
+}
+
+#include <sys/socket.h>
+#include <time.h>
+
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+namespace searchserver {
+
+// A DnsResolver does reverse DNS lookups on a background thread and
+// remembers the answers for a while, so that nobody serving requests
+// ever has to wait on a (possibly very slow) resolver.
+//
+// lookup() never blocks: it returns the cached name if there is a
+// fresh one, and otherwise queues a lookup and tells the caller to
+// make do with the numeric address this time.
+class DnsResolver {
+ public:
+  // Creates a resolver that caches at most "max_entries" answers, each
+  // for "ttl_seconds" seconds, and starts its lookup thread.
+  DnsResolver(size_t max_entries, int ttl_seconds);
+
+  // Stops the lookup thread.  Queued lookups are dropped.
+  virtual ~DnsResolver();
+
+  // Looks up the DNS name for the address "addr" of length "len".  If
+  // a fresh answer is cached, returns true and the name through
+  // "*name".  Otherwise queues a lookup (if one isn't queued already)
+  // and returns false.
+  bool lookup(const struct sockaddr *addr, socklen_t len, std::string *name);
+
+  // The number of cached answers, for tests.
+  size_t size();
+
+  DnsResolver(const DnsResolver &other) = delete;
+  DnsResolver &operator=(const DnsResolver &other) = delete;
+
+ private:
+  // A cached answer.  "pending" is true while the lookup that will
+  // fill it in is still queued or running.
+  struct Entry {
+    std::string name;
+    time_t expires = 0;
+    bool pending = true;
+    std::list<std::string>::iterator lru_pos;
+  };
+
+  // A queued lookup.
+  struct Request {
+    std::string key;
+    struct sockaddr_storage addr;
+    socklen_t len;
+  };
+
+  // The lookup thread's start routine and main loop.
+  static void *resolver_thread(void *arg);
+  void resolver_loop();
+
+  // Drops the least recently used answers until there is room for one
+  // more.  Must be called with lock_ held.
+  void evict();
+
+  size_t max_entries_;
+  int ttl_seconds_;
+
+  // Guards everything below.
+  pthread_mutex_t lock_;
+  pthread_cond_t cond_;
+
+  // Cached answers keyed by numeric address, and their keys from most
+  // to least recently used.
+  std::unordered_map<std::string, Entry> cache_;
+  std::list<std::string> lru_;
+
+  // Lookups waiting for the lookup thread.
+  std::deque<Request> queue_;
+
+  bool stop_;
+  pthread_t thread_;
+};
+
+}  // namespace searchserver
+
+#endif  // DNSRESOLVER_H_
@@ -0,0 +1,495 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "./EventLoop.h"
+#include "./HttpRequest.h"
+#include "./HttpServer.h"
+
+using std::cerr;
+using std::endl;
+using std::list;
+using std::pair;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace searchserver {
+
+///////////////////////////////////////////////////////////////////////////////
+// Constants, internal helper functions
+///////////////////////////////////////////////////////////////////////////////
+
+// epoll user data for the file descriptors that are not clients.
+// Client connection ids start above these.
+static const uint64_t kListenId = 0;
+static const uint64_t kWakeId = 1;
+static const uint64_t kDrainId = 2;
+
+// How many epoll events to pick up per epoll_wait().
+static const int kMaxEvents = 256;
+
+// A request, and any requests pipelined behind it, handed to a worker
+// thread.
+class EventLoopTask : public ThreadPool::Task {
+ public:
+  explicit EventLoopTask(ThreadPool::thread_task_fn f)
+    : ThreadPool::Task(f) { }
+
+  EventLoop *loop;
+  uint64_t conn_id;
+  std::vector<HttpRequest> requests;
+};
+
+// Processes an EventLoopTask on a worker thread and posts the
+// responses back to the loop.
+static void EventLoop_ThrFn(ThreadPool::Task *t) {
+  unique_ptr<EventLoopTask> task(static_cast<EventLoopTask *>(t));
+  vector<HttpResponse> responses;
+  responses.reserve(task->requests.size());
+  for (const HttpRequest &request : task->requests) {
+    responses.push_back(ProcessRequest(request, task->loop->base_dir(),
+                                       task->loop->index(),
+                                       task->loop->pool(),
+                                       task->loop->file_cache(),
+                                       task->loop->open_files(),
+                                       task->loop->compressed_files()));
+  }
+  task->loop->post_responses(task->conn_id, &responses);
+}
+
+// Puts "fd" into non-blocking mode.  Returns false on failure.
+static bool SetNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags == -1) {
+    return false;
+  }
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// EventLoop
+///////////////////////////////////////////////////////////////////////////////
+EventLoop::EventLoop(int listen_fd, int drain_fd, const string &base_dir,
+                     WordIndex *index, StaticFileCache *file_cache,
+                     OpenFileCache *open_files,
+                     CompressedFileCache *compressed_files,
+                     uint32_t num_workers,
+                     const TimeoutOptions &timeouts, ConnectionStats *stats)
+  : listen_fd_(listen_fd), drain_fd_(drain_fd), base_dir_(base_dir),
+    index_(index), file_cache_(file_cache), open_files_(open_files),
+    compressed_files_(compressed_files),
+    epoll_fd_(-1), timeouts_(timeouts), stats_(stats),
+    wheel_(TimerWheel::NowMs(), kTimeoutTickMs),
+    now_ms_(TimerWheel::NowMs()), wake_fd_(-1), stopping_(false),
+    draining_(false), drain_deadline_ms_(0), next_conn_id_(kDrainId + 1),
+    pool_(new ThreadPool(num_workers)) {
+  pthread_mutex_init(&completions_lock_, nullptr);
+}
+
+EventLoop::~EventLoop() {
+  // Join the workers first; any task they had queued still posts its
+  // response to us, which needs the lock and the eventfd.
+  pool_.reset();
+
+  connections_.clear();
+  if (wake_fd_ != -1) {
+    close(wake_fd_);
+  }
+  if (epoll_fd_ != -1) {
+    close(epoll_fd_);
+  }
+  pthread_mutex_destroy(&completions_lock_);
+}
+
+bool EventLoop::run() {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ == -1) {
+    cerr << "epoll_create1() failed: " << strerror(errno) << endl;
+    return false;
+  }
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd_ == -1) {
+    cerr << "eventfd() failed: " << strerror(errno) << endl;
+    return false;
+  }
+
+  // The listening socket must not block, since we accept until EAGAIN.
+  if (!SetNonBlocking(listen_fd_)) {
+    cerr << "Couldn't make the listening socket non-blocking: "
+         << strerror(errno) << endl;
+    return false;
+  }
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.u64 = kListenId;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev) == -1) {
+    cerr << "epoll_ctl() failed: " << strerror(errno) << endl;
+    return false;
+  }
+  ev.data.u64 = kWakeId;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev) == -1) {
+    cerr << "epoll_ctl() failed: " << strerror(errno) << endl;
+    return false;
+  }
+  if (drain_fd_ != -1) {
+    // Level-triggered, and removed once seen.
+    ev.events = EPOLLIN;
+    ev.data.u64 = kDrainId;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, drain_fd_, &ev) == -1) {
+      cerr << "epoll_ctl() failed: " << strerror(errno) << endl;
+      return false;
+    }
+  }
+
+  struct epoll_event events[kMaxEvents];
+  while (!stopping_) {
+    if (draining_ &&
+        (connections_.empty() || (now_ms_ >= drain_deadline_ms_))) {
+      break;
+    }
+
+    // Sleep no later than the next deadline.
+    int timeout = wheel_.next_timeout_ms(now_ms_);
+    if (draining_) {
+      int drain_left = static_cast<int>(drain_deadline_ms_ - now_ms_);
+      timeout = (timeout < 0) ? drain_left : std::min(timeout, drain_left);
+    }
+    int n = epoll_wait(epoll_fd_, events, kMaxEvents, timeout);
+    now_ms_ = TimerWheel::NowMs();
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      cerr << "epoll_wait() failed: " << strerror(errno) << endl;
+      return false;
+    }
+
+    for (int i = 0; i < n; i++) {
+      uint64_t id = events[i].data.u64;
+      if (id == kListenId) {
+        if (!draining_) {
+          accept_clients();
+        }
+      } else if (id == kDrainId) {
+        start_drain();
+      } else if (id == kWakeId) {
+        uint64_t count;
+        while (read(wake_fd_, &count, sizeof(count)) > 0) { }
+        handle_completions();
+      } else {
+        handle_event(id, events[i].events);
+      }
+    }
+    expire_timers();
+  }
+
+  // Whatever is left after a drain gets cut off.
+  while (!connections_.empty()) {
+    close_connection(connections_.begin()->first);
+  }
+  return true;
+}
+
+void EventLoop::stop() {
+  stopping_ = true;
+  uint64_t one = 1;
+  if (write(wake_fd_, &one, sizeof(one)) == -1) {
+    // The counter is already non-zero, so the loop will wake anyway.
+  }
+}
+
+void EventLoop::post_responses(uint64_t conn_id,
+                               vector<HttpResponse> *responses) {
+  pthread_mutex_lock(&completions_lock_);
+  completions_.emplace_back(conn_id, std::move(*responses));
+  pthread_mutex_unlock(&completions_lock_);
+
+  uint64_t one = 1;
+  if (write(wake_fd_, &one, sizeof(one)) == -1) {
+    // The counter is already non-zero, so the loop will wake anyway.
+  }
+}
+
+void EventLoop::accept_clients() {
+  // Edge-triggered: keep accepting until the backlog is empty, or we
+  // won't hear about the connections still queued in it.
+  while (1) {
+    int client_fd = accept4(listen_fd_, nullptr, nullptr,
+                            SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd == -1) {
+      if ((errno == EINTR) || (errno == ECONNABORTED)) {
+        continue;
+      }
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+        cerr << "Failure on accept: " << strerror(errno) << endl;
+      }
+      return;
+    }
+
+    uint64_t id = next_conn_id_++;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.u64 = id;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client_fd, &ev) == -1) {
+      cerr << "epoll_ctl() failed: " << strerror(errno) << endl;
+      close(client_fd);
+      continue;
+    }
+    Connection *c = new Connection(client_fd);
+    connections_[id].reset(c);
+    stats_->record_open();
+    update_deadline(id, c);
+  }
+}
+
+void EventLoop::start_drain() {
+  if (draining_) {
+    return;
+  }
+  draining_ = true;
+  drain_deadline_ms_ = now_ms_ + timeouts_.drain_ms;
+
+  // Connections still queued on the listening socket are left for
+  // whoever else is accepting from it, if anyone.
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, listen_fd_, nullptr);
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, drain_fd_, nullptr);
+
+  vector<uint64_t> idle;
+  for (auto &entry : connections_) {
+    if (drained(entry.second.get())) {
+      idle.push_back(entry.first);
+    }
+  }
+  for (uint64_t conn_id : idle) {
+    close_connection(conn_id);
+  }
+}
+
+bool EventLoop::drained(Connection *c) const {
+  return c->served && !c->busy && !c->conn.has_pending_output() &&
+         (c->conn.buffered_bytes() == 0);
+}
+
+void EventLoop::handle_event(uint64_t conn_id, uint32_t events) {
+  auto it = connections_.find(conn_id);
+  if (it == connections_.end()) {
+    return;
+  }
+  Connection *c = it->second.get();
+
+  if (events & EPOLLERR) {
+    close_connection(conn_id);
+    return;
+  }
+
+  if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) && !read_input(c)) {
+    close_connection(conn_id);
+    return;
+  }
+
+  // EPOLLOUT needs no special handling: drive() always flushes.
+  drive(conn_id, c);
+}
+
+void EventLoop::handle_completions() {
+  list<pair<uint64_t, vector<HttpResponse>>> done;
+  pthread_mutex_lock(&completions_lock_);
+  done.swap(completions_);
+  pthread_mutex_unlock(&completions_lock_);
+
+  for (auto &completion : done) {
+    auto it = connections_.find(completion.first);
+    if (it == connections_.end()) {
+      // The connection died while its request was being processed.
+      continue;
+    }
+    Connection *c = it->second.get();
+    c->busy = false;
+    for (HttpResponse &response : completion.second) {
+      c->conn.queue_response(std::move(response));
+    }
+    if (c->bad_request) {
+      c->conn.queue_response(BadRequestResponse());
+      c->bad_request = false;
+    }
+    drive(completion.first, c);
+  }
+}
+
+bool EventLoop::read_input(Connection *c) {
+  // The limit allows for the body of a request whose header is in.
+  c->conn.has_buffered_request();
+  size_t limit = kMaxBufferedBytes + c->conn.pending_body_length();
+  bool eof = false;
+  if (!c->conn.read_available(&eof, limit)) {
+    return false;
+  }
+  if (eof) {
+    c->peer_closed = true;
+  }
+  c->more_input = !eof && (c->conn.buffered_bytes() > limit);
+  return true;
+}
+
+void EventLoop::drive(uint64_t conn_id, Connection *c) {
+  while (1) {
+    // Answer buffered requests in order until one has to go to a
+    // worker.
+    HttpRequest req;
+    while (!c->busy && !c->close_after_write &&
+           c->conn.has_buffered_request()) {
+      if (!c->conn.next_buffered_request(&req)) {
+        // Say why, then hang up.
+        c->served = true;
+        c->conn.queue_response(BadRequestResponse());
+        c->close_after_write = true;
+        break;
+      }
+      c->served = true;
+      // Whatever deadline applies next starts afresh.
+      wheel_.cancel(&c->timer);
+      if (req.WantsClose()) {
+        // Answer this request, then hang up; anything after it is
+        // ignored.
+        c->close_after_write = true;
+      }
+      HttpResponse cached;
+      if (AnswerFromFileCache(req, base_dir_, file_cache_, &cached)) {
+        c->conn.queue_response(std::move(cached));
+        continue;
+      }
+
+      // Anything else may read files or search the index, so it goes
+      // to a worker.  Hand it every request that is already buffered
+      // behind this one as well, so that a pipelined batch is processed
+      // in order and its responses come back (and go out) together.
+      EventLoopTask *task = new EventLoopTask(EventLoop_ThrFn);
+      task->loop = this;
+      task->conn_id = conn_id;
+      task->requests.push_back(std::move(req));
+      while (!c->close_after_write && c->conn.has_buffered_request()) {
+        HttpRequest next;
+        if (!c->conn.next_buffered_request(&next)) {
+          // Answer what came before it, then say why we hang up.
+          c->close_after_write = true;
+          c->bad_request = true;
+          break;
+        }
+        if (next.WantsClose()) {
+          c->close_after_write = true;
+        }
+        task->requests.push_back(std::move(next));
+      }
+      c->busy = true;
+      pool_->dispatch(task);
+      break;
+    }
+
+    // A read that stopped at the limit left data in the socket that
+    // epoll won't report again.  Once requests have been taken out of
+    // the buffer (or a header has said how long a body to expect),
+    // there may be room to read it.
+    if (!c->more_input || c->close_after_write ||
+        (c->conn.buffered_bytes() >
+         kMaxBufferedBytes + c->conn.pending_body_length())) {
+      break;
+    }
+    if (!read_input(c)) {
+      close_connection(conn_id);
+      return;
+    }
+  }
+
+  if (!c->conn.flush_output()) {
+    close_connection(conn_id);
+    return;
+  }
+  if (!c->busy && !c->conn.has_pending_output() &&
+      (c->close_after_write || c->peer_closed ||
+       (draining_ && drained(c)) || c->conn.buffer_overflowed())) {
+    close_connection(conn_id);
+    return;
+  }
+  update_deadline(conn_id, c);
+}
+
+void EventLoop::update_deadline(uint64_t conn_id, Connection *c) {
+  if (c->busy) {
+    // Waiting on a worker is our fault, not the client's.
+    wheel_.cancel(&c->timer);
+    return;
+  }
+  TimeoutKind kind = CurrentDeadline(c->conn.has_pending_output(),
+                                     c->conn.buffered_bytes() > 0);
+  if (c->timer.armed() && (c->deadline == kind) &&
+      ((kind != TimeoutKind::kBody) ||
+       (c->conn.bytes_written() == c->deadline_written))) {
+    // Still doing the same thing, and (if sending) the client hasn't
+    // taken anything more since, so the deadline keeps running.
+    return;
+  }
+  uint32_t limit = timeouts_.limit(kind);
+  if (limit == 0) {
+    wheel_.cancel(&c->timer);
+    return;
+  }
+  c->deadline = kind;
+  c->deadline_written = c->conn.bytes_written();
+  c->timer.data = conn_id;
+  wheel_.schedule(&c->timer, now_ms_ + limit);
+}
+
+void EventLoop::expire_timers() {
+  vector<TimerWheel::Timer *> expired;
+  wheel_.advance(now_ms_, &expired);
+  for (TimerWheel::Timer *timer : expired) {
+    auto it = connections_.find(timer->data);
+    if (it != connections_.end()) {
+      stats_->record_timeout(it->second->deadline);
+      if (it->second->deadline == TimeoutKind::kBody) {
+        ResetOnClose(it->second->conn.fd());
+      }
+      close_connection(timer->data);
+    }
+  }
+}
+
+void EventLoop::close_connection(uint64_t conn_id) {
+  auto it = connections_.find(conn_id);
+  if (it == connections_.end()) {
+    return;
+  }
+  wheel_.cancel(&it->second->timer);
+  stats_->record_close();
+
+  // Closing the descriptor (in ~HttpConnection) also removes it from
+  // the epoll set.
+  connections_.erase(it);
+}
+
+}  // namespace searchserver
@@ -0,0 +1,226 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef EVENTLOOP_H_
+#define EVENTLOOP_H_
+
+extern "C" {
+  #include <pthread.h>  // for the pthread threading/mutex functions
+}
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <utility>
+
+#include "./Compression.h"
+#include "./HttpConnection.h"
+#include "./HttpResponse.h"
+#include "./OpenFileCache.h"
+#include "./StaticFileCache.h"
+#include "./ThreadPool.h"
+#include "./Timeouts.h"
+#include "./TimerWheel.h"
+#include "./WordIndex.h"
+
+namespace searchserver {
+
+// An EventLoop is an edge-triggered epoll reactor.  A single thread
+// (the one that calls run()) accepts connections on a listening
+// socket, reads and parses requests from every client, and writes the
+// responses back, all with non-blocking sockets.  Only static files
+// whose whole response is in the StaticFileCache are answered inline;
+// everything else may read files or search the index, so it is handed
+// to a ThreadPool owned by the loop and the responses are posted back
+// to the loop thread when they are ready.
+//
+// Because no thread ever blocks on a client, an idle keep-alive
+// connection costs a file descriptor and a little memory rather than
+// a whole worker thread.  Each connection has one deadline at a time
+// (see TimeoutKind), kept in a TimerWheel, and is closed if it misses
+// it.
+class EventLoop {
+ public:
+  // Creates an event loop that accepts connections on "listen_fd",
+  // serves static files out of "base_dir" (through "file_cache",
+  // "open_files" and "compressed_files", if not nullptr), and answers
+  // queries from "index" using "num_workers" worker threads.
+  // Connections are held to "timeouts", and timeouts and closes are
+  // counted in "stats".
+  //
+  // Once "drain_fd" (if not -1) becomes readable, the loop drains: it
+  // stops accepting, closes connections as soon as they are idle, and
+  // returns from run() when none are left or timeouts.drain_ms has
+  // passed.  The loop never reads drain_fd, so one descriptor can
+  // drain many loops.
+  //
+  // Ownership of listen_fd, drain_fd, index, file_cache, open_files,
+  // compressed_files and stats is not taken.
+  EventLoop(int listen_fd, int drain_fd, const std::string &base_dir,
+            WordIndex *index, StaticFileCache *file_cache,
+            OpenFileCache *open_files,
+            CompressedFileCache *compressed_files, uint32_t num_workers,
+            const TimeoutOptions &timeouts, ConnectionStats *stats);
+
+  // Closes every client connection still owned by the loop.
+  virtual ~EventLoop();
+
+  // Runs the loop on the calling thread until stop() is called or it
+  // has drained.  Returns false if the loop could not be set up or
+  // epoll failed.
+  bool run();
+
+  // Asks the loop to return from run().  Safe to call from any thread.
+  void stop();
+
+  // Hands the responses for connection "conn_id", in order, back to
+  // the loop thread, emptying "*responses".  Called by worker threads
+  // once a batch of requests has been processed.
+  void post_responses(uint64_t conn_id,
+                      std::vector<HttpResponse> *responses);
+
+  // Accessors used by worker threads to process requests.
+  const std::string &base_dir() const { return base_dir_; }
+  WordIndex *index() const { return index_; }
+  StaticFileCache *file_cache() const { return file_cache_; }
+  OpenFileCache *open_files() const { return open_files_; }
+  CompressedFileCache *compressed_files() const {
+    return compressed_files_;
+  }
+  ThreadPool *pool() const { return pool_.get(); }
+
+ private:
+  // The loop's state for one client connection.
+  struct Connection {
+    explicit Connection(int fd) : conn(fd) { }
+
+    HttpConnection conn;
+
+    // True while a request from this connection is being processed
+    // by a worker thread.  Further requests stay in the connection's
+    // buffer until it finishes so responses go out in order.
+    bool busy = false;
+
+    // Set once the client sent "Connection: close"; requests after it
+    // are ignored and the connection is closed after the pending
+    // output is written.
+    bool close_after_write = false;
+
+    // Set when a request pipelined behind those handed to a worker
+    // is malformed; a 400 follows their responses.
+    bool bad_request = false;
+
+    // Set once the client closed its end.  Requests it sent before
+    // that are still answered.
+    bool peer_closed = false;
+
+    // Set when the last read stopped because as much as may be
+    // buffered was, rather than at EAGAIN; the socket may still have
+    // data that edge-triggered epoll won't report again.
+    bool more_input = false;
+
+    // Set once a request from this connection has been read.  Until
+    // then a drain leaves it open, since its first request is likely
+    // already on its way.
+    bool served = false;
+
+    // The connection's current deadline, and which one it is.
+    TimerWheel::Timer timer;
+    TimeoutKind deadline = TimeoutKind::kIdle;
+
+    // conn.bytes_written() as of when the deadline was armed.  A kBody
+    // deadline starts again whenever more has been written.
+    uint64_t deadline_written = 0;
+  };
+
+  // Accepts every pending connection on listen_fd_.
+  void accept_clients();
+
+  // Handles readiness reported by epoll for connection "conn_id".
+  void handle_event(uint64_t conn_id, uint32_t events);
+
+  // Picks up the responses that worker threads have posted.
+  void handle_completions();
+
+  // Stops accepting and closes every idle connection.
+  void start_drain();
+
+  // Returns true if, while draining, the connection can be closed: it
+  // has been served, nothing of it is being processed or waiting to be
+  // sent, and the client is not partway through a request.
+  bool drained(Connection *c) const;
+
+  // Reads what the client has sent, up to the most the connection may
+  // buffer.  Returns false if the read failed.
+  bool read_input(Connection *c);
+
+  // Serves whatever the connection has buffered, writes out pending
+  // output, and closes the connection once it is finished with.
+  void drive(uint64_t conn_id, Connection *c);
+
+  // Arms, keeps or cancels the connection's deadline to suit what it
+  // is doing now.
+  void update_deadline(uint64_t conn_id, Connection *c);
+
+  // Closes every connection whose deadline has passed.
+  void expire_timers();
+
+  // Removes the connection from the loop and closes it.
+  void close_connection(uint64_t conn_id);
+
+  int listen_fd_;
+  int drain_fd_;
+  std::string base_dir_;
+  WordIndex *index_;
+  StaticFileCache *file_cache_;
+  OpenFileCache *open_files_;
+  CompressedFileCache *compressed_files_;
+
+  int epoll_fd_;
+
+  TimeoutOptions timeouts_;
+  ConnectionStats *stats_;
+  TimerWheel wheel_;
+
+  // The time as of the last return from epoll_wait().
+  uint64_t now_ms_;
+
+  // An eventfd used to wake the loop from stop() and post_responses().
+  int wake_fd_;
+  std::atomic<bool> stopping_;
+
+  // Whether the loop is draining, and when it gives up waiting for
+  // the connections it still has.
+  bool draining_;
+  uint64_t drain_deadline_ms_;
+
+  // Every open connection, keyed by an id that is never reused, so a
+  // late response for a closed connection cannot reach a new client
+  // that happens to get the same file descriptor.
+  std::unordered_map<uint64_t, std::unique_ptr<Connection>> connections_;
+  uint64_t next_conn_id_;
+
+  // Responses posted by worker threads, guarded by completions_lock_.
+  pthread_mutex_t completions_lock_;
+  std::list<std::pair<uint64_t, std::vector<HttpResponse>>> completions_;
+
+  // The worker threads.  The destructor tears the pool down before
+  // anything else, since leftover tasks post back into this loop.
+  std::unique_ptr<ThreadPool> pool_;
+};
+
+}  // namespace searchserver
+
+#endif  // EVENTLOOP_H_
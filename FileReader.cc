@@ -9,13 +9,13 @@
  * author.
  */
 
-#include <stdio.h>
-#include <string>
-#include <cstdlib>
-#include <iostream>
-#include <sstream>
-#include <unistd.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
 
 #include "./HttpUtils.h"
 #include "./FileReader.h"
@@ -24,46 +24,115 @@ using std::string;
 
 namespace searchserver {
 
+///////////////////////////////////////////////////////////////////////////////
+// Constants, internal helper functions
+///////////////////////////////////////////////////////////////////////////////
+
+// What a file with no size to go on (e.g., one in /proc) is read in.
+static const size_t kReadChunk = 64 * 1024;
+
+// Reads everything from "fd", whose size fstat() says is "size", into
+// "*str".  Returns false if a read fails.
+static bool ReadAll(int fd, size_t size, string *str) {
+  // One more byte than expected, so that the read that fills the file
+  // in doesn't fill the string, and the next one can see the end.  If
+  // the file has grown since, the string grows to match.
+  string contents(size + 1, '\0');
+  size_t len = 0;
+  while (1) {
+    if (len == contents.size()) {
+      contents.resize(contents.size() + std::max(contents.size(), kReadChunk));
+    }
+    ssize_t res = read(fd, &contents[len], contents.size() - len);
+    if (res == 0) {
+      break;
+    }
+    if (res == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    len += res;
+  }
+  contents.resize(len);
+  str->swap(contents);
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FileView
+///////////////////////////////////////////////////////////////////////////////
+FileView &FileView::operator=(FileView &&other) {
+  if (this != &other) {
+    reset();
+    map_ = other.map_;
+    map_len_ = other.map_len_;
+    str_ = std::move(other.str_);
+    other.map_ = nullptr;
+    other.map_len_ = 0;
+    other.str_.clear();
+  }
+  return *this;
+}
+
+void FileView::reset() {
+  if (map_ != nullptr) {
+    munmap(map_, map_len_);
+  }
+  map_ = nullptr;
+  map_len_ = 0;
+  str_.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FileReader
+///////////////////////////////////////////////////////////////////////////////
 bool FileReader::read_file(string *str) {
   // Read the file into memory, and store the file contents in the
   // output parameter "str."  Be careful to handle binary data
   // correctly; i.e., you probably want to use the two-argument
   // constructor to std::string (the one that includes a length as a
   // second argument).
-
-  // TODO: implement
-  int fd = open(fname_.c_str(), O_RDONLY);
+  int fd = open(fname_.c_str(), O_RDONLY | O_CLOEXEC);
   if (fd == -1) {
     // detect file open error
     return false;
   }
+  struct stat st;
+  bool ok = (fstat(fd, &st) != -1) && ReadAll(fd, st.st_size, str);
+  close(fd);
+  return ok;
+}
 
-  string result_string;
-  char single_char;
-  int count = 0;
-  while (true) {
-    // keep looping until read success or encounter faluire 
-    ssize_t result = read(fd, &single_char, 1); // read in one single char
-    if (result == 0){
-      // if reach the end of the file
-      break;
-    }else if (result == -1){
-      // if encounter error
-      if (errno != EINTR) {
-        // if real error happened, exit
-        close(fd);
-        return false;
-      }
-      continue; // else, try again
-    }
-    result_string += single_char;
-    count ++;
+bool FileReader::read_view(FileView *view) {
+  int fd = open(fname_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return false;
   }
 
-  *str = result_string;
-
+  view->reset();
+  bool ok = true;
+  void *map = MAP_FAILED;
+  if (S_ISREG(st.st_mode) &&
+      (static_cast<size_t>(st.st_size) >= kMinMappedBytes)) {
+    map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  if (map != MAP_FAILED) {
+    // The contents are read from the front to the back, once.
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    view->map_ = map;
+    view->map_len_ = st.st_size;
+  } else {
+    ok = ReadAll(fd, st.st_size, &view->str_);
+  }
   close(fd);
-  return true;
+  return ok;
 }
 
 }  // namespace searchserver
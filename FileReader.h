@@ -12,14 +12,55 @@
 #ifndef FILEREADER_H_
 #define FILEREADER_H_
 
+#include <cstddef>
 #include <string>
+#include <string_view>
 
 namespace searchserver {
 
+// The contents of a file, as read by FileReader::read_view(): either
+// mapped into memory, read-only, or read into a string.  Either way
+// they stay valid for as long as the FileView does.  A mapped file
+// must not be truncated while it is being looked at.
+class FileView {
+ public:
+  FileView() { }
+  virtual ~FileView() { reset(); }
+
+  FileView(FileView &&other) { *this = std::move(other); }
+  FileView &operator=(FileView &&other);
+  FileView(const FileView &other) = delete;
+  FileView &operator=(const FileView &other) = delete;
+
+  std::string_view data() const {
+    return (map_ != nullptr) ?
+           std::string_view(static_cast<const char *>(map_), map_len_) :
+           std::string_view(str_);
+  }
+
+  // Returns true if the contents are mapped rather than copied.
+  bool mapped() const { return map_ != nullptr; }
+
+ private:
+  friend class FileReader;
+
+  // Unmaps or frees the contents, leaving the view empty.
+  void reset();
+
+  void *map_ = nullptr;
+  size_t map_len_ = 0;
+  std::string str_;
+};
+
 // This class is used to read a file into memory and return its
 // contents as a string.
 class FileReader {
  public:
+  // Files at least this big are mapped by read_view() rather than
+  // read: past this size, setting up the mapping costs less than
+  // copying the contents.
+  static const size_t kMinMappedBytes = 64 * 1024;
+
   // Constructs a file reader for the specified file
   FileReader(const std::string &fname)
     : fname_(fname) { }
@@ -28,9 +69,16 @@ class FileReader {
   // Attempts to reads in the file specified by the constructor
   // arguments. If the file could not be found or could not be opened
   // returns false.  Otherwise, returns true and also returns 
-  // the file contents through "str".
+  // the file contents through "str".  The string is sized from the
+  // file's length up front, so a file is read in one go.
   bool read_file(std::string *str);
 
+  // Like read_file(), but returns the contents through "*view",
+  // mapping the file instead of copying it if it has at least
+  // kMinMappedBytes.  For a caller that only needs to look at the
+  // contents, this saves copying big files.
+  bool read_view(FileView *view);
+
  private:
   std::string fname_;
 };
@@ -0,0 +1,276 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "./FileWatcher.h"
+#include "./TimerWheel.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+using std::unordered_set;
+using std::vector;
+
+namespace searchserver {
+
+///////////////////////////////////////////////////////////////////////////////
+// Constants, internal helper functions
+///////////////////////////////////////////////////////////////////////////////
+
+// What each directory is watched for: anything that changes what a
+// file in it holds, or which files it has.
+static const uint32_t kWatchMask =
+  IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+  IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW;
+
+// A batch with more changed paths than this is reported as a change to
+// the root, which costs listeners less than looking at every path.
+static const size_t kMaxChangedPaths = 4096;
+
+///////////////////////////////////////////////////////////////////////////////
+// FileWatcher
+///////////////////////////////////////////////////////////////////////////////
+FileWatcher::FileWatcher(const string &root_dir, uint32_t coalesce_ms)
+  : root_dir_(root_dir), coalesce_ms_(coalesce_ms), inotify_fd_(-1),
+    wake_fd_(-1), running_(false) {
+  pthread_mutex_init(&lock_, nullptr);
+}
+
+FileWatcher::~FileWatcher() {
+  stop();
+  if (wake_fd_ != -1) {
+    close(wake_fd_);
+  }
+  if (inotify_fd_ != -1) {
+    close(inotify_fd_);
+  }
+  pthread_mutex_destroy(&lock_);
+}
+
+void FileWatcher::add_listener(Listener listener) {
+  pthread_mutex_lock(&lock_);
+  listeners_.push_back(std::move(listener));
+  pthread_mutex_unlock(&lock_);
+}
+
+bool FileWatcher::start() {
+  char *real = realpath(root_dir_.c_str(), nullptr);
+  if (real == nullptr) {
+    cerr << "realpath(" << root_dir_ << ") failed: " << strerror(errno)
+         << endl;
+    return false;
+  }
+  root_ = real;
+  free(real);
+
+  inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd_ == -1) {
+    cerr << "inotify_init1() failed: " << strerror(errno) << endl;
+    return false;
+  }
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd_ == -1) {
+    cerr << "eventfd() failed: " << strerror(errno) << endl;
+    return false;
+  }
+  if (!watch_tree(root_)) {
+    return false;
+  }
+
+  running_ = true;
+  if (pthread_create(&thread_, nullptr, &watcher_thread,
+                     static_cast<void *>(this)) != 0) {
+    running_ = false;
+    return false;
+  }
+  return true;
+}
+
+void FileWatcher::stop() {
+  if (!running_) {
+    return;
+  }
+  running_ = false;
+  uint64_t one = 1;
+  if (write(wake_fd_, &one, sizeof(one)) == -1) {
+    // The counter is already non-zero, so the thread will wake anyway.
+  }
+  pthread_join(thread_, nullptr);
+}
+
+bool FileWatcher::watch_tree(const string &dir) {
+  // Watching a directory that is already watched (say, one that was
+  // renamed) gives back its old descriptor, which then names it by
+  // its new path.
+  int wd = inotify_add_watch(inotify_fd_, dir.c_str(), kWatchMask);
+  if (wd == -1) {
+    if ((errno == ENOENT) || (errno == ENOTDIR)) {
+      // It went away again before we got to it; that was reported.
+      return true;
+    }
+    cerr << "inotify_add_watch(" << dir << ") failed: " << strerror(errno)
+         << endl;
+    return false;
+  }
+  dirs_[wd] = dir;
+
+  // Symbolic links aren't followed, as crawl_filetree() doesn't.
+  DIR *d = opendir(dir.c_str());
+  if (d == nullptr) {
+    return true;
+  }
+  bool ok = true;
+  struct dirent *entry;
+  while (ok && ((entry = readdir(d)) != nullptr)) {
+    if ((strcmp(entry->d_name, ".") == 0) ||
+        (strcmp(entry->d_name, "..") == 0)) {
+      continue;
+    }
+    string path = dir + "/" + entry->d_name;
+    bool is_dir = (entry->d_type == DT_DIR);
+    if (entry->d_type == DT_UNKNOWN) {
+      struct stat st;
+      is_dir = (lstat(path.c_str(), &st) == 0) && S_ISDIR(st.st_mode);
+    }
+    if (is_dir) {
+      ok = watch_tree(path);
+    }
+  }
+  closedir(d);
+  return ok;
+}
+
+void FileWatcher::read_events(unordered_set<string> *changed) {
+  alignas(struct inotify_event) char buf[65536];
+  while (1) {
+    ssize_t len = read(inotify_fd_, buf, sizeof(buf));
+    if (len <= 0) {
+      // EAGAIN: we have everything the kernel had for us.
+      return;
+    }
+    for (ssize_t pos = 0; pos < len; ) {
+      const struct inotify_event *event =
+        reinterpret_cast<const struct inotify_event *>(buf + pos);
+      pos += sizeof(struct inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        // Events were lost, so anything may have changed.
+        changed->insert(root_);
+        continue;
+      }
+      auto it = dirs_.find(event->wd);
+      if (it == dirs_.end()) {
+        continue;
+      }
+      if (event->mask & IN_IGNORED) {
+        // The directory is gone; its IN_DELETE_SELF said so already.
+        dirs_.erase(it);
+        continue;
+      }
+      string path = it->second;
+      if (event->len > 0) {
+        path += "/";
+        path += event->name;
+      }
+      if ((event->mask & IN_ISDIR) &&
+          (event->mask & (IN_CREATE | IN_MOVED_TO)) &&
+          !watch_tree(path)) {
+        // Whatever happens below it from now on would go unseen.
+        cerr << "  can't watch " << path << " for changes" << endl;
+      }
+      changed->insert(std::move(path));
+    }
+  }
+}
+
+void *FileWatcher::watcher_thread(void *arg) {
+  static_cast<FileWatcher *>(arg)->watcher_loop();
+  return nullptr;
+}
+
+void FileWatcher::watcher_loop() {
+  unordered_set<string> changed;
+  uint64_t report_ms = 0;
+  while (1) {
+    // Sleep until something changes, or until it's time to report
+    // what has.
+    int timeout = -1;
+    if (!changed.empty()) {
+      uint64_t now = TimerWheel::NowMs();
+      timeout = (report_ms > now) ? static_cast<int>(report_ms - now) : 0;
+    }
+    struct pollfd fds[2];
+    fds[0].fd = inotify_fd_;
+    fds[0].events = POLLIN;
+    fds[1].fd = wake_fd_;
+    fds[1].events = POLLIN;
+    int res = poll(fds, 2, timeout);
+    if ((res == -1) && (errno != EINTR)) {
+      cerr << "poll() failed: " << strerror(errno) << endl;
+      return;
+    }
+    if ((res > 0) && (fds[1].revents & POLLIN)) {
+      return;
+    }
+    if ((res > 0) && (fds[0].revents & POLLIN)) {
+      bool was_empty = changed.empty();
+      read_events(&changed);
+      if (was_empty && !changed.empty()) {
+        report_ms = TimerWheel::NowMs() + coalesce_ms_;
+      }
+    }
+
+    if (changed.empty() || (TimerWheel::NowMs() < report_ms)) {
+      continue;
+    }
+    vector<string> paths;
+    if ((changed.size() > kMaxChangedPaths) || changed.count(root_)) {
+      paths.push_back(root_);
+    } else {
+      paths.assign(changed.begin(), changed.end());
+    }
+    changed.clear();
+    pthread_mutex_lock(&lock_);
+    vector<Listener> listeners = listeners_;
+    pthread_mutex_unlock(&lock_);
+    for (const Listener &listener : listeners) {
+      listener(paths);
+    }
+  }
+}
+
+bool IsChanged(const string &path, const unordered_set<string> &changed) {
+  // The path and each directory above it are looked up in turn.
+  string prefix = path;
+  while (!prefix.empty()) {
+    if (changed.count(prefix) > 0) {
+      return true;
+    }
+    size_t slash = prefix.rfind('/');
+    prefix.resize((slash == string::npos) ? 0 : slash);
+  }
+  return false;
+}
+
+}  // namespace searchserver
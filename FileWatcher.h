@@ -0,0 +1,112 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef FILEWATCHER_H_
+#define FILEWATCHER_H_
+
+extern "C" {
+  #include <pthread.h>  // for the pthread threading/mutex functions
+}
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace searchserver {
+
+// A FileWatcher follows changes to the files under a directory (and
+// every directory below it) with inotify, on a background thread, and
+// tells its listeners which paths changed.  Caches of those files use
+// it to drop what has gone out of date, rather than stat()ing the
+// files every time they are used.
+//
+// Changes are coalesced: once one is seen, the watcher waits a little
+// for more, then hands the listeners each changed path once.  A path
+// is the absolute, canonical path of a file or directory under the
+// root; a change to a directory (e.g., it was removed or renamed)
+// stands for everything below it too.  If the kernel drops events,
+// the root itself is reported, i.e., everything may have changed.
+class FileWatcher {
+ public:
+  // Called, on the watcher's thread, with a batch of changed paths.
+  typedef std::function<void(const std::vector<std::string> &paths)> Listener;
+
+  // Creates a watcher for the tree at "root_dir" that gathers changes
+  // for "coalesce_ms" before reporting them.
+  FileWatcher(const std::string &root_dir, uint32_t coalesce_ms);
+
+  // Stops the watcher if need be.
+  virtual ~FileWatcher();
+
+  // Adds a listener for every batch reported from now on.  Safe to
+  // call from any thread, at any time.
+  void add_listener(Listener listener);
+
+  // Watches every directory in the tree and starts the watcher's
+  // thread.  Returns false if that could not be done, e.g., the tree
+  // has more directories than the user may watch; changes then go
+  // unreported.
+  bool start();
+
+  // Stops the watcher's thread; no listener is called after this
+  // returns.
+  void stop();
+
+  // The canonical path of the root, once start() has worked it out.
+  const std::string &root() const { return root_; }
+
+  FileWatcher(const FileWatcher &other) = delete;
+  FileWatcher &operator=(const FileWatcher &other) = delete;
+
+ private:
+  // Watches "dir" and every directory below it.  Returns false if a
+  // watch could not be added.
+  bool watch_tree(const std::string &dir);
+
+  // Reads the events the kernel has for us and adds the paths they
+  // are about to "*changed".
+  void read_events(std::unordered_set<std::string> *changed);
+
+  static void *watcher_thread(void *arg);
+  void watcher_loop();
+
+  std::string root_dir_;
+  std::string root_;
+  uint32_t coalesce_ms_;
+
+  // Guards listeners_, which may be added to while the thread runs.
+  pthread_mutex_t lock_;
+  std::vector<Listener> listeners_;
+
+  int inotify_fd_;
+
+  // An eventfd that wakes the watcher thread when it is to stop.
+  int wake_fd_;
+
+  // The directory each watch descriptor is for.  Only the watcher
+  // thread touches this once it is running.
+  std::unordered_map<int, std::string> dirs_;
+
+  bool running_;
+  pthread_t thread_;
+};
+
+// Returns true if "path" is among the "changed" paths a FileWatcher
+// reported, or is below a directory among them.
+bool IsChanged(const std::string &path,
+               const std::unordered_set<std::string> &changed);
+
+}  // namespace searchserver
+
+#endif  // FILEWATCHER_H_
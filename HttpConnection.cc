@@ -9,9 +9,15 @@
  * author.
  */
 
+#include <errno.h>
+#include <limits.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <charconv>
 #include <cstdint>
-#include <boost/algorithm/string.hpp>
-#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 #include <map>
 #include <string>
 #include <vector>
@@ -27,9 +33,107 @@ using std::vector;
 
 namespace searchserver {
 
-static const char *kHeaderEnd = "\r\n\r\n";
-static const int kHeaderEndLen = 4;
+///////////////////////////////////////////////////////////////////////////////
+// Constants, internal helper functions
+///////////////////////////////////////////////////////////////////////////////
 
+// A request with a longer body than this is refused, so that a client
+// can't make us buffer without bound.
+static const size_t kMaxRequestBodyBytes = 8 << 20;
+
+// The most iovecs one writev() or sendmsg() takes.
+static const size_t kMaxIovecs = IOV_MAX;
+
+///////////////////////////////////////////////////////////////////////////////
+// QueuedResponse
+///////////////////////////////////////////////////////////////////////////////
+QueuedResponse::QueuedResponse(HttpResponse response)
+  : response(std::move(response)) {
+  const HttpResponse &r = this->response;
+  if (!r.prebuilt_header()) {
+    r.AppendHeaderTo(&data, r.body_length());
+  }
+  memory_len = r.prebuilt_header() ? r.prebuilt_header()->size()
+                                   : data.size();
+  if (r.body_file()) {
+    file_offset = r.body_file_offset();
+    file_remaining = r.body_length();
+  } else if (!r.body_stream()) {
+    memory_len += r.body_length();
+  }
+}
+
+void QueuedResponse::AppendIovecs(size_t skip,
+                                  std::vector<struct iovec> *iov) const {
+  size_t first = iov->size();
+  if (chunking) {
+    iov->push_back({ const_cast<char *>(data.data()), data.size() });
+  } else {
+    const string &header = response.prebuilt_header() ?
+                           *response.prebuilt_header() : data;
+    iov->push_back({ const_cast<char *>(header.data()), header.size() });
+    response.AppendBodyIovecs(iov);
+  }
+
+  // Drop what has been sent already, which may end partway into an
+  // iovec.
+  size_t next = first;
+  while ((next < iov->size()) && (skip >= (*iov)[next].iov_len)) {
+    skip -= (*iov)[next].iov_len;
+    next++;
+  }
+  if (next < iov->size()) {
+    struct iovec &v = (*iov)[next];
+    v.iov_base = static_cast<char *>(v.iov_base) + skip;
+    v.iov_len -= skip;
+  }
+  iov->erase(iov->begin() + first, iov->begin() + next);
+}
+
+bool QueuedResponse::NextChunk() {
+  if (!response.body_stream()) {
+    return false;
+  }
+  data.clear();
+  if (!response.body_stream()->NextChunk(&data)) {
+    return false;
+  }
+  chunking = true;
+  memory_len = data.size();
+  return true;
+}
+
+void GatherQueuedOutput(const std::deque<QueuedResponse> &out, size_t skip,
+                        std::vector<struct iovec> *iov) {
+  for (const QueuedResponse &queued : out) {
+    queued.AppendIovecs(skip, iov);
+    skip = 0;
+    if (!queued.in_memory() || (iov->size() >= kMaxIovecs)) {
+      break;
+    }
+  }
+  if (iov->size() > kMaxIovecs) {
+    iov->resize(kMaxIovecs);
+  }
+}
+
+void AdvanceQueuedOutput(std::deque<QueuedResponse> *out, size_t *pos,
+                         size_t written) {
+  while (written > 0) {
+    QueuedResponse &front = out->front();
+    size_t done = std::min(written, front.memory_len - *pos);
+    *pos += done;
+    written -= done;
+    if ((*pos == front.memory_len) && front.in_memory()) {
+      out->pop_front();
+      *pos = 0;
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// HttpConnection
+///////////////////////////////////////////////////////////////////////////////
 bool HttpConnection::next_request(HttpRequest *request) {
   // Use "wrapped_read" to read data into the buffer_
   // instance variable.  Keep reading data until either the
@@ -45,95 +149,235 @@ bool HttpConnection::next_request(HttpRequest *request) {
   // caller invokes next_request()!
 
   // TODO: implement
-  int index = 0;
-  while(1) {
-    // get the index where the "\r\n\r\n" start
-    index = buffer_.find(kHeaderEnd, 0);
-    if (index != (int)string::npos) {
-        // if find 
-        break;
-    }
-    // keep read in requests
-    wrapped_read(fd_, &buffer_);
-  }
-  
-  // get the request header
-  string header = buffer_.substr(0, index);
-  // deal with the rest 
-  int buffer_length = buffer_.length();
-  buffer_ = buffer_.substr(index + kHeaderEndLen, buffer_length - index - 4);
-  // pass the header into parse_request
-  bool if_success = parse_request(header, request);
-  
-  return if_success;
+  while (!has_buffered_request()) {
+    // keep read in requests; give up if the client went away, or has
+    // sent more than any request header could be
+    if (buffer_overflowed() || (buffer_.read_from(fd_) <= 0)) {
+      return false;
+    }
+  }
+  return next_buffered_request(request);
 }
 
-bool HttpConnection::write_response(const HttpResponse &response) {
-  // Implement so that the response is converted to a string
-  // and written out to the socket for this connection  
+bool HttpConnection::read_some() {
+  return buffer_.read_from(fd_) > 0;
+}
 
-  // TODO: implement
-  const string response_string = response.GenerateResponseString();
-  int response_len = response_string.length();
-  int actual_len = wrapped_write(fd_, response_string);
+bool HttpConnection::has_buffered_request() {
+  // The parser picks up where it left off, so bytes that were already
+  // looked at on an earlier call aren't scanned again.
+  HttpRequestParser::Status status =
+    parser_.parse(buffer_.data(), buffer_.size());
+  if (status != HttpRequestParser::Status::kDone) {
+    return status == HttpRequestParser::Status::kError;
+  }
+  if (!body_checked_) {
+    check_body();
+  }
+  return body_bad_ || (buffer_.size() >= parser_.length() + body_length_);
+}
 
-  if(response_len == actual_len) {
-    return true;
+bool HttpConnection::next_buffered_request(HttpRequest *request) {
+  if (!has_buffered_request() ||
+      (parser_.parse(buffer_.data(), buffer_.size()) !=
+       HttpRequestParser::Status::kDone) || body_bad_) {
+    return false;
   }
+  bool ok = parse_request(request);
 
-  return false;
+  // deal with the rest
+  buffer_.consume(parser_.length() + body_length_);
+  parser_.reset();
+  body_checked_ = body_bad_ = false;
+  body_length_ = 0;
+  return ok;
 }
 
-bool HttpConnection::parse_request(const string &request, HttpRequest* out) {
-  HttpRequest req("/");  // by default, get "/".
+void HttpConnection::check_body() {
+  body_checked_ = true;
+  parser_.view(buffer_.data(), &view_);
+  bool have_length = false;
+  for (const auto &header : view_.headers) {
+    if (header.first == "transfer-encoding") {
+      // A chunked body would have to be decoded as it arrives; no
+      // client of ours needs to send one.
+      body_bad_ = true;
+      return;
+    }
+    if (header.first != "content-length") {
+      continue;
+    }
+    std::string_view value = header.second;
+    uint64_t length;
+    auto res = std::from_chars(value.data(), value.data() + value.size(),
+                               length);
+    if ((res.ec != std::errc()) || (res.ptr != value.data() + value.size()) ||
+        (length > kMaxRequestBodyBytes) ||
+        (have_length && (length != body_length_))) {
+      body_bad_ = true;
+      return;
+    }
+    have_length = true;
+    body_length_ = length;
+  }
+}
 
-  // Split the request into lines.  Extract the URI from the first line
-  // and store it in req.URI.  For each additional line beyond the
-  // first, extract out the header name and value and store them in
-  // req.headers_ (i.e., HttpRequest::AddHeader).  You should look
-  // at HttpRequest.h for details about the HTTP header format that
-  // you need to parse.
-  //
-  // You'll probably want to look up boost functions for (a) splitting
-  // a string into lines on a "\r\n" delimiter, (b) trimming
-  // whitespace from the end of a string, and (c) converting a string
-  // to lowercase.
-  //
-  // If a request is malfrormed, return false, otherwise true and 
-  // the parsed request is retrned via *out
-  
-  // TODO: implement
+bool HttpConnection::read_available(bool *eof, size_t limit) {
+  *eof = false;
+  while (buffer_.size() <= limit) {
+    ssize_t res = buffer_.read_from(fd_);
+    if (res > 0) {
+      continue;
+    }
+    if (res == 0) {
+      *eof = true;
+      return true;
+    }
+    // EAGAIN means we have drained everything the kernel had for us.
+    return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+  }
+  return true;
+}
+
+void HttpConnection::queue_response(HttpResponse response) {
+  out_.emplace_back(std::move(response));
+}
 
-  // trim, to lower case and split request by "\r\n"
-  string request_copy = std::string(request);
-  boost::algorithm::to_lower(request_copy);
-  boost::algorithm::trim(request_copy);  // trim out the white space
-  vector<string> lines;
-  boost::split(lines, request_copy, boost::is_any_of("\r\n"), boost::token_compress_on);
+bool HttpConnection::flush_output() {
+  while (!out_.empty()) {
+    QueuedResponse &front = out_.front();
+    if ((out_pos_ == front.memory_len) && (front.file_remaining == 0)) {
+      // Written the in-memory part; move on to the next chunk of a
+      // streamed body, if any, or else to the next response.
+      out_pos_ = 0;
+      if (!front.NextChunk()) {
+        out_.pop_front();
+      }
+      continue;
+    }
+    ssize_t res;
+    if (out_pos_ == front.memory_len) {
+      res = sendfile(fd_, front.response.body_file()->fd(),
+                     &front.file_offset, front.file_remaining);
+    } else {
+      iov_.clear();
+      GatherQueuedOutput(out_, out_pos_, &iov_);
+      res = writev(fd_, iov_.data(), iov_.size());
+    }
+    if (res == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // EAGAIN: the socket buffer is full, try again when it drains.
+      return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+    }
+    bytes_written_ += res;
+    if (out_pos_ < front.memory_len) {
+      AdvanceQueuedOutput(&out_, &out_pos_, res);
+      continue;
+    }
+    if (res == 0) {
+      // The file is shorter than the Content-length we promised, so
+      // there is no way to finish this response.
+      return false;
+    }
+    front.file_remaining -= res;
+  }
+  return true;
+}
 
-  // get url
-  string first_line = lines[0];
-  vector<string> components;
-  boost::split(components, first_line, boost::is_any_of(" "), boost::token_compress_on);
+bool HttpConnection::write_response(const HttpResponse &response) {
+  return write_responses(&response, 1);
+}
 
-  // check whether the request is malfrormed
-  if(components[0] != "get"){
-    return false;
+bool HttpConnection::write_responses(const HttpResponse *responses,
+                                     size_t count,
+                                     const std::function<void()> &progress) {
+  // The header blocks and body segments are gathered into one writev(),
+  // without being copied into a single string first.  Only a file body
+  // interrupts it: what is gathered so far (including that response's
+  // headers) is written, then the body is sent straight from the file.
+  //
+  // Every header block is serialized into one buffer first, so that
+  // the iovecs pointing into it don't move.  The buffers belong to the
+  // thread and keep their memory, so this doesn't allocate once they
+  // are big enough.
+  static thread_local string headers;
+  static thread_local vector<size_t> header_ends;
+  static thread_local vector<struct iovec> iov;
+  headers.clear();
+  header_ends.clear();
+  for (size_t i = 0; i < count; i++) {
+    responses[i].AppendHeaderTo(&headers, responses[i].body_length());
+    header_ends.push_back(headers.size());
   }
 
-  // set the uri
-  req.set_uri(components[1]);
+  iov.clear();
+  size_t memory_len = 0;
+  for (size_t i = 0; i < count; i++) {
+    const HttpResponse &response = responses[i];
+    size_t header_start = (i == 0) ? 0 : header_ends[i - 1];
+    size_t header_len = header_ends[i] - header_start;
+    iov.push_back({ &headers[header_start], header_len });
+    response.AppendBodyIovecs(&iov);
+    memory_len += header_len;
+    if (!response.body_file() && !response.body_stream()) {
+      memory_len += response.body_length();
+      continue;
+    }
 
-  // deal with remaining lines
-  for (int i = 1; i < (int)lines.size(); i++) {
-    boost::split(components, lines[i], boost::is_any_of(":"), boost::token_compress_on);
-    boost::algorithm::trim(components[0]);
-    boost::algorithm::trim(components[1]);
-    req.AddHeader(components[0], components[1]);
+    if (wrapped_writev(fd_, &iov, progress) != memory_len) {
+      return false;
+    }
+    iov.clear();
+    memory_len = 0;
+    if (response.body_stream()) {
+      // Each chunk is written as soon as it is made.
+      static thread_local string chunk;
+      chunk.clear();
+      while (response.body_stream()->NextChunk(&chunk)) {
+        if (wrapped_write(fd_, chunk) != static_cast<int>(chunk.size())) {
+          return false;
+        }
+        if (progress) {
+          progress();
+        }
+        chunk.clear();
+      }
+      continue;
+    }
+    if (wrapped_sendfile(fd_, response.body_file()->fd(),
+                         response.body_file_offset(), response.body_length(),
+                         progress) != response.body_length()) {
+      return false;
+    }
   }
+  return (memory_len == 0) ||
+         (wrapped_writev(fd_, &iov, progress) == memory_len);
+}
 
-  *out = req;
+bool HttpConnection::parse_request(HttpRequest* out) {
+  // The parser has split the request into the request line and the
+  // header lines, and lowercased the header names; the URI comes from
+  // the request line, and each header line becomes one of the
+  // request's headers (see HttpRequest::Assign).  You should look at
+  // HttpRequest.h for details about the HTTP header format.
+  //
+  // If a request is malfrormed, return false, otherwise true and 
+  // the parsed request is retrned via *out
+  parser_.view(buffer_.data(), &view_);
+
+  // check whether the request is one we serve
+  if (!boost::algorithm::iequals(view_.method, "get") &&
+      !boost::algorithm::iequals(view_.method, "post")) {
+    return false;
+  }
 
+  // The body, if any, comes straight after the header.
+  view_.body = std::string_view(buffer_.data() + parser_.length(),
+                                body_length_);
+  out->Assign(std::string_view(buffer_.data(),
+                               parser_.length() + body_length_), view_);
   return true;
 }
 
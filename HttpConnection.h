@@ -13,15 +13,79 @@
 #define HTTPCONNECTION_H_
 
 #include <cstdint>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <deque>
+#include <functional>
 #include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "./HttpRequest.h"
+#include "./HttpRequestParser.h"
+#include "./InputBuffer.h"
 #include "./HttpResponse.h"
 
 namespace searchserver {
 
+// A client that has sent this much without completing a request
+// header (or, beyond the length of its body, without completing the
+// request) is not speaking HTTP to us, so servers hang up on it.
+static const size_t kMaxBufferedBytes = 64 * 1024;
+
+// A response waiting to be sent by an event loop.  Its in-memory part
+// (the status line and headers, then the body segments; or, once
+// they are sent, the current chunk of a streamed body) is gathered
+// with writev() or sendmsg() straight from the response, so a shared
+// or static body, such as a cache hit, is never copied.  A file body
+// follows it, sent from the file.  The iovecs point into the object,
+// so a queue of them must not move its elements (a deque doesn't).
+struct QueuedResponse {
+  explicit QueuedResponse(HttpResponse response);
+
+  // Appends iovecs for the in-memory part, less its first "skip"
+  // bytes, to "*iov".
+  void AppendIovecs(size_t skip, std::vector<struct iovec> *iov) const;
+
+  // Makes the next chunk of a streamed body the in-memory part.
+  // Returns false if there is no streamed body or it has ended.
+  bool NextChunk();
+
+  // True if nothing follows the in-memory part.
+  bool in_memory() const {
+    return !response.body_file() && !response.body_stream();
+  }
+
+  HttpResponse response;
+
+  // The serialized status line and headers, unless the response has
+  // them prebuilt; or the current chunk, if "chunking" is set.
+  std::string data;
+  bool chunking = false;
+
+  // The length of the in-memory part.
+  size_t memory_len = 0;
+
+  // The part of a file body still to be sent.
+  off_t file_offset = 0;
+  size_t file_remaining = 0;
+};
+
+// Appends to "*iov" the in-memory output at the front of "out", less
+// the "skip" bytes of it already sent: that of each response up to
+// and including the first that has a file or streamed body after it,
+// and no more than IOV_MAX iovecs.
+void GatherQueuedOutput(const std::deque<QueuedResponse> &out, size_t skip,
+                        std::vector<struct iovec> *iov);
+
+// Accounts for "written" bytes of the output gathered from "out" with
+// GatherQueuedOutput(), given that "*pos" bytes of the front one had
+// been sent before: drops the responses that are finished, and sets
+// "*pos" to how much of the new front one's in-memory part is sent.
+void AdvanceQueuedOutput(std::deque<QueuedResponse> *out, size_t *pos,
+                         size_t written);
+
 // The HttpConnection class represents a connection to a single client
 class HttpConnection {
  public:
@@ -38,6 +102,9 @@ class HttpConnection {
     fd_ = -1;
   }
 
+  // Returns the file descriptor associated with the client.
+  int fd() const { return fd_; }
+
   // Read and parse the next request from the file descriptor fd_,
   // storing the state in the output parameter "request."  Returns
   // true if a request could be read, false if the parsing failed
@@ -45,17 +112,102 @@ class HttpConnection {
   // connection.
   bool next_request(HttpRequest *request);
 
+  // Blocks until the client sends some more data and appends it to
+  // buffer_.  Returns false if the client closed the connection or
+  // the read failed.
+  bool read_some();
+
   // Write the response to the file descriptor fd_.  Returns true
   // if the response was successfully written, false if the
-  // connection experiences an error and should be closed.
+  // connection experiences an error and should be closed.  A file
+  // body is sent with sendfile() after the headers.
   bool write_response(const HttpResponse &response);
 
+  // Like write_response(), but writes the "count" responses starting
+  // at "responses", in order.  Everything but file and streamed bodies
+  // goes out in a single writev(), so a batch of pipelined responses
+  // costs one system call instead of one each.  "progress", if given,
+  // is called whenever some of the output has been written (see
+  // wrapped_writev()).
+  bool write_responses(const HttpResponse *responses, size_t count,
+                       const std::function<void()> &progress = nullptr);
+
+  // The methods below let an event loop drive the connection when
+  // fd_ is in non-blocking mode.  None of them ever block.
+
+  // Reads everything the kernel currently has for fd_ onto the end of
+  // buffer_, stopping at EAGAIN, or as soon as more than "limit" bytes
+  // are buffered (when the kernel may have more).  Sets "*eof" if the
+  // client closed its end of the connection.  Returns false if the
+  // read failed and the connection should be closed.
+  bool read_available(bool *eof, size_t limit);
+
+  // Appends bytes that were read from fd_ by someone else (e.g., an
+  // io_uring completion) to buffer_.
+  void append_input(const char *data, size_t len) {
+    buffer_.append(data, len);
+  }
+
+  // Parses as much of the next request as buffer_ holds, and returns
+  // true if that is a complete request header and body (or enough to
+  // tell that it is malformed), i.e., next_buffered_request() can be
+  // called without any reads.
+  bool has_buffered_request();
+
+  // Parses the next complete request out of buffer_ into "*request"
+  // and removes it from the buffer.  Must only be called when
+  // has_buffered_request() is true.  Returns false if the request is
+  // malformed, in which case the caller should close the connection.
+  bool next_buffered_request(HttpRequest *request);
+
+  // Returns the number of bytes read from the client that have not
+  // yet been consumed by a request.
+  size_t buffered_bytes() const { return buffer_.size(); }
+
+  // Returns the length of the body of the next request, once
+  // has_buffered_request() has seen all of its header, or 0.  Until
+  // that much more has arrived, the request isn't complete, so a
+  // caller that limits how much may be buffered should allow for it.
+  size_t pending_body_length() const { return body_length_; }
+
+  // Returns true if buffer_ holds more than kMaxBufferedBytes (plus
+  // the body of the request whose header it holds) without holding a
+  // complete request, i.e., the client has overrun the limit.
+  bool buffer_overflowed() {
+    return !has_buffered_request() &&
+           (buffer_.size() > kMaxBufferedBytes + body_length_);
+  }
+
+  // Appends the response to the pending output.  Nothing is written
+  // until flush_output() is called, and then the headers and body
+  // segments go out with writev(), without being copied.  A file body
+  // is not read; flush_output() sends it with sendfile().  Nor is a
+  // streamed body; flush_output() takes a chunk at a time from it as
+  // the socket has room.
+  void queue_response(HttpResponse response);
+
+  // Writes as much pending output as the socket will take without
+  // blocking.  Returns false if the connection experienced an error
+  // and should be closed.
+  bool flush_output();
+
+  // Returns true if there is queued output that has not been written.
+  bool has_pending_output() const { return !out_.empty(); }
+
+  // The number of bytes flush_output() has written so far.
+  uint64_t bytes_written() const { return bytes_written_; }
+
  private:
-  // A helper function to parse the contents of data read from
-  // the HTTP connection. Returns true if the request was parsed
-  // successfully and that request is returned through *request
-  // and returns false if the Request is an invalid format
-  bool parse_request(const std::string &request, HttpRequest *out);
+  // A helper function to turn the request header that parser_ has
+  // found at the front of buffer_, and the body_length_ bytes after
+  // it, into "*out".  Returns false if it is not a request we can
+  // serve.
+  bool parse_request(HttpRequest *out);
+
+  // Once parser_ has found a request header, works out from it how
+  // long the body that follows is, setting body_length_, or sets
+  // body_bad_ if it isn't framed in a way we take.
+  void check_body();
 
   // The file descriptor associated with the client.
   int fd_;
@@ -63,7 +215,28 @@ class HttpConnection {
   // A buffer storing data read from the client.
   // Used for the case where we read more data than we need to process a request
   // store the excess data read into the buffer so that next time we read, we can parse from here
-  std::string buffer_;
+  InputBuffer buffer_;
+
+  // Keeps track of how much of the request at the front of buffer_ has
+  // been parsed, and "view_" is where it puts the result; both are
+  // reused from one request to the next.
+  HttpRequestParser parser_;
+  HttpRequestView view_;
+
+  // What check_body() found out about the request parser_ has found,
+  // and whether it has been called for it yet.
+  bool body_checked_ = false;
+  bool body_bad_ = false;
+  size_t body_length_ = 0;
+
+  // Output waiting to be written, in order, and how much of the
+  // in-memory part of the response at the front has been written.
+  // "iov_" is reused by each flush_output(), so that it doesn't
+  // allocate once it is big enough.
+  std::deque<QueuedResponse> out_;
+  size_t out_pos_ = 0;
+  std::vector<struct iovec> iov_;
+  uint64_t bytes_written_ = 0;
 };
 
 }  // namespace searchserver
@@ -12,15 +12,19 @@
 #ifndef HTTPREQUEST_H_
 #define HTTPREQUEST_H_
 
+#include <strings.h>
 #include <cstdint>
 
-#include <map>
 #include <string>
+#include <string_view>
+#include <vector>
+
+#include "./HttpRequestParser.h"
 
 namespace searchserver {
 
 // This class represents the state of an HTTP request.  We'll
-// only handle "GET"-style requests in this project, which means
+// mostly handle "GET"-style requests in this project, which means
 // a request has the following format:
 //
 // GET [URI] [http_protocol]\r\n
@@ -35,32 +39,123 @@ namespace searchserver {
 // GET /foo/bar?baz=bam HTTP/1.1\r\n
 // Host: www.news.com\r\n
 //
+// A "POST" request is the same, except that its header is followed by
+// a body of as many bytes as its Content-Length header says.
+//
 class HttpRequest {
  public:
-  HttpRequest() { }
-  explicit HttpRequest(const std::string &uri)
-    : uri_(uri) { }
+  // The headers the server itself looks at.  These are found without
+  // searching: see GetHeaderValue(KnownHeader).
+  enum class KnownHeader {
+    kConnection,
+    kHost,
+    kAcceptEncoding,
+    kIfNoneMatch,
+    kIfModifiedSince,
+    kRange,
+  };
+  static const int kNumKnownHeaders = 6;
+
+  HttpRequest() { Clear(); }
+  explicit HttpRequest(const std::string &uri) {
+    Clear();
+    set_uri(uri);
+  }
   virtual ~HttpRequest() { }
 
-  const std::string& uri() const { return uri_; }
-  void set_uri(const std::string& uri) { uri_ = uri; }
+  // The method from the request line, e.g. "GET", as the client sent
+  // it, or empty if it was never set.
+  std::string_view method() const { return View(method_); }
+  void set_method(std::string_view method) { method_ = Store(method); }
+
+  std::string_view uri() const { return View(uri_); }
+  void set_uri(std::string_view uri) { uri_ = Store(uri); }
+
+  // The protocol from the request line, e.g. "HTTP/1.1", or empty if
+  // the client didn't send one.
+  std::string_view protocol() const { return View(protocol_); }
+  void set_protocol(std::string_view protocol) { protocol_ = Store(protocol); }
+
+  // The body that followed the request header, if any.
+  std::string_view body() const { return View(body_); }
+  void set_body(std::string_view body) { body_ = Store(body); }
+
+  // Replaces the whole request with the one "view" describes, whose
+  // views all point into "block", the request header it was parsed
+  // from (and its body, if it has one).  The block is copied once, into
+  // memory the HttpRequest keeps from one request to the next, so
+  // assigning request after request to the same HttpRequest doesn't
+  // allocate.
+  void Assign(std::string_view block, const HttpRequestView &view) {
+    Clear();
+    block_.assign(block.data(), block.size());
+    method_ = SpanOf(block, view.method);
+    uri_ = SpanOf(block, view.uri);
+    protocol_ = SpanOf(block, view.protocol);
+    body_ = SpanOf(block, view.body);
+    for (const auto &header : view.headers) {
+      Header h{SpanOf(block, header.first), SpanOf(block, header.second)};
+      int known = KnownIndex(header.first);
+      if ((known != -1) && (known_[known] != -1)) {
+        // Only the first of a repeated header counts.
+        continue;
+      }
+      if (known != -1) {
+        known_[known] = headers_.size();
+      }
+      headers_.push_back(h);
+    }
+  }
 
   // Returns the value associated with the passed-in header name, or empty
   // string if it does not exist in the header map.  The passed-in name must
   // be entirely lowercase to comply with our implementation of RFC 2616:4.2.
-  std::string GetHeaderValue(const std::string &name) const {
-    std::map<std::string, std::string>::const_iterator it = headers_.find(name);
-    if (it == headers_.end()) {
-      return "";
-    } else {
-      return it->second;
+  // If the client sent the header more than once, the first value counts,
+  // so that a later copy can't override what an earlier check saw.
+  std::string_view GetHeaderValue(std::string_view name) const {
+    int known = KnownIndex(name);
+    if (known != -1) {
+      return GetHeaderValue(static_cast<KnownHeader>(known));
+    }
+    for (const Header &h : headers_) {
+      if (View(h.name) == name) {
+        return View(h.value);
+      }
     }
+    return std::string_view();
+  }
+
+  // Like GetHeaderValue(name), in constant time.
+  std::string_view GetHeaderValue(KnownHeader which) const {
+    int index = known_[static_cast<int>(which)];
+    return (index == -1) ? std::string_view() : View(headers_[index].value);
+  }
+
+  // Returns true if the client asked for the connection to be closed
+  // after this request, i.e., sent "Connection: close" in any case.
+  bool WantsClose() const {
+    std::string_view value = GetHeaderValue(KnownHeader::kConnection);
+    return (value.size() == 5) && (strncasecmp(value.data(), "close", 5) == 0);
   }
 
   // Adds a name -> value mapping to the header map, over-writing any existing
-  // previous mapping for name.
-  void AddHeader(const std::string &name, const std::string &value) {
-    headers_[name] = value;
+  // previous mapping for name.  If the client sent name more than once, it
+  // is the value that counts (the first) that is replaced.
+  void AddHeader(std::string_view name, std::string_view value) {
+    for (Header &h : headers_) {
+      if (View(h.name) == name) {
+        h.value = Store(value);
+        return;
+      }
+    }
+    int known = KnownIndex(name);
+    if (known != -1) {
+      known_[known] = headers_.size();
+    }
+    Header h;
+    h.name = Store(name);
+    h.value = Store(value);
+    headers_.push_back(h);
   }
 
   // Returns the number of headers this HttpRequest contains
@@ -69,15 +164,89 @@ class HttpRequest {
   }
 
  private:
-  // Which URI did the client request?
-  std::string uri_;
-
-  // A map from header name to header value, representing
-  // all of the headers that the client supplied to us.  The
-  // header names are converted to all lower case since RFC
-  // 2616:4.2 states that header names are case-insensitive;
-  // the header values are retained verbatim.
-  std::map<std::string, std::string> headers_;
+  // A piece of block_.  Offsets, unlike views, survive the request
+  // being copied or moved.
+  struct Span {
+    uint32_t offset;
+    uint32_t len;
+  };
+
+  struct Header {
+    Span name;
+    Span value;
+  };
+
+  void Clear() {
+    block_.clear();
+    method_ = uri_ = protocol_ = body_ = Span{0, 0};
+    headers_.clear();
+    for (int &index : known_) {
+      index = -1;
+    }
+  }
+
+  // Copies "s" onto the end of block_ and returns where it is.
+  Span Store(std::string_view s) {
+    Span span{static_cast<uint32_t>(block_.size()),
+              static_cast<uint32_t>(s.size())};
+    block_.append(s.data(), s.size());
+    return span;
+  }
+
+  // Where "s", which points into "block", is within it.
+  static Span SpanOf(std::string_view block, std::string_view s) {
+    return Span{static_cast<uint32_t>(s.data() - block.data()),
+                static_cast<uint32_t>(s.size())};
+  }
+
+  std::string_view View(const Span &span) const {
+    return std::string_view(block_.data() + span.offset, span.len);
+  }
+
+  // Returns the KnownHeader that "name" is, as an int, or -1.
+  static int KnownIndex(std::string_view name) {
+    switch (name.size()) {
+      case 4:
+        return (name == "host") ? static_cast<int>(KnownHeader::kHost) : -1;
+      case 5:
+        return (name == "range") ? static_cast<int>(KnownHeader::kRange) : -1;
+      case 10:
+        return (name == "connection") ?
+               static_cast<int>(KnownHeader::kConnection) : -1;
+      case 13:
+        return (name == "if-none-match") ?
+               static_cast<int>(KnownHeader::kIfNoneMatch) : -1;
+      case 15:
+        return (name == "accept-encoding") ?
+               static_cast<int>(KnownHeader::kAcceptEncoding) : -1;
+      case 17:
+        return (name == "if-modified-since") ?
+               static_cast<int>(KnownHeader::kIfModifiedSince) : -1;
+      default:
+        return -1;
+    }
+  }
+
+  // Holds the bytes of the URI and of every header name and value:
+  // the request header as it arrived, plus whatever was added to it
+  // (such as the body).
+  std::string block_;
+
+  // Which URI did the client request, with which method and protocol,
+  // and what did it send after the header?
+  Span method_;
+  Span uri_;
+  Span protocol_;
+  Span body_;
+
+  // The headers that the client supplied to us, in the order it sent
+  // them.  The header names are converted to all lower case since RFC
+  // 2616:4.2 states that header names are case-insensitive; the header
+  // values are retained verbatim.
+  std::vector<Header> headers_;
+
+  // For each KnownHeader, its index in headers_, or -1.
+  int known_[kNumKnownHeaders];
 };
 
 }  // namespace searchserver
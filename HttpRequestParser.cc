@@ -0,0 +1,336 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <cstdint>
+#include <cstring>
+
+#include "./HttpRequestParser.h"
+
+namespace searchserver {
+
+///////////////////////////////////////////////////////////////////////////////
+// Constants, internal helper functions
+///////////////////////////////////////////////////////////////////////////////
+
+// Control characters may not appear in the method or the URI.
+static bool IsControl(unsigned char c) {
+  return (c < 0x20) || (c == 0x7f);
+}
+
+static bool IsSpace(char c) {
+  return (c == ' ') || (c == '\t');
+}
+
+// The characters a header name may be made of (RFC 9110's tchar).
+static bool IsTokenChar(unsigned char c) {
+  return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) ||
+         ((c >= '0') && (c <= '9')) ||
+         ((c != 0) && (strchr("!#$%&'*+-.^_`|~", c) != nullptr));
+}
+
+// The long runs of a request header -- the URI and the header values,
+// cookies especially -- are skipped over a vector at a time, looking
+// for the byte that ends them.  A Stop says which bytes those are.
+enum class Stop {
+  // '\r' or '\n', which end a header value.
+  kLineEnd,
+
+  // A space or a control character, which end the URI.
+  kUriEnd,
+};
+
+template <Stop kStop>
+static bool IsStop(unsigned char c) {
+  if (kStop == Stop::kLineEnd) {
+    return (c == '\r') || (c == '\n');
+  }
+  return (c <= ' ') || (c == 0x7f);
+}
+
+// Each Find*() returns the offset of the first stop byte in
+// data[from, len), or len if there is none.
+template <Stop kStop>
+static size_t FindScalar(const char *data, size_t from, size_t len) {
+  while ((from < len) && !IsStop<kStop>(data[from])) {
+    from++;
+  }
+  return from;
+}
+
+#if defined(__x86_64__)
+// Every x86-64 CPU has SSE2; AVX2 is picked at run time if there.
+template <Stop kStop>
+__attribute__((target("sse2")))
+static size_t FindSse2(const char *data, size_t from, size_t len) {
+  for (; from + 16 <= len; from += 16) {
+    __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + from));
+    __m128i hits;
+    if (kStop == Stop::kLineEnd) {
+      hits = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')),
+                          _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    } else {
+      // min(v, ' ') == v exactly where v <= ' ', as unsigned bytes.
+      hits = _mm_or_si128(
+          _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(' ')), v),
+          _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+    }
+    int mask = _mm_movemask_epi8(hits);
+    if (mask != 0) {
+      return from + __builtin_ctz(mask);
+    }
+  }
+  return FindScalar<kStop>(data, from, len);
+}
+
+template <Stop kStop>
+__attribute__((target("avx2")))
+static size_t FindAvx2(const char *data, size_t from, size_t len) {
+  for (; from + 32 <= len; from += 32) {
+    __m256i v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + from));
+    __m256i hits;
+    if (kStop == Stop::kLineEnd) {
+      hits = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')),
+                             _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+    } else {
+      hits = _mm256_or_si256(
+          _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(' ')), v),
+          _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7f)));
+    }
+    uint32_t mask = _mm256_movemask_epi8(hits);
+    if (mask != 0) {
+      return from + __builtin_ctz(mask);
+    }
+  }
+  return FindSse2<kStop>(data, from, len);
+}
+#endif  // defined(__x86_64__)
+
+template <Stop kStop>
+static size_t Find(const char *data, size_t from, size_t len) {
+#if defined(__x86_64__)
+  typedef size_t (*FindFn)(const char *, size_t, size_t);
+  static const FindFn find = __builtin_cpu_supports("avx2") ?
+                             &FindAvx2<kStop> : &FindSse2<kStop>;
+  return find(data, from, len);
+#else
+  return FindScalar<kStop>(data, from, len);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// HttpRequestParser
+///////////////////////////////////////////////////////////////////////////////
+void HttpRequestParser::reset() {
+  status_ = Status::kIncomplete;
+  state_ = State::kStart;
+  pos_ = 0;
+  method_ = uri_ = protocol_ = name_ = value_ = Span{0, 0};
+  headers_.clear();
+}
+
+HttpRequestParser::Status HttpRequestParser::parse(char *data, size_t len) {
+  for (; (status_ == Status::kIncomplete) && (pos_ < len); pos_++) {
+    char c = data[pos_];
+    switch (state_) {
+      case State::kStart:
+        if ((c == '\r') || (c == '\n')) {
+          break;
+        }
+        if (IsControl(c) || (c == ' ')) {
+          status_ = Status::kError;
+          return status_;
+        }
+        method_ = Span{pos_, 1};
+        state_ = State::kMethod;
+        break;
+
+      case State::kMethod:
+        if (c == ' ') {
+          state_ = State::kBeforeUri;
+        } else if (IsControl(c)) {
+          status_ = Status::kError;
+          return status_;
+        } else {
+          method_.len++;
+        }
+        break;
+
+      case State::kBeforeUri:
+        if (c == ' ') {
+          break;
+        }
+        if (IsControl(c)) {
+          status_ = Status::kError;
+          return status_;
+        }
+        uri_ = Span{pos_, 1};
+        state_ = State::kUri;
+        break;
+
+      case State::kUri:
+        // Everything up to the next stop byte is part of the URI.
+        uri_.len += Find<Stop::kUriEnd>(data, pos_, len) - pos_;
+        pos_ = uri_.offset + uri_.len;
+        if (pos_ == len) {
+          return status_;
+        }
+        c = data[pos_];
+        if (c == ' ') {
+          state_ = State::kBeforeProtocol;
+        } else if (c == '\r') {
+          state_ = State::kLineFeed;
+        } else if (c == '\n') {
+          state_ = State::kHeaderStart;
+        } else {
+          status_ = Status::kError;
+          return status_;
+        }
+        break;
+
+      case State::kBeforeProtocol:
+        if (c == '\r') {
+          state_ = State::kLineFeed;
+        } else if (c == '\n') {
+          state_ = State::kHeaderStart;
+        } else if (c != ' ') {
+          protocol_ = Span{pos_, 1};
+          state_ = State::kProtocol;
+        }
+        break;
+
+      case State::kProtocol:
+        if (c == '\r') {
+          state_ = State::kLineFeed;
+        } else if (c == '\n') {
+          state_ = State::kHeaderStart;
+        } else if (c == ' ') {
+          state_ = State::kRequestLineRest;
+        } else {
+          protocol_.len++;
+        }
+        break;
+
+      case State::kRequestLineRest:
+        pos_ = Find<Stop::kLineEnd>(data, pos_, len);
+        if (pos_ == len) {
+          return status_;
+        }
+        c = data[pos_];
+        if (c == '\r') {
+          state_ = State::kLineFeed;
+        } else if (c == '\n') {
+          state_ = State::kHeaderStart;
+        }
+        break;
+
+      case State::kLineFeed:
+        if (c != '\n') {
+          status_ = Status::kError;
+          return status_;
+        }
+        state_ = State::kHeaderStart;
+        break;
+
+      case State::kHeaderStart:
+        if (c == '\r') {
+          state_ = State::kEndLineFeed;
+          break;
+        }
+        if (c == '\n') {
+          status_ = Status::kDone;
+          break;
+        }
+        // A line starting with whitespace would be a continuation of
+        // the previous one (obsolete line folding), which we reject.
+        if (!IsTokenChar(c)) {
+          status_ = Status::kError;
+          return status_;
+        }
+        if ((c >= 'A') && (c <= 'Z')) {
+          data[pos_] = c - 'A' + 'a';
+        }
+        name_ = Span{pos_, 1};
+        state_ = State::kName;
+        break;
+
+      case State::kName:
+        if (c == ':') {
+          state_ = State::kBeforeValue;
+        } else if (IsTokenChar(c)) {
+          if ((c >= 'A') && (c <= 'Z')) {
+            data[pos_] = c - 'A' + 'a';
+          }
+          name_.len = pos_ + 1 - name_.offset;
+        } else {
+          // Whitespace before the colon included: a proxy might take
+          // "Name :" as a different header than we do.
+          status_ = Status::kError;
+          return status_;
+        }
+        break;
+
+      case State::kBeforeValue:
+        if (IsSpace(c)) {
+          break;
+        }
+        value_ = Span{pos_, 0};
+        if ((c == '\r') || (c == '\n')) {
+          headers_.emplace_back(name_, value_);
+          state_ = (c == '\r') ? State::kLineFeed : State::kHeaderStart;
+          break;
+        }
+        value_.len = 1;
+        state_ = State::kValue;
+        break;
+
+      case State::kValue:
+        // The value runs to the end of the line, less any whitespace
+        // before that.  Its first byte isn't whitespace.
+        pos_ = Find<Stop::kLineEnd>(data, pos_, len);
+        if (pos_ == len) {
+          return status_;
+        }
+        c = data[pos_];
+        value_.len = pos_ - value_.offset;
+        while (IsSpace(data[value_.offset + value_.len - 1])) {
+          value_.len--;
+        }
+        headers_.emplace_back(name_, value_);
+        state_ = (c == '\r') ? State::kLineFeed : State::kHeaderStart;
+        break;
+
+      case State::kEndLineFeed:
+        status_ = (c == '\n') ? Status::kDone : Status::kError;
+        break;
+    }
+  }
+  return status_;
+}
+
+void HttpRequestParser::view(const char *data, HttpRequestView *view) const {
+  view->method = ViewOf(data, method_);
+  view->uri = ViewOf(data, uri_);
+  view->protocol = ViewOf(data, protocol_);
+  view->body = std::string_view(data + pos_, 0);
+  view->headers.clear();
+  for (const auto &header : headers_) {
+    view->headers.emplace_back(ViewOf(data, header.first),
+                               ViewOf(data, header.second));
+  }
+}
+
+}  // namespace searchserver
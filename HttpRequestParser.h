@@ -0,0 +1,128 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HTTPREQUESTPARSER_H_
+#define HTTPREQUESTPARSER_H_
+
+#include <cstddef>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace searchserver {
+
+// A parsed request header, as views into the buffer it was parsed
+// from.  Only valid for as long as that buffer is left alone.
+struct HttpRequestView {
+  std::string_view method;
+  std::string_view uri;
+  std::string_view protocol;  // empty if the request line had none
+
+  // (name, value) pairs in the order the client sent them.  Names are
+  // lowercase; values are as sent, less surrounding whitespace.
+  std::vector<std::pair<std::string_view, std::string_view>> headers;
+
+  // The body that follows the header.  The parser doesn't look for
+  // one: it leaves this empty, just past the header, for whoever reads
+  // the body to extend.
+  std::string_view body;
+};
+
+// An HttpRequestParser parses a request header (the request line, the
+// header lines and the blank line that ends them) as its bytes arrive.
+// It is a state machine that remembers how far it got, so each byte is
+// looked at once no matter how many reads the header is spread over,
+// and nothing is copied: the parser keeps offsets into the caller's
+// buffer, and lowercases header names in place.
+//
+// Lines may end in "\r\n" or a bare "\n", and blank lines before the
+// request line are skipped.  Header lines must have a name and a ':'.
+class HttpRequestParser {
+ public:
+  enum class Status {
+    // The header has not all arrived yet.
+    kIncomplete,
+
+    // The header is complete; see length() and view().
+    kDone,
+
+    // The bytes so far can't be the start of a valid request.
+    kError,
+  };
+
+  HttpRequestParser() { reset(); }
+  virtual ~HttpRequestParser() { }
+
+  // Forgets the request parsed so far, so the parser can start on the
+  // next one.  Keeps its memory, so that parsing doesn't allocate once
+  // the parser has seen a request with as many headers before.
+  void reset();
+
+  // Carries on parsing the request that starts at "data", which holds
+  // "len" bytes.  The bytes passed to earlier calls since reset() must
+  // still be there, unchanged, though more may have been added after
+  // them and the whole buffer may have moved.  Once this has returned
+  // kDone or kError, it keeps returning the same without parsing.
+  Status parse(char *data, size_t len);
+
+  // Once parse() has returned kDone, returns the number of bytes the
+  // request header took up, including the blank line that ends it.
+  size_t length() const { return pos_; }
+
+  // Once parse() has returned kDone, points "*view" into "data", which
+  // must be the buffer that was parsed (wherever it is now).
+  void view(const char *data, HttpRequestView *view) const;
+
+ private:
+  enum class State {
+    kStart,             // before the request line
+    kMethod,
+    kBeforeUri,
+    kUri,
+    kBeforeProtocol,
+    kProtocol,
+    kRequestLineRest,   // anything after the protocol is ignored
+    kLineFeed,          // a line ended in '\r'; expecting '\n'
+    kHeaderStart,       // at the start of a header line
+    kName,
+    kBeforeValue,
+    kValue,
+    kEndLineFeed,       // the blank line ended in '\r'; expecting '\n'
+  };
+
+  // A piece of the parsed buffer.
+  struct Span {
+    size_t offset;
+    size_t len;
+  };
+
+  static std::string_view ViewOf(const char *data, const Span &span) {
+    return std::string_view(data + span.offset, span.len);
+  }
+
+  Status status_;
+  State state_;
+
+  // The offset of the next byte to look at.
+  size_t pos_;
+
+  Span method_, uri_, protocol_;
+
+  // The header line being parsed.  Trailing whitespace is left out of
+  // the lengths as it goes by.
+  Span name_, value_;
+
+  std::vector<std::pair<Span, Span>> headers_;
+};
+
+}  // namespace searchserver
+
+#endif  // HTTPREQUESTPARSER_H_
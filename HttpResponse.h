@@ -13,10 +13,17 @@
 #define HTTPRESPONSE_H_
 
 #include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
+#include <charconv>
+#include <cstring>
 #include <map>
+#include <memory>
 #include <string>
-#include <sstream>
+#include <string_view>
+#include <vector>
 
 namespace searchserver {
 
@@ -41,40 +48,383 @@ namespace searchserver {
 // Content-length: 10\r\n
 // \r\n
 // Hi there!!
+//
+// The body is kept as a list of segments rather than one string, and
+// GenerateIovecs() hands the header block and those segments to the
+// caller as iovecs, so a connection can writev() the whole response
+// without first concatenating it.
+//
+// Instead of bytes appended with AppendToBody(), the body can be a
+// range of an open file (see SetBodyFile()).  Connections send such a
+// body straight from the file with sendfile(), so its bytes never pass
+// through user space.
+//
+// Or the body can be a BodyStream (see SetBodyStream()), produced a
+// piece at a time while it is sent, with "Transfer-Encoding: chunked"
+// in place of a Content-length.
+//
+// Serializing a response doesn't allocate if it is done into a buffer
+// that already has the room (see AppendHeaderTo()), and a body built
+// up with AppendToBody() can be given its final size up front with
+// ReserveBody().  The storage for the extra headers and the list of
+// body segments is sized for a typical response, and is reused from
+// responses that have gone away on the same thread.
+
+// An open, read-only file that is (part of) the body of one or more
+// responses.  The descriptor is closed when the last response that
+// refers to it goes away.
+class BodyFile {
+ public:
+  explicit BodyFile(int fd) : fd_(fd) { }
+  virtual ~BodyFile() {
+    if (fd_ != -1) {
+      close(fd_);
+    }
+  }
+
+  int fd() const { return fd_; }
+
+  BodyFile(const BodyFile &other) = delete;
+  BodyFile &operator=(const BodyFile &other) = delete;
+
+ private:
+  int fd_;
+};
+
+// A response body that is produced a piece at a time, as it is sent,
+// so that it never has to be held in memory all at once and the first
+// of it can go out before the rest is ready.  Subclasses provide the
+// pieces through Next(); connections call NextChunk(), which frames
+// them for the chunked transfer coding.  A stream is read either with
+// NextChunk() or with Next(), not both.
+//
+// A stream can only be sent once.
+class BodyStream {
+ public:
+  BodyStream() { }
+  virtual ~BodyStream() { }
+
+  // Appends the next piece of the body to "*out" as a chunk; after the
+  // last piece, the terminating zero-length chunk is appended too.
+  // Returns false, and appends nothing, once that has been done.
+  bool NextChunk(std::string *out) {
+    if (done_) {
+      return false;
+    }
+    // The size goes in front of the piece, but is only known once the
+    // piece is there, so room is left for it in hex of a fixed width
+    // (leading zeros are allowed).
+    size_t size_pos = out->size();
+    out->append(kSizeWidth, '0');
+    out->append("\r\n");
+    size_t piece_pos = out->size();
+    bool more;
+    while ((more = Next(out)) && (out->size() == piece_pos)) {
+      // An empty piece would end the body early; ask for another.
+    }
+    if (!more) {
+      out->resize(size_pos);
+      out->append("0\r\n\r\n");
+      done_ = true;
+      return true;
+    }
+    size_t size = out->size() - piece_pos;
+    for (size_t i = kSizeWidth; i > 0; i--, size >>= 4) {
+      (*out)[size_pos + i - 1] = "0123456789abcdef"[size & 0xf];
+    }
+    out->append("\r\n");
+    return true;
+  }
+
+  // Appends the next piece of the body to "*out" and returns true, or
+  // returns false if the body is complete.  This is the body as it
+  // is, for streams that transform another; connections want
+  // NextChunk() instead.
+  virtual bool Next(std::string *out) = 0;
+
+  BodyStream(const BodyStream &other) = delete;
+  BodyStream &operator=(const BodyStream &other) = delete;
+
+ private:
+  // Hex digits in a chunk size: enough for a piece of up to 4 GiB.
+  static const size_t kSizeWidth = 8;
+
+  bool done_ = false;
+};
 
 class HttpResponse {
  public:
   HttpResponse() { }
-  virtual ~HttpResponse() { }
+  HttpResponse(const HttpResponse &other) = default;
+  HttpResponse(HttpResponse &&other) = default;
+  HttpResponse &operator=(const HttpResponse &other) = default;
+  HttpResponse &operator=(HttpResponse &&other) = default;
+  virtual ~HttpResponse() { GiveBackStorage(); }
 
   void set_protocol(const std::string &protocol) { protocol_ = protocol; }
   void set_response_code(uint16_t code) { response_code_ = code; }
   void set_message(const std::string &msg) { message_ = msg; }
   void set_content_type(const std::string &type) { content_type_ = type; }
+  const std::string &content_type() const { return content_type_; }
+
+  // Adds a "name: value" header line, sent after Content-type.
+  void AddHeader(std::string_view name, std::string_view value) {
+    if (extra_headers_.empty()) {
+      TakeHeaderStorage();
+    }
+    extra_headers_.append(name.data(), name.size());
+    extra_headers_.append(": ");
+    extra_headers_.append(value.data(), value.size());
+    extra_headers_.append("\r\n");
+  }
+
+  void AppendToBody(std::string_view body_fragment) {
+    if (body_.empty() || !body_.back().owned()) {
+      NewBodySegment();
+    }
+    body_.back().data.append(body_fragment.data(), body_fragment.size());
+    body_length_ += body_fragment.size();
+  }
+
+  // Appends the decimal digits of "n" to the body.
+  void AppendNumberToBody(int64_t n) {
+    char digits[kMaxDigits];
+    char *end = std::to_chars(digits, digits + sizeof(digits), n).ptr;
+    AppendToBody(std::string_view(digits, end - digits));
+  }
+
+  // Makes room for "len" more bytes of AppendToBody() (or
+  // AppendNumberToBody()), so that appending them doesn't reallocate.
+  void ReserveBody(size_t len) {
+    if (body_.empty() || !body_.back().owned()) {
+      NewBodySegment();
+    }
+    body_.back().data.reserve(body_.back().data.size() + len);
+  }
+
+  // Appends "fragment" to the body as a segment of its own, taking its
+  // memory rather than copying it.
+  void MoveToBody(std::string &&fragment) {
+    body_length_ += fragment.size();
+    NewBodySegment().data = std::move(fragment);
+  }
+
+  // Appends "len" bytes at "ptr" to the body without copying them.
+  // The bytes must outlive the response (e.g., a string literal).
+  void AppendStaticToBody(const char *ptr, size_t len) {
+    BodySegment &segment = NewBodySegment();
+    segment.ptr = ptr;
+    segment.len = len;
+    body_length_ += len;
+  }
+  void AppendStaticToBody(const char *str) {
+    AppendStaticToBody(str, strlen(str));
+  }
 
-  void AppendToBody(const std::string &body_fragment) {
-    body_ += body_fragment;
+  // Appends the bytes of "data" to the body without copying them,
+  // keeping a reference to them for as long as the response needs it.
+  void AppendSharedToBody(std::shared_ptr<const std::string> data) {
+    body_length_ += data->size();
+    NewBodySegment().shared = std::move(data);
+  }
+
+  // Makes the response "header", the status line and headers already
+  // serialized (e.g., by AppendHeaderTo()), followed by "body".  The
+  // header is sent as it is, in place of one made from the fields
+  // above, so it must have the right Content-length for "body".
+  void SetPrebuilt(std::shared_ptr<const std::string> header,
+                   std::shared_ptr<const std::string> body) {
+    ClearBody();
+    prebuilt_header_ = std::move(header);
+    AppendSharedToBody(std::move(body));
+  }
+
+  // Empties the body, wherever it is.
+  void ClearBody() {
+    body_.clear();
+    body_length_ = 0;
+    body_file_.reset();
+    body_stream_.reset();
+  }
+
+  // Makes the body the "length" bytes of "file" starting at "offset",
+  // in place of anything appended with AppendToBody().
+  void SetBodyFile(std::shared_ptr<const BodyFile> file,
+                   off_t offset, size_t length) {
+    body_.clear();
+    body_length_ = 0;
+    body_stream_.reset();
+    body_file_ = std::move(file);
+    body_file_offset_ = offset;
+    body_file_length_ = length;
+  }
+
+  // Makes "stream" the body, in place of anything appended with
+  // AppendToBody() or set with SetBodyFile().  The response is sent
+  // with the chunked transfer coding, which only HTTP/1.1 clients
+  // understand.  Copies of the response share the stream, so only
+  // one of them can be sent.
+  void SetBodyStream(std::shared_ptr<BodyStream> stream) {
+    body_.clear();
+    body_length_ = 0;
+    body_file_.reset();
+    body_stream_ = std::move(stream);
+  }
+
+  // The body set with SetBodyStream(), or nullptr.
+  const std::shared_ptr<BodyStream> &body_stream() const {
+    return body_stream_;
+  }
+
+  // Accessors for a body set with SetBodyFile().  body_file() is
+  // nullptr if the body is in memory.
+  const std::shared_ptr<const BodyFile> &body_file() const {
+    return body_file_;
+  }
+  off_t body_file_offset() const { return body_file_offset_; }
+
+  // The header block given with SetPrebuilt(), or nullptr.
+  const std::shared_ptr<const std::string> &prebuilt_header() const {
+    return prebuilt_header_;
+  }
+
+  // The length of the body in bytes, wherever it is.
+  size_t body_length() const {
+    return body_file_ ? body_file_length_ : body_length_;
+  }
+
+  // Lays the response out for writev(): serializes the status line and
+  // headers into "*header" and sets "*iov" to an iovec for *header
+  // followed by one for each in-memory body segment.  The iovecs point
+  // into *header and into this response, so both must outlive them.
+  // A file body gets no iovec; send the file range after these.  Nor
+  // does a streamed one; send its chunks after these.
+  void GenerateIovecs(std::string *header,
+                      std::vector<struct iovec> *iov) const {
+    header->clear();
+    AppendHeaderTo(header, body_length());
+    iov->clear();
+    iov->push_back({ &(*header)[0], header->size() });
+    AppendBodyIovecs(iov);
+  }
+
+  // Appends an iovec for each in-memory body segment to "*iov".  They
+  // point into this response, which must outlive them.
+  void AppendBodyIovecs(std::vector<struct iovec> *iov) const {
+    for (const BodySegment &segment : body_) {
+      if (segment.size() > 0) {
+        iov->push_back({ const_cast<char *>(segment.bytes()), segment.size() });
+      }
+    }
   }
 
   // A method to generate a std::string of the HTTP response, suitable
   // for writing back to the client.  We automatically generate the
   // "Content-length:" header, and make that be the last header
   // in the block.  The value of the Content-length header is the
-  // size of the response body (in bytes).
+  // size of the response body (in bytes).  A 304 (Not Modified)
+  // response has neither a body nor a Content-length.
+  //
+  // A file body is read into the string; connections avoid that by
+  // sending GenerateHeaderString() and then the file range.  A
+  // streamed body is read to its end and appended, chunk by chunk.
   std::string GenerateResponseString() const {
-    std::stringstream resp;
+    std::string resp;
+    AppendResponseTo(&resp);
+    return resp;
+  }
 
-    resp << protocol_ << " " << response_code_ << " " << message_ << "\r\n";
+  // Like GenerateResponseString(), but appends the response to "*out".
+  void AppendResponseTo(std::string *out) const {
+    out->reserve(out->size() + HeaderSizeEstimate() + body_length());
+    AppendHeaderTo(out, body_length());
+    if (body_stream_) {
+      while (body_stream_->NextChunk(out)) {
+      }
+      return;
+    }
+    if (!body_file_) {
+      for (const BodySegment &segment : body_) {
+        out->append(segment.bytes(), segment.size());
+      }
+      return;
+    }
+    size_t body_start = out->size();
+    out->resize(body_start + body_file_length_);
+    size_t done = 0;
+    while (done < body_file_length_) {
+      ssize_t res = pread(body_file_->fd(), &(*out)[body_start + done],
+                          body_file_length_ - done, body_file_offset_ + done);
+      if (res <= 0) {
+        // The file shrank or failed; what we send will be short.
+        break;
+      }
+      done += res;
+    }
+    out->resize(body_start + done);
+  }
+
+  // Generates only the status line and headers of the response, up to
+  // and including the blank line that ends them, for a body of
+  // "content_length" bytes.  This is for callers that send the body
+  // themselves rather than from the body segments.
+  std::string GenerateHeaderString(size_t content_length) const {
+    std::string resp;
+    AppendHeaderTo(&resp, content_length);
+    return resp;
+  }
+
+  // Like GenerateHeaderString(), but appends the status line and
+  // headers to "*out".  With a streamed body, "content_length" is
+  // ignored and the headers say the body is chunked.
+  void AppendHeaderTo(std::string *out, size_t content_length) const {
+    if (prebuilt_header_) {
+      out->append(*prebuilt_header_);
+      return;
+    }
+    out->reserve(out->size() + HeaderSizeEstimate());
+    out->append(protocol_);
+    out->push_back(' ');
+    AppendNumber(out, response_code_);
+    out->push_back(' ');
+    out->append(message_);
+    out->append("\r\n");
     if (!content_type_.empty()) {
-      resp << "Content-type: " << content_type_ << "\r\n";
+      out->append("Content-type: ");
+      out->append(content_type_);
+      out->append("\r\n");
+    }
+    out->append(extra_headers_);
+    if (body_stream_) {
+      out->append("Transfer-Encoding: chunked\r\n");
+    } else if (response_code_ != 304) {
+      out->append("Content-length: ");
+      AppendNumber(out, content_length);
+      out->append("\r\n");
     }
-    resp << "Content-length: " << body_.size() << "\r\n";
-    resp << "\r\n";
-    resp << body_;
-    return resp.str();
+    out->append("\r\n");
   }
 
  private:
+  // Enough room for any 64-bit number in decimal, with its sign.
+  static const int kMaxDigits = 20;
+
+  // Roughly how long the status line and headers will be, with room
+  // for the numbers in them.
+  size_t HeaderSizeEstimate() const {
+    if (prebuilt_header_) {
+      return prebuilt_header_->size();
+    }
+    return protocol_.size() + message_.size() + content_type_.size() +
+           extra_headers_.size() + 64;
+  }
+
+  static void AppendNumber(std::string *out, uint64_t n) {
+    char digits[kMaxDigits];
+    char *end = std::to_chars(digits, digits + sizeof(digits), n).ptr;
+    out->append(digits, end - digits);
+  }
+
   // The HTTP protocol string to pass back in the header.
   std::string protocol_;
 
@@ -87,8 +437,119 @@ class HttpResponse {
   // The HTTP content type string to pass back in the header.  Optional .
   std::string content_type_;
 
-  // The body of the response.
-  std::string body_;
+  // Any other headers, already serialized.
+  std::string extra_headers_;
+
+  // The whole header block, if it was given with SetPrebuilt().
+  std::shared_ptr<const std::string> prebuilt_header_;
+
+  // A piece of the body: bytes owned in "data"; or, if "ptr" is set,
+  // "len" bytes of storage that outlives the response; or, if
+  // "shared" is set, the bytes of that string.
+  struct BodySegment {
+    std::string data;
+    const char *ptr = nullptr;
+    size_t len = 0;
+    std::shared_ptr<const std::string> shared;
+
+    // Whether the bytes are in "data", and so can be appended to.
+    bool owned() const { return !ptr && !shared; }
+
+    const char *bytes() const {
+      return ptr ? ptr : (shared ? shared->data() : data.data());
+    }
+    size_t size() const {
+      return ptr ? len : (shared ? shared->size() : data.size());
+    }
+  };
+
+  // Room for the extra headers a response usually has (an ETag, a
+  // Last-Modified, a Vary, ...), and for as many body segments as a
+  // result page usually has, so that they are made once, not grown.
+  static const size_t kHeaderReserve = 256;
+  static const size_t kBodyReserve = 16;
+
+  // Header strings and body segment lists left by responses that have
+  // gone away, kept by each thread for its next responses: at most
+  // kMaxSpare of each, and none much bigger than usual.
+  static const size_t kMaxSpare = 64;
+  static const size_t kMaxSpareHeaderBytes = 4096;
+  static const size_t kMaxSpareBodySegments = 1024;
+  struct SpareStorage {
+    std::vector<std::string> headers;
+    std::vector<std::vector<BodySegment>> bodies;
+    bool *gone;
+    ~SpareStorage() { *gone = true; }
+  };
+
+  // Returns this thread's SpareStorage, or nullptr if the thread is
+  // exiting and it has been destroyed already.
+  static SpareStorage *Spare() {
+    static thread_local bool gone = false;
+    static thread_local SpareStorage spare{{}, {}, &gone};
+    return gone ? nullptr : &spare;
+  }
+
+  // Gives extra_headers_ room for the usual headers, from spare
+  // storage if there is some.
+  void TakeHeaderStorage() {
+    SpareStorage *spare = Spare();
+    if ((spare != nullptr) && !spare->headers.empty()) {
+      extra_headers_.swap(spare->headers.back());
+      spare->headers.pop_back();
+    } else {
+      extra_headers_.reserve(kHeaderReserve);
+    }
+  }
+
+  // Appends an empty segment to the body and returns it.  The first
+  // gives body_ room for the usual number, from spare storage if there
+  // is some.
+  BodySegment &NewBodySegment() {
+    if (body_.capacity() == 0) {
+      SpareStorage *spare = Spare();
+      if ((spare != nullptr) && !spare->bodies.empty()) {
+        body_.swap(spare->bodies.back());
+        spare->bodies.pop_back();
+      } else {
+        body_.reserve(kBodyReserve);
+      }
+    }
+    body_.emplace_back();
+    return body_.back();
+  }
+
+  // Leaves extra_headers_ and body_ to the thread's next responses.
+  void GiveBackStorage() {
+    bool headers = (extra_headers_.capacity() >= kHeaderReserve) &&
+                   (extra_headers_.capacity() <= kMaxSpareHeaderBytes);
+    bool body = (body_.capacity() > 0) &&
+                (body_.capacity() <= kMaxSpareBodySegments);
+    SpareStorage *spare = (headers || body) ? Spare() : nullptr;
+    if (spare == nullptr) {
+      return;
+    }
+    if (headers && (spare->headers.size() < kMaxSpare)) {
+      extra_headers_.clear();
+      spare->headers.push_back(std::move(extra_headers_));
+    }
+    if (body && (spare->bodies.size() < kMaxSpare)) {
+      body_.clear();
+      spare->bodies.push_back(std::move(body_));
+    }
+  }
+
+  // The body of the response, and its total length.
+  std::vector<BodySegment> body_;
+  size_t body_length_ = 0;
+
+  // The file range that is the body instead, if body_file_ is set.
+  std::shared_ptr<const BodyFile> body_file_;
+  off_t body_file_offset_ = 0;
+  size_t body_file_length_ = 0;
+
+  // Or the stream that produces the body, if body_stream_ is set.
+  std::shared_ptr<BodyStream> body_stream_;
 };
 
 }  // namespace searchserver
@@ -9,19 +9,34 @@
  * author.
  */
 
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <optional>
 #include <vector>
 #include <string>
 #include <sstream>
+#include <thread>
 
-#include "./FileReader.h"
+#include "./Compression.h"
+#include "./EventLoop.h"
 #include "./HttpConnection.h"
 #include "./HttpRequest.h"
 #include "./HttpUtils.h"
 #include "./HttpServer.h"
+#include "./ListenerHandoff.h"
+#include "./UringLoop.h"
 
 
 using std::cerr;
@@ -58,69 +73,725 @@ static const char *kFivegleStr =
   "</form>\n"
   "</center><p>\n";
 
-// static
-const int HttpServer::kNumThreads = 100;
+// How many reverse DNS answers to keep, and for how long (seconds).
+static const size_t kDnsCacheEntries = 4096;
+static const int kDnsTtlSeconds = 300;
+
+// How often a draining thread-mode listener checks whether all of the
+// connections are gone.
+static const int kDrainPollMs = 50;
+
+// A request for more byte ranges than this, or for more bytes in all
+// than the file holds, is answered with the whole file instead, so
+// that overlapping ranges can't be used to multiply the work.
+static const size_t kMaxByteRanges = 16;
+
+// Several ranges are read into memory to make a multipart body, so a
+// request for more than this in all is answered with the whole file,
+// sent straight from it, instead.
+static const uint64_t kMaxMultipartBytes = 1 << 20;
+
+// Bodies shorter than this are sent as they are; compressing them
+// would save less than a packet.
+static const size_t kMinCompressBytes = 1024;
+
+// A response in the static file cache is trusted for this long before
+// its files are stat()ed again to see whether they changed.  While
+// they are watched, a change drops the response straight away, so the
+// stat() is only a backstop.
+static const uint32_t kFileCacheRevalidateMs = 1000;
+static const uint32_t kWatchedFileCacheRevalidateMs = 10 * 60 * 1000;
+
+// How long the watcher gathers changes to static files before passing
+// them on, so that a file being written is dealt with once.
+static const uint32_t kFileWatchCoalesceMs = 50;
+
+// The open file cache may hold at most 1/kOpenFilesLimitShare of the
+// descriptors the process is allowed, so that the rest are left for
+// connections, listeners and the files that aren't cached.
+static const size_t kOpenFilesLimitShare = 4;
+
+// A page with more results than this is streamed to clients that can
+// take it, in pieces of about kStreamPieceSize bytes, rather than
+// built in memory first.
+static const size_t kMaxUnstreamedResults = 128;
+static const size_t kStreamPieceSize = 16384;
+
+// The end of a page of results.
+static const char *kResultsEndStr = "</ul>\n</body>\n</html>";
+
+// Where a batch of queries is POSTed, one query per line, to be
+// answered all at once.  A batch may hold up to kMaxBatchQueries.
+static const char *kBatchUri = "/batch";
+static const size_t kMaxBatchQueries = 100000;
+
+// The queries of a batch are looked up kBatchShardQueries at a time,
+// by the thread that received it and by up to kMaxBatchHelpers more
+// from the pool.
+static const size_t kBatchShardQueries = 64;
+static const size_t kMaxBatchHelpers = 8;
+
+// Appends the decimal digits of "n" to "*out".
+static void AppendNumber(string *out, int64_t n) {
+  char digits[20];
+  char *end = std::to_chars(digits, digits + sizeof(digits), n).ptr;
+  out->append(digits, end - digits);
+}
+
+// Appends the start of a page of "count" (at least one) results for
+// "queries", which goes after the logo and before the results.
+static void AppendResultsHeader(string *out,
+                                const vector<string> &queries,
+                                size_t count) {
+  out->append("<p>\n <br>\n");
+  AppendNumber(out, count);
+  out->append(" result for <b>");
+  for (auto& q : queries) {
+    out->append(q);
+    out->append(" ");
+  }
+  out->append("</b>\n </p>\n <p></p>\n<ul>\n");
+}
+
+// Appends one result's entry to a page of results.
+static void AppendResult(string *out, const Result &r) {
+  out->append("<li> <a href =\"/static/./");
+  out->append(r.doc_name);
+  out->append("\">");
+  out->append(r.doc_name);
+  out->append("</a> [");
+  AppendNumber(out, r.rank);
+  out->append("]\n<br>\n</li>\n");
+}
+
+// Produces a page of results a piece at a time: the logo and the start
+// of the page first, so that they go out at once, then the results,
+// then the end of the page.
+class QueryResultStream : public BodyStream {
+ public:
+  QueryResultStream(vector<string> queries, vector<Result> results)
+    : queries_(std::move(queries)), results_(std::move(results)) { }
+
+  bool Next(string *out) override {
+    if (!started_) {
+      out->append(kFivegleStr);
+      AppendResultsHeader(out, queries_, results_.size());
+      started_ = true;
+      return true;
+    }
+    if (next_ < results_.size()) {
+      size_t start = out->size();
+      while ((next_ < results_.size()) &&
+             (out->size() - start < kStreamPieceSize)) {
+        AppendResult(out, results_[next_++]);
+      }
+      return true;
+    }
+    if (!finished_) {
+      out->append(kResultsEndStr);
+      finished_ = true;
+      return true;
+    }
+    return false;
+  }
+
+ private:
+  vector<string> queries_;
+  vector<Result> results_;
+
+  // How far the page has got: whether its start has been produced,
+  // the next result to produce, and whether its end has been.
+  bool started_ = false;
+  size_t next_ = 0;
+  bool finished_ = false;
+};
+
+// Appends the answer to one query of a batch: the number of results,
+// then a line with the rank and document name of each.
+static void AppendBatchAnswer(string *out, const vector<Result> &results) {
+  AppendNumber(out, results.size());
+  out->push_back('\n');
+  for (auto& r : results) {
+    AppendNumber(out, r.rank);
+    out->push_back('\t');
+    out->append(r.doc_name);
+    out->push_back('\n');
+  }
+}
+
+// The queries of a batch request, looked up a shard at a time by
+// whichever threads are working on it.  The thread that received the
+// batch works through shards as well, so the batch is finished even if
+// every worker is busy, and a helper that only starts once every shard
+// has been taken finds nothing to do.
+class QueryBatch {
+ public:
+  // "queries" point into the request, which only has to outlive
+  // Wait(): no query is looked at once every shard has been taken.
+  QueryBatch(WordIndex *index, vector<std::string_view> queries)
+    : index_(index), queries_(std::move(queries)),
+      num_shards_((queries_.size() + kBatchShardQueries - 1) /
+                  kBatchShardQueries),
+      answers_(num_shards_), next_shard_(0), shards_done_(0) {
+    pthread_mutex_init(&lock_, nullptr);
+    pthread_cond_init(&done_cond_, nullptr);
+  }
+
+  virtual ~QueryBatch() {
+    pthread_cond_destroy(&done_cond_);
+    pthread_mutex_destroy(&lock_);
+  }
+
+  size_t num_shards() const { return num_shards_; }
+
+  // Looks up shards until there are none left to take.
+  void Work() {
+    vector<string> terms;
+    size_t shard;
+    while ((shard = next_shard_.fetch_add(1)) < num_shards_) {
+      size_t end = std::min(queries_.size(), (shard + 1) * kBatchShardQueries);
+      string &answer = answers_[shard];
+      for (size_t i = shard * kBatchShardQueries; i < end; i++) {
+        SplitTerms(queries_[i], &terms);
+        AppendBatchAnswer(&answer, index_->lookup_query(terms));
+      }
+      pthread_mutex_lock(&lock_);
+      if (++shards_done_ == num_shards_) {
+        pthread_cond_broadcast(&done_cond_);
+      }
+      pthread_mutex_unlock(&lock_);
+    }
+  }
+
+  // Waits until every shard has been looked up, and returns the
+  // answers to each, in order.
+  vector<string> *Wait() {
+    pthread_mutex_lock(&lock_);
+    while (shards_done_ < num_shards_) {
+      pthread_cond_wait(&done_cond_, &lock_);
+    }
+    pthread_mutex_unlock(&lock_);
+    return &answers_;
+  }
+
+ private:
+  // Splits "query" into its lowercased terms, which are separated by
+  // spaces or tabs.
+  static void SplitTerms(std::string_view query, vector<string> *terms) {
+    terms->clear();
+    size_t pos = 0;
+    while (pos < query.size()) {
+      size_t end = query.find_first_of(" \t", pos);
+      if (end == std::string_view::npos) {
+        end = query.size();
+      }
+      if (end > pos) {
+        terms->emplace_back(query.substr(pos, end - pos));
+        boost::to_lower(terms->back());
+      }
+      pos = end + 1;
+    }
+  }
+
+  WordIndex *index_;
+  vector<std::string_view> queries_;
+  const size_t num_shards_;
+  vector<string> answers_;
+
+  // The next shard to take, and how many have been looked up.
+  std::atomic<size_t> next_shard_;
+  pthread_mutex_t lock_;
+  pthread_cond_t done_cond_;
+  size_t shards_done_;
+};
+
+// A pool worker's share of a QueryBatch.
+class QueryBatchTask : public ThreadPool::Task {
+ public:
+  explicit QueryBatchTask(std::shared_ptr<QueryBatch> batch)
+    : ThreadPool::Task(&QueryBatchTask_ThrFn), batch_(std::move(batch)) { }
+
+ private:
+  static void QueryBatchTask_ThrFn(ThreadPool::Task *t) {
+    unique_ptr<QueryBatchTask> task(static_cast<QueryBatchTask *>(t));
+    task->batch_->Work();
+  }
+
+  std::shared_ptr<QueryBatch> batch_;
+};
 
 // This is the function that threads are dispatched into
 // in order to process new client connections.
 static void HttpServer_ThrFn(ThreadPool::Task *t);
 
-// Given a request, produce a response.
-static HttpResponse ProcessRequest(const HttpRequest &req,
-                            const string &base_dir,
-                            WordIndex *indices);
+// Process a file request, answering it from "file_cache" if that is
+// not nullptr and has it, opening files through "open_files" if that
+// is not nullptr, and compressing them through "compressed_files" if
+// that is not nullptr.
+static HttpResponse ProcessFileRequest(const HttpRequest &req,
+                                       const string &uri,
+                                       const string &base_dir,
+                                       StaticFileCache *file_cache,
+                                       OpenFileCache *open_files,
+                                       CompressedFileCache *compressed_files);
+
+// Opens the file at "path", below "base_dir", read-only, through
+// "open_files" if it is not nullptr, and sets "*st" to what fstat()
+// says about it.  Returns nullptr if it can't be opened.
+static std::shared_ptr<const BodyFile> OpenStaticFile(
+    OpenFileCache *open_files, const string &base_dir, const string &path,
+    struct stat *st);
+
+// Returns how many files the open file cache may hold, given that
+// "wanted" were asked for: no more than its share of RLIMIT_NOFILE,
+// after raising the soft limit as far as the hard one allows.
+static size_t OpenFilesAllowed(size_t wanted);
+
+// Returns true if the response to "req", a /static/ request, may come
+// from the static file cache: it is a plain request for the whole
+// file, as conditional and range requests always look at the file.
+static bool FileCacheable(const HttpRequest &req);
+
+// Returns the key under which the response to "req" for the file at
+// "real_name", of type "content_type", is cached: the file, and which
+// of the codings it might be sent with the client takes.
+static string FileCacheKey(const HttpRequest &req,
+                           const string &real_name,
+                           const string &content_type);
+
+// Adds a Source for the file at "path", open as "file" and described
+// by "st", to "*sources", and another for where the file really is if
+// that path goes through a symbolic link, so that a FileWatcher's
+// report of a change to either drops the response.
+static void AddSource(const string &path, const BodyFile &file,
+                      const struct stat &st,
+                      vector<StaticFileCache::Source> *sources);
+
+// Adds "response", a 200 with "cached" or else the "size" bytes of
+// "file" as its body, to "file_cache" under "key" if it is small
+// enough.  The response was made from the files "sources".
+static void CacheFileResponse(StaticFileCache *file_cache,
+                              const string &key,
+                              const HttpResponse &response,
+                              const BodyFile &file,
+                              size_t size,
+                              const std::shared_ptr<const string> &cached,
+                              vector<StaticFileCache::Source> &&sources);
+
+// Returns true if "req" is conditional on the file described by "st"
+// and "etag" and the client's copy is still current, i.e., it should
+// be answered with a 304.
+static bool NotModified(const HttpRequest &req,
+                        const struct stat &st,
+                        const string &etag);
+
+// Returns true if the Range header of "req" should be honoured, i.e.,
+// there is no If-Range, or it names the file's current version.
+static bool IfRangeHolds(const HttpRequest &req,
+                         const struct stat &st,
+                         const string &etag);
+
+// Turns "*response", a 200 for "file", into a 206 (or 416) answer for
+// "ranges" of it, as parsed by parse_byte_ranges().  Returns false,
+// leaving *response alone, if the whole file should be sent instead.
+static bool SetRangeResponse(const std::shared_ptr<const BodyFile> &file,
+                             uint64_t size,
+                             const vector<ByteRange> &ranges,
+                             HttpResponse *response);
+
+// Works out whether the static file "file_name", which is open as
+// "*file" and described by "*st", should go to a client that sent
+// "accept_encoding" compressed.  If it should, returns the coding,
+// and either replaces *file and *st with a precompressed sibling of
+// the file (file_name.br or file_name.gz) that is up to date, or sets
+// "*cached" to a compressed copy from "compressed_files", if that is
+// not nullptr.  Otherwise returns kIdentity, setting "*compressing" if
+// the copy is still being made, so that the answer isn't worth
+// caching.  Siblings are opened below "base_dir", through "open_files"
+// if it is not nullptr.  Each sibling looked for and not used, being
+// missing or out of date, is added to "*passed_over", since a change
+// to it would change the answer.
+static ContentEncoding ChooseFileEncoding(
+    std::string_view accept_encoding,
+    const string &base_dir,
+    const string &file_name,
+    OpenFileCache *open_files,
+    CompressedFileCache *compressed_files,
+    std::shared_ptr<const BodyFile> *file,
+    struct stat *st,
+    std::shared_ptr<const string> *cached,
+    bool *compressing,
+    vector<StaticFileCache::Source> *passed_over);
 
-// Process a file request.
-static HttpResponse ProcessFileRequest(const string &uri,
-                                const string &base_dir);
+// Sends the body of "*response" gzipped if the client that sent "req"
+// takes that and it's worth it.
+static void CompressResponse(const HttpRequest &req, HttpResponse *response);
 
-// Process a query request.
+// Process a query request.  If "can_stream", a long page of results
+// may be sent with the chunked transfer coding.
 static HttpResponse ProcessQueryRequest(const string &uri,
-                                 WordIndex *index);
+                                 WordIndex *index,
+                                 bool can_stream);
+
+// Process a batch of queries, one per line of "body", with help from
+// "pool" if it is not nullptr.  The answer is plain text: for each
+// query in turn, the number of results, then a line per result with
+// its rank and document name, separated by a tab.
+static HttpResponse ProcessBatchRequest(std::string_view body,
+                                        WordIndex *index,
+                                        ThreadPool *pool);
+
+// Returns a 405 for a request with a method that "uri" doesn't take;
+// "allow" is the one it does.
+static HttpResponse MethodNotAllowedResponse(const string &uri,
+                                             const char *allow);
 
 
 ///////////////////////////////////////////////////////////////////////////////
 // HttpServer
 ///////////////////////////////////////////////////////////////////////////////
+HttpServer::HttpServer(uint16_t port,
+                       const string &static_file_dir_path,
+                       WordIndex* index,
+                       const HttpServerOptions &options)
+  : port_(port), drain_fd_(eventfd(0, EFD_CLOEXEC)), draining_(false),
+    static_file_dir_path_(static_file_dir_path), index_(index),
+    options_(options) { }
+
+HttpServer::~HttpServer() {
+  if (drain_fd_ != -1) {
+    close(drain_fd_);
+  }
+}
+
+void HttpServer::drain() {
+  if (draining_.exchange(true)) {
+    return;
+  }
+  cout << "  draining..." << endl;
+
+  // Never read, so it stays readable for every group to see.
+  uint64_t one = 1;
+  if (write(drain_fd_, &one, sizeof(one)) == -1) {
+    cerr << "Couldn't start draining: " << strerror(errno) << endl;
+  }
+}
+
 bool HttpServer::run(void) {
-  // Create the server listening socket.
-  int listen_fd;
-  cout << "  creating and binding the listening socket..." << endl;
-  if (!socket_.bind_and_listen(&listen_fd)) {
-    cerr << endl << "Couldn't bind to the listening socket." << endl;
+  // Work out how many listener groups to run and what each one gets.
+  uint32_t num_listeners = options_.num_listeners;
+  if (num_listeners == 0) {
+    num_listeners = std::max(1u, std::thread::hardware_concurrency());
+  }
+  uint32_t num_workers = options_.num_workers;
+  if (num_workers == 0) {
+    num_workers = std::max(1u, std::thread::hardware_concurrency());
+  }
+  if ((options_.io_mode == IoMode::kUring) && !UringLoop::IsSupported()) {
+    cout << "  io_uring isn't supported by this kernel; using epoll." << endl;
+    options_.io_mode = IoMode::kEpoll;
+  }
+
+  if (options_.io_mode == IoMode::kThreads) {
+    watchdog_.reset(new Watchdog(options_.timeouts, &stats_));
+  }
+  if (options_.reverse_dns) {
+    resolver_.reset(new DnsResolver(kDnsCacheEntries, kDnsTtlSeconds));
+  }
+  if (options_.watch_files &&
+      ((options_.file_cache_bytes > 0) || (options_.open_files > 0))) {
+    watcher_.reset(new FileWatcher(static_file_dir_path_,
+                                   kFileWatchCoalesceMs));
+    if (watcher_->start()) {
+      cout << "  watching " << watcher_->root() << " for changes..." << endl;
+    } else {
+      watcher_.reset();
+    }
+  }
+  // If nothing will tell the caches about changes, they have to look.
+  uint32_t revalidate_ms = watcher_ ? kWatchedFileCacheRevalidateMs :
+                                      kFileCacheRevalidateMs;
+  if (options_.file_cache_bytes > 0) {
+    StaticFileCache *cache =
+        new StaticFileCache(options_.file_cache_bytes,
+                            options_.file_cache_max_entry_bytes,
+                            revalidate_ms);
+    file_cache_.reset(cache);
+    if (watcher_) {
+      watcher_->add_listener([cache](const vector<string> &paths) {
+        cache->invalidate(paths);
+      });
+    }
+  }
+  if (options_.open_files > 0) {
+    options_.open_files = OpenFilesAllowed(options_.open_files);
+    cout << "  keeping up to " << options_.open_files
+         << " static files open" << endl;
+  }
+  if (options_.open_files > 0) {
+    OpenFileCache *cache = new OpenFileCache(options_.open_files,
+                                             revalidate_ms,
+                                             static_file_dir_path_);
+    open_files_.reset(cache);
+    if (watcher_) {
+      watcher_->add_listener([cache](const vector<string> &paths) {
+        cache->invalidate(paths);
+      });
+    }
+  }
+  if (options_.compressed_files_bytes > 0) {
+    compressed_files_.reset(
+        new CompressedFileCache(options_.compressed_files_bytes,
+                                options_.compressed_file_max_bytes));
+  }
+
+  if (drain_fd_ == -1) {
+    cerr << "eventfd() failed: " << strerror(errno) << endl;
     return false;
   }
 
-  // Spin, accepting connections and dispatching them.  Use a
-  // threadpool to dispatch connections into their own thread.
-  cout << "  accepting connections..." << endl << endl;
-  ThreadPool tp(kNumThreads);
-  while (1) {
+  // If a server is already running with our handoff path, take its
+  // listening sockets (and with them, however many listeners it had).
+  vector<int> inherited;
+  if (!options_.handoff_path.empty() &&
+      TakeListeners(options_.handoff_path, &inherited)) {
+    cout << "  took over " << inherited.size() << " listening socket(s) "
+         << "from the running server" << endl;
+    num_listeners = inherited.size();
+  }
+
+  // Create the server listening sockets.  With more than one, they all
+  // share the port through SO_REUSEPORT and the kernel load-balances
+  // new connections across their accept queues.
+  if (inherited.empty()) {
+    cout << "  creating and binding the listening socket..." << endl;
+  }
+  vector<int> listen_fds;
+  for (uint32_t i = 0; i < num_listeners; i++) {
+    int listen_fd = inherited.empty() ? -1 : inherited[i];
+    sockets_.emplace_back(new ServerSocket(port_, num_listeners > 1));
+    bool ok = inherited.empty() ?
+              sockets_.back()->bind_and_listen(&listen_fd) :
+              sockets_.back()->adopt(listen_fd);
+    if (!ok) {
+      cerr << endl << "Couldn't bind to the listening socket." << endl;
+      for (uint32_t j = i + 1; j < inherited.size(); j++) {
+        close(inherited[j]);
+      }
+      return false;
+    }
+    listen_fds.push_back(listen_fd);
+  }
+
+  // Be ready to hand the sockets on to our own successor.
+  unique_ptr<HandoffListener> handoff;
+  if (!options_.handoff_path.empty()) {
+    handoff.reset(new HandoffListener(options_.handoff_path, listen_fds,
+                                      [this]() { drain(); }));
+    if (!handoff->start()) {
+      return false;
+    }
+  }
+
+  // Each listener gets its own acceptor and its own workers, so the
+  // groups share no locks or queues with each other.
+  uint32_t workers_per_group = std::max(1u, num_workers / num_listeners);
+  const char *mode_name = "threads";
+  if (options_.io_mode == IoMode::kEpoll) {
+    mode_name = "epoll";
+  } else if (options_.io_mode == IoMode::kUring) {
+    mode_name = "io_uring";
+  }
+  cout << "  accepting connections (" << mode_name << ", "
+       << workers_per_group << " workers per listener)";
+  if (num_listeners > 1) {
+    cout << " on " << num_listeners << " listeners";
+  }
+  cout << "..." << endl << endl;
+
+  vector<std::thread> groups;
+  vector<char> group_ok(num_listeners, 0);
+  for (uint32_t i = 0; i < num_listeners; i++) {
+    auto run_group = [&, i]() {
+      bool ok;
+      if (options_.io_mode == IoMode::kEpoll) {
+        ok = run_epoll(listen_fds[i], workers_per_group);
+      } else if (options_.io_mode == IoMode::kUring) {
+        ok = run_uring(listen_fds[i], workers_per_group);
+      } else {
+        ok = run_threads(sockets_[i].get(), workers_per_group);
+      }
+      group_ok[i] = ok;
+    };
+    if (i + 1 < num_listeners) {
+      groups.emplace_back(run_group);
+    } else {
+      // The last group runs on the calling thread.
+      run_group();
+    }
+  }
+  for (std::thread &t : groups) {
+    t.join();
+  }
+  if (file_cache_) {
+    cout << "  static file cache: " << file_cache_->hits() << " hits, "
+         << file_cache_->misses() << " misses" << endl;
+  }
+  if (open_files_) {
+    cout << "  open file cache: " << open_files_->hits() << " hits, "
+         << open_files_->misses() << " misses" << endl;
+  }
+  return std::all_of(group_ok.begin(), group_ok.end(),
+                     [](char ok) { return ok != 0; });
+}
+
+bool HttpServer::run_threads(ServerSocket *socket, uint32_t num_threads) {
+  // Connections wait in the poller until the client sends something,
+  // and only then take up one of the (few) worker threads.
+  ConnectionPoller poller(options_.timeouts, &stats_);
+  ThreadPool tp(num_threads);
+  if (!poller.start(&tp)) {
+    return false;
+  }
+
+  // Spin, accepting connections and parking them until they have a
+  // request for us, until we are drained.
+  while (!draining_) {
     HttpServerTask *hst = new HttpServerTask(HttpServer_ThrFn);
     hst->base_dir = static_file_dir_path_;
     hst->index = index_;
-    if (!socket_.accept_client(&hst->client_fd,
-                    &hst->c_addr,
-                    &hst->c_port,
-                    &hst->c_dns,
-                    &hst->s_addr,
-                    &hst->s_dns)) {
-      // The accept failed for some reason, so quit out of the server.
-      // (Will happen when kill command is used to shut down the server.)
+    hst->pool = &tp;
+    hst->file_cache = file_cache_.get();
+    hst->open_files = open_files_.get();
+    hst->compressed_files = compressed_files_.get();
+    hst->resolver = resolver_.get();
+    hst->watchdog = watchdog_.get();
+    hst->poller = &poller;
+    hst->stats = &stats_;
+    if (!socket->accept_client(&hst->client_fd,
+                    &hst->client_addr,
+                    &hst->client_addr_len,
+                    drain_fd_)) {
+      // The accept failed for some reason, or we were told to drain,
+      // so quit out of the server.
+      delete hst;
       break;
     }
-    // The accept succeeded; dispatch it.
-    tp.dispatch(hst);
+    // The accept succeeded; wait for the first request.
+    stats_.record_open();
+    poller.park(hst, hst->client_fd, TimeoutKind::kIdle, TimerWheel::NowMs(),
+                false);
+  }
+
+  // Drain: idle connections are closed now, and the rest as soon as
+  // they have answered what they have been sent.  The count of open
+  // connections is server-wide, but every group is draining at once.
+  poller.drain();
+  uint64_t deadline = TimerWheel::NowMs() + options_.timeouts.drain_ms;
+  while ((stats_.open() > 0) && (TimerWheel::NowMs() < deadline)) {
+    usleep(kDrainPollMs * 1000);
+  }
+
+  // Then cut off whatever is left: responses still being written fail
+  // at once, and parked connections are closed by stop().
+  if (watchdog_) {
+    watchdog_->expire_all();
   }
+
+  // Stop dispatching before the pool goes away; the tasks it still has
+  // then close their connections instead of parking them.
+  poller.stop();
   return true;
 }
 
+bool HttpServer::run_epoll(int listen_fd, uint32_t num_workers) {
+  // The event loop owns every connection and only hands query
+  // processing to its worker threads, so it runs until drained.
+  EventLoop loop(listen_fd, drain_fd_, static_file_dir_path_, index_,
+                 file_cache_.get(), open_files_.get(),
+                 compressed_files_.get(), num_workers, options_.timeouts,
+                 &stats_);
+  return loop.run();
+}
+
+bool HttpServer::run_uring(int listen_fd, uint32_t num_workers) {
+  UringLoop loop(listen_fd, drain_fd_, static_file_dir_path_, index_,
+                 file_cache_.get(), open_files_.get(),
+                 compressed_files_.get(), num_workers, options_.timeouts,
+                 &stats_);
+  return loop.run();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// HttpServerTask
+///////////////////////////////////////////////////////////////////////////////
+HttpServerTask::~HttpServerTask() {
+  // Once there is an HttpConnection, it owns the descriptor.
+  if (!connection && (client_fd != -1)) {
+    close(client_fd);
+  }
+}
+
+uint16_t HttpServerTask::c_port() {
+  c_addr();
+  return c_port_;
+}
+
+const string &HttpServerTask::c_addr() {
+  if (!have_c_addr_) {
+    format_address(reinterpret_cast<struct sockaddr *>(&client_addr),
+                   &c_addr_, &c_port_);
+    have_c_addr_ = true;
+  }
+  return c_addr_;
+}
+
+const string &HttpServerTask::c_dns() {
+  if (!have_c_dns_) {
+    if ((resolver == nullptr) ||
+        !resolver->lookup(reinterpret_cast<struct sockaddr *>(&client_addr),
+                          client_addr_len, &c_dns_)) {
+      c_dns_ = c_addr();
+    }
+    have_c_dns_ = true;
+  }
+  return c_dns_;
+}
+
+const string &HttpServerTask::s_addr() {
+  if (!have_s_addr_) {
+    uint16_t port;
+    s_sockaddr_len_ = sizeof(s_sockaddr_);
+    memset(&s_sockaddr_, 0, sizeof(s_sockaddr_));
+    getsockname(client_fd, reinterpret_cast<struct sockaddr *>(&s_sockaddr_),
+                &s_sockaddr_len_);
+    format_address(reinterpret_cast<struct sockaddr *>(&s_sockaddr_),
+                   &s_addr_, &port);
+    have_s_addr_ = true;
+  }
+  return s_addr_;
+}
+
+const string &HttpServerTask::s_dns() {
+  if (!have_s_dns_) {
+    s_addr();
+    if ((resolver == nullptr) ||
+        !resolver->lookup(reinterpret_cast<struct sockaddr *>(&s_sockaddr_),
+                          s_sockaddr_len_, &s_dns_)) {
+      s_dns_ = s_addr_;
+    }
+    have_s_dns_ = true;
+  }
+  return s_dns_;
+}
+
 static void HttpServer_ThrFn(ThreadPool::Task *t) {
   // Cast back our HttpServerTask structure with all of our new
   // client's information in it.
   unique_ptr<HttpServerTask> hst(static_cast<HttpServerTask *>(t));
-  cout << "  client " << hst->c_dns << ":" << hst->c_port << " "
-       << "(IP address " << hst->c_addr << ")" << " connected." << endl;
+  if (!hst->connection) {
+    hst->connection.reset(new HttpConnection(hst->client_fd));
+  }
 
   // Read in the next request, process it, write the response.
 
@@ -134,40 +805,605 @@ static void HttpServer_ThrFn(ThreadPool::Task *t) {
   // creating/destroying the same connection repeatedly.
 
   // TODO: Implement
-  bool done = false;
-  HttpConnection connect(hst -> client_fd);
-  while (!done) {    
+  HttpConnection &connect = *hst->connection;
+
+  // The poller only hands us the connection once it is readable, so
+  // this doesn't block.
+  bool done = !connect.read_some();
+  {
+    // Disarmed when it goes out of scope, before the connection is
+    // parked or closed.  While it is armed, a client that doesn't read
+    // its response gets its socket shut down, and the write fails.
+    std::optional<Watchdog::Deadline> deadline;
+    if (hst->watchdog != nullptr) {
+      deadline.emplace(hst->watchdog, hst->client_fd);
+    }
+
+    // Answer every request that has arrived in full, in order, and
+    // send all of the responses back together.
+    vector<HttpResponse> responses;
     HttpRequest req;
-    bool has_request = connect.next_request(&req); 
-    if (!has_request) {
-      return;
+    while (!done && connect.has_buffered_request()) {
+      hst->header_started_ms = 0;
+      hst->served = true;
+      if (!connect.next_buffered_request(&req)) {
+        // Answer what came before it, then say why we hang up.
+        responses.push_back(BadRequestResponse());
+        done = true;
+        break;
+      }
+      if (req.WantsClose()) {
+        done = true;
+        break;
+      }
+      responses.push_back(ProcessRequest(req, hst -> base_dir, hst -> index,
+                                         hst -> pool, hst -> file_cache,
+                                         hst -> open_files,
+                                         hst -> compressed_files));
     }
-    if(req.GetHeaderValue("connection") == "close") {
+    if (!responses.empty()) {
+      std::function<void()> progress;
+      if (deadline) {
+        // Every write that gets somewhere restarts the clock, so a
+        // slow client can take as long as it needs, as long as it
+        // keeps reading.
+        deadline->arm(TimeoutKind::kBody);
+        Watchdog::Deadline *d = &*deadline;
+        progress = [d]() { d->touch(); };
+      }
+      if (!connect.write_responses(responses.data(), responses.size(),
+                                   progress)) {
+        done = true;
+      }
+      if (deadline) {
+        deadline->cancel();
+      }
+    }
+
+    // As in the event loops, a client may not have more buffered than
+    // a request header; parked, it would otherwise grow without bound.
+    // Unlike them, we have time to say why we are hanging up.
+    if (!done && connect.buffer_overflowed()) {
+      HttpResponse too_large;
+      too_large.set_protocol("HTTP/1.1");
+      too_large.set_response_code(431);
+      too_large.set_message("Request Header Fields Too Large");
+      too_large.set_content_type("text/html");
+      too_large.AppendToBody("<html><body>Request header too large"
+                             "</body></html>\n");
+      if (deadline) {
+        deadline->arm(TimeoutKind::kBody);
+      }
+      connect.write_response(too_large);
       done = true;
-    } else {
-      HttpResponse response = ProcessRequest(req, hst -> base_dir, hst -> index);
-      connect.write_response(response);
-    }    
+    }
+  }
+  if (done) {
+    if (hst->stats != nullptr) {
+      hst->stats->record_close();
+    }
+    return;
+  }
+
+  // Wait, off the pool, for the client to send (the rest of) its next
+  // request.
+  uint64_t now = TimerWheel::NowMs();
+  TimeoutKind kind = TimeoutKind::kIdle;
+  uint64_t since = now;
+  if (connect.buffered_bytes() > 0) {
+    if (hst->header_started_ms == 0) {
+      hst->header_started_ms = now;
+    }
+    kind = TimeoutKind::kHeader;
+    since = hst->header_started_ms;
+  }
+  int fd = hst->client_fd;
+  bool served = hst->served;
+  hst->poller->park(hst.release(), fd, kind, since, served);
+}
+
+bool AnswerFromFileCache(const HttpRequest &req,
+                         const string &base_dir,
+                         StaticFileCache *file_cache,
+                         HttpResponse *response) {
+  if ((file_cache == nullptr) || IsQueryRequest(req) ||
+      !boost::iequals(req.method(), "get") || !FileCacheable(req)) {
+    return false;
+  }
+  HttpResponse ret;
+  string file_name, real_name;
+  if (!PrepareFileResponse(string(req.uri()), base_dir, &file_name, &ret,
+                           &real_name)) {
+    return false;
+  }
+  std::shared_ptr<const StaticFileCache::Entry> entry =
+      file_cache->get(FileCacheKey(req, real_name, ret.content_type()),
+                      false);
+  if (!entry) {
+    return false;
   }
+  response->SetPrebuilt(std::shared_ptr<const string>(entry, &entry->header),
+                        entry->body);
+  return true;
+}
+
+bool IsQueryRequest(const HttpRequest &req) {
+  return req.uri().substr(0, 8) != "/static/";
 }
 
-static HttpResponse ProcessRequest(const HttpRequest &req,
+HttpResponse BadRequestResponse() {
+  HttpResponse ret;
+  ret.set_protocol("HTTP/1.1");
+  ret.set_response_code(400);
+  ret.set_message("Bad Request");
+  ret.set_content_type("text/html");
+  ret.AppendToBody("<html><body>Bad request</body></html>\n");
+  return ret;
+}
+
+HttpResponse ProcessRequest(const HttpRequest &req,
                             const string &base_dir,
-                            WordIndex *index) {
+                            WordIndex *index,
+                            ThreadPool *pool,
+                            StaticFileCache *file_cache,
+                            OpenFileCache *open_files,
+                            CompressedFileCache *compressed_files) {
+  // Is the user sending a batch of queries?  That is the only thing
+  // that can be POSTed.
+  string uri(req.uri());
+  bool post = boost::iequals(req.method(), "post");
+  if (uri == kBatchUri) {
+    if (!post) {
+      return MethodNotAllowedResponse(uri, "POST");
+    }
+    HttpResponse ret = ProcessBatchRequest(req.body(), index, pool);
+    CompressResponse(req, &ret);
+    return ret;
+  }
+  if (post) {
+    return MethodNotAllowedResponse(uri, "GET");
+  }
+
   // Is the user asking for a static file?
-  if (req.uri().substr(0, 8) == "/static/") {
-    return ProcessFileRequest(req.uri(), base_dir);
+  if (!IsQueryRequest(req)) {
+    return ProcessFileRequest(req, uri, base_dir, file_cache, open_files,
+                              compressed_files);
   }
 
   // The user must be asking for a query.
-  return ProcessQueryRequest(req.uri(), index);
+  HttpResponse ret = ProcessQueryRequest(uri, index,
+                                         req.protocol() == "HTTP/1.1");
+  CompressResponse(req, &ret);
+  return ret;
 }
 
-static HttpResponse ProcessFileRequest(const string &uri,
-                                const string &base_dir) {
+static HttpResponse ProcessFileRequest(const HttpRequest &req,
+                                       const string &uri,
+                                       const string &base_dir,
+                                       StaticFileCache *file_cache,
+                                       OpenFileCache *open_files,
+                                       CompressedFileCache *compressed_files) {
   // The response we'll build up.
   HttpResponse ret;
   string file_name = "";
+  string real_name;
+  if (!PrepareFileResponse(uri, base_dir, &file_name, &ret, &real_name)) {
+    return ret;
+  }
+
+  //  - a plain request for the whole file is answered from memory if
+  //    the same answer was made recently and the file hasn't changed
+  //
+  string cache_key;
+  if ((file_cache != nullptr) && FileCacheable(req)) {
+    cache_key = FileCacheKey(req, real_name, ret.content_type());
+    std::shared_ptr<const StaticFileCache::Entry> entry =
+        file_cache->get(cache_key);
+    if (entry) {
+      HttpResponse hit;
+      hit.SetPrebuilt(std::shared_ptr<const string>(entry, &entry->header),
+                      entry->body);
+      return hit;
+    }
+  }
+
+  //  - open the file; its contents are not read here, but sent
+  //    straight from the file by whoever writes the response
+  //
+  struct stat st;
+  std::shared_ptr<const BodyFile> file =
+      OpenStaticFile(open_files, base_dir, real_name, &st);
+  if (!file || !S_ISREG(st.st_mode)) {
+    return FileNotFoundResponse(file_name);
+  }
+  std::shared_ptr<const BodyFile> original_file = file;
+  struct stat original_st = st;
+
+  //  - text goes compressed to clients that take it: from a
+  //    precompressed sibling of the file if there is one, or else
+  //    compressed in the background, once, and sent as it is until
+  //    that is done
+  //
+  ContentEncoding encoding = ContentEncoding::kIdentity;
+  std::shared_ptr<const string> cached;
+  bool compressing = false;
+  vector<StaticFileCache::Source> passed_over;
+  if (ret.content_type().compare(0, 5, "text/") == 0) {
+    ret.AddHeader("Vary", "Accept-Encoding");
+    encoding = ChooseFileEncoding(
+        req.GetHeaderValue(HttpRequest::KnownHeader::kAcceptEncoding),
+        base_dir, real_name, open_files, compressed_files, &file, &st,
+        &cached, &compressing, &passed_over);
+  }
+
+  //  - tag the response so that clients can revalidate their copy,
+  //    and if the copy they have is current, tell them so instead
+  //    of sending it again; a copy compressed here is tagged as a
+  //    variant of the file
+  //
+  string etag = make_etag(st);
+  if (cached) {
+    etag.insert(etag.size() - 1, string("-") + encoding_name(encoding));
+  }
+  ret.AddHeader("ETag", etag);
+  ret.AddHeader("Last-Modified", format_http_date(st.st_mtime));
+  if (encoding != ContentEncoding::kIdentity) {
+    ret.AddHeader("Content-Encoding", encoding_name(encoding));
+  }
+  if (!cached) {
+    ret.AddHeader("Accept-Ranges", "bytes");
+  }
+  if (NotModified(req, st, etag)) {
+    ret.set_response_code(304);
+    ret.set_message("Not Modified");
+    ret.set_content_type("");
+    return ret;
+  }
+  if (!cache_key.empty() && !compressing) {
+    vector<StaticFileCache::Source> sources;
+    AddSource(real_name, *original_file, original_st, &sources);
+    if ((encoding != ContentEncoding::kIdentity) && !cached) {
+      AddSource(
+          real_name + (encoding == ContentEncoding::kBrotli ? ".br" : ".gz"),
+          *file, st, &sources);
+    }
+    sources.insert(sources.end(), passed_over.begin(), passed_over.end());
+    CacheFileResponse(file_cache, cache_key, ret, *file, st.st_size, cached,
+                      std::move(sources));
+  }
+  if (cached) {
+    ret.AppendSharedToBody(cached);
+    return ret;
+  }
+
+  //  - if the client asked for only part of the file, send just that
+  //
+  std::string_view range =
+      req.GetHeaderValue(HttpRequest::KnownHeader::kRange);
+  vector<ByteRange> ranges;
+  if (!range.empty() && IfRangeHolds(req, st, etag) &&
+      parse_byte_ranges(range, st.st_size, &ranges) &&
+      SetRangeResponse(file, st.st_size, ranges, &ret)) {
+    return ret;
+  }
+
+  //  - make the whole file the body of ret
+  //
+  ret.SetBodyFile(file, 0, st.st_size);
+  return ret;
+}
+
+static std::shared_ptr<const BodyFile> OpenStaticFile(
+    OpenFileCache *open_files, const string &base_dir, const string &path,
+    struct stat *st) {
+  if (open_files != nullptr) {
+    return open_files->open(path, st);
+  }
+  int fd = open_beneath(base_dir, path);
+  if (fd == -1) {
+    return nullptr;
+  }
+  std::shared_ptr<const BodyFile> file(new BodyFile(fd));
+  if (fstat(fd, st) == -1) {
+    return nullptr;
+  }
+  return file;
+}
+
+static size_t OpenFilesAllowed(size_t wanted) {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+    cerr << "getrlimit() failed: " << strerror(errno) << endl;
+    return wanted;
+  }
+  if (limit.rlim_cur < limit.rlim_max) {
+    struct rlimit raised = limit;
+    raised.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &raised) == 0) {
+      limit = raised;
+    }
+  }
+  if (limit.rlim_cur == RLIM_INFINITY) {
+    return wanted;
+  }
+  return std::min(wanted,
+                  static_cast<size_t>(limit.rlim_cur / kOpenFilesLimitShare));
+}
+
+static bool FileCacheable(const HttpRequest &req) {
+  return req.GetHeaderValue(HttpRequest::KnownHeader::kRange).empty() &&
+         req.GetHeaderValue(HttpRequest::KnownHeader::kIfNoneMatch).empty() &&
+         req.GetHeaderValue(HttpRequest::KnownHeader::kIfModifiedSince).empty();
+}
+
+static string FileCacheKey(const HttpRequest &req,
+                           const string &real_name,
+                           const string &content_type) {
+  // Only text is ever compressed, so for anything else the client's
+  // Accept-Encoding makes no difference.
+  string key = "-";
+  if (content_type.compare(0, 5, "text/") == 0) {
+    std::string_view accept_encoding =
+        req.GetHeaderValue(HttpRequest::KnownHeader::kAcceptEncoding);
+    key = accepts_encoding(accept_encoding, "br") ? "b" : "-";
+    key += accepts_encoding(accept_encoding, "gzip") ? "g" : "-";
+  }
+  key += real_name;
+  return key;
+}
+
+static void AddSource(const string &path, const BodyFile &file,
+                      const struct stat &st,
+                      vector<StaticFileCache::Source> *sources) {
+  sources->push_back(StaticFileCache::SourceOf(path, st));
+  string real_path;
+  if (real_path_of(file.fd(), &real_path) && (real_path != path)) {
+    sources->push_back(StaticFileCache::SourceOf(real_path, st));
+  }
+}
+
+static void CacheFileResponse(StaticFileCache *file_cache,
+                              const string &key,
+                              const HttpResponse &response,
+                              const BodyFile &file,
+                              size_t size,
+                              const std::shared_ptr<const string> &cached,
+                              vector<StaticFileCache::Source> &&sources) {
+  size_t length = cached ? cached->size() : size;
+  if (length > file_cache->max_entry_bytes()) {
+    return;
+  }
+  std::shared_ptr<StaticFileCache::Entry> entry =
+      std::make_shared<StaticFileCache::Entry>();
+  response.AppendHeaderTo(&entry->header, length);
+  if (cached) {
+    entry->body = cached;
+  } else {
+    // The file is read only now, after it was stat()ed, so if it
+    // changes in between the entry is simply found stale later.
+    string body;
+    body.resize(length);
+    size_t done = 0;
+    while (done < length) {
+      ssize_t res = pread(file.fd(), &body[done], length - done, done);
+      if (res <= 0) {
+        return;
+      }
+      done += res;
+    }
+    entry->body = std::make_shared<const string>(std::move(body));
+  }
+  entry->sources = std::move(sources);
+  file_cache->put(key, std::move(entry));
+}
+
+static bool NotModified(const HttpRequest &req,
+                        const struct stat &st,
+                        const string &etag) {
+  // If-None-Match wins when both are sent (RFC 7232 section 6).
+  std::string_view if_none_match =
+      req.GetHeaderValue(HttpRequest::KnownHeader::kIfNoneMatch);
+  if (!if_none_match.empty()) {
+    return etag_matches(if_none_match, etag);
+  }
+  std::string_view if_modified_since =
+      req.GetHeaderValue(HttpRequest::KnownHeader::kIfModifiedSince);
+  time_t since;
+  return !if_modified_since.empty() &&
+         parse_http_date(if_modified_since, &since) &&
+         (st.st_mtime <= since);
+}
+
+static ContentEncoding ChooseFileEncoding(
+    std::string_view accept_encoding,
+    const string &base_dir,
+    const string &file_name,
+    OpenFileCache *open_files,
+    CompressedFileCache *compressed_files,
+    std::shared_ptr<const BodyFile> *file,
+    struct stat *st,
+    std::shared_ptr<const string> *cached,
+    bool *compressing,
+    vector<StaticFileCache::Source> *passed_over) {
+  *compressing = false;
+
+  // Brotli compresses text better, so it is preferred.
+  static const ContentEncoding kEncodings[] = {
+    ContentEncoding::kBrotli,
+    ContentEncoding::kGzip,
+  };
+  static const char *const kSuffixes[] = { ".br", ".gz" };
+
+  for (int i = 0; i < 2; i++) {
+    if (!accepts_encoding(accept_encoding, encoding_name(kEncodings[i]))) {
+      continue;
+    }
+    struct stat sibling_st;
+    std::shared_ptr<const BodyFile> sibling =
+        OpenStaticFile(open_files, base_dir, file_name + kSuffixes[i],
+                       &sibling_st);
+    if (sibling && S_ISREG(sibling_st.st_mode) &&
+        (sibling_st.st_mtime >= st->st_mtime)) {
+      *file = std::move(sibling);
+      *st = sibling_st;
+      return kEncodings[i];
+    }
+    passed_over->push_back(
+        sibling ? StaticFileCache::SourceOf(file_name + kSuffixes[i],
+                                            sibling_st)
+                : StaticFileCache::AbsenceOf(file_name + kSuffixes[i]));
+  }
+
+  if ((compressed_files == nullptr) ||
+      (static_cast<size_t>(st->st_size) < kMinCompressBytes)) {
+    return ContentEncoding::kIdentity;
+  }
+  for (int i = 0; i < 2; i++) {
+    if (!accepts_encoding(accept_encoding, encoding_name(kEncodings[i]))) {
+      continue;
+    }
+    *cached = compressed_files->get(file_name, *file, *st, kEncodings[i],
+                                    compressing);
+    if (*cached) {
+      return kEncodings[i];
+    }
+    if (*compressing) {
+      // Sent as it is until the copy is ready.
+      break;
+    }
+  }
+  return ContentEncoding::kIdentity;
+}
+
+static void CompressResponse(const HttpRequest &req, HttpResponse *response) {
+  HttpResponse &ret = *response;
+  ret.AddHeader("Vary", "Accept-Encoding");
+  if (!accepts_encoding(
+          req.GetHeaderValue(HttpRequest::KnownHeader::kAcceptEncoding),
+          "gzip")) {
+    return;
+  }
+
+  // A streamed body is compressed as it goes.
+  if (ret.body_stream()) {
+    ret.SetBodyStream(std::make_shared<GzipBodyStream>(ret.body_stream()));
+    ret.AddHeader("Content-Encoding", "gzip");
+    return;
+  }
+
+  if (ret.body_length() < kMinCompressBytes) {
+    return;
+  }
+  static thread_local vector<struct iovec> iov;
+  iov.clear();
+  ret.AppendBodyIovecs(&iov);
+  string compressed;
+  if (!gzip_compress(iov.data(), iov.size(), &compressed) ||
+      (compressed.size() >= ret.body_length())) {
+    return;
+  }
+  ret.ClearBody();
+  ret.MoveToBody(std::move(compressed));
+  ret.AddHeader("Content-Encoding", "gzip");
+}
+
+static bool IfRangeHolds(const HttpRequest &req,
+                         const struct stat &st,
+                         const string &etag) {
+  std::string_view if_range = req.GetHeaderValue("if-range");
+  if (if_range.empty()) {
+    return true;
+  }
+  // An entity tag must match strongly, so a weak one never does.
+  if ((if_range[0] == '"') || (if_range.substr(0, 2) == "W/")) {
+    return if_range == etag;
+  }
+  time_t date;
+  return parse_http_date(if_range, &date) && (date == st.st_mtime);
+}
+
+// Returns the Content-Range header value for "range" of a file of
+// "size" bytes: "bytes first-last/size".
+static string ContentRange(const ByteRange &range, uint64_t size) {
+  return "bytes " + std::to_string(range.offset) + "-" +
+         std::to_string(range.offset + range.length - 1) + "/" +
+         std::to_string(size);
+}
+
+static bool SetRangeResponse(const std::shared_ptr<const BodyFile> &file,
+                             uint64_t size,
+                             const vector<ByteRange> &ranges,
+                             HttpResponse *response) {
+  HttpResponse &ret = *response;
+  if (ranges.empty()) {
+    ret.set_response_code(416);
+    ret.set_message("Range Not Satisfiable");
+    ret.set_content_type("");
+    ret.AddHeader("Content-Range", "bytes */" + std::to_string(size));
+    return true;
+  }
+
+  if (ranges.size() == 1) {
+    // Sent straight from the file, starting at the range.
+    ret.set_response_code(206);
+    ret.set_message("Partial Content");
+    ret.AddHeader("Content-Range", ContentRange(ranges[0], size));
+    ret.SetBodyFile(file, ranges[0].offset, ranges[0].length);
+    return true;
+  }
+
+  uint64_t total = 0;
+  for (const ByteRange &range : ranges) {
+    total += range.length;
+  }
+  if ((ranges.size() > kMaxByteRanges) || (total > size) ||
+      (total > kMaxMultipartBytes)) {
+    return false;
+  }
+
+  // Several ranges go out as a multipart/byteranges body.  Each part
+  // is read from the file on its own, so only the requested bytes are.
+  vector<string> parts(ranges.size());
+  for (size_t i = 0; i < ranges.size(); i++) {
+    parts[i].resize(ranges[i].length);
+    size_t done = 0;
+    while (done < ranges[i].length) {
+      ssize_t res = pread(file->fd(), &parts[i][done],
+                          ranges[i].length - done, ranges[i].offset + done);
+      if (res <= 0) {
+        // The file shrank or failed; send it whole, or fail to.
+        return false;
+      }
+      done += res;
+    }
+  }
+
+  static std::atomic<uint64_t> next_boundary(0);
+  string boundary = "searchserver-byteranges-" +
+                    std::to_string(next_boundary++);
+  string part_type = ret.content_type();
+  ret.set_response_code(206);
+  ret.set_message("Partial Content");
+  ret.set_content_type("multipart/byteranges; boundary=" + boundary);
+  for (size_t i = 0; i < ranges.size(); i++) {
+    ret.AppendToBody("\r\n--" + boundary + "\r\n");
+    if (!part_type.empty()) {
+      ret.AppendToBody("Content-type: " + part_type + "\r\n");
+    }
+    ret.AppendToBody("Content-range: " + ContentRange(ranges[i], size) +
+                     "\r\n\r\n");
+    ret.AppendToBody(parts[i]);
+  }
+  ret.AppendToBody("\r\n--" + boundary + "--\r\n");
+  return true;
+}
+
+bool PrepareFileResponse(const string &uri,
+                         const string &base_dir,
+                         string *file_name,
+                         HttpResponse *response,
+                         string *real_name) {
+  HttpResponse &ret = *response;
 
   // Steps to follow:
   //  - use the URLParser class to figure out what filename
@@ -178,40 +1414,23 @@ static HttpResponse ProcessFileRequest(const string &uri,
   url_parser.parse(uri);  // parse the uri
 
   // get the filename
-  file_name = (url_parser.path()).substr(8);
-  bool is_safe = is_path_safe(base_dir, file_name);
+  *file_name = (url_parser.path()).substr(8);
+  string real_path;
+  bool is_safe = is_path_safe(base_dir, *file_name, &real_path);
+  if (is_safe && (real_name != nullptr)) {
+    *real_name = std::move(real_path);
+  }
   if(!is_safe){
-    // If you couldn't find the file, return an HTTP 404 error.
+    // The file is outside of base_dir, return an HTTP 403 error.
     ret.set_protocol("HTTP/1.1");
     ret.set_response_code(403);
     ret.set_message("Forbidden");
     ret.AppendToBody("<html><body> Forbidden \""
-                    + escape_html(file_name)
+                    + escape_html(*file_name)
                     + "\"</body></html>\n");
-    return ret;
-  }
-
-  //  - use the FileReader class to read the file into memory
-  //
-  FileReader reader(file_name);
-  // read in file
-  string file_content;
-  bool if_read = reader.read_file(&file_content);
-  if(!if_read) {
-    // If you couldn't find the file, return an HTTP 404 error.
-    ret.set_protocol("HTTP/1.1");
-    ret.set_response_code(404);
-    ret.set_message("Not Found");
-    ret.AppendToBody("<html><body>Couldn't find file \""
-                    + escape_html(file_name)
-                    + "\"</body></html>\n");
-    return ret;
+    return false;
   }
 
-  //  - copy the file content into the ret.body
-  //
-  ret.AppendToBody(file_content);
-
   //  - depending on the file name suffix, set the response
   //    Content-type header as appropriate, e.g.,:
   //      --> for ".html" or ".htm", set to "text/html"
@@ -225,7 +1444,7 @@ static HttpResponse ProcessFileRequest(const string &uri,
   //
   // get file name suffix
   vector<string> name_elements;
-  boost::split(name_elements, file_name, boost::is_any_of("."), boost::token_compress_on);
+  boost::split(name_elements, *file_name, boost::is_any_of("."), boost::token_compress_on);
   string suffix = name_elements[name_elements.size() - 1];
   if(suffix == "html"){
     ret.set_content_type("text/html");
@@ -256,12 +1475,24 @@ static HttpResponse ProcessFileRequest(const string &uri,
   ret.set_protocol("HTTP/1.1");
   ret.set_response_code(200);
   ret.set_message("Happy :)");
-  
+  return true;
+}
+
+HttpResponse FileNotFoundResponse(const string &file_name) {
+  // If you couldn't find the file, return an HTTP 404 error.
+  HttpResponse ret;
+  ret.set_protocol("HTTP/1.1");
+  ret.set_response_code(404);
+  ret.set_message("Not Found");
+  ret.AppendToBody("<html><body>Couldn't find file \""
+                  + escape_html(file_name)
+                  + "\"</body></html>\n");
   return ret;
 }
 
 static HttpResponse ProcessQueryRequest(const string &uri,
-                                 WordIndex *index) {
+                                 WordIndex *index,
+                                 bool can_stream) {
   // The response we're building up.
   HttpResponse ret;
 
@@ -299,7 +1530,7 @@ static HttpResponse ProcessQueryRequest(const string &uri,
   ret.set_protocol("HTTP/1.1");
   ret.set_response_code(200);
   ret.set_message("OK");
-  ret.AppendToBody(kFivegleStr);
+  ret.AppendStaticToBody(kFivegleStr);
 
   // if search is pressed with nothing inside to query, do not change interface
   if (args_.size() == 0){
@@ -309,36 +1540,97 @@ static HttpResponse ProcessQueryRequest(const string &uri,
   if (result.size() == 0) {
     ret.AppendToBody("<p>\n <br>");
     ret.AppendToBody(" No results found for <b>");
-    string tmp;
     for (auto& q : queries) {
-      tmp += (q + " ");
+      ret.AppendToBody(q);
+      ret.AppendToBody(" ");
     }
-    ret.AppendToBody(tmp);
     ret.AppendToBody("</b>\n </p>\n <p></p>\n<p></p>\n</body>");
 
+  } else if (can_stream && (result.size() > kMaxUnstreamedResults)) {
+    ret.SetBodyStream(std::make_shared<QueryResultStream>(std::move(queries),
+                                                          std::move(result)));
+
   } else {
-    ret.AppendToBody("<p>\n <br>\n");
-    ret.AppendToBody(std::to_string(result.size()));
-    ret.AppendToBody(" result for <b>");
-    string tmp;
+    // Size the body up front, so that it is built without reallocating.
+    size_t body_len = 128;
     for (auto& q : queries) {
-      tmp += (q + " ");
-    }
-    ret.AppendToBody(tmp);
-    ret.AppendToBody("</b>\n </p>\n <p></p>\n<ul>\n");
-    for (auto& r :result) {
-      ret.AppendToBody("<li> <a href =\"/static/./");
-      ret.AppendToBody(r.doc_name);
-      ret.AppendToBody("\">");
-      ret.AppendToBody(r.doc_name);
-      ret.AppendToBody("</a> [");
-      ret.AppendToBody(std::to_string(r.rank));
-      ret.AppendToBody("]\n<br>\n</li>\n");
-    }
-    ret.AppendToBody("</ul>\n</body>\n</html>");
-    
+      body_len += q.size() + 1;
+    }
+    for (auto& r : result) {
+      body_len += 2 * r.doc_name.size() + 64;
+    }
+    string body;
+    body.reserve(body_len);
+    AppendResultsHeader(&body, queries, result.size());
+    for (auto& r : result) {
+      AppendResult(&body, r);
+    }
+    body.append(kResultsEndStr);
+    ret.MoveToBody(std::move(body));
+  }
+  return ret;
+}
+
+static HttpResponse ProcessBatchRequest(std::string_view body,
+                                        WordIndex *index,
+                                        ThreadPool *pool) {
+  HttpResponse ret;
+  ret.set_protocol("HTTP/1.1");
+
+  // One query per line; a last line without a newline counts too.
+  vector<std::string_view> queries;
+  size_t pos = 0;
+  while (pos < body.size()) {
+    size_t end = body.find('\n', pos);
+    if (end == std::string_view::npos) {
+      end = body.size();
+    }
+    std::string_view query = body.substr(pos, end - pos);
+    if (!query.empty() && (query.back() == '\r')) {
+      query.remove_suffix(1);
+    }
+    queries.push_back(query);
+    pos = end + 1;
+  }
+  if (queries.size() > kMaxBatchQueries) {
+    ret.set_response_code(413);
+    ret.set_message("Payload Too Large");
+    ret.AppendToBody("<html><body>A batch may hold at most ");
+    ret.AppendNumberToBody(kMaxBatchQueries);
+    ret.AppendToBody(" queries</body></html>\n");
+    return ret;
+  }
+
+  // Share the shards out, and take some ourselves.
+  auto batch = std::make_shared<QueryBatch>(index, std::move(queries));
+  if ((pool != nullptr) && (batch->num_shards() > 1)) {
+    size_t helpers = std::min(batch->num_shards() - 1, kMaxBatchHelpers);
+    for (size_t i = 0; i < helpers; i++) {
+      pool->dispatch(new QueryBatchTask(batch));
+    }
+  }
+  batch->Work();
+
+  ret.set_response_code(200);
+  ret.set_message("OK");
+  ret.set_content_type("text/plain");
+  for (string &answer : *batch->Wait()) {
+    ret.MoveToBody(std::move(answer));
   }
   return ret;
 }
 
+static HttpResponse MethodNotAllowedResponse(const string &uri,
+                                             const char *allow) {
+  HttpResponse ret;
+  ret.set_protocol("HTTP/1.1");
+  ret.set_response_code(405);
+  ret.set_message("Method Not Allowed");
+  ret.AddHeader("Allow", allow);
+  ret.AppendToBody("<html><body>\""
+                  + escape_html(uri)
+                  + "\" only takes " + allow + "</body></html>\n");
+  return ret;
+}
+
 }  // namespace searchserver
@@ -12,16 +12,102 @@
 #ifndef HTTPSERVER_H_
 #define HTTPSERVER_H_
 
+#include <atomic>
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <list>
+#include <vector>
 
+#include "./ConnectionPoller.h"
+#include "./DnsResolver.h"
+#include "./FileWatcher.h"
+#include "./Compression.h"
+#include "./HttpConnection.h"
 #include "./ThreadPool.h"
 #include "./ServerSocket.h"
+#include "./StaticFileCache.h"
+#include "./Timeouts.h"
 #include "./WordIndex.h"
+#include "./HttpRequest.h"
+#include "./HttpResponse.h"
+#include "./OpenFileCache.h"
 
 namespace searchserver {
 
+// Selects how the server multiplexes its client connections.
+enum class IoMode {
+  // Each request is served start to finish by a ThreadPool worker
+  // using blocking I/O.  Between requests, connections wait in a
+  // ConnectionPoller rather than holding a worker.
+  kThreads,
+
+  // A single edge-triggered epoll loop owns every connection; the
+  // ThreadPool is only used to run query processing.
+  kEpoll,
+
+  // Like kEpoll, but all socket and file I/O goes through io_uring.
+  // Falls back to kEpoll if the kernel doesn't support it.
+  kUring,
+};
+
+// Knobs that control how an HttpServer runs.
+struct HttpServerOptions {
+  IoMode io_mode = IoMode::kThreads;
+
+  // Number of worker threads, split evenly across the listeners.  In
+  // the event loop modes they only process queries.  Zero means one
+  // per core.
+  uint32_t num_workers = 0;
+
+  // Number of SO_REUSEPORT listening sockets to open, each served by
+  // its own acceptor (or event loop) and its own worker threads.  Zero
+  // means one per core.
+  uint32_t num_listeners = 1;
+
+  // Whether to look up the DNS names of clients when something (e.g.
+  // the connection log) asks for them.  Lookups are always done in the
+  // background and cached.
+  bool reverse_dns = true;
+
+  // How long a client connection may sit idle, take to send a request
+  // header, or take to receive a response before it is closed, and how
+  // long a drain may take.
+  TimeoutOptions timeouts;
+
+  // If not empty, the Unix domain socket through which listening
+  // sockets are handed from a running server to the one replacing it
+  // (see ListenerHandoff.h).
+  std::string handoff_path;
+
+  // Up to this many bytes of whole responses to static file requests
+  // are kept in memory (see StaticFileCache.h), each of at most
+  // file_cache_max_entry_bytes; bigger ones are always sent from the
+  // file.  Zero turns the cache off.
+  size_t file_cache_bytes = 64 << 20;
+  size_t file_cache_max_entry_bytes = 1 << 20;
+
+  // Up to this many static files are kept open between requests (see
+  // OpenFileCache.h), or a quarter of RLIMIT_NOFILE if that is fewer.
+  // Zero opens and closes them every time.
+  size_t open_files = 1024;
+
+  // Up to this many bytes of compressed copies of static text files
+  // that have no precompressed sibling are kept in memory (see
+  // CompressedFileCache in Compression.h), of files of at most
+  // compressed_file_max_bytes; bigger ones are sent as they are.  Zero
+  // turns the cache off, and with it compressing static files here.
+  size_t compressed_files_bytes = 64 << 20;
+  size_t compressed_file_max_bytes = 4 << 20;
+
+  // Whether to watch the static file directory for changes with
+  // inotify (see FileWatcher.h), so that cached responses and open
+  // files are dropped as soon as their files change.  Without it, the
+  // files behind a cached response are stat()ed again, and open files
+  // are opened again, every second they are used.
+  bool watch_files = true;
+};
+
 // The HttpServer class contains the main logic for the web server.
 class HttpServer {
  public:
@@ -31,29 +117,111 @@ class HttpServer {
   // the index is not taken.
   explicit HttpServer(uint16_t port,
                       const std::string &static_file_dir_path,
-                      WordIndex* index)
-    : socket_(port), static_file_dir_path_(static_file_dir_path),
-      index_(index) { }
+                      WordIndex* index,
+                      const HttpServerOptions &options = HttpServerOptions());
 
-  // The destructor closes the listening socket if it is open and
+  // The destructor closes the listening sockets if they are open and
   // also kills off any threads in the threadpool.
-  virtual ~HttpServer() { }
-
-  // Creates a listening socket for the server and launches it, accepting
-  // connections and dispatching them to worker threads.  Returns
-  // "true" if the server was able to start and run, "false" otherwise.
-  // The server continues to run until a kill command is used to send
-  // a SIGTERM signal to the server process (i.e., kill pid), so this function
-  // doesn't really return.
+  virtual ~HttpServer();
+
+  // Creates the listening socket(s) for the server, or takes them over
+  // from the server at options.handoff_path, and launches it,
+  // accepting connections and dispatching them to worker threads.
+  // Returns "true" if the server was able to start and run, "false"
+  // otherwise.  The server continues to run until it is drained (see
+  // drain()), which also happens when its listening sockets are handed
+  // to a new server.
   bool run();
 
+  // Drains the server: it stops accepting connections, closes its idle
+  // ones, and lets the others finish the requests they have sent, for
+  // up to options.timeouts.drain_ms.  Then it closes whatever is left
+  // and run() returns.  Safe to call from any thread, at any time.
+  void drain();
+
  private:
-  ServerSocket socket_;
+  // Runs one listener group in each IoMode, on the calling thread,
+  // once its listening socket is bound.
+  bool run_threads(ServerSocket *socket, uint32_t num_threads);
+  bool run_epoll(int listen_fd, uint32_t num_workers);
+  bool run_uring(int listen_fd, uint32_t num_workers);
+
+  uint16_t port_;
+  std::vector<std::unique_ptr<ServerSocket>> sockets_;
+
+  // An eventfd that becomes readable once the server is to drain;
+  // every listener group watches it.
+  int drain_fd_;
+  std::atomic<bool> draining_;
+  std::unique_ptr<DnsResolver> resolver_;
+  ConnectionStats stats_;
+
+  // Enforces the timeouts on connections served by blocking threads.
+  std::unique_ptr<Watchdog> watchdog_;
   std::string static_file_dir_path_;
   WordIndex* index_;
-  static const int kNumThreads;
+  HttpServerOptions options_;
+
+  // Shared by every listener group; nullptr if they are turned off.
+  // The watcher, if any, tells them which files changed.
+  std::unique_ptr<StaticFileCache> file_cache_;
+  std::unique_ptr<OpenFileCache> open_files_;
+  std::unique_ptr<CompressedFileCache> compressed_files_;
+  std::unique_ptr<FileWatcher> watcher_;
 };
 
+// Given a request, produce a response.  Every I/O mode funnels its
+// requests through here.  If "pool" is not nullptr, the queries of a
+// batch request are spread over its workers as well as the calling
+// thread.  If "file_cache" is not nullptr, static files are answered
+// from it when they can be, and added to it when they aren't; if
+// "open_files" is not nullptr, they are opened through it; and if
+// "compressed_files" is not nullptr, text files without a
+// precompressed sibling are sent compressed from it.
+HttpResponse ProcessRequest(const HttpRequest &req,
+                            const std::string &base_dir,
+                            WordIndex *index,
+                            ThreadPool *pool = nullptr,
+                            StaticFileCache *file_cache = nullptr,
+                            OpenFileCache *open_files = nullptr,
+                            CompressedFileCache *compressed_files = nullptr);
+
+// Handles everything about a /static/ request except reading the
+// file, for callers that send the file's contents themselves.  If the
+// file may be served, returns true, sets "*file_name" to the path of
+// the file to send, and fills in all of "*response" but the body.
+// Otherwise returns false and "*response" is the error to send.  If
+// "real_name" is not nullptr, it is also set to the file's canonical
+// absolute path (see is_path_safe()), to be opened with open_beneath().
+bool PrepareFileResponse(const std::string &uri,
+                         const std::string &base_dir,
+                         std::string *file_name,
+                         HttpResponse *response,
+                         std::string *real_name = nullptr);
+
+// Returns the response for a /static/ file that couldn't be read.
+HttpResponse FileNotFoundResponse(const std::string &file_name);
+
+// Answers "req" into "*response" if it is a /static/ request whose
+// whole response is in "file_cache", which takes no file I/O beyond,
+// now and then, a stat() to see that the file hasn't changed.  Returns
+// false otherwise, without counting a miss, as the request then goes
+// on to ProcessRequest().  Event loops use this to answer cache hits
+// on their own thread and hand everything else to a worker.
+bool AnswerFromFileCache(const HttpRequest &req,
+                         const std::string &base_dir,
+                         StaticFileCache *file_cache,
+                         HttpResponse *response);
+
+// Returns true if "req" will be answered from the index rather than
+// from a static file.
+bool IsQueryRequest(const HttpRequest &req);
+
+// Returns the response to a request that couldn't be parsed, a 400.
+// The connection should be closed once it has been sent, since there
+// is no telling where the next request would start.
+HttpResponse BadRequestResponse();
+
 // A task for the ThreadPool
 // When the server accpets a new connection, it must
 // initialize one of these tasks to that the thread has
@@ -61,13 +229,66 @@ class HttpServer {
 class HttpServerTask : public ThreadPool::Task {
  public:
   explicit HttpServerTask(ThreadPool::thread_task_fn f)
-    : ThreadPool::Task(f) { }
+    : ThreadPool::Task(f), client_fd(-1), pool(nullptr),
+      file_cache(nullptr), open_files(nullptr), compressed_files(nullptr),
+      resolver(nullptr),
+      watchdog(nullptr), poller(nullptr), stats(nullptr),
+      header_started_ms(0), served(false) { }
+
+  // Closes the connection.
+  virtual ~HttpServerTask();
 
   int client_fd;
-  uint16_t c_port;
-  std::string c_addr, c_dns, s_addr, s_dns;
+  struct sockaddr_storage client_addr;  // as returned by accept()
+  socklen_t client_addr_len;
   std::string base_dir;
   WordIndex *index;
+
+  // The pool the task runs on, which also helps with batch requests.
+  ThreadPool *pool;
+
+  // Where static file responses are cached, static files are kept
+  // open, and compressed copies of them are kept, or nullptr.
+  StaticFileCache *file_cache;
+  OpenFileCache *open_files;
+  CompressedFileCache *compressed_files;
+
+  // Where c_dns() and s_dns() get their answers; nullptr to skip DNS
+  // entirely.
+  DnsResolver *resolver;
+
+  // Enforces the connection's body timeouts, if not nullptr.
+  Watchdog *watchdog;
+
+  // Where the connection waits between requests.
+  ConnectionPoller *poller;
+  ConnectionStats *stats;
+
+  // The connection, once it has been served for the first time; it
+  // keeps any bytes read past the last request.  Also when a partial
+  // request header started to arrive (see TimerWheel::NowMs), or 0,
+  // and whether any request has been read from it yet.
+  std::unique_ptr<HttpConnection> connection;
+  uint64_t header_started_ms;
+  bool served;
+
+  // Information about both ends of the connection.  None of it is
+  // needed to serve requests, so each piece is only worked out the
+  // first time someone asks for it.  The DNS names are whatever the
+  // resolver has cached, or the numeric address if it has nothing yet.
+  uint16_t c_port();
+  const std::string &c_addr();
+  const std::string &c_dns();
+  const std::string &s_addr();
+  const std::string &s_dns();
+
+ private:
+  bool have_c_addr_ = false, have_c_dns_ = false;
+  bool have_s_addr_ = false, have_s_dns_ = false;
+  uint16_t c_port_;
+  std::string c_addr_, c_dns_, s_addr_, s_dns_;
+  struct sockaddr_storage s_sockaddr_;
+  socklen_t s_sockaddr_len_;
 };
 
 }  // namespace searchserver
@@ -14,7 +14,9 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <linux/openat2.h>
 #include <netdb.h>
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string.hpp>
@@ -22,10 +24,20 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
 #include <iostream>
 #include <vector>
 #include "./HttpUtils.h"
@@ -40,35 +52,282 @@ using std::vector;
 
 namespace searchserver {
 
+// The most wrapped_writev() and wrapped_sendfile() hand to one system
+// call when they report progress.
+static const size_t kProgressSliceBytes = 256 * 1024;
+
+// What is worked out once about a root directory: the absolute path it
+// names, taken lexically; its canonical path; and a descriptor open on
+// it for open_beneath().  Paths are kept without a trailing "/", so
+// "/" itself is "".
+struct StaticRoot {
+  string cwd;
+  string lexical;
+  string real;
+  int fd;
+};
+
+// Resolves "." and ".." in the absolute path "path", and squeezes out
+// repeated "/"s, without looking at the file system.  ".." at the top
+// stays there, as it does in the kernel.
+static string NormalizePath(const string &path) {
+  string out;
+  out.reserve(path.size());
+  size_t pos = 0;
+  while (pos < path.size()) {
+    size_t end = path.find('/', pos);
+    if (end == string::npos) {
+      end = path.size();
+    }
+    size_t len = end - pos;
+    if ((len == 2) && (path[pos] == '.') && (path[pos + 1] == '.')) {
+      out.resize(std::min(out.size(), out.rfind('/')));
+    } else if ((len > 0) && !((len == 1) && (path[pos] == '.'))) {
+      out += '/';
+      out.append(path, pos, len);
+    }
+    pos = end + 1;
+  }
+  return out;
+}
+
+// Returns what we know about "root_dir", working it out the first time
+// it is asked for.  Returns nullptr if root_dir can't be resolved;
+// that isn't remembered, so the directory may yet appear.
+static const StaticRoot *RootFor(const string &root_dir) {
+  // Servers have the one root, so each thread remembers the last it
+  // used and, almost always, need not take the lock.
+  static thread_local string last_dir;
+  static thread_local const StaticRoot *last_root = nullptr;
+  if ((last_root != nullptr) && (last_dir == root_dir)) {
+    return last_root;
+  }
+
+  // Roots are never forgotten; there are only ever a few.
+  static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  static map<string, StaticRoot *> roots;
+  pthread_mutex_lock(&lock);
+  auto it = roots.find(root_dir);
+  StaticRoot *root = (it != roots.end()) ? it->second : nullptr;
+  pthread_mutex_unlock(&lock);
+  if (root == nullptr) {
+    char cwd[PATH_MAX];
+    char *real = realpath(root_dir.c_str(), nullptr);
+    if ((real == nullptr) || (getcwd(cwd, sizeof(cwd)) == nullptr)) {
+      free(real);
+      return nullptr;
+    }
+    int fd = open(real, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+      free(real);
+      return nullptr;
+    }
+    root = new StaticRoot;
+    root->cwd = cwd;
+    root->lexical = NormalizePath((root_dir[0] == '/') ?
+                                  root_dir : root->cwd + "/" + root_dir);
+    root->real = NormalizePath(real);
+    root->fd = fd;
+    free(real);
+
+    pthread_mutex_lock(&lock);
+    auto res = roots.emplace(root_dir, root);
+    if (!res.second) {
+      // Another thread got there first.
+      close(root->fd);
+      delete root;
+      root = res.first->second;
+    }
+    pthread_mutex_unlock(&lock);
+  }
+  last_dir = root_dir;
+  last_root = root;
+  return root;
+}
+
+// Returns "path" relative to root's canonical path, or nullptr if it
+// isn't below it.
+static const char *BelowRoot(const StaticRoot &root, const string &path) {
+  size_t len = root.real.size();
+  if ((path.size() <= len + 1) || (path.compare(0, len, root.real) != 0) ||
+      (path[len] != '/')) {
+    return nullptr;
+  }
+  return path.c_str() + len + 1;
+}
+
+// The most symbolic links one open may follow, as in the kernel.
+static const int kMaxLinks = 40;
+
+// Appends the components of "path" to "*names" in order, or, if
+// "front" is set, puts them before the ones already there.
+static void PushComponents(const string &path, bool front,
+                           std::deque<string> *names) {
+  std::deque<string> parts;
+  size_t pos = 0;
+  while (pos <= path.size()) {
+    size_t end = std::min(path.find('/', pos), path.size());
+    parts.emplace_back(path, pos, end - pos);
+    pos = end + 1;
+  }
+  if (front) {
+    names->insert(names->begin(), parts.begin(), parts.end());
+  } else {
+    names->insert(names->end(), parts.begin(), parts.end());
+  }
+}
+
+// Opens "relative" below "root" read-only the way openat2()'s
+// RESOLVE_BENEATH does, for kernels without it: a component at a
+// time, from descriptors that never leave the root, refusing with
+// EXDEV an absolute symbolic link or a ".." that would climb above the
+// root, wherever they turn up.  Each step is taken with O_NOFOLLOW, so
+// a link swapped in once a name has been looked at isn't followed.
+static int WalkBeneath(const StaticRoot &root, const char *relative) {
+  std::deque<string> names;
+  PushComponents(relative, false, &names);
+  vector<int> dirs;  // where we are below the root, innermost last
+  int links = 0;
+  int fd = -1;
+  while (1) {
+    int at = dirs.empty() ? root.fd : dirs.back();
+    while (!names.empty() &&
+           (names.front().empty() || (names.front() == "."))) {
+      names.pop_front();
+    }
+    if (names.empty()) {
+      fd = openat(at, ".", O_RDONLY | O_CLOEXEC);
+      break;
+    }
+    string name = std::move(names.front());
+    names.pop_front();
+    if (name == "..") {
+      if (dirs.empty()) {
+        errno = EXDEV;
+        break;
+      }
+      close(dirs.back());
+      dirs.pop_back();
+      continue;
+    }
+
+    char target[PATH_MAX];
+    ssize_t len = readlinkat(at, name.c_str(), target, sizeof(target) - 1);
+    if (len >= 0) {
+      if (++links > kMaxLinks) {
+        errno = ELOOP;
+        break;
+      }
+      if ((len == 0) || (target[0] == '/')) {
+        errno = (len == 0) ? ENOENT : EXDEV;
+        break;
+      }
+      PushComponents(string(target, len), true, &names);
+      continue;
+    }
+    if (errno != EINVAL) {
+      // Missing, or unreadable; not a link.
+      break;
+    }
+    if (names.empty()) {
+      fd = openat(at, name.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+      break;
+    }
+    int dir = openat(at, name.c_str(),
+                     O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (dir == -1) {
+      break;
+    }
+    dirs.push_back(dir);
+  }
+
+  int saved_errno = errno;
+  for (int dir : dirs) {
+    close(dir);
+  }
+  errno = saved_errno;
+  return fd;
+}
+
 bool is_path_safe(const string &root_dir, const string &test_file) {
-  // rootdir is a directory path. testfile is a path to a file.
-  // return whether or not testfile is within rootdir.
-  // Be sure that your code handles the case when"." and ".."
-  // are found in the path for testfile.
-  //
-  // HINT: It can be tricky to handle all of the cases where "."
-  // and ".." show up in the passed in file paths. It would be easier
-  // to just handle the absolute paths for the files (no "." or "..").
-  // You may want to research and see if there is a C function that gets
-  // the absolute path of a file.
+  string real_path;
+  return is_path_safe(root_dir, test_file, &real_path);
+}
 
-  // TODO: implment
-  // get the absolute path
-  char* absolute_path = realpath(test_file.c_str(), NULL);
-  std::cout << "original :  " << test_file << "\n absolute :  " << absolute_path << std::endl;
+bool is_path_safe(const string &root_dir, const string &test_file,
+                  string *real_path) {
+  // Both paths are made absolute and "." and ".." resolved, then
+  // test_file must be root_dir followed by at least one more
+  // component (so "test_files_private" isn't below "test_files").
+  const StaticRoot *root = RootFor(root_dir);
+  if ((root == nullptr) || test_file.empty()) {
+    return false;
+  }
+  string path = NormalizePath((test_file[0] == '/') ?
+                              test_file : root->cwd + "/" + test_file);
+  size_t len = root->lexical.size();
+  if ((path.size() <= len + 1) ||
+      (path.compare(0, len, root->lexical) != 0) || (path[len] != '/')) {
+    return false;
+  }
+  *real_path = root->real;
+  real_path->append(path, len, string::npos);
+  return true;
+}
+
+int open_beneath(const string &root_dir, const string &real_path) {
+  const StaticRoot *root = RootFor(root_dir);
+  if (root == nullptr) {
+    return -1;
+  }
+  const char *relative = BelowRoot(*root, real_path);
+  if (relative == nullptr) {
+    errno = EXDEV;
+    return -1;
+  }
 
-  // find if given root_dir is in the absolute_path
-  string path = absolute_path;
-  int index = path.find(root_dir, 0);
-  if (index != (int)string::npos) {
-    string next = path.substr(index + root_dir.length(), 1);
-    if(next == "/") {
-        free(absolute_path);
-        return true;
+  // openat2() (Linux 5.6) refuses, atomically, to resolve anything
+  // that leads out of the directory.  Once it is found missing, it
+  // isn't tried again.
+  static std::atomic<bool> have_openat2(true);
+  if (have_openat2) {
+    struct open_how how;
+    memset(&how, 0, sizeof(how));
+    how.flags = O_RDONLY | O_CLOEXEC;
+    how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+    int fd = static_cast<int>(syscall(__NR_openat2, root->fd, relative,
+                                      &how, sizeof(how)));
+    if ((fd != -1) || (errno != ENOSYS)) {
+      return fd;
     }
+    have_openat2 = false;
   }
-  free(absolute_path);
-  return false;
+  return WalkBeneath(*root, relative);
+}
+
+int walk_beneath(const string &root_dir, const string &real_path) {
+  const StaticRoot *root = RootFor(root_dir);
+  if (root == nullptr) {
+    return -1;
+  }
+  const char *relative = BelowRoot(*root, real_path);
+  if (relative == nullptr) {
+    errno = EXDEV;
+    return -1;
+  }
+  return WalkBeneath(*root, relative);
+}
+
+bool real_path_of(int fd, string *path) {
+  char link[64];
+  char target[PATH_MAX];
+  snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+  ssize_t len = readlink(link, target, sizeof(target) - 1);
+  if (len <= 0) {
+    return false;
+  }
+  path->assign(target, len);
+  return true;
 }
 
 string escape_html(const string &from) {
@@ -187,6 +446,188 @@ void URLParser::parse(const string &url) {
   }
 }
 
+string make_etag(const struct stat &st) {
+  uint64_t mtime_ns = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000 +
+                      st.st_mtim.tv_nsec;
+  char tag[64];
+  snprintf(tag, sizeof(tag), "\"%llx-%llx-%llx\"",
+           static_cast<unsigned long long>(st.st_ino),
+           static_cast<unsigned long long>(st.st_size),
+           static_cast<unsigned long long>(mtime_ns));
+  return tag;
+}
+
+string format_http_date(time_t t) {
+  struct tm tm;
+  char date[64];
+  gmtime_r(&t, &tm);
+  size_t len = strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  return string(date, len);
+}
+
+bool parse_http_date(std::string_view date, time_t *t) {
+  // The preferred format, then the two obsolete ones that recipients
+  // must still accept (RFC 850 and asctime()).
+  static const char *const kFormats[] = {
+    "%a, %d %b %Y %H:%M:%S GMT",
+    "%A, %d-%b-%y %H:%M:%S GMT",
+    "%a %b %e %H:%M:%S %Y",
+  };
+  string copy(date);
+  for (const char *format : kFormats) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(copy.c_str(), format, &tm);
+    if ((end != nullptr) && (*end == '\0')) {
+      *t = timegm(&tm);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Removes spaces and tabs from both ends of "*s".
+static void TrimWhitespace(std::string_view *s) {
+  while (!s->empty() && ((s->front() == ' ') || (s->front() == '\t'))) {
+    s->remove_prefix(1);
+  }
+  while (!s->empty() && ((s->back() == ' ') || (s->back() == '\t'))) {
+    s->remove_suffix(1);
+  }
+}
+
+// Strips the weak indicator off an entity tag.
+static std::string_view OpaqueTag(std::string_view etag) {
+  if ((etag.size() >= 2) && (etag[0] == 'W') && (etag[1] == '/')) {
+    etag.remove_prefix(2);
+  }
+  return etag;
+}
+
+bool etag_matches(std::string_view if_none_match, std::string_view etag) {
+  std::string_view wanted = OpaqueTag(etag);
+  while (!if_none_match.empty()) {
+    size_t comma = if_none_match.find(',');
+    std::string_view tag = if_none_match.substr(0, comma);
+    if_none_match.remove_prefix(
+        (comma == std::string_view::npos) ? if_none_match.size() : comma + 1);
+
+    TrimWhitespace(&tag);
+    if ((tag == "*") || (OpaqueTag(tag) == wanted)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool accepts_encoding(std::string_view accept_encoding,
+                      std::string_view coding) {
+  // What "*" says, and whether "coding" was named itself, which
+  // overrides that.
+  bool star = false;
+  while (!accept_encoding.empty()) {
+    size_t comma = accept_encoding.find(',');
+    std::string_view item = accept_encoding.substr(0, comma);
+    accept_encoding.remove_prefix((comma == std::string_view::npos) ?
+                                  accept_encoding.size() : comma + 1);
+
+    // "coding" or "coding;q=value"; a q of 0 (0, 0.0, 0.000) refuses.
+    size_t semicolon = item.find(';');
+    std::string_view name = item.substr(0, semicolon);
+    TrimWhitespace(&name);
+    bool refused = false;
+    if (semicolon != std::string_view::npos) {
+      std::string_view param = item.substr(semicolon + 1);
+      TrimWhitespace(&param);
+      if ((param.size() >= 2) && ((param[0] == 'q') || (param[0] == 'Q')) &&
+          (param[1] == '=')) {
+        param.remove_prefix(2);
+        refused = (param.find_first_not_of("0.") == std::string_view::npos);
+      }
+    }
+    if ((name.size() == coding.size()) &&
+        (strncasecmp(name.data(), coding.data(), coding.size()) == 0)) {
+      return !refused;
+    }
+    if (name == "*") {
+      star = !refused;
+    }
+  }
+  return star;
+}
+
+// Parses the decimal number at the front of "*s" and removes it.
+// Returns false if there is none, or it doesn't fit in 64 bits.
+static bool ParseDecimal(std::string_view *s, uint64_t *n) {
+  size_t len = 0;
+  *n = 0;
+  while ((len < s->size()) && ((*s)[len] >= '0') && ((*s)[len] <= '9')) {
+    uint64_t digit = (*s)[len] - '0';
+    if (*n > (UINT64_MAX - digit) / 10) {
+      return false;
+    }
+    *n = *n * 10 + digit;
+    len++;
+  }
+  s->remove_prefix(len);
+  return len > 0;
+}
+
+bool parse_byte_ranges(std::string_view range, uint64_t size,
+                       vector<ByteRange> *ranges) {
+  ranges->clear();
+  if ((range.size() < 6) || (strncasecmp(range.data(), "bytes=", 6) != 0)) {
+    return false;
+  }
+  range.remove_prefix(6);
+
+  bool any = false;
+  while (!range.empty()) {
+    size_t comma = range.find(',');
+    std::string_view spec = range.substr(0, comma);
+    range.remove_prefix(
+        (comma == std::string_view::npos) ? range.size() : comma + 1);
+    TrimWhitespace(&spec);
+    if (spec.empty()) {
+      // Empty list elements are allowed, and mean nothing.
+      continue;
+    }
+    any = true;
+
+    uint64_t first, last;
+    if (spec.front() == '-') {
+      // "-N": the last N bytes.
+      spec.remove_prefix(1);
+      if (!ParseDecimal(&spec, &last) || !spec.empty()) {
+        return false;
+      }
+      if ((last > 0) && (size > 0)) {
+        uint64_t length = std::min(last, size);
+        ranges->push_back({ size - length, length });
+      }
+      continue;
+    }
+
+    // "first-last", or "first-" for everything from first on.
+    if (!ParseDecimal(&spec, &first) || spec.empty() || (spec[0] != '-')) {
+      return false;
+    }
+    spec.remove_prefix(1);
+    last = UINT64_MAX;
+    if (!spec.empty() && (!ParseDecimal(&spec, &last) || !spec.empty())) {
+      return false;
+    }
+    if (last < first) {
+      return false;
+    }
+    if (first < size) {
+      last = std::min(last, size - 1);
+      ranges->push_back({ first, last - first + 1 });
+    }
+  }
+  return any;
+}
+
 int wrapped_read(int fd, string *buf) {
   int res;
   char buffer[1024];
@@ -198,7 +639,9 @@ int wrapped_read(int fd, string *buf) {
     }
     break;
   }
-  *buf += string(buffer, res);
+  if (res > 0) {
+    buf->append(buffer, res);
+  }
   return res;
 }
 
@@ -220,6 +663,88 @@ int wrapped_write(int fd, const string& buf)  {
   return written_so_far;
 }
 
+size_t wrapped_writev(int fd, std::vector<struct iovec> *iov,
+                      const std::function<void()> &progress) {
+  size_t written_so_far = 0;
+  size_t next = 0;  // the first iovec not yet completely written
+
+  while (next < iov->size()) {
+    int iovcnt = std::min(iov->size() - next, static_cast<size_t>(IOV_MAX));
+
+    // To report progress, write no more than kProgressSliceBytes at a
+    // time: the iovec that crosses the limit is cut short for this
+    // writev(), then restored.
+    size_t cut = iov->size();
+    size_t cut_len = 0;
+    if (progress) {
+      size_t total = 0;
+      for (int i = 0; i < iovcnt; i++) {
+        struct iovec &v = (*iov)[next + i];
+        if (total + v.iov_len > kProgressSliceBytes) {
+          cut = next + i;
+          cut_len = v.iov_len;
+          v.iov_len = kProgressSliceBytes - total;
+          iovcnt = i + 1;
+          break;
+        }
+        total += v.iov_len;
+      }
+    }
+    ssize_t res = writev(fd, iov->data() + next, iovcnt);
+    if (cut < iov->size()) {
+      (*iov)[cut].iov_len = cut_len;
+    }
+    if (res == -1) {
+      if ((errno == EAGAIN) || (errno == EINTR))
+        continue;
+      break;
+    }
+    if (res == 0)
+      break;
+    written_so_far += res;
+    if (progress) {
+      progress();
+    }
+
+    // Skip over what was written, which may end partway into an iovec.
+    size_t left = res;
+    while ((next < iov->size()) && (left >= (*iov)[next].iov_len)) {
+      left -= (*iov)[next].iov_len;
+      next++;
+    }
+    if (left > 0) {
+      (*iov)[next].iov_base = static_cast<char *>((*iov)[next].iov_base) + left;
+      (*iov)[next].iov_len -= left;
+    }
+  }
+  return written_so_far;
+}
+
+size_t wrapped_sendfile(int out_fd, int in_fd, off_t offset, size_t count,
+                        const std::function<void()> &progress) {
+  size_t sent_so_far = 0;
+
+  while (sent_so_far < count) {
+    size_t len = count - sent_so_far;
+    if (progress) {
+      len = std::min(len, kProgressSliceBytes);
+    }
+    ssize_t res = sendfile(out_fd, in_fd, &offset, len);
+    if (res == -1) {
+      if ((errno == EAGAIN) || (errno == EINTR))
+        continue;
+      break;
+    }
+    if (res == 0)
+      break;
+    sent_so_far += res;
+    if (progress) {
+      progress();
+    }
+  }
+  return sent_so_far;
+}
+
 bool connect_to_server(const string &host_name, uint16_t port_num,
                      int *client_fd) {
   struct addrinfo hints, *results, *r;
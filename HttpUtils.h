@@ -15,11 +15,18 @@
 #ifndef HTTPUTILS_H_
 #define HTTPUTILS_H_
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <cstdint>
+#include <ctime>
+#include <functional>
 
 #include <string>
+#include <string_view>
 #include <utility>
 #include <map>
+#include <vector>
 
 namespace searchserver {
 
@@ -44,6 +51,40 @@ namespace searchserver {
 //
 bool is_path_safe(const std::string &root_dir, const std::string &test_file);
 
+// Like the above, but if test_file is safe, also sets "*real_path" to
+// its absolute path: root_dir's canonical path (see realpath()), then
+// the rest of test_file with "." and ".." resolved.  Two names for the
+// same file that differ only in those give the same real path.
+//
+// The check is lexical, and makes no system calls once root_dir has
+// been seen: test_file need not exist, and a symbolic link below
+// root_dir is not followed, so a file reached through one has a real
+// path that isn't its canonical one (see real_path_of()).  Open the
+// file with open_beneath() to be sure that no link takes it out of
+// root_dir.
+bool is_path_safe(const std::string &root_dir, const std::string &test_file,
+                  std::string *real_path);
+
+// Opens "real_path", which is_path_safe() said is below "root_dir",
+// read-only, such that neither ".." nor a symbolic link in it can take
+// the open out of root_dir: with openat2()'s RESOLVE_BENEATH where the
+// kernel has it, or else with walk_beneath().  A relative link that
+// stays below root_dir is followed; an absolute one never is.
+// Returns the descriptor, or -1 with errno set (EXDEV if the file is
+// outside root_dir).
+int open_beneath(const std::string &root_dir, const std::string &real_path);
+
+// Like open_beneath(), but resolves "real_path" itself, a component at
+// a time, as open_beneath() does on kernels without openat2().  It
+// opens just the files RESOLVE_BENEATH would.
+int walk_beneath(const std::string &root_dir, const std::string &real_path);
+
+// Sets "*path" to the canonical path of the file open at "fd", as
+// /proc/self/fd says, which a FileWatcher reports changes to it by
+// even if it was opened through a symbolic link.  Returns false if
+// that can't be read.
+bool real_path_of(int fd, std::string *path);
+
 // This function performs HTML escaping in place.  It scans a string
 // for dangerous HTML tokens (such as "<") and replaces them with the
 // escaped HTML equivalent (such as "&lt;").  This helps to prevent
@@ -88,6 +129,47 @@ class URLParser {
   std::map<std::string, std::string> args_;
 };
 
+// Returns a strong entity tag for the file described by "st", built
+// from its inode, size and modification time, quoted and ready to be
+// sent in an ETag header.  The tag changes whenever the file is
+// replaced or rewritten.
+std::string make_etag(const struct stat &st);
+
+// Returns "t" as an HTTP date (RFC 7231 IMF-fixdate), for example
+// "Sun, 06 Nov 1994 08:49:37 GMT".
+std::string format_http_date(time_t t);
+
+// Parses an HTTP date as sent in If-Modified-Since.  Returns false if
+// "date" isn't one.
+bool parse_http_date(std::string_view date, time_t *t);
+
+// Tests whether an If-None-Match header value matches "etag": true if
+// the value is "*" or lists "etag".  The comparison is the weak one
+// required for If-None-Match, so W/"x" matches "x".
+bool etag_matches(std::string_view if_none_match, std::string_view etag);
+
+// Tests whether an Accept-Encoding header value allows a body to be
+// sent with the content coding "coding" (e.g., "gzip"): it must be
+// listed, or covered by "*", without "q=0".
+bool accepts_encoding(std::string_view accept_encoding,
+                      std::string_view coding);
+
+// One range of bytes from a Range header: "length" bytes starting at
+// "offset".
+struct ByteRange {
+  uint64_t offset;
+  uint64_t length;
+};
+
+// Parses the value of a Range header for a representation that is
+// "size" bytes long.  Returns false if it isn't a valid "bytes=" range
+// set, in which case the header should be ignored.  Otherwise sets
+// "*ranges" to the requested ranges, in the order asked for, clipped
+// to the representation and without those that lie wholly past its
+// end; if none are left, the range is not satisfiable.
+bool parse_byte_ranges(std::string_view range, uint64_t size,
+                       std::vector<ByteRange> *ranges);
+
 // A wrapper around the write() system call that shields the caller
 // from dealing with the ugly issues of partial writes, EINTR, EAGAIN,
 // and so on.
@@ -99,6 +181,24 @@ class URLParser {
 // was encountered, like the connection being dropped.
 int wrapped_write(int fd, const std::string& buf);
 
+// Like wrapped_write(), but gathers the bytes to write from the "iov"
+// array with writev(), so that separate buffers go out without being
+// concatenated first.  "iov" is used as scratch space and is modified.
+// Returns the total number of bytes written.  If "progress" is given,
+// it is called after every write that gets somewhere, and no one write
+// is allowed to take long: each moves at most a few hundred KiB.
+size_t wrapped_writev(int fd, std::vector<struct iovec> *iov,
+                      const std::function<void()> &progress = nullptr);
+
+// Like wrapped_write(), but sends "count" bytes of the file "in_fd"
+// starting at "offset" with sendfile(), so the bytes are copied by
+// the kernel without passing through user space.  Returns the total
+// number of bytes sent; if this is less than count, the connection
+// failed or the file was shorter than expected.  "progress" is as for
+// wrapped_writev().
+size_t wrapped_sendfile(int out_fd, int in_fd, off_t offset, size_t count,
+                        const std::function<void()> &progress = nullptr);
+
 // A wrapper around the read() system call that shields the caller
 // from dealing with the ugly issues of partial reads, EINTR, EAGAIN,
 // and so on.
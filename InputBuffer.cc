@@ -0,0 +1,160 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+extern "C" {
+  #include <pthread.h>  // for the pthread threading/mutex functions
+}
+
+#include <errno.h>
+#include <sys/uio.h>
+#include <cstring>
+#include <vector>
+
+#include "./InputBuffer.h"
+
+using std::vector;
+
+namespace searchserver {
+
+///////////////////////////////////////////////////////////////////////////////
+// Constants, internal helper functions
+///////////////////////////////////////////////////////////////////////////////
+
+// At most this many free blocks are kept in the pool (16 MiB); more
+// than that are freed.
+static const size_t kMaxPooledBlocks = 1024;
+
+// How much read_from() can take beyond the buffer's spare room.  The
+// overflow lands in a per-thread scratch area and is then appended,
+// so a buffer only grows when a client really sends that much.
+static const size_t kScratchSize = 65536;
+
+// The pool of free blocks.
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static vector<char *> pool_blocks;
+
+static char *AcquireBlock() {
+  char *block = nullptr;
+  pthread_mutex_lock(&pool_lock);
+  if (!pool_blocks.empty()) {
+    block = pool_blocks.back();
+    pool_blocks.pop_back();
+  }
+  pthread_mutex_unlock(&pool_lock);
+  return (block != nullptr) ? block : new char[kInputBlockSize];
+}
+
+static void ReleaseBlock(char *block) {
+  pthread_mutex_lock(&pool_lock);
+  if (pool_blocks.size() < kMaxPooledBlocks) {
+    pool_blocks.push_back(block);
+    block = nullptr;
+  }
+  pthread_mutex_unlock(&pool_lock);
+  delete[] block;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// InputBuffer
+///////////////////////////////////////////////////////////////////////////////
+void InputBuffer::append(const char *data, size_t len) {
+  if (len == 0) {
+    return;
+  }
+  reserve(len);
+  memcpy(storage_ + end_, data, len);
+  end_ += len;
+}
+
+void InputBuffer::consume(size_t len) {
+  begin_ += len;
+  if (begin_ == end_) {
+    release();
+  }
+}
+
+ssize_t InputBuffer::read_from(int fd) {
+  static thread_local char scratch[kScratchSize];
+
+  // Some room of our own, so that a typical request is read straight
+  // into place.
+  if (capacity_ == end_) {
+    reserve(1);
+  }
+  struct iovec iov[2];
+  iov[0].iov_base = storage_ + end_;
+  iov[0].iov_len = capacity_ - end_;
+  iov[1].iov_base = scratch;
+  iov[1].iov_len = sizeof(scratch);
+
+  ssize_t res;
+  do {
+    res = readv(fd, iov, 2);
+  } while ((res == -1) && (errno == EINTR));
+
+  if (res <= 0) {
+    if (empty()) {
+      release();
+    }
+    return res;
+  }
+  size_t direct = iov[0].iov_len;
+  if (static_cast<size_t>(res) <= direct) {
+    end_ += res;
+  } else {
+    end_ += direct;
+    append(scratch, res - direct);
+  }
+  return res;
+}
+
+void InputBuffer::reserve(size_t len) {
+  if (capacity_ - end_ >= len) {
+    return;
+  }
+
+  // Moving the unconsumed bytes down may be enough.
+  size_t used = size();
+  if ((storage_ != nullptr) && (capacity_ - used >= len)) {
+    memmove(storage_, storage_ + begin_, used);
+    begin_ = 0;
+    end_ = used;
+    return;
+  }
+
+  size_t capacity = kInputBlockSize;
+  while (capacity < used + len) {
+    capacity *= 2;
+  }
+  char *storage = (capacity == kInputBlockSize) ?
+                  AcquireBlock() : new char[capacity];
+  if (used > 0) {
+    memcpy(storage, storage_ + begin_, used);
+  }
+  release();
+  storage_ = storage;
+  capacity_ = capacity;
+  end_ = used;
+}
+
+void InputBuffer::release() {
+  if (storage_ != nullptr) {
+    if (capacity_ == kInputBlockSize) {
+      ReleaseBlock(storage_);
+    } else {
+      delete[] storage_;
+    }
+  }
+  storage_ = nullptr;
+  capacity_ = begin_ = end_ = 0;
+}
+
+}  // namespace searchserver
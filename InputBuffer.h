@@ -0,0 +1,82 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef INPUTBUFFER_H_
+#define INPUTBUFFER_H_
+
+#include <sys/types.h>
+#include <cstddef>
+
+namespace searchserver {
+
+// An InputBuffer holds bytes received from a client that haven't been
+// consumed yet, in one contiguous piece of memory that is read into
+// directly.  Consumed bytes are dropped from the front by moving a
+// cursor; the rest are only moved down when room is needed at the end.
+//
+// Most requests fit in a block of kInputBlockSize bytes, so buffers
+// take their memory from a process-wide pool of such blocks, and give
+// it back as soon as they are empty.  An idle connection therefore
+// holds no input memory at all, and a busy one doesn't allocate.
+//
+// An InputBuffer is not thread-safe, but the pool behind it is.
+class InputBuffer {
+ public:
+  InputBuffer() { }
+
+  // Gives the buffer's memory back.
+  virtual ~InputBuffer() { release(); }
+
+  // The unconsumed bytes, and how many there are.  data() may be
+  // nullptr when size() is 0, and moves when more is added.
+  char *data() { return storage_ + begin_; }
+  const char *data() const { return storage_ + begin_; }
+  size_t size() const { return end_ - begin_; }
+  bool empty() const { return end_ == begin_; }
+
+  // Appends "len" bytes from "data".
+  void append(const char *data, size_t len);
+
+  // Drops the first "len" unconsumed bytes.  Once none are left, the
+  // memory goes back to the pool.
+  void consume(size_t len);
+
+  // Makes a single read of whatever "fd" has, up to the buffer's spare
+  // room plus 64 KiB, and appends it.  Returns what read() would: the
+  // number of bytes read, 0 at end of file, or -1 with errno set.
+  // Retries if interrupted by a signal.
+  ssize_t read_from(int fd);
+
+  InputBuffer(const InputBuffer &other) = delete;
+  InputBuffer &operator=(const InputBuffer &other) = delete;
+
+ private:
+  // Makes room for at least "len" more bytes after end_.
+  void reserve(size_t len);
+
+  // Returns storage_ to the pool (or frees it) and empties the buffer.
+  void release();
+
+  char *storage_ = nullptr;
+  size_t capacity_ = 0;
+
+  // The unconsumed bytes are storage_[begin_, end_).
+  size_t begin_ = 0;
+  size_t end_ = 0;
+};
+
+// The size of the pooled blocks; bigger buffers are allocated and
+// freed as needed.
+static const size_t kInputBlockSize = 16384;
+
+}  // namespace searchserver
+
+#endif  // INPUTBUFFER_H_
@@ -0,0 +1,312 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#include "./ListenerHandoff.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+namespace searchserver {
+
+///////////////////////////////////////////////////////////////////////////////
+// Constants, internal helper functions
+///////////////////////////////////////////////////////////////////////////////
+
+// The byte that carries the descriptors, and the one the new server
+// answers with once it has them.
+static const char kHandoffByte = 'L';
+static const char kAckByte = 'K';
+
+// How long either side waits for the other during a handoff.
+static const int kHandoffTimeoutSeconds = 5;
+
+// Fills in "*addr" for the Unix domain socket at "path".  Returns
+// false if the path is too long.
+static bool MakeUnixAddress(const string &path, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr->sun_path)) {
+    cerr << "handoff path " << path << " is too long" << endl;
+    return false;
+  }
+  memcpy(addr->sun_path, path.c_str(), path.size());
+  return true;
+}
+
+// Bounds how long reads and writes on "sock" may block.
+static void SetHandoffTimeouts(int sock) {
+  struct timeval tv;
+  tv.tv_sec = kHandoffTimeoutSeconds;
+  tv.tv_usec = 0;
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+bool SendFds(int sock, const vector<int> &fds) {
+  if (fds.empty() || (fds.size() > static_cast<size_t>(kMaxHandoffFds))) {
+    return false;
+  }
+
+  // The descriptors ride along with a single byte of ordinary data.
+  char byte = kHandoffByte;
+  struct iovec iov = { &byte, 1 };
+  vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()), 0);
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+  memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+
+  while (sendmsg(sock, &msg, MSG_NOSIGNAL) == -1) {
+    if (errno != EINTR) {
+      cerr << "sendmsg() failed: " << strerror(errno) << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ReceiveFds(int sock, vector<int> *fds) {
+  char byte;
+  struct iovec iov = { &byte, 1 };
+  vector<char> control(CMSG_SPACE(sizeof(int) * kMaxHandoffFds), 0);
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+
+  ssize_t res;
+  while ((res = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) == -1) {
+    if (errno != EINTR) {
+      cerr << "recvmsg() failed: " << strerror(errno) << endl;
+      return false;
+    }
+  }
+
+  fds->clear();
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if ((cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS)) {
+      continue;
+    }
+    size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < n; i++) {
+      int fd;
+      memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+      fds->push_back(fd);
+    }
+  }
+
+  // Descriptors that didn't fit are lost, so don't use the rest.
+  if ((res != 1) || (byte != kHandoffByte) || (msg.msg_flags & MSG_CTRUNC) ||
+      fds->empty()) {
+    for (int fd : *fds) {
+      close(fd);
+    }
+    fds->clear();
+    return false;
+  }
+  return true;
+}
+
+bool TakeListeners(const string &path, vector<int> *fds) {
+  fds->clear();
+  struct sockaddr_un addr;
+  if (!MakeUnixAddress(path, &addr)) {
+    return false;
+  }
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock == -1) {
+    cerr << "socket() failed: " << strerror(errno) << endl;
+    return false;
+  }
+  if (connect(sock, reinterpret_cast<struct sockaddr *>(&addr),
+              sizeof(addr)) == -1) {
+    // No server there (or a stale socket left by one that died): not
+    // an error, there is just nothing to take over.
+    if ((errno != ENOENT) && (errno != ECONNREFUSED)) {
+      cerr << "connect() to " << path << " failed: " << strerror(errno)
+           << endl;
+    }
+    close(sock);
+    return false;
+  }
+  SetHandoffTimeouts(sock);
+
+  // Only once the old server hears back does it start draining.
+  bool ok = ReceiveFds(sock, fds) &&
+            (send(sock, &kAckByte, 1, MSG_NOSIGNAL) == 1);
+  if (!ok) {
+    for (int fd : *fds) {
+      close(fd);
+    }
+    fds->clear();
+  }
+  close(sock);
+  return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// HandoffListener
+///////////////////////////////////////////////////////////////////////////////
+HandoffListener::HandoffListener(const string &path,
+                                 const vector<int> &listen_fds,
+                                 std::function<void()> on_handoff)
+  : path_(path), listen_fds_(listen_fds), on_handoff_(std::move(on_handoff)),
+    sock_fd_(-1), stop_fd_(-1), handed_off_(false), running_(false) { }
+
+HandoffListener::~HandoffListener() {
+  if (running_) {
+    uint64_t one = 1;
+    if (write(stop_fd_, &one, sizeof(one)) == -1) {
+      // The counter is already non-zero, so the thread will wake anyway.
+    }
+    pthread_join(thread_, nullptr);
+    if (!handed_off_) {
+      unlink(path_.c_str());
+    }
+  }
+  if (sock_fd_ != -1) {
+    close(sock_fd_);
+  }
+  if (stop_fd_ != -1) {
+    close(stop_fd_);
+  }
+}
+
+bool HandoffListener::start() {
+  struct sockaddr_un addr;
+  if (!MakeUnixAddress(path_, &addr)) {
+    return false;
+  }
+  stop_fd_ = eventfd(0, EFD_CLOEXEC);
+  if (stop_fd_ == -1) {
+    cerr << "eventfd() failed: " << strerror(errno) << endl;
+    return false;
+  }
+  sock_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock_fd_ == -1) {
+    cerr << "socket() failed: " << strerror(errno) << endl;
+    return false;
+  }
+
+  // Whatever is at the path belongs to a server that is gone or that
+  // has just handed its sockets to us.  The socket is made private
+  // before it listens, so no one else can connect to it even briefly.
+  unlink(path_.c_str());
+  if ((bind(sock_fd_, reinterpret_cast<struct sockaddr *>(&addr),
+            sizeof(addr)) == -1) ||
+      (chmod(path_.c_str(), S_IRUSR | S_IWUSR) == -1) ||
+      (listen(sock_fd_, 1) == -1)) {
+    cerr << "Couldn't listen on " << path_ << ": " << strerror(errno) << endl;
+    close(sock_fd_);
+    sock_fd_ = -1;
+    return false;
+  }
+
+  if (pthread_create(&thread_, nullptr, &handoff_thread,
+                     static_cast<void *>(this)) != 0) {
+    cerr << "Couldn't start the handoff thread" << endl;
+    unlink(path_.c_str());
+    close(sock_fd_);
+    sock_fd_ = -1;
+    return false;
+  }
+  running_ = true;
+  return true;
+}
+
+void *HandoffListener::handoff_thread(void *arg) {
+  static_cast<HandoffListener *>(arg)->handoff_loop();
+  return nullptr;
+}
+
+void HandoffListener::handoff_loop() {
+  while (1) {
+    struct pollfd fds[2];
+    fds[0].fd = sock_fd_;
+    fds[0].events = POLLIN;
+    fds[1].fd = stop_fd_;
+    fds[1].events = POLLIN;
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      cerr << "poll() failed: " << strerror(errno) << endl;
+      return;
+    }
+    if (fds[1].revents & POLLIN) {
+      return;
+    }
+
+    int client = accept4(sock_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client == -1) {
+      continue;
+    }
+    SetHandoffTimeouts(client);
+    bool ok = hand_off(client);
+    close(client);
+    if (ok) {
+      // Only ever one successor; anyone else who asks is refused.
+      close(sock_fd_);
+      sock_fd_ = -1;
+      handed_off_ = true;
+      on_handoff_();
+      return;
+    }
+  }
+}
+
+bool HandoffListener::hand_off(int client) {
+  // The listening sockets are only for a server run by our own user.
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) {
+    cerr << "getsockopt(SO_PEERCRED) failed: " << strerror(errno) << endl;
+    return false;
+  }
+  if (cred.uid != geteuid()) {
+    cerr << "refusing to hand off to uid " << cred.uid << endl;
+    return false;
+  }
+  if (!SendFds(client, listen_fds_)) {
+    return false;
+  }
+  char ack;
+  ssize_t res;
+  while (((res = read(client, &ack, 1)) == -1) && (errno == EINTR)) { }
+  return (res == 1) && (ack == kAckByte);
+}
+
+}  // namespace searchserver
@@ -0,0 +1,105 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef LISTENERHANDOFF_H_
+#define LISTENERHANDOFF_H_
+
+extern "C" {
+  #include <pthread.h>  // for the pthread threading/mutex functions
+}
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace searchserver {
+
+// Zero-downtime restarts.  A server started with a handoff path first
+// asks the server already running with that path for its listening
+// sockets (TakeListeners()), and only binds new ones if there is no
+// such server.  The old server hands its sockets over through a
+// HandoffListener and then drains.
+//
+// Both processes then hold the very same sockets, so connections that
+// queue up on them during the switch are accepted by the new server
+// rather than refused.  And since a server only asks once its index is
+// built, it takes over warm.
+
+// The most descriptors one handoff can carry.
+static const int kMaxHandoffFds = 64;
+
+// Sends the descriptors in "fds" over the connected Unix domain socket
+// "sock" (SCM_RIGHTS).  Returns false on failure.
+bool SendFds(int sock, const std::vector<int> &fds);
+
+// Receives descriptors sent with SendFds() over "sock" into "*fds".
+// They are close-on-exec.  Returns false on failure, or if nothing
+// came.
+bool ReceiveFds(int sock, std::vector<int> *fds);
+
+// Connects to the HandoffListener at "path" and takes over its
+// listening sockets, returning them through "*fds".  Returns false if
+// there is no running server there (or the handoff failed), in which
+// case the caller should bind its own.
+bool TakeListeners(const std::string &path, std::vector<int> *fds);
+
+// A HandoffListener waits on a Unix domain socket for the server that
+// is to replace this one, and hands it the listening sockets.
+class HandoffListener {
+ public:
+  // Once started, a listener at "path" hands "listen_fds" to the first
+  // server that asks for them, then calls "on_handoff" (on its own
+  // thread), e.g. to drain this server.  Ownership of listen_fds is
+  // not taken; the caller should keep them open until it has drained.
+  HandoffListener(const std::string &path, const std::vector<int> &listen_fds,
+                  std::function<void()> on_handoff);
+
+  // Stops listening.  Removes "path", unless the sockets were handed
+  // off, in which case it belongs to the server that took them.
+  virtual ~HandoffListener();
+
+  // Binds "path", replacing anything already there, and starts the
+  // listening thread.  Only this user may connect to the socket.
+  // Returns false on failure.
+  bool start();
+
+  // True once the sockets have been handed off.
+  bool handed_off() const { return handed_off_; }
+
+  HandoffListener(const HandoffListener &other) = delete;
+  HandoffListener &operator=(const HandoffListener &other) = delete;
+
+ private:
+  static void *handoff_thread(void *arg);
+  void handoff_loop();
+
+  // Hands the sockets to the server on "client", if it runs as the
+  // same user as this one.  Returns true if it confirmed that it got
+  // them.
+  bool hand_off(int client);
+
+  std::string path_;
+  std::vector<int> listen_fds_;
+  std::function<void()> on_handoff_;
+
+  int sock_fd_;
+
+  // An eventfd that wakes the thread when it is to stop.
+  int stop_fd_;
+  std::atomic<bool> handed_off_;
+  bool running_;
+  pthread_t thread_;
+};
+
+}  // namespace searchserver
+
+#endif  // LISTENERHANDOFF_H_
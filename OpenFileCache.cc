@@ -0,0 +1,137 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <unordered_set>
+#include <utility>
+
+#include "./FileWatcher.h"
+#include "./HttpUtils.h"
+#include "./OpenFileCache.h"
+#include "./TimerWheel.h"
+
+using std::shared_ptr;
+using std::string;
+
+namespace searchserver {
+
+///////////////////////////////////////////////////////////////////////////////
+// OpenFileCache
+///////////////////////////////////////////////////////////////////////////////
+OpenFileCache::OpenFileCache(size_t max_files, uint32_t revalidate_ms,
+                             const string &root_dir)
+  : shard_max_files_(std::max<size_t>(1, max_files / kNumShards)),
+    revalidate_ms_(revalidate_ms), root_dir_(root_dir) {
+  for (Shard &shard : shards_) {
+    pthread_mutex_init(&shard.lock, nullptr);
+  }
+}
+
+OpenFileCache::~OpenFileCache() {
+  for (Shard &shard : shards_) {
+    pthread_mutex_destroy(&shard.lock);
+  }
+}
+
+shared_ptr<const BodyFile> OpenFileCache::open(const string &path,
+                                               struct stat *st) {
+  Shard *shard = ShardFor(path);
+  uint64_t now = TimerWheel::NowMs();
+  pthread_mutex_lock(&shard->lock);
+  auto it = shard->slots.find(path);
+  if ((it != shard->slots.end()) &&
+      (now - it->second.opened_ms < revalidate_ms_)) {
+    shared_ptr<const BodyFile> file = it->second.file;
+    shard->lru.splice(shard->lru.begin(), shard->lru, it->second.lru_pos);
+    pthread_mutex_unlock(&shard->lock);
+    hits_++;
+    if (!file || (fstat(file->fd(), st) == -1)) {
+      return nullptr;
+    }
+    return file;
+  }
+  pthread_mutex_unlock(&shard->lock);
+  misses_++;
+
+  // Opened without the lock held; if another thread opens the same
+  // file meanwhile, the last one to finish is kept.
+  shared_ptr<const BodyFile> file;
+  string real_path;
+  int fd = root_dir_.empty() ? ::open(path.c_str(), O_RDONLY | O_CLOEXEC)
+                             : open_beneath(root_dir_, path);
+  if (fd != -1) {
+    file.reset(new BodyFile(fd));
+    if (fstat(fd, st) == -1) {
+      file.reset();
+    } else if (!real_path_of(fd, &real_path) || (real_path == path)) {
+      real_path.clear();
+    }
+  }
+
+  pthread_mutex_lock(&shard->lock);
+  it = shard->slots.find(path);
+  if (it == shard->slots.end()) {
+    shard->lru.push_front(path);
+    it = shard->slots.emplace(path, Slot()).first;
+    it->second.lru_pos = shard->lru.begin();
+  } else {
+    shard->lru.splice(shard->lru.begin(), shard->lru, it->second.lru_pos);
+  }
+  it->second.file = file;
+  it->second.real_path = std::move(real_path);
+  it->second.opened_ms = now;
+  while (shard->slots.size() > shard_max_files_) {
+    // Only the cache's reference goes; the file stays open for anyone
+    // still sending it.
+    shard->slots.erase(shard->lru.back());
+    shard->lru.pop_back();
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return file;
+}
+
+void OpenFileCache::invalidate(const std::vector<string> &paths) {
+  std::unordered_set<string> path_set(paths.begin(), paths.end());
+  for (Shard &shard : shards_) {
+    pthread_mutex_lock(&shard.lock);
+    for (auto it = shard.slots.begin(); it != shard.slots.end(); ) {
+      if (IsChanged(it->first, path_set) ||
+          (!it->second.real_path.empty() &&
+           IsChanged(it->second.real_path, path_set))) {
+        shard.lru.erase(it->second.lru_pos);
+        it = shard.slots.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    pthread_mutex_unlock(&shard.lock);
+  }
+}
+
+size_t OpenFileCache::size() {
+  size_t size = 0;
+  for (Shard &shard : shards_) {
+    pthread_mutex_lock(&shard.lock);
+    size += shard.slots.size();
+    pthread_mutex_unlock(&shard.lock);
+  }
+  return size;
+}
+
+OpenFileCache::Shard *OpenFileCache::ShardFor(const string &path) {
+  return &shards_[std::hash<string>()(path) % kNumShards];
+}
+
+}  // namespace searchserver
@@ -0,0 +1,119 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef OPENFILECACHE_H_
+#define OPENFILECACHE_H_
+
+extern "C" {
+  #include <pthread.h>  // for the pthread threading/mutex functions
+}
+
+#include <sys/stat.h>
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "./HttpResponse.h"
+
+namespace searchserver {
+
+// Static files, kept open, so that serving one doesn't cost an open()
+// and a close(), and the walk of its path that open() does, every
+// time.  Up to a number of files are kept open; beyond that, the least
+// recently used are let go.
+//
+// The files are BodyFiles, shared by reference count with every
+// response that is sending them, so letting one go never closes a
+// descriptor that is in use: it is closed once the last response is
+// done with it.  Responses only read files with pread()/sendfile() at
+// offsets of their own, so they can share a descriptor.
+//
+// That a file can't be opened (e.g., a precompressed sibling that
+// isn't there) is remembered too.  Whatever is remembered is trusted
+// for a while, after which the file is opened again; and invalidate()
+// forgets files straight away, whether it is told of the path they
+// were opened by or, for one opened through a symbolic link, of where
+// they really are.  A file that is changed in place is
+// seen at once, though, as its stat is always fresh.
+//
+// An OpenFileCache is thread-safe, and split into shards by the hash
+// of the path, as StaticFileCache is.
+class OpenFileCache {
+ public:
+  // Creates a cache that keeps up to "max_files" files open, and opens
+  // each again once it has been open for "revalidate_ms".  If
+  // "root_dir" is given, files are opened with open_beneath() it, and
+  // one outside it can't be.
+  OpenFileCache(size_t max_files, uint32_t revalidate_ms,
+                const std::string &root_dir = "");
+  virtual ~OpenFileCache();
+
+  // Returns the file at "path" (which should be canonical, see
+  // is_path_safe()) opened read-only, and sets "*st" to what fstat()
+  // says about it now.  Returns nullptr if it can't be opened.
+  std::shared_ptr<const BodyFile> open(const std::string &path,
+                                       struct stat *st);
+
+  // Forgets every file among "paths", or below a directory among them,
+  // as StaticFileCache::invalidate() does.
+  void invalidate(const std::vector<std::string> &paths);
+
+  uint64_t hits() const { return hits_; }
+  uint64_t misses() const { return misses_; }
+
+  // The number of files (and failures to open one) remembered.
+  size_t size();
+
+  OpenFileCache(const OpenFileCache &other) = delete;
+  OpenFileCache &operator=(const OpenFileCache &other) = delete;
+
+ private:
+  static const int kNumShards = 16;
+
+  // A remembered file, or nullptr if it couldn't be opened, with when
+  // it was opened (see TimerWheel::NowMs) and its place in the LRU
+  // list.
+  struct Slot {
+    std::shared_ptr<const BodyFile> file;
+
+    // The file's canonical path, if it isn't the one it was opened by.
+    std::string real_path;
+    uint64_t opened_ms;
+    std::list<std::string>::iterator lru_pos;
+  };
+
+  // One part of the cache, with its share of the files.  The most
+  // recently used are at the front of "lru".
+  struct Shard {
+    pthread_mutex_t lock;
+    std::unordered_map<std::string, Slot> slots;
+    std::list<std::string> lru;
+  };
+
+  Shard *ShardFor(const std::string &path);
+
+  const size_t shard_max_files_;
+  const uint32_t revalidate_ms_;
+  const std::string root_dir_;
+  Shard shards_[kNumShards];
+
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+};
+
+}  // namespace searchserver
+
+#endif  // OPENFILECACHE_H_
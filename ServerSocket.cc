@@ -10,6 +10,8 @@
  */
 
 #include <cstdio>       // for snprintf()
+#include <fcntl.h>       // for fcntl()
+#include <poll.h>        // for poll()
 #include <unistd.h>      // for close(), fcntl()
 #include <sys/types.h>   // for socket(), getaddrinfo(), etc.
 #include <sys/socket.h>  // for socket(), getaddrinfo(), etc.
@@ -23,8 +25,9 @@
 
 namespace searchserver {
 
-ServerSocket::ServerSocket(uint16_t port) {
+ServerSocket::ServerSocket(uint16_t port, bool reuse_port) {
   port_ = port;
+  reuse_port_ = reuse_port;
   listen_sock_fd_ = -1;
 }
 
@@ -89,7 +92,7 @@ bool ServerSocket::bind_and_listen(int *listen_fd) {
       // Creating this socket failed.  So, loop to the next returned
       // result and try again.
       std::cerr << "socket() failed: " << strerror(errno) << std::endl;
-      fd = 0;
+      fd = -1;
       continue;
     }
 
@@ -101,6 +104,18 @@ bool ServerSocket::bind_and_listen(int *listen_fd) {
     setsockopt(fd, SOL_SOCKET, SO_REUSEADDR,
                &optval, sizeof(optval));
 
+    // If asked to, also let other sockets bind to this same port so
+    // that each can have its own accept queue.
+    if (reuse_port_ &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT,
+                   &optval, sizeof(optval)) != 0) {
+      std::cerr << "setsockopt(SO_REUSEPORT) failed: "
+                << strerror(errno) << std::endl;
+      close(fd);
+      fd = -1;
+      continue;
+    }
+
     // Try binding the socket to the address and port number returned
     // by getaddrinfo().
     if (bind(fd, rp->ai_addr, rp->ai_addrlen) == 0) {
@@ -132,11 +147,29 @@ bool ServerSocket::bind_and_listen(int *listen_fd) {
     return false;
   }
 
-  listen_sock_fd_ = fd;
+  if (!adopt(fd)) {
+    return false;
+  }
   *listen_fd = fd;
   return true;
 }
 
+bool ServerSocket::adopt(int listen_fd) {
+  int flags = fcntl(listen_fd, F_GETFL, 0);
+  if ((flags == -1) ||
+      (fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) == -1)) {
+    std::cerr << "Couldn't make the listening socket non-blocking: "
+              << strerror(errno) << std::endl;
+    close(listen_fd);
+    return false;
+  }
+  if (listen_sock_fd_ != -1) {
+    close(listen_sock_fd_);
+  }
+  listen_sock_fd_ = listen_fd;
+  return true;
+}
+
 bool ServerSocket::accept_client(int *accepted_fd,
                           std::string *client_addr,
                           uint16_t *client_port,
@@ -150,37 +183,13 @@ bool ServerSocket::accept_client(int *accepted_fd,
 
   // TODO: implement
 
-  if (listen_sock_fd_ <= 0) {
-    // We failed to bind/listen to a socket.  Quit with failure.
-    std::cerr << "Couldn't bind to any addresses." << std::endl;
-    return EXIT_FAILURE;
-  }
-
   struct sockaddr_storage caddr;
   socklen_t caddr_len = sizeof(caddr);
-  int client_fd;
-
-  while(1){
-    client_fd = accept(listen_sock_fd_,
-                        reinterpret_cast<struct sockaddr *>(&caddr),
-                        &caddr_len);
-    if (client_fd < 0) {
-      if ((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK)) {
-        continue;
-      }
-      std::cerr << "Failure on accept: " << strerror(errno) << std::endl;
-      return false;
-    } else {
-      break;
-    }
-  }  
-  *accepted_fd = client_fd;
-
-  char astring[INET6_ADDRSTRLEN];
-  struct sockaddr_in6 *in6 = reinterpret_cast<struct sockaddr_in6 *>(reinterpret_cast<struct sockaddr *>(&caddr));
-  inet_ntop(AF_INET6, &(in6->sin6_addr), astring, INET6_ADDRSTRLEN);
-  *client_addr = astring;
-  *client_port = ntohs(in6->sin6_port);
+  if (!accept_client(accepted_fd, &caddr, &caddr_len)) {
+    return false;
+  }
+  format_address(reinterpret_cast<struct sockaddr *>(&caddr),
+                 client_addr, client_port);
 
   char hostname[1024];  // ought to be big enough.
   if (getnameinfo(reinterpret_cast<struct sockaddr *>(&caddr), caddr_len, hostname, 1024, nullptr, 0, 0) != 0) {
@@ -191,12 +200,11 @@ bool ServerSocket::accept_client(int *accepted_fd,
   char hname[1024];
   hname[0] = '\0';
 
-  struct sockaddr_in6 srvr;
+  struct sockaddr_storage srvr;
   socklen_t srvrlen = sizeof(srvr);
-  char addrbuf[INET6_ADDRSTRLEN];
-  getsockname(client_fd, (struct sockaddr *) &srvr, &srvrlen);
-  inet_ntop(AF_INET6, &srvr.sin6_addr, addrbuf, INET6_ADDRSTRLEN);
-  *server_addr = std::string(addrbuf);
+  uint16_t server_port;
+  getsockname(*accepted_fd, (struct sockaddr *) &srvr, &srvrlen);
+  format_address((struct sockaddr *) &srvr, server_addr, &server_port);
   // Get the server's dns name, or return it's IP address as
   // a substitute if the dns lookup fails.
   getnameinfo((const struct sockaddr *) &srvr,
@@ -206,4 +214,74 @@ bool ServerSocket::accept_client(int *accepted_fd,
   return true;
 }
 
+bool ServerSocket::accept_client(int *accepted_fd,
+                                 struct sockaddr_storage *client_addr,
+                                 socklen_t *client_addr_len,
+                                 int wake_fd) const {
+  *accepted_fd = -1;
+  if (listen_sock_fd_ <= 0) {
+    // We failed to bind/listen to a socket.  Quit with failure.
+    std::cerr << "Couldn't bind to any addresses." << std::endl;
+    return false;
+  }
+
+  int client_fd;
+  while(1){
+    *client_addr_len = sizeof(*client_addr);
+    client_fd = accept(listen_sock_fd_,
+                        reinterpret_cast<struct sockaddr *>(client_addr),
+                        client_addr_len);
+    if (client_fd < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        // No client yet, or someone else took it; wait for the next.
+        if (!wait_for_client(wake_fd)) {
+          return false;
+        }
+        continue;
+      }
+      if ((errno == EINTR) || (errno == ECONNABORTED)) {
+        continue;
+      }
+      std::cerr << "Failure on accept: " << strerror(errno) << std::endl;
+      return false;
+    } else {
+      break;
+    }
+  }
+  *accepted_fd = client_fd;
+  return true;
+}
+
+bool ServerSocket::wait_for_client(int wake_fd) const {
+  struct pollfd fds[2];
+  fds[0].fd = listen_sock_fd_;
+  fds[0].events = POLLIN;
+  fds[1].fd = wake_fd;  // poll() ignores it if it is -1
+  fds[1].events = POLLIN;
+  while (poll(fds, 2, -1) == -1) {
+    if (errno != EINTR) {
+      std::cerr << "poll() failed: " << strerror(errno) << std::endl;
+      return false;
+    }
+  }
+  return (fds[1].revents & POLLIN) == 0;
+}
+
+void format_address(const struct sockaddr *addr, std::string *ip,
+                    uint16_t *port) {
+  char astring[INET6_ADDRSTRLEN];
+  if (addr->sa_family == AF_INET) {
+    const struct sockaddr_in *in4 =
+      reinterpret_cast<const struct sockaddr_in *>(addr);
+    inet_ntop(AF_INET, &(in4->sin_addr), astring, INET6_ADDRSTRLEN);
+    *port = ntohs(in4->sin_port);
+  } else {
+    const struct sockaddr_in6 *in6 =
+      reinterpret_cast<const struct sockaddr_in6 *>(addr);
+    inet_ntop(AF_INET6, &(in6->sin6_addr), astring, INET6_ADDRSTRLEN);
+    *port = ntohs(in6->sin6_port);
+  }
+  *ip = astring;
+}
+
 }  // namespace searchserver
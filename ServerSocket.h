@@ -32,7 +32,12 @@ class ServerSocket {
   // This constructor creates a new ServerSocket object and associates
   // it with the provided port number.  The constructor doesn't create
   // a socket yet; it just memorizes the given port.
-  explicit ServerSocket(uint16_t port);
+  //
+  // If "reuse_port" is true, the listening socket is created with
+  // SO_REUSEPORT, so several ServerSockets (each with reuse_port set)
+  // can listen on the same port at once and the kernel spreads
+  // incoming connections across them.
+  explicit ServerSocket(uint16_t port, bool reuse_port = false);
 
   // The destructor closes the listening socket if it is open.
   virtual ~ServerSocket();
@@ -48,8 +53,22 @@ class ServerSocket {
   //
   // - listen_fd: the file descriptor for the listening socket.
   //              which should be the same value as listen_fd_
+  //
+  // The listening socket is non-blocking: accept_client() waits for
+  // clients in poll(), so that it can't get stuck in accept() when a
+  // client it was told about is taken by someone else sharing the
+  // socket (see adopt()).
   bool bind_and_listen(int *listen_fd);
 
+  // Instead of bind_and_listen(), makes the ServerSocket use
+  // "listen_fd", a socket that is already bound and listening, e.g.,
+  // one handed over by the server process this one replaces.  Takes
+  // ownership of listen_fd.  Returns false if it can't be used.
+  bool adopt(int listen_fd);
+
+  // Returns the listening socket, or -1 if there is none yet.
+  int listen_fd() const { return listen_sock_fd_; }
+
   // This function causes the ServerSocket to attempt to accept
   // an incoming connection from a client.  On failure, returns false.
   // On success, it returns true, and also returns (via output
@@ -78,11 +97,36 @@ class ServerSocket {
                      std::string *client_dns_name, std::string *server_addr,
                      std::string *server_dns_name) const;
 
+  // A cheaper version of the above for the server's accept loop.  It
+  // only returns the new file descriptor and the client's raw address
+  // (through "client_addr" and "client_addr_len"); it makes no other
+  // system calls and does no DNS lookups.  Use format_address(),
+  // getsockname() and a DnsResolver to get the rest when needed.
+  //
+  // If "wake_fd" isn't -1, waiting for a client is abandoned as soon
+  // as wake_fd becomes readable; false is returned then, too, with
+  // *accepted_fd set to -1.
+  bool accept_client(int *accepted_fd,
+                     struct sockaddr_storage *client_addr,
+                     socklen_t *client_addr_len,
+                     int wake_fd = -1) const;
+
  private:
+  // Blocks until a client may be waiting to be accepted.  Returns
+  // false if "wake_fd" (unless it is -1) became readable first, or if
+  // the wait failed.
+  bool wait_for_client(int wake_fd) const;
+
   uint16_t port_;
+  bool reuse_port_;
   int listen_sock_fd_;
 };
 
+// Returns a printable representation of the IP address in "addr"
+// through "ip", and its port number through "port".
+void format_address(const struct sockaddr *addr, std::string *ip,
+                    uint16_t *port);
+
 }  // namespace searchserver
 
 #endif  // SERVERSOCKET_H_
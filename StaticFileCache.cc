@@ -0,0 +1,198 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <functional>
+#include <iterator>
+#include <string>
+#include <unordered_set>
+
+#include "./FileWatcher.h"
+#include "./StaticFileCache.h"
+#include "./TimerWheel.h"
+
+using std::shared_ptr;
+using std::string;
+
+namespace searchserver {
+
+///////////////////////////////////////////////////////////////////////////////
+// Constants, internal helper functions
+///////////////////////////////////////////////////////////////////////////////
+
+// What an entry costs against the budget beyond its key, header and
+// body: roughly what the map, the list and the Entry take to hold it.
+static const size_t kEntryOverhead = 256;
+
+static int64_t MtimeNs(const struct stat &st) {
+  return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+         st.st_mtim.tv_nsec;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// StaticFileCache
+///////////////////////////////////////////////////////////////////////////////
+StaticFileCache::StaticFileCache(size_t budget_bytes, size_t max_entry_bytes,
+                                 uint32_t revalidate_ms)
+  : shard_budget_bytes_(budget_bytes / kNumShards),
+    max_entry_bytes_(max_entry_bytes), revalidate_ms_(revalidate_ms) {
+  for (Shard &shard : shards_) {
+    pthread_mutex_init(&shard.lock, nullptr);
+  }
+}
+
+StaticFileCache::~StaticFileCache() {
+  for (Shard &shard : shards_) {
+    pthread_mutex_destroy(&shard.lock);
+  }
+}
+
+shared_ptr<const StaticFileCache::Entry> StaticFileCache::get(
+    const string &key, bool count_miss) {
+  Shard *shard = ShardFor(key);
+  uint64_t now = TimerWheel::NowMs();
+  pthread_mutex_lock(&shard->lock);
+  auto it = shard->slots.find(key);
+  if (it == shard->slots.end()) {
+    pthread_mutex_unlock(&shard->lock);
+    if (count_miss) {
+      misses_++;
+    }
+    return nullptr;
+  }
+  shared_ptr<const Entry> entry = it->second.entry;
+  bool check = (now - it->second.checked_ms >= revalidate_ms_);
+  shard->lru.splice(shard->lru.begin(), shard->lru, it->second.lru_pos);
+  pthread_mutex_unlock(&shard->lock);
+  if (!check) {
+    hits_++;
+    return entry;
+  }
+
+  // The sources are looked at without the lock held.  Whatever is in
+  // the slot by the time we have, if it is still this entry, is now
+  // known to be current, or is dropped.
+  bool current = Current(*entry);
+  pthread_mutex_lock(&shard->lock);
+  it = shard->slots.find(key);
+  if ((it != shard->slots.end()) && (it->second.entry == entry)) {
+    if (current) {
+      it->second.checked_ms = now;
+    } else {
+      Erase(shard, it);
+    }
+  }
+  pthread_mutex_unlock(&shard->lock);
+  if (!current) {
+    if (count_miss) {
+      misses_++;
+    }
+    return nullptr;
+  }
+  hits_++;
+  return entry;
+}
+
+void StaticFileCache::put(const string &key, shared_ptr<const Entry> entry) {
+  size_t response_bytes =
+    entry->header.size() + (entry->body ? entry->body->size() : 0);
+  size_t cost = key.size() + response_bytes + kEntryOverhead;
+  if ((response_bytes > max_entry_bytes_) || (cost > shard_budget_bytes_)) {
+    return;
+  }
+
+  Shard *shard = ShardFor(key);
+  uint64_t now = TimerWheel::NowMs();
+  pthread_mutex_lock(&shard->lock);
+  auto it = shard->slots.find(key);
+  if (it != shard->slots.end()) {
+    Erase(shard, it);
+  }
+  while (!shard->lru.empty() &&
+         (shard->used_bytes + cost > shard_budget_bytes_)) {
+    Erase(shard, shard->slots.find(shard->lru.back()));
+  }
+  shard->lru.push_front(key);
+  Slot &slot = shard->slots[key];
+  slot.entry = std::move(entry);
+  slot.checked_ms = now;
+  slot.cost = cost;
+  slot.lru_pos = shard->lru.begin();
+  shard->used_bytes += cost;
+  pthread_mutex_unlock(&shard->lock);
+}
+
+void StaticFileCache::invalidate(const std::vector<string> &paths) {
+  std::unordered_set<string> path_set(paths.begin(), paths.end());
+  for (Shard &shard : shards_) {
+    pthread_mutex_lock(&shard.lock);
+    for (auto it = shard.slots.begin(); it != shard.slots.end(); ) {
+      auto next = std::next(it);
+      for (const Source &source : it->second.entry->sources) {
+        if (IsChanged(source.path, path_set)) {
+          Erase(&shard, it);
+          break;
+        }
+      }
+      it = next;
+    }
+    pthread_mutex_unlock(&shard.lock);
+  }
+}
+
+StaticFileCache::Source StaticFileCache::SourceOf(const string &path,
+                                                  const struct stat &st) {
+  return Source{path, st.st_ino, st.st_size, MtimeNs(st)};
+}
+
+StaticFileCache::Source StaticFileCache::AbsenceOf(const string &path) {
+  return Source{path, 0, 0, 0, false};
+}
+
+size_t StaticFileCache::size() {
+  size_t size = 0;
+  for (Shard &shard : shards_) {
+    pthread_mutex_lock(&shard.lock);
+    size += shard.used_bytes;
+    pthread_mutex_unlock(&shard.lock);
+  }
+  return size;
+}
+
+StaticFileCache::Shard *StaticFileCache::ShardFor(const string &key) {
+  return &shards_[std::hash<string>()(key) % kNumShards];
+}
+
+void StaticFileCache::Erase(
+    Shard *shard, std::unordered_map<string, Slot>::iterator it) {
+  shard->used_bytes -= it->second.cost;
+  shard->lru.erase(it->second.lru_pos);
+  shard->slots.erase(it);
+}
+
+bool StaticFileCache::Current(const Entry &entry) {
+  for (const Source &source : entry.sources) {
+    struct stat st;
+    if (stat(source.path.c_str(), &st) == -1) {
+      if (source.present) {
+        return false;
+      }
+      continue;
+    }
+    if (!source.present ||
+        (st.st_ino != source.ino) || (st.st_size != source.size) ||
+        (MtimeNs(st) != source.mtime_ns)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace searchserver
@@ -0,0 +1,148 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef STATICFILECACHE_H_
+#define STATICFILECACHE_H_
+
+extern "C" {
+  #include <pthread.h>  // for the pthread threading/mutex functions
+}
+
+#include <sys/stat.h>
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace searchserver {
+
+// Whole responses to static file requests, kept in memory so that a
+// popular file is answered without touching the disk: the header block
+// is already serialized, and the body is shared by every response that
+// sends it.  Up to a budget of bytes are kept; beyond that, the least
+// recently used go.
+//
+// A StaticFileCache is thread-safe.  It is split into shards, each with
+// its own lock, by the hash of the key, so that threads looking up
+// different files rarely wait for one another.
+class StaticFileCache {
+ public:
+  // A file that a cached response was made from, and the version of it
+  // that was used; or, if "present" is false, a file that was looked
+  // for and not found, whose appearance would change the response.
+  // While every one of an entry's files is unchanged, the entry is
+  // current.
+  struct Source {
+    std::string path;
+    ino_t ino;
+    off_t size;
+    int64_t mtime_ns;
+    bool present = true;
+  };
+
+  // A cached response.
+  struct Entry {
+    // The status line and headers, ending with the blank line.
+    std::string header;
+    std::shared_ptr<const std::string> body;
+    std::vector<Source> sources;
+  };
+
+  // Creates a cache of at most "budget_bytes" in all, of responses of
+  // at most "max_entry_bytes" each.  An entry's sources are stat()ed
+  // again when it is used, if it has been more than "revalidate_ms"
+  // since they last were; until then, a change to them may go unseen.
+  StaticFileCache(size_t budget_bytes, size_t max_entry_bytes,
+                  uint32_t revalidate_ms);
+  virtual ~StaticFileCache();
+
+  // Returns the entry for "key" if there is one and it is current, or
+  // nullptr.  Counts a hit, or a miss unless "count_miss" is false
+  // (for a caller that will look again before it makes the response).
+  std::shared_ptr<const Entry> get(const std::string &key,
+                                   bool count_miss = true);
+
+  // Adds "entry" under "key", replacing any that is there, if it is
+  // small enough.  Its sources must have been stat()ed before the
+  // response was made.
+  void put(const std::string &key, std::shared_ptr<const Entry> entry);
+
+  // Drops every entry made from one of "paths", or from a file below a
+  // directory among them.  This is how a FileWatcher tells the cache
+  // about changes, so that entries can be trusted for long stretches
+  // between stat()s.
+  void invalidate(const std::vector<std::string> &paths);
+
+  // Returns a Source for the file "path" that "st" describes.
+  static Source SourceOf(const std::string &path, const struct stat &st);
+
+  // Returns a Source for "path", where there is no file.
+  static Source AbsenceOf(const std::string &path);
+
+  // The most a response can take up and still be cached.
+  size_t max_entry_bytes() const { return max_entry_bytes_; }
+
+  uint64_t hits() const { return hits_; }
+  uint64_t misses() const { return misses_; }
+
+  // The number of bytes counted against the budget.
+  size_t size();
+
+  StaticFileCache(const StaticFileCache &other) = delete;
+  StaticFileCache &operator=(const StaticFileCache &other) = delete;
+
+ private:
+  static const int kNumShards = 16;
+
+  // An entry as it is kept, with when its sources were last checked
+  // (see TimerWheel::NowMs) and its place in the LRU list.
+  struct Slot {
+    std::shared_ptr<const Entry> entry;
+    uint64_t checked_ms;
+    size_t cost;
+    std::list<std::string>::iterator lru_pos;
+  };
+
+  // One part of the cache, with its own share of the budget.  The most
+  // recently used entries are at the front of "lru".
+  struct Shard {
+    pthread_mutex_t lock;
+    std::unordered_map<std::string, Slot> slots;
+    std::list<std::string> lru;
+    size_t used_bytes = 0;
+  };
+
+  Shard *ShardFor(const std::string &key);
+
+  // Removes the slot at "it" from "shard".  Must hold shard->lock.
+  static void Erase(Shard *shard,
+                    std::unordered_map<std::string, Slot>::iterator it);
+
+  // Returns true if every source of "entry" is as it was.
+  static bool Current(const Entry &entry);
+
+
+  const size_t shard_budget_bytes_;
+  const size_t max_entry_bytes_;
+  const uint32_t revalidate_ms_;
+  Shard shards_[kNumShards];
+
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+};
+
+}  // namespace searchserver
+
+#endif  // STATICFILECACHE_H_
@@ -51,6 +51,7 @@ class ThreadPool {
     // "f" is the task function that a worker thread should invoke to
     // process the task.
     explicit Task(thread_task_fn func) : func_(func) { }
+    virtual ~Task() { }
 
     // The dispatch function.
     thread_task_fn func_;
@@ -0,0 +1,177 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <sys/socket.h>
+#include <time.h>
+#include <iostream>
+#include <vector>
+
+#include "./Timeouts.h"
+
+using std::cout;
+using std::endl;
+using std::vector;
+
+namespace searchserver {
+
+///////////////////////////////////////////////////////////////////////////////
+// Constants, internal helper functions
+///////////////////////////////////////////////////////////////////////////////
+
+// At most how often ConnectionStats prints its counts.
+static const uint64_t kReportIntervalMs = 10000;
+
+// The watchdog thread wakes at least this often, so that a deadline
+// armed while it sleeps is never missed by much more than this.
+static const int kMaxWatchdogSleepMs = 1000;
+
+void ResetOnClose(int fd) {
+  struct linger linger;
+  linger.l_onoff = 1;
+  linger.l_linger = 0;
+  setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ConnectionStats
+///////////////////////////////////////////////////////////////////////////////
+void ConnectionStats::record_timeout(TimeoutKind kind) {
+  timeouts_[static_cast<int>(kind)]++;
+
+  // Only the thread that gets to move last_report_ms_ forward prints.
+  uint64_t now = TimerWheel::NowMs();
+  uint64_t last = last_report_ms_;
+  if ((now - last < kReportIntervalMs) ||
+      !last_report_ms_.compare_exchange_strong(last, now)) {
+    return;
+  }
+  cout << "  timeouts: " << timeouts(TimeoutKind::kIdle) << " idle, "
+       << timeouts(TimeoutKind::kHeader) << " header, "
+       << timeouts(TimeoutKind::kBody) << " body; "
+       << closed() << " connections closed" << endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Watchdog
+///////////////////////////////////////////////////////////////////////////////
+void Watchdog::Deadline::arm(TimeoutKind kind) {
+  uint32_t limit = watchdog_->options_.limit(kind);
+  armed_ms_ = TimerWheel::NowMs();
+  pthread_mutex_lock(&watchdog_->lock_);
+  if (limit == 0) {
+    watchdog_->wheel_.cancel(&timer_);
+  } else {
+    kind_ = kind;
+    timer_.data = reinterpret_cast<uint64_t>(this);
+    watchdog_->wheel_.schedule(&timer_, armed_ms_ + limit);
+  }
+  pthread_mutex_unlock(&watchdog_->lock_);
+}
+
+void Watchdog::Deadline::touch() {
+  uint64_t now = TimerWheel::NowMs();
+  if (now - armed_ms_ < kTimeoutTickMs) {
+    return;
+  }
+  armed_ms_ = now;
+  pthread_mutex_lock(&watchdog_->lock_);
+  if (timer_.armed()) {
+    watchdog_->wheel_.schedule(&timer_,
+                               now + watchdog_->options_.limit(kind_));
+  }
+  pthread_mutex_unlock(&watchdog_->lock_);
+}
+
+void Watchdog::Deadline::cancel() {
+  // Once this returns, the watchdog can't touch fd_ any more, so the
+  // caller may close it.
+  pthread_mutex_lock(&watchdog_->lock_);
+  watchdog_->wheel_.cancel(&timer_);
+  pthread_mutex_unlock(&watchdog_->lock_);
+}
+
+Watchdog::Watchdog(const TimeoutOptions &options, ConnectionStats *stats)
+  : options_(options), stats_(stats),
+    wheel_(TimerWheel::NowMs(), kTimeoutTickMs), stop_(false) {
+  pthread_mutex_init(&lock_, nullptr);
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&cond_, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_create(&thread_, nullptr, &watchdog_thread,
+                 static_cast<void *>(this));
+}
+
+Watchdog::~Watchdog() {
+  pthread_mutex_lock(&lock_);
+  stop_ = true;
+  pthread_cond_broadcast(&cond_);
+  pthread_mutex_unlock(&lock_);
+
+  pthread_join(thread_, nullptr);
+  pthread_cond_destroy(&cond_);
+  pthread_mutex_destroy(&lock_);
+}
+
+void Watchdog::expire_all() {
+  vector<TimerWheel::Timer *> expired;
+  pthread_mutex_lock(&lock_);
+  wheel_.expire_all(&expired);
+  for (TimerWheel::Timer *timer : expired) {
+    Deadline *deadline = reinterpret_cast<Deadline *>(timer->data);
+    ResetOnClose(deadline->fd_);
+    shutdown(deadline->fd_, SHUT_RDWR);
+    stats_->record_timeout(deadline->kind_);
+  }
+  pthread_mutex_unlock(&lock_);
+}
+
+void *Watchdog::watchdog_thread(void *arg) {
+  static_cast<Watchdog *>(arg)->watchdog_loop();
+  return nullptr;
+}
+
+void Watchdog::watchdog_loop() {
+  vector<TimerWheel::Timer *> expired;
+  pthread_mutex_lock(&lock_);
+  while (!stop_) {
+    expired.clear();
+    wheel_.advance(TimerWheel::NowMs(), &expired);
+    for (TimerWheel::Timer *timer : expired) {
+      // The serving thread notices on its next (or current) read or
+      // write, and closes the connection itself.
+      Deadline *deadline = reinterpret_cast<Deadline *>(timer->data);
+      if (deadline->kind_ == TimeoutKind::kBody) {
+        ResetOnClose(deadline->fd_);
+      }
+      shutdown(deadline->fd_, SHUT_RDWR);
+      stats_->record_timeout(deadline->kind_);
+    }
+
+    int sleep_ms = wheel_.next_timeout_ms(TimerWheel::NowMs());
+    if ((sleep_ms < 0) || (sleep_ms > kMaxWatchdogSleepMs)) {
+      sleep_ms = kMaxWatchdogSleepMs;
+    }
+    struct timespec until;
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    until.tv_sec += sleep_ms / 1000;
+    until.tv_nsec += (sleep_ms % 1000) * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&cond_, &lock_, &until);
+  }
+  pthread_mutex_unlock(&lock_);
+}
+
+}  // namespace searchserver
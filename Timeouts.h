@@ -0,0 +1,185 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef TIMEOUTS_H_
+#define TIMEOUTS_H_
+
+extern "C" {
+  #include <pthread.h>  // for the pthread threading/mutex functions
+}
+
+#include <atomic>
+#include <cstdint>
+
+#include "./TimerWheel.h"
+
+namespace searchserver {
+
+// The deadlines a client connection can miss.
+enum class TimeoutKind {
+  // Waiting, between requests, for the first byte of the next one.
+  kIdle,
+
+  // Waiting for the rest of a request header once it has started.
+  kHeader,
+
+  // Sending a response to a client that is not reading it; restarted
+  // whenever more of the response has been written.
+  kBody,
+};
+
+// How long, in milliseconds, a connection may spend in each state
+// before the server hangs up on it.  0 means no limit.  "drain_ms" is
+// how long a draining server lets the connections it has finish what
+// they are doing before it closes them; there, 0 means not at all.
+struct TimeoutOptions {
+  uint32_t idle_ms = 15000;
+  uint32_t header_ms = 10000;
+  uint32_t body_ms = 60000;
+  uint32_t drain_ms = 30000;
+
+  uint32_t limit(TimeoutKind kind) const {
+    switch (kind) {
+      case TimeoutKind::kIdle:   return idle_ms;
+      case TimeoutKind::kHeader: return header_ms;
+      default:                   return body_ms;
+    }
+  }
+};
+
+// Works out which deadline applies to a connection that an event
+// loop is serving, when the server isn't busy with one of its
+// requests (there is no deadline then): kBody while a response is
+// being sent, kHeader while part of a request has arrived, and kIdle
+// otherwise.
+inline TimeoutKind CurrentDeadline(bool sending, bool partial_request) {
+  if (sending) {
+    return TimeoutKind::kBody;
+  }
+  return partial_request ? TimeoutKind::kHeader : TimeoutKind::kIdle;
+}
+
+// Makes close() of the socket "fd" reset the connection instead of
+// lingering to deliver whatever is still queued for the client.  Used
+// on clients that missed a kBody deadline, so that they can't keep
+// holding kernel buffers by not reading.
+void ResetOnClose(int fd);
+
+// The granularity of every timeout, in milliseconds.
+static const uint32_t kTimeoutTickMs = 100;
+
+// Counts of timeouts and of opened and closed connections, shared by
+// every loop and thread of a server.  Safe to use from any thread.
+class ConnectionStats {
+ public:
+  ConnectionStats() : last_report_ms_(0) { }
+
+  // Records that a connection missed a deadline of kind "kind".  Every
+  // so often, this prints a summary of the counts to cout.
+  void record_timeout(TimeoutKind kind);
+
+  // Records that a connection was accepted, and that it was closed,
+  // for whatever reason.  Every accepted connection must eventually
+  // be recorded as closed.
+  void record_open() { opened_++; }
+  void record_close() { closed_++; }
+
+  uint64_t timeouts(TimeoutKind kind) const {
+    return timeouts_[static_cast<int>(kind)];
+  }
+  uint64_t closed() const { return closed_; }
+
+  // The number of connections accepted but not yet closed.
+  uint64_t open() const { return opened_ - closed_; }
+
+ private:
+  std::atomic<uint64_t> timeouts_[3] = { {0}, {0}, {0} };
+  std::atomic<uint64_t> opened_{0};
+  std::atomic<uint64_t> closed_{0};
+  std::atomic<uint64_t> last_report_ms_;
+};
+
+// A Watchdog enforces deadlines on connections that are served with
+// blocking I/O, i.e., by a thread that may be stuck in read() or
+// write() on the client.  Its own thread keeps the deadlines in a
+// TimerWheel, and when one passes, shuts the connection's socket down
+// so that whatever the serving thread is blocked in fails at once.
+class Watchdog {
+ public:
+  // A deadline on one connection, armed and disarmed by the thread
+  // serving it.  Disarms itself when destroyed, which must happen
+  // before the connection's socket is closed.
+  class Deadline {
+   public:
+    Deadline(Watchdog *watchdog, int fd) : watchdog_(watchdog), fd_(fd) { }
+    virtual ~Deadline() { cancel(); }
+
+    // Gives the connection "kind"'s time limit from now, replacing
+    // any deadline it already had.
+    void arm(TimeoutKind kind);
+
+    // Restarts the armed deadline's time limit from now, if it is still
+    // armed; called as a response makes progress, so that kBody limits
+    // how long a client may go without reading rather than how long
+    // the whole response may take.  Cheap enough to call after every
+    // write, since it only re-arms once per timeout tick.
+    void touch();
+
+    // Removes the deadline.
+    void cancel();
+
+    Deadline(const Deadline &other) = delete;
+    Deadline &operator=(const Deadline &other) = delete;
+
+   private:
+    friend class Watchdog;
+    Watchdog *watchdog_;
+    int fd_;
+    TimeoutKind kind_;
+    TimerWheel::Timer timer_;
+
+    // When the deadline was last armed or touched.  Only used by the
+    // serving thread.
+    uint64_t armed_ms_ = 0;
+  };
+
+  // Starts the watchdog thread.  Counts go to "stats".
+  Watchdog(const TimeoutOptions &options, ConnectionStats *stats);
+
+  // Stops the watchdog thread.  Every Deadline must be gone by then.
+  virtual ~Watchdog();
+
+  // Shuts down every connection whose deadline is armed right now, as
+  // if they had all passed; used to cut off a drain.  Those count as
+  // timeouts of the kind that was armed.
+  void expire_all();
+
+  Watchdog(const Watchdog &other) = delete;
+  Watchdog &operator=(const Watchdog &other) = delete;
+
+ private:
+  static void *watchdog_thread(void *arg);
+  void watchdog_loop();
+
+  TimeoutOptions options_;
+  ConnectionStats *stats_;
+
+  // Guards everything below.
+  pthread_mutex_t lock_;
+  pthread_cond_t cond_;
+  TimerWheel wheel_;
+  bool stop_;
+  pthread_t thread_;
+};
+
+}  // namespace searchserver
+
+#endif  // TIMEOUTS_H_
@@ -0,0 +1,155 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <time.h>
+#include <vector>
+
+#include "./TimerWheel.h"
+
+using std::vector;
+
+namespace searchserver {
+
+// static
+uint64_t TimerWheel::NowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+TimerWheel::TimerWheel(uint64_t now_ms, uint32_t tick_ms)
+  : tick_ms_(tick_ms), now_tick_(now_ms / tick_ms), count_(0) {
+  for (int level = 0; level < kLevels; level++) {
+    for (uint64_t slot = 0; slot < kSlots; slot++) {
+      Timer *head = &slots_[level][slot];
+      head->prev = head->next = head;
+    }
+  }
+}
+
+void TimerWheel::schedule(Timer *timer, uint64_t when_ms) {
+  cancel(timer);
+
+  // Round up, so that a timer never fires early, and never put a
+  // timer in the slot for the tick we are on, which has been handled.
+  timer->expires = (when_ms + tick_ms_ - 1) / tick_ms_;
+  if (timer->expires <= now_tick_) {
+    timer->expires = now_tick_ + 1;
+  }
+  insert(timer);
+  count_++;
+}
+
+void TimerWheel::cancel(Timer *timer) {
+  if (!timer->armed()) {
+    return;
+  }
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->prev = timer->next = nullptr;
+  count_--;
+}
+
+void TimerWheel::advance(uint64_t now_ms, vector<Timer *> *expired) {
+  uint64_t target = now_ms / tick_ms_;
+  while (now_tick_ < target) {
+    if (count_ == 0) {
+      // Nothing to expire or cascade, so skip straight there.
+      now_tick_ = target;
+      break;
+    }
+    now_tick_++;
+
+    // When a wheel comes round to its first slot, the next slot of the
+    // wheel above it is due to be spread out over the wheels below.
+    int top = 0;
+    while ((top < kLevels - 1) &&
+           (((now_tick_ >> (kSlotBits * top)) & kSlotMask) == 0)) {
+      top++;
+    }
+    for (int level = top; level > 0; level--) {
+      cascade(level, (now_tick_ >> (kSlotBits * level)) & kSlotMask);
+    }
+
+    Timer *head = &slots_[0][now_tick_ & kSlotMask];
+    while (head->next != head) {
+      Timer *timer = head->next;
+      cancel(timer);
+      expired->push_back(timer);
+    }
+  }
+}
+
+void TimerWheel::expire_all(vector<Timer *> *expired) {
+  for (int level = 0; level < kLevels; level++) {
+    for (uint64_t slot = 0; slot < kSlots; slot++) {
+      Timer *head = &slots_[level][slot];
+      while (head->next != head) {
+        Timer *timer = head->next;
+        cancel(timer);
+        expired->push_back(timer);
+      }
+    }
+  }
+}
+
+int TimerWheel::next_timeout_ms(uint64_t now_ms) const {
+  if (count_ == 0) {
+    return -1;
+  }
+
+  // The first non-empty slot of the finest wheel, unless a cascade
+  // comes first and might bring in something sooner.
+  uint64_t tick = now_tick_ + 1;
+  while (((tick & kSlotMask) != 0) &&
+         (slots_[0][tick & kSlotMask].next == &slots_[0][tick & kSlotMask])) {
+    tick++;
+  }
+  uint64_t when_ms = tick * tick_ms_;
+  return (when_ms > now_ms) ? static_cast<int>(when_ms - now_ms) : 0;
+}
+
+void TimerWheel::insert(Timer *timer) {
+  uint64_t delta = timer->expires - now_tick_;
+
+  // Pick the finest wheel whose range covers the deadline.  Deadlines
+  // beyond the coarsest wheel are parked as far out as it reaches,
+  // and get re-inserted from there.
+  int level = 0;
+  while ((level < kLevels - 1) &&
+         (delta >= (static_cast<uint64_t>(1) << (kSlotBits * (level + 1))))) {
+    level++;
+  }
+  uint64_t expires = timer->expires;
+  uint64_t range = static_cast<uint64_t>(1) << (kSlotBits * kLevels);
+  if (delta >= range) {
+    expires = now_tick_ + range - 1;
+  }
+
+  Timer *head = &slots_[level][(expires >> (kSlotBits * level)) & kSlotMask];
+  timer->prev = head->prev;
+  timer->next = head;
+  head->prev->next = timer;
+  head->prev = timer;
+}
+
+void TimerWheel::cascade(int level, uint64_t slot) {
+  Timer *head = &slots_[level][slot];
+  Timer *timer = head->next;
+  head->prev = head->next = head;
+  while (timer != head) {
+    Timer *next = timer->next;
+    insert(timer);
+    timer = next;
+  }
+}
+
+}  // namespace searchserver
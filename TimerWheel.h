@@ -0,0 +1,107 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef TIMERWHEEL_H_
+#define TIMERWHEEL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace searchserver {
+
+// A TimerWheel keeps track of a large number of timers, each of which
+// expires at some point in the future, such that arming, re-arming
+// and cancelling a timer are all O(1) no matter how many there are.
+//
+// Time is divided into ticks of a fixed number of milliseconds, and
+// a timer expires on the first tick at or after its deadline.  Timers
+// live in a hierarchy of wheels: the first holds one slot per tick for
+// the next 64 ticks, the second one slot per 64 ticks, and so on.  As
+// time moves on, the timers in the next slot of a coarser wheel are
+// "cascaded" down into the finer ones.
+//
+// Timers are intrusive: callers embed a Timer in their own objects,
+// and the wheel only links them together.  A TimerWheel is not
+// thread-safe.
+class TimerWheel {
+ public:
+  // A timer.  "data" is for the owner, e.g., to tell which of its
+  // objects an expired timer belongs to.  The rest is the wheel's.
+  // A Timer must be cancelled before it is destroyed.
+  struct Timer {
+    uint64_t data = 0;
+
+    bool armed() const { return next != nullptr; }
+
+    uint64_t expires = 0;  // in ticks
+    Timer *prev = nullptr;
+    Timer *next = nullptr;
+  };
+
+  // Returns the current time in milliseconds on a monotonic clock.
+  static uint64_t NowMs();
+
+  // Creates a wheel with ticks of "tick_ms" milliseconds, whose clock
+  // starts at "now_ms".
+  TimerWheel(uint64_t now_ms, uint32_t tick_ms);
+  virtual ~TimerWheel() { }
+
+  // Arms "timer" to expire at "when_ms", replacing any deadline it
+  // already had.
+  void schedule(Timer *timer, uint64_t when_ms);
+
+  // Disarms "timer" if it is armed.
+  void cancel(Timer *timer);
+
+  // Moves the wheel's clock forward to "now_ms" and appends every
+  // timer that has expired to "*expired".  Those timers are disarmed
+  // before they are returned.
+  void advance(uint64_t now_ms, std::vector<Timer *> *expired);
+
+  // Disarms every timer and appends it to "*expired", as if they had
+  // all expired at once.
+  void expire_all(std::vector<Timer *> *expired);
+
+  // Returns how many milliseconds after "now_ms" advance() next needs
+  // to be called, or -1 if no timer is armed.
+  int next_timeout_ms(uint64_t now_ms) const;
+
+  // Returns the number of armed timers.
+  size_t size() const { return count_; }
+
+  TimerWheel(const TimerWheel &other) = delete;
+  TimerWheel &operator=(const TimerWheel &other) = delete;
+
+ private:
+  static const int kLevels = 4;
+  static const int kSlotBits = 6;
+  static const uint64_t kSlots = 1 << kSlotBits;
+  static const uint64_t kSlotMask = kSlots - 1;
+
+  // Links "timer" into the slot for its expiry tick, which must not
+  // be before now_tick_.
+  void insert(Timer *timer);
+
+  // Re-inserts every timer in slot "slot" of wheel "level".
+  void cascade(int level, uint64_t slot);
+
+  // Each slot is a circular list headed by a sentinel Timer.
+  Timer slots_[kLevels][kSlots];
+
+  uint32_t tick_ms_;
+  uint64_t now_tick_;
+  size_t count_;
+};
+
+}  // namespace searchserver
+
+#endif  // TIMERWHEEL_H_
@@ -0,0 +1,947 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "./HttpRequest.h"
+#include "./HttpServer.h"
+#include "./UringLoop.h"
+
+using std::cerr;
+using std::endl;
+using std::list;
+using std::pair;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace searchserver {
+
+///////////////////////////////////////////////////////////////////////////////
+// Constants, internal helper functions
+///////////////////////////////////////////////////////////////////////////////
+
+// Submission queue size.  The completion queue is twice this.
+static const unsigned kRingEntries = 1024;
+
+// The provided-buffer pool that client data is received into.
+static const uint16_t kBufGroup = 0;
+static const uint16_t kNumRecvBufs = 256;
+static const size_t kRecvBufSize = 16 * 1024;
+
+// How much of a static file each read -> send pair moves.
+static const size_t kFileChunk = 64 * 1024;
+
+// The longest the loop sleeps while any deadline is armed, so that one
+// armed after the timeout was queued is never missed by much more.
+static const int kMaxTimeoutMs = 1000;
+
+// Each operation's user_data holds the connection id in the upper bits
+// and one of these in the low byte, so completions can be routed.
+enum UringOp {
+  kOpAccept = 1,
+  kOpWake,
+  kOpProvide,
+  kOpRecv,
+  kOpSendData,
+  kOpFileRead,
+  kOpFileSend,
+  kOpTimeout,
+  kOpAcceptPoll,
+  kOpDrain,
+  kOpCancel,
+};
+
+static uint64_t MakeUserData(uint64_t conn_id, UringOp op) {
+  return (conn_id << 8) | op;
+}
+
+// Raw system call wrappers; glibc doesn't provide these.
+static int IoUringSetup(unsigned entries, struct io_uring_params *p) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int IoUringEnter(int fd, unsigned to_submit, unsigned min_complete,
+                        unsigned flags) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit,
+                                  min_complete, flags, nullptr, 0));
+}
+
+static int IoUringRegister(int fd, unsigned opcode, void *arg,
+                           unsigned nr_args) {
+  return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode,
+                                  arg, nr_args));
+}
+
+// A request that isn't a file cache hit, and any requests pipelined
+// behind it, handed to a worker thread.
+class UringLoopTask : public ThreadPool::Task {
+ public:
+  explicit UringLoopTask(ThreadPool::thread_task_fn f)
+    : ThreadPool::Task(f) { }
+
+  UringLoop *loop;
+  uint64_t conn_id;
+  std::vector<HttpRequest> requests;
+};
+
+// Processes a UringLoopTask on a worker thread and posts the
+// responses back to the loop.
+static void UringLoop_ThrFn(ThreadPool::Task *t) {
+  unique_ptr<UringLoopTask> task(static_cast<UringLoopTask *>(t));
+  vector<HttpResponse> responses;
+  responses.reserve(task->requests.size());
+  for (const HttpRequest &request : task->requests) {
+    responses.push_back(ProcessRequest(request, task->loop->base_dir(),
+                                       task->loop->index(),
+                                       task->loop->pool(),
+                                       task->loop->file_cache(),
+                                       task->loop->open_files(),
+                                       task->loop->compressed_files()));
+  }
+  task->loop->post_responses(task->conn_id, &responses);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// UringLoop
+///////////////////////////////////////////////////////////////////////////////
+
+// static
+bool UringLoop::IsSupported() {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = IoUringSetup(4, &params);
+  if (fd == -1) {
+    return false;
+  }
+
+  // Ask the kernel which opcodes it knows about.
+  const unsigned kProbeOps = 256;
+  size_t probe_len = sizeof(struct io_uring_probe) +
+                     kProbeOps * sizeof(struct io_uring_probe_op);
+  unique_ptr<char[]> probe_buf(new char[probe_len]);
+  memset(probe_buf.get(), 0, probe_len);
+  struct io_uring_probe *probe =
+    reinterpret_cast<struct io_uring_probe *>(probe_buf.get());
+  bool ok = IoUringRegister(fd, IORING_REGISTER_PROBE, probe, kProbeOps) == 0;
+  close(fd);
+  if (!ok) {
+    return false;
+  }
+
+  const int needed[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND,
+                         IORING_OP_SENDMSG, IORING_OP_READ,
+                         IORING_OP_PROVIDE_BUFFERS, IORING_OP_TIMEOUT,
+                         IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL };
+  for (int op : needed) {
+    if ((op > probe->last_op) ||
+        !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+UringLoop::UringLoop(int listen_fd, int drain_fd, const string &base_dir,
+                     WordIndex *index, StaticFileCache *file_cache,
+                     OpenFileCache *open_files,
+                     CompressedFileCache *compressed_files,
+                     uint32_t num_workers,
+                     const TimeoutOptions &timeouts, ConnectionStats *stats)
+  : listen_fd_(listen_fd), drain_fd_(drain_fd), base_dir_(base_dir),
+    index_(index), file_cache_(file_cache), open_files_(open_files),
+    compressed_files_(compressed_files),
+    ring_fd_(-1), sq_ptr_(MAP_FAILED), cq_ptr_(MAP_FAILED),
+    sq_ring_size_(0), cq_ring_size_(0),
+    sqes_(static_cast<struct io_uring_sqe *>(MAP_FAILED)), sqes_size_(0),
+    sq_entries_(0), sqe_tail_(0),
+    ring_failed_(false), lost_sqe_(new struct io_uring_sqe),
+    recv_bufs_(new char[kNumRecvBufs * kRecvBufSize]),
+    multishot_accept_(true), accept_armed_(false), wake_fd_(-1),
+    wake_buf_(0), stopping_(false),
+    draining_(false), drain_deadline_ms_(0),
+    timeouts_(timeouts), stats_(stats),
+    wheel_(TimerWheel::NowMs(), kTimeoutTickMs),
+    now_ms_(TimerWheel::NowMs()), timeout_armed_(false),
+    next_conn_id_(1), pool_(new ThreadPool(num_workers)) {
+  pthread_mutex_init(&completions_lock_, nullptr);
+}
+
+UringLoop::~UringLoop() {
+  // As in EventLoop, the workers go first since they post back to us.
+  pool_.reset();
+
+  // Tearing the ring down cancels everything still in flight, so it
+  // has to happen before the buffers those operations point at go.
+  if (ring_fd_ != -1) {
+    close(ring_fd_);
+  }
+  if (sqes_ != MAP_FAILED) {
+    munmap(sqes_, sqes_size_);
+  }
+  if ((cq_ptr_ != MAP_FAILED) && (cq_ptr_ != sq_ptr_)) {
+    munmap(cq_ptr_, cq_ring_size_);
+  }
+  if (sq_ptr_ != MAP_FAILED) {
+    munmap(sq_ptr_, sq_ring_size_);
+  }
+  connections_.clear();
+  if (wake_fd_ != -1) {
+    close(wake_fd_);
+  }
+  pthread_mutex_destroy(&completions_lock_);
+}
+
+bool UringLoop::setup_ring() {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = kRingEntries * 2;
+  ring_fd_ = IoUringSetup(kRingEntries, &params);
+  if (ring_fd_ == -1) {
+    cerr << "io_uring_setup() failed: " << strerror(errno) << endl;
+    return false;
+  }
+
+  // Map the submission and completion rings, which may share a
+  // mapping, and the array of submission queue entries.
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ = params.cq_off.cqes +
+                  params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  }
+  sq_ptr_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ptr_ == MAP_FAILED) {
+    cerr << "mmap() of the io_uring failed: " << strerror(errno) << endl;
+    return false;
+  }
+  if (single_mmap) {
+    cq_ptr_ = sq_ptr_;
+  } else {
+    cq_ptr_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ptr_ == MAP_FAILED) {
+      cerr << "mmap() of the io_uring failed: " << strerror(errno) << endl;
+      return false;
+    }
+  }
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqes_ = static_cast<struct io_uring_sqe *>(
+    mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+         MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+  if (sqes_ == MAP_FAILED) {
+    cerr << "mmap() of the io_uring failed: " << strerror(errno) << endl;
+    return false;
+  }
+
+  char *sq = static_cast<char *>(sq_ptr_);
+  char *cq = static_cast<char *>(cq_ptr_);
+  sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+  sq_entries_ = params.sq_entries;
+
+  // We always fill SQEs in ring order, so the index array is fixed.
+  for (unsigned i = 0; i < sq_entries_; i++) {
+    sq_array_[i] = i;
+  }
+  sqe_tail_ = *sq_tail_;
+  return true;
+}
+
+struct io_uring_sqe *UringLoop::get_sqe() {
+  // If the submission queue is full, hand what we have to the kernel,
+  // which consumes it before io_uring_enter() returns.  It refuses
+  // more (EBUSY, EAGAIN) while its completions have nowhere to go, so
+  // then take them off the ring, waiting for one if there are none
+  // yet, before trying again.  run() handles them later.
+  while (!ring_failed_ &&
+         (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >=
+          sq_entries_)) {
+    if (!submit_and_wait(0)) {
+      ring_failed_ = true;
+    } else if ((sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >=
+                sq_entries_) && (reap_completions() == 0)) {
+      ring_failed_ = !wait_for_completion();
+    }
+  }
+  if (ring_failed_) {
+    // run() gives up as soon as it sees this; until then, let the
+    // caller fill in an entry that goes nowhere.
+    memset(lost_sqe_.get(), 0, sizeof(*lost_sqe_));
+    return lost_sqe_.get();
+  }
+  struct io_uring_sqe *sqe = &sqes_[sqe_tail_ & *sq_mask_];
+  sqe_tail_++;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+bool UringLoop::submit_and_wait(unsigned wait_nr) {
+  // Everything the kernel hasn't consumed yet is submitted, including
+  // entries a previous, refused, submit left behind.
+  __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+  unsigned to_submit =
+    sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+
+  unsigned flags = (wait_nr > 0) ? IORING_ENTER_GETEVENTS : 0;
+  if (IoUringEnter(ring_fd_, to_submit, wait_nr, flags) == -1) {
+    if ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY)) {
+      // Interrupted, or the completion queue is full and we have to
+      // reap before the kernel will take more; either way, go reap.
+      return true;
+    }
+    cerr << "io_uring_enter() failed: " << strerror(errno) << endl;
+    return false;
+  }
+  return true;
+}
+
+bool UringLoop::wait_for_completion() {
+  while (IoUringEnter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS) == -1) {
+    if (errno != EINTR) {
+      cerr << "io_uring_enter() failed: " << strerror(errno) << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t UringLoop::reap_completions() {
+  unsigned head = *cq_head_;
+  unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  size_t reaped = tail - head;
+  for (; head != tail; head++) {
+    reaped_.push_back(cqes_[head & *cq_mask_]);
+  }
+  __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  return reaped;
+}
+
+bool UringLoop::run() {
+  if (!setup_ring()) {
+    return false;
+  }
+  wake_fd_ = eventfd(0, EFD_CLOEXEC);
+  if (wake_fd_ == -1) {
+    cerr << "eventfd() failed: " << strerror(errno) << endl;
+    return false;
+  }
+
+  // Hand the whole receive buffer pool to the kernel.
+  struct io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe->fd = kNumRecvBufs;
+  sqe->addr = reinterpret_cast<uint64_t>(recv_bufs_.get());
+  sqe->len = kRecvBufSize;
+  sqe->off = 0;
+  sqe->buf_group = kBufGroup;
+  sqe->user_data = MakeUserData(0, kOpProvide);
+
+  queue_accept();
+  queue_wake_read();
+  if (drain_fd_ != -1) {
+    queue_poll(drain_fd_, kOpDrain);
+  }
+
+  while (!stopping_) {
+    if (draining_ &&
+        ((connections_.empty() && !accept_armed_) ||
+         (now_ms_ >= drain_deadline_ms_))) {
+      break;
+    }
+
+    // One system call both submits everything queued since the last
+    // iteration and waits for the next completion.
+    queue_timeout();
+    if (ring_failed_ || !submit_and_wait(1)) {
+      return false;
+    }
+    now_ms_ = TimerWheel::NowMs();
+
+    // Handling a completion can queue enough to fill the submission
+    // queue, which may reap more completions onto the end of reaped_.
+    reap_completions();
+    while (!reaped_.empty()) {
+      struct io_uring_cqe cqe = reaped_.front();
+      reaped_.pop_front();
+      handle_cqe(&cqe);
+    }
+
+    // Buffers have been given back by now, so retry starved receives.
+    vector<uint64_t> starved;
+    starved.swap(starved_);
+    for (uint64_t conn_id : starved) {
+      auto it = connections_.find(conn_id);
+      if (it != connections_.end() && !it->second->closing) {
+        maybe_recv(conn_id, it->second.get());
+      }
+    }
+    expire_timers();
+  }
+
+  // Whatever is left after a drain gets cut off; tearing down the
+  // ring takes care of what is still in flight.
+  vector<uint64_t> left;
+  for (auto &entry : connections_) {
+    left.push_back(entry.first);
+  }
+  for (uint64_t conn_id : left) {
+    auto it = connections_.find(conn_id);
+    if ((it != connections_.end()) && !it->second->closing) {
+      close_connection(conn_id, it->second.get());
+    }
+  }
+  return true;
+}
+
+void UringLoop::stop() {
+  stopping_ = true;
+  uint64_t one = 1;
+  if (write(wake_fd_, &one, sizeof(one)) == -1) {
+    // The loop isn't running yet, so it will see stopping_ anyway.
+  }
+}
+
+void UringLoop::post_responses(uint64_t conn_id,
+                               vector<HttpResponse> *responses) {
+  pthread_mutex_lock(&completions_lock_);
+  completions_.emplace_back(conn_id, std::move(*responses));
+  pthread_mutex_unlock(&completions_lock_);
+
+  uint64_t one = 1;
+  if (write(wake_fd_, &one, sizeof(one)) == -1) {
+    // The counter is already non-zero, so the loop will wake anyway.
+  }
+}
+
+void UringLoop::queue_accept() {
+  struct io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listen_fd_;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  if (multishot_accept_) {
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  }
+  sqe->user_data = MakeUserData(0, kOpAccept);
+  accept_armed_ = true;
+}
+
+void UringLoop::queue_wake_read() {
+  struct io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = wake_fd_;
+  sqe->addr = reinterpret_cast<uint64_t>(&wake_buf_);
+  sqe->len = sizeof(wake_buf_);
+  sqe->user_data = MakeUserData(0, kOpWake);
+}
+
+void UringLoop::queue_poll(int fd, int op) {
+  struct io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = MakeUserData(0, static_cast<UringOp>(op));
+}
+
+void UringLoop::queue_recv(uint64_t conn_id, Connection *c) {
+  // Let the kernel pick a buffer from the pool when data arrives,
+  // rather than pinning one per idle connection.
+  struct io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = c->fd;
+  sqe->len = kRecvBufSize;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kBufGroup;
+  sqe->user_data = MakeUserData(conn_id, kOpRecv);
+  c->recvs_in_flight++;
+}
+
+void UringLoop::maybe_recv(uint64_t conn_id, Connection *c) {
+  // The limit allows for the body of a request whose header is in.
+  c->conn.has_buffered_request();
+  if ((c->recvs_in_flight == 0) && !c->peer_closed && !c->closing &&
+      !c->close_after_write &&
+      (c->conn.buffered_bytes() <=
+       kMaxBufferedBytes + c->conn.pending_body_length())) {
+    queue_recv(conn_id, c);
+  }
+}
+
+void UringLoop::queue_provide_buffer(uint16_t bid) {
+  struct io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe->fd = 1;
+  sqe->addr = reinterpret_cast<uint64_t>(recv_bufs_.get() +
+                                         bid * kRecvBufSize);
+  sqe->len = kRecvBufSize;
+  sqe->off = bid;
+  sqe->buf_group = kBufGroup;
+  sqe->user_data = MakeUserData(0, kOpProvide);
+}
+
+void UringLoop::queue_timeout() {
+  if (timeout_armed_ || stopping_) {
+    return;
+  }
+  int timeout = wheel_.next_timeout_ms(now_ms_);
+  if (draining_) {
+    int drain_left = static_cast<int>(drain_deadline_ms_ - now_ms_);
+    timeout = (timeout < 0) ? drain_left : std::min(timeout, drain_left);
+  }
+  if (timeout < 0) {
+    return;
+  }
+  timeout = std::min(timeout, kMaxTimeoutMs);
+  timeout_ts_.tv_sec = timeout / 1000;
+  timeout_ts_.tv_nsec = (timeout % 1000) * 1000000L;
+
+  struct io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_TIMEOUT;
+  sqe->addr = reinterpret_cast<uint64_t>(&timeout_ts_);
+  sqe->len = 1;
+  sqe->user_data = MakeUserData(0, kOpTimeout);
+  timeout_armed_ = true;
+}
+
+void UringLoop::handle_cqe(const struct io_uring_cqe *cqe) {
+  uint64_t conn_id = cqe->user_data >> 8;
+  int op = cqe->user_data & 0xff;
+
+  switch (op) {
+    case kOpAccept:
+      handle_accept(cqe->res, cqe->flags);
+      break;
+    case kOpWake:
+      handle_completions();
+      if (!stopping_) {
+        queue_wake_read();
+      }
+      break;
+    case kOpProvide:
+      if (cqe->res < 0) {
+        cerr << "io_uring provide buffers failed: "
+             << strerror(-cqe->res) << endl;
+      }
+      break;
+    case kOpRecv:
+      handle_recv(conn_id, cqe->res, cqe->flags);
+      break;
+    case kOpTimeout:
+      // -ETIME is the usual result; expire_timers() does the work.
+      timeout_armed_ = false;
+      break;
+    case kOpAcceptPoll:
+      accept_armed_ = false;
+      if (!stopping_ && !draining_) {
+        queue_accept();
+      }
+      break;
+    case kOpDrain:
+      start_drain();
+      break;
+    case kOpCancel:
+      // Nothing to do; the cancelled operation completes by itself.
+      break;
+    default:
+      handle_send(conn_id, op, cqe->res);
+      break;
+  }
+}
+
+void UringLoop::handle_accept(int res, uint32_t flags) {
+  bool wait_first = false;
+  if (res >= 0) {
+    uint64_t conn_id = next_conn_id_++;
+    Connection *c = new Connection(res);
+    connections_[conn_id].reset(c);
+    stats_->record_open();
+    queue_recv(conn_id, c);
+    update_deadline(conn_id, c);
+  } else if ((res == -EINVAL) && multishot_accept_) {
+    // Older kernel: fall back to one accept per connection.
+    multishot_accept_ = false;
+  } else if (res == -EAGAIN) {
+    // The listening socket is non-blocking (see ServerSocket), which
+    // some kernels honour rather than waiting for a client.
+    wait_first = true;
+  } else if ((res != -EINTR) && (res != -ECONNABORTED) &&
+             (res != -ECANCELED)) {
+    cerr << "Failure on accept: " << strerror(-res) << endl;
+  }
+
+  // A multishot accept keeps going until the kernel says otherwise.
+  if (flags & IORING_CQE_F_MORE) {
+    return;
+  }
+  accept_armed_ = false;
+  if (!stopping_ && !draining_) {
+    if (wait_first) {
+      queue_poll(listen_fd_, kOpAcceptPoll);
+      accept_armed_ = true;
+    } else {
+      queue_accept();
+    }
+  }
+}
+
+void UringLoop::start_drain() {
+  if (draining_) {
+    return;
+  }
+  draining_ = true;
+  drain_deadline_ms_ = now_ms_ + timeouts_.drain_ms;
+
+  // Stop accepting, whether the accept is in flight or waiting for
+  // its poll.  Either one completes with -ECANCELED and isn't renewed.
+  const UringOp accept_ops[] = { kOpAccept, kOpAcceptPoll };
+  for (UringOp op : accept_ops) {
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = MakeUserData(0, op);
+    sqe->user_data = MakeUserData(0, kOpCancel);
+  }
+
+  // Closing a connection can free it, so pick them out first.
+  vector<uint64_t> idle;
+  for (auto &entry : connections_) {
+    if (!entry.second->closing && drained(entry.second.get())) {
+      idle.push_back(entry.first);
+    }
+  }
+  for (uint64_t conn_id : idle) {
+    close_connection(conn_id, connections_[conn_id].get());
+  }
+}
+
+bool UringLoop::drained(Connection *c) const {
+  return c->served && !c->busy && c->out.empty() &&
+         (c->sends_in_flight == 0) &&
+         (c->conn.buffered_bytes() == 0);
+}
+
+void UringLoop::handle_recv(uint64_t conn_id, int res, uint32_t flags) {
+  auto it = connections_.find(conn_id);
+  if (it == connections_.end()) {
+    return;
+  }
+  Connection *c = it->second.get();
+  c->recvs_in_flight--;
+
+  if (flags & IORING_CQE_F_BUFFER) {
+    // Copy the data out and give the buffer straight back to the pool.
+    uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    if (res > 0) {
+      c->conn.append_input(recv_bufs_.get() + bid * kRecvBufSize, res);
+    }
+    queue_provide_buffer(bid);
+  }
+
+  if (c->closing) {
+    maybe_free(conn_id, c);
+    return;
+  }
+  if (res == -ENOBUFS) {
+    starved_.push_back(conn_id);
+    return;
+  }
+  if (res < 0) {
+    close_connection(conn_id, c);
+    return;
+  }
+  if (res == 0) {
+    c->peer_closed = true;
+  }
+  // drive() receives more once there is room for it.
+  drive(conn_id, c);
+}
+
+void UringLoop::handle_send(uint64_t conn_id, int op, int res) {
+  auto it = connections_.find(conn_id);
+  if (it == connections_.end()) {
+    return;
+  }
+  Connection *c = it->second.get();
+  c->sends_in_flight--;
+
+  if (res < 0) {
+    c->send_failed = true;
+  } else if (op == kOpSendData) {
+    // Retire whatever has been sent completely.
+    AdvanceQueuedOutput(&c->out, &c->data_sent, res);
+    c->bytes_sent += res;
+  } else if (op == kOpFileRead) {
+    // send_next() sends what was read.  Reading nothing means the file
+    // shrank under us, and the response can't be finished.
+    if (res == 0) {
+      c->send_failed = true;
+    } else {
+      c->chunk_len = res;
+      c->chunk_sent = 0;
+    }
+  } else if (op == kOpFileSend) {
+    c->chunk_sent += res;
+    c->bytes_sent += res;
+    if (c->chunk_sent == c->chunk_len) {
+      QueuedResponse &front = c->out.front();
+      front.file_offset += c->chunk_len;
+      front.file_remaining -= c->chunk_len;
+      c->chunk_len = c->chunk_sent = 0;
+      if (front.file_remaining == 0) {
+        c->out.pop_front();
+        c->data_sent = 0;
+      }
+    }
+  }
+
+  if (c->closing) {
+    maybe_free(conn_id, c);
+    return;
+  }
+  if (c->send_failed) {
+    close_connection(conn_id, c);
+    return;
+  }
+  drive(conn_id, c);
+}
+
+void UringLoop::handle_completions() {
+  list<pair<uint64_t, vector<HttpResponse>>> done;
+  pthread_mutex_lock(&completions_lock_);
+  done.swap(completions_);
+  pthread_mutex_unlock(&completions_lock_);
+
+  for (auto &completion : done) {
+    auto it = connections_.find(completion.first);
+    if (it == connections_.end() || it->second->closing) {
+      continue;
+    }
+    Connection *c = it->second.get();
+    c->busy = false;
+    for (HttpResponse &response : completion.second) {
+      queue_response(c, std::move(response));
+    }
+    if (c->bad_request) {
+      queue_response(c, BadRequestResponse());
+      c->bad_request = false;
+    }
+    drive(completion.first, c);
+  }
+}
+
+void UringLoop::drive(uint64_t conn_id, Connection *c) {
+  // Answer buffered requests in order until one has to go to a worker.
+  HttpRequest req;
+  while (!c->busy && !c->close_after_write &&
+         c->conn.has_buffered_request()) {
+    if (!c->conn.next_buffered_request(&req)) {
+      // Say why, then hang up.
+      c->served = true;
+      queue_response(c, BadRequestResponse());
+      c->close_after_write = true;
+      break;
+    }
+    c->served = true;
+    wheel_.cancel(&c->timer);
+    if (req.WantsClose()) {
+      c->close_after_write = true;
+    }
+    HttpResponse cached;
+    if (AnswerFromFileCache(req, base_dir_, file_cache_, &cached)) {
+      queue_response(c, std::move(cached));
+      continue;
+    }
+
+    // Anything else may open files or search the index, so it goes to
+    // a worker, as in EventLoop, with every request that is already
+    // buffered behind it.
+    UringLoopTask *task = new UringLoopTask(UringLoop_ThrFn);
+    task->loop = this;
+    task->conn_id = conn_id;
+    task->requests.push_back(std::move(req));
+    while (!c->close_after_write && c->conn.has_buffered_request()) {
+      HttpRequest next;
+      if (!c->conn.next_buffered_request(&next)) {
+        // Answer what came before it, then say why we hang up.
+        c->close_after_write = true;
+        c->bad_request = true;
+        break;
+      }
+      if (next.WantsClose()) {
+        c->close_after_write = true;
+      }
+      task->requests.push_back(std::move(next));
+    }
+    c->busy = true;
+    pool_->dispatch(task);
+    break;
+  }
+
+  send_next(conn_id, c);
+  if (!c->busy && c->out.empty() &&
+      (c->close_after_write || c->peer_closed ||
+       (draining_ && drained(c)) || c->conn.buffer_overflowed())) {
+    close_connection(conn_id, c);
+    return;
+  }
+  maybe_recv(conn_id, c);
+  update_deadline(conn_id, c);
+}
+
+void UringLoop::queue_response(Connection *c, HttpResponse response) {
+  c->out.emplace_back(std::move(response));
+}
+
+void UringLoop::send_next(uint64_t conn_id, Connection *c) {
+  if ((c->sends_in_flight > 0) || c->out.empty() || c->closing) {
+    return;
+  }
+
+  QueuedResponse &front = c->out.front();
+  if ((c->data_sent == front.memory_len) && (front.file_remaining == 0)) {
+    // Sent the in-memory part; move on to the next chunk of a streamed
+    // body, if any, or else to the next response.
+    c->data_sent = 0;
+    if (!front.NextChunk()) {
+      c->out.pop_front();
+      send_next(conn_id, c);
+      return;
+    }
+  }
+  if (c->data_sent < front.memory_len) {
+    // Gather the in-memory output of consecutive responses into a
+    // single send, straight from the responses.
+    c->send_iov.clear();
+    GatherQueuedOutput(c->out, c->data_sent, &c->send_iov);
+    c->send_msg = {};
+    c->send_msg.msg_iov = c->send_iov.data();
+    c->send_msg.msg_iovlen = c->send_iov.size();
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = c->fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&c->send_msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = MakeUserData(conn_id, kOpSendData);
+    c->sends_in_flight++;
+    return;
+  }
+
+  if (!c->file_buf) {
+    c->file_buf.reset(new char[kFileChunk]);
+  }
+
+  if (c->chunk_sent < c->chunk_len) {
+    // The last send of this chunk was short; send the rest.
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = c->fd;
+    sqe->addr = reinterpret_cast<uint64_t>(c->file_buf.get() + c->chunk_sent);
+    sqe->len = c->chunk_len - c->chunk_sent;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = MakeUserData(conn_id, kOpFileSend);
+    c->sends_in_flight++;
+    return;
+  }
+
+  // Read the next chunk of the file.  Its send is only queued once the
+  // read has completed (above), sized by what the read returned, so a
+  // short read never sends bytes left over from the last chunk.
+  struct io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = front.response.body_file()->fd();
+  sqe->addr = reinterpret_cast<uint64_t>(c->file_buf.get());
+  sqe->len = std::min(kFileChunk, front.file_remaining);
+  sqe->off = front.file_offset;
+  sqe->user_data = MakeUserData(conn_id, kOpFileRead);
+  c->sends_in_flight++;
+}
+
+void UringLoop::update_deadline(uint64_t conn_id, Connection *c) {
+  if (c->busy) {
+    wheel_.cancel(&c->timer);
+    return;
+  }
+  TimeoutKind kind = CurrentDeadline(!c->out.empty(),
+                                     c->conn.buffered_bytes() > 0);
+  if (c->timer.armed() && (c->deadline == kind) &&
+      ((kind != TimeoutKind::kBody) ||
+       (c->bytes_sent == c->deadline_written))) {
+    return;
+  }
+  uint32_t limit = timeouts_.limit(kind);
+  if (limit == 0) {
+    wheel_.cancel(&c->timer);
+    return;
+  }
+  c->deadline = kind;
+  c->deadline_written = c->bytes_sent;
+  c->timer.data = conn_id;
+  wheel_.schedule(&c->timer, now_ms_ + limit);
+}
+
+void UringLoop::expire_timers() {
+  vector<TimerWheel::Timer *> expired;
+  wheel_.advance(now_ms_, &expired);
+  for (TimerWheel::Timer *timer : expired) {
+    auto it = connections_.find(timer->data);
+    if ((it != connections_.end()) && !it->second->closing) {
+      stats_->record_timeout(it->second->deadline);
+      if (it->second->deadline == TimeoutKind::kBody) {
+        ResetOnClose(it->second->fd);
+      }
+      close_connection(timer->data, it->second.get());
+    }
+  }
+}
+
+void UringLoop::close_connection(uint64_t conn_id, Connection *c) {
+  if (c->closing) {
+    return;
+  }
+  c->closing = true;
+  wheel_.cancel(&c->timer);
+  stats_->record_close();
+
+  // Make any receive or send still in flight complete promptly.
+  shutdown(c->fd, SHUT_RDWR);
+  maybe_free(conn_id, c);
+}
+
+void UringLoop::maybe_free(uint64_t conn_id, Connection *c) {
+  if ((c->recvs_in_flight == 0) && (c->sends_in_flight == 0)) {
+    connections_.erase(conn_id);
+  }
+}
+
+}  // namespace searchserver
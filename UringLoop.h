@@ -0,0 +1,300 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef URINGLOOP_H_
+#define URINGLOOP_H_
+
+extern "C" {
+  #include <pthread.h>  // for the pthread threading/mutex functions
+}
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "./Compression.h"
+#include "./HttpConnection.h"
+#include "./HttpResponse.h"
+#include "./OpenFileCache.h"
+#include "./StaticFileCache.h"
+#include "./ThreadPool.h"
+#include "./Timeouts.h"
+#include "./TimerWheel.h"
+#include "./WordIndex.h"
+
+namespace searchserver {
+
+// A UringLoop is an alternative to EventLoop that does its socket and
+// file I/O through io_uring instead of epoll plus read()/write().
+// Accepts come from one multishot accept, client data is received into
+// kernel-selected buffers from a provided-buffer pool, and /static/
+// bodies are sent in chunks, each read from the file and then sent
+// once the read has completed, so the file is never read into an
+// HttpResponse.  All operations queued while handling one batch of
+// completions are submitted together with a single io_uring_enter().
+//
+// As with EventLoop, a single thread runs the loop, every request but
+// a whole-response file cache hit is handed to a ThreadPool owned by
+// the loop, no more than a request header (plus its body) is buffered
+// per connection, and connection deadlines are kept in a TimerWheel.
+// An io_uring timeout wakes the loop when the next one is due.
+class UringLoop {
+ public:
+  // Returns true if the running kernel supports every io_uring
+  // operation the loop needs.  Callers should fall back to EventLoop
+  // if it doesn't.
+  static bool IsSupported();
+
+  // Creates a loop that accepts connections on "listen_fd", serves
+  // static files out of "base_dir" (through "file_cache", "open_files"
+  // and "compressed_files", if not nullptr), and answers queries from
+  // "index", using "num_workers" worker threads.  Connections are held to
+  // "timeouts", and timeouts and closes are counted in "stats".  The
+  // loop drains once "drain_fd" becomes readable, as EventLoop does.
+  // Ownership of listen_fd, drain_fd, index, file_cache, open_files,
+  // compressed_files and stats is not taken.
+  UringLoop(int listen_fd, int drain_fd, const std::string &base_dir,
+            WordIndex *index, StaticFileCache *file_cache,
+            OpenFileCache *open_files,
+            CompressedFileCache *compressed_files, uint32_t num_workers,
+            const TimeoutOptions &timeouts, ConnectionStats *stats);
+
+  // Closes every client connection and tears down the ring.
+  virtual ~UringLoop();
+
+  // Runs the loop on the calling thread until stop() is called or it
+  // has drained.  Returns false if the ring could not be set up or
+  // failed.
+  bool run();
+
+  // Asks the loop to return from run().  Safe to call from any thread.
+  void stop();
+
+  // Hands the responses for connection "conn_id", in order, back to
+  // the loop thread, emptying "*responses".  Called by worker threads
+  // once a batch of requests has been processed.
+  void post_responses(uint64_t conn_id,
+                      std::vector<HttpResponse> *responses);
+
+  // Accessors used by worker threads to process requests.
+  const std::string &base_dir() const { return base_dir_; }
+  WordIndex *index() const { return index_; }
+  StaticFileCache *file_cache() const { return file_cache_; }
+  OpenFileCache *open_files() const { return open_files_; }
+  CompressedFileCache *compressed_files() const {
+    return compressed_files_;
+  }
+  ThreadPool *pool() const { return pool_.get(); }
+
+ private:
+  // The loop's state for one client connection.
+  struct Connection {
+    explicit Connection(int fd) : fd(fd), conn(fd) { }
+
+    int fd;
+    HttpConnection conn;
+
+    // Output waiting to be sent, in order.
+    std::deque<QueuedResponse> out;
+
+    // The in-memory output a kOpSendData send is gathering, which
+    // must stay put until it completes.
+    std::vector<struct iovec> send_iov;
+    struct msghdr send_msg = {};
+
+    // Holds file data between a read and the send of what it read.
+    std::unique_ptr<char[]> file_buf;
+
+    // How much of the in-memory part of the response at the front of
+    // "out" has been sent.
+    size_t data_sent = 0;
+
+    // The chunk of the file body of the response at the front of "out"
+    // that is in file_buf, and how much of it has been sent.
+    size_t chunk_len = 0;
+    size_t chunk_sent = 0;
+
+    // Operations submitted for this connection that have not yet
+    // completed.  The connection can only be freed once both are zero.
+    int recvs_in_flight = 0;
+    int sends_in_flight = 0;
+
+    // Set if a send, or the file read feeding it, failed.
+    bool send_failed = false;
+
+    // As in EventLoop::Connection.
+    bool busy = false;
+    bool close_after_write = false;
+    bool bad_request = false;
+    bool peer_closed = false;
+    bool served = false;
+
+    // Set once we have decided to close the connection; it is freed as
+    // soon as its in-flight operations drain.
+    bool closing = false;
+
+    // The bytes sent so far, over every response.
+    uint64_t bytes_sent = 0;
+
+    // As in EventLoop::Connection.
+    TimerWheel::Timer timer;
+    TimeoutKind deadline = TimeoutKind::kIdle;
+    uint64_t deadline_written = 0;
+  };
+
+  // Thin wrappers over the shared-memory rings.
+  bool setup_ring();
+  struct io_uring_sqe *get_sqe();
+  bool submit_and_wait(unsigned wait_nr);
+
+  // Blocks until the kernel posts a completion.  Returns false if the
+  // ring failed.
+  bool wait_for_completion();
+
+  // Moves every completion on the ring onto reaped_, and returns how
+  // many there were.
+  size_t reap_completions();
+
+  // Queue the operations the loop keeps re-arming.
+  void queue_accept();
+  void queue_wake_read();
+
+  // Waits for "fd" to become readable; the completion is tagged "op".
+  void queue_poll(int fd, int op);
+  void queue_recv(uint64_t conn_id, Connection *c);
+
+  // Queues a receive for the connection unless one is in flight, or
+  // it already has as much buffered as it may.
+  void maybe_recv(uint64_t conn_id, Connection *c);
+  void queue_provide_buffer(uint16_t bid);
+
+  // Makes sure a timeout will wake the loop in time for the next
+  // connection deadline.
+  void queue_timeout();
+
+  // Completion handlers.
+  void handle_cqe(const struct io_uring_cqe *cqe);
+  void handle_accept(int res, uint32_t flags);
+  void handle_recv(uint64_t conn_id, int res, uint32_t flags);
+  void handle_send(uint64_t conn_id, int op, int res);
+  void handle_completions();
+
+  // As in EventLoop.
+  void start_drain();
+  bool drained(Connection *c) const;
+
+  // Serves whatever the connection has buffered and starts sending.
+  void drive(uint64_t conn_id, Connection *c);
+
+  // Queues "response" onto the connection's output.  A file body is
+  // queued as a file range rather than read.
+  void queue_response(Connection *c, HttpResponse response);
+
+  // Starts sending the front of the connection's output if nothing
+  // is being sent already.
+  void send_next(uint64_t conn_id, Connection *c);
+
+  // Starts closing the connection; it is freed once nothing that
+  // refers to it is still in flight.
+  void close_connection(uint64_t conn_id, Connection *c);
+  void maybe_free(uint64_t conn_id, Connection *c);
+
+  // As in EventLoop.
+  void update_deadline(uint64_t conn_id, Connection *c);
+  void expire_timers();
+
+  int listen_fd_;
+  int drain_fd_;
+  std::string base_dir_;
+  WordIndex *index_;
+  StaticFileCache *file_cache_;
+  OpenFileCache *open_files_;
+  CompressedFileCache *compressed_files_;
+
+  // The ring itself.
+  int ring_fd_;
+  void *sq_ptr_, *cq_ptr_;
+  size_t sq_ring_size_, cq_ring_size_;
+  struct io_uring_sqe *sqes_;
+  size_t sqes_size_;
+  unsigned *sq_head_, *sq_tail_, *sq_mask_, *sq_array_;
+  unsigned *cq_head_, *cq_tail_, *cq_mask_;
+  struct io_uring_cqe *cqes_;
+  unsigned sq_entries_;
+  unsigned sqe_tail_;  // our not-yet-published SQ tail
+
+  // Set once io_uring_enter() has failed outright; run() then returns
+  // false.  Entries asked for after that are filled into lost_sqe_.
+  bool ring_failed_;
+  std::unique_ptr<struct io_uring_sqe> lost_sqe_;
+
+  // Completions taken off the ring but not yet handled.
+  std::deque<struct io_uring_cqe> reaped_;
+
+  // The provided-buffer pool that receives pick buffers from.
+  std::unique_ptr<char[]> recv_bufs_;
+
+  // Connections whose receive found the buffer pool empty; their
+  // receives are re-queued once buffers are given back.
+  std::vector<uint64_t> starved_;
+
+  // Whether the kernel accepted a multishot accept; if not, we re-arm
+  // a single-shot accept after every connection.
+  bool multishot_accept_;
+
+  // Whether an accept (or the poll that precedes it) is in flight.  A
+  // drain waits for it to complete, or a client it accepted could be
+  // lost with the ring.
+  bool accept_armed_;
+
+  // An eventfd used to wake the loop from stop() and post_responses(),
+  // and the buffer its read completes into.
+  int wake_fd_;
+  uint64_t wake_buf_;
+  std::atomic<bool> stopping_;
+
+  // As in EventLoop.
+  bool draining_;
+  uint64_t drain_deadline_ms_;
+
+  TimeoutOptions timeouts_;
+  ConnectionStats *stats_;
+  TimerWheel wheel_;
+
+  // The time as of the last return from io_uring_enter().
+  uint64_t now_ms_;
+
+  // The timespec of the timeout operation in flight, if there is one.
+  struct __kernel_timespec timeout_ts_;
+  bool timeout_armed_;
+
+  // As in EventLoop.
+  std::unordered_map<uint64_t, std::unique_ptr<Connection>> connections_;
+  uint64_t next_conn_id_;
+  pthread_mutex_t completions_lock_;
+  std::list<std::pair<uint64_t, std::vector<HttpResponse>>> completions_;
+  std::unique_ptr<ThreadPool> pool_;
+};
+
+}  // namespace searchserver
+
+#endif  // URINGLOOP_H_
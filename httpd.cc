@@ -20,6 +20,7 @@
 #include <iostream>
 #include <list>
 #include <string>
+#include <thread>
 
 #include "./ServerSocket.h"
 #include "./HttpServer.h"
@@ -46,6 +47,16 @@ static void GetPortAndPath(int argc,
                     uint16_t *port,
                     string *path);
 
+// Parses the optional "--name=value" arguments that follow the port
+// and path into "options", invokes Usage() on failure.
+static void GetOptions(int argc,
+                    char **argv,
+                    searchserver::HttpServerOptions *options);
+
+// Waits for one of "signals" and drains "server"; on the next one,
+// exits without waiting for the drain to finish.
+static void DrainOnSignal(searchserver::HttpServer *server, sigset_t signals);
+
 int main(int argc, char **argv) {
   // Print out welcome message.
   cout << "initializing:" << endl;
@@ -55,6 +66,15 @@ int main(int argc, char **argv) {
   // disconnects unexpectedly.
   signal(SIGPIPE, SIG_IGN);
 
+  // SIGTERM and SIGINT drain the server rather than kill it.  They are
+  // blocked here, before any thread starts, so that every thread
+  // inherits that and only DrainOnSignal() ever sees them.
+  sigset_t drain_signals;
+  sigemptyset(&drain_signals);
+  sigaddset(&drain_signals, SIGTERM);
+  sigaddset(&drain_signals, SIGINT);
+  pthread_sigmask(SIG_BLOCK, &drain_signals, nullptr);
+
   // Get the port number and list of index files.
   uint16_t port_num;
   string static_dir;
@@ -62,6 +82,9 @@ int main(int argc, char **argv) {
   cout << "    port: " << port_num << endl;
   cout << "    path: " << static_dir << endl;
 
+  searchserver::HttpServerOptions options;
+  GetOptions(argc, argv, &options);
+
   searchserver::WordIndex *index = new searchserver::WordIndex();
  
   if (!searchserver::crawl_filetree(static_dir, index)) {
@@ -70,7 +93,8 @@ int main(int argc, char **argv) {
   }
 
   // Run the server.
-  searchserver::HttpServer hs(port_num, static_dir, index);
+  searchserver::HttpServer hs(port_num, static_dir, index, options);
+  std::thread(DrainOnSignal, &hs, drain_signals).detach();
   if (!hs.run()) {
     cerr << "  server failed to run!?" << endl;
   }
@@ -82,9 +106,51 @@ int main(int argc, char **argv) {
 }
 
 
+static void DrainOnSignal(searchserver::HttpServer *server, sigset_t signals) {
+  int sig;
+  sigwait(&signals, &sig);
+  server->drain();
+  sigwait(&signals, &sig);
+  cerr << "  second signal; exiting without finishing the drain." << endl;
+  _exit(EXIT_FAILURE);
+}
+
 static void Usage(char *prog_name) {
-  cerr << "Usage: " << prog_name << " port staticfiles_directory";
+  cerr << "Usage: " << prog_name << " port staticfiles_directory [options]";
   cerr << endl;
+  cerr << "Options:" << endl;
+  cerr << "  --io=threads|epoll|uring  how client connections are handled "
+       << "(default threads)" << endl;
+  cerr << "  --workers=N               worker threads; with --io=epoll and "
+       << "--io=uring, for all but cached files (default: one per core)"
+       << endl;
+  cerr << "  --listeners=N             SO_REUSEPORT listeners, each with its "
+       << "own acceptor and workers (default 1, 0: one per core)" << endl;
+  cerr << "  --no-dns                  never look up client DNS names" << endl;
+  cerr << "  --idle-timeout=SECONDS    close keep-alive connections idle this "
+       << "long (default 15, 0: never)" << endl;
+  cerr << "  --header-timeout=SECONDS  time allowed to send a request header "
+       << "(default 10, 0: unlimited)" << endl;
+  cerr << "  --body-timeout=SECONDS    time a client may go without reading "
+       << "any of a response (default 60, 0: unlimited)" << endl;
+  cerr << "  --drain-timeout=SECONDS   on SIGTERM/SIGINT, time allowed for "
+       << "open connections to finish (default 30)" << endl;
+  cerr << "  --handoff=PATH            take the listening sockets over from "
+       << "the server at the Unix socket PATH, if any, and hand them on "
+       << "to the next one" << endl;
+  cerr << "  --file-cache=MIB          memory for cached static file "
+       << "responses (default 64, 0: no cache)" << endl;
+  cerr << "  --file-cache-entry=KIB    largest static file response to "
+       << "cache (default 1024)" << endl;
+  cerr << "  --open-files=N            static files to keep open between "
+       << "requests (default 1024, 0: none; at most a quarter of the "
+       << "descriptor limit)" << endl;
+  cerr << "  --compress-cache=MIB      memory for compressed copies of "
+       << "static text files (default 64, 0: don't compress them)" << endl;
+  cerr << "  --compress-file=KIB       largest static file to compress "
+       << "(default 4096)" << endl;
+  cerr << "  --no-watch                don't watch the static files for "
+       << "changes; check cached ones every second instead" << endl;
   exit(EXIT_FAILURE);
 }
 
@@ -99,7 +165,7 @@ static void GetPortAndPath(int argc,
 
   // STEP 1:
   // Do we have the right number of command line arguments?
-  if (argc != 3) {
+  if (argc < 3) {
     cerr << endl;
     Usage(argv[0]);
   }
@@ -128,3 +194,85 @@ static void GetPortAndPath(int argc,
   *path = argv[2];
 }
 
+
+static void GetOptions(int argc,
+                    char **argv,
+                    searchserver::HttpServerOptions *options) {
+  for (int i = 3; i < argc; i++) {
+    string arg = argv[i];
+    string value = arg.substr(arg.find('=') + 1);
+    if (arg == "--io=threads") {
+      options->io_mode = searchserver::IoMode::kThreads;
+    } else if (arg == "--io=epoll") {
+      options->io_mode = searchserver::IoMode::kEpoll;
+    } else if (arg == "--io=uring") {
+      options->io_mode = searchserver::IoMode::kUring;
+    } else if (arg.rfind("--workers=", 0) == 0) {
+      if (sscanf(value.c_str(), "%u", &options->num_workers) != 1) {
+        cerr << endl << value << " isn't a valid number of workers." << endl;
+        Usage(argv[0]);
+      }
+    } else if ((arg.rfind("--idle-timeout=", 0) == 0) ||
+               (arg.rfind("--header-timeout=", 0) == 0) ||
+               (arg.rfind("--body-timeout=", 0) == 0) ||
+               (arg.rfind("--drain-timeout=", 0) == 0)) {
+      uint32_t seconds;
+      if (sscanf(value.c_str(), "%u", &seconds) != 1) {
+        cerr << endl << value << " isn't a valid number of seconds." << endl;
+        Usage(argv[0]);
+      }
+      uint32_t *limit = &options->timeouts.idle_ms;
+      if (arg[2] == 'h') {
+        limit = &options->timeouts.header_ms;
+      } else if (arg[2] == 'b') {
+        limit = &options->timeouts.body_ms;
+      } else if (arg[2] == 'd') {
+        limit = &options->timeouts.drain_ms;
+      }
+      *limit = seconds * 1000;
+    } else if ((arg.rfind("--handoff=", 0) == 0) && (value.size() > 0)) {
+      options->handoff_path = value;
+    } else if ((arg.rfind("--file-cache=", 0) == 0) ||
+               (arg.rfind("--file-cache-entry=", 0) == 0)) {
+      size_t size;
+      if (sscanf(value.c_str(), "%zu", &size) != 1) {
+        cerr << endl << value << " isn't a valid size." << endl;
+        Usage(argv[0]);
+      }
+      if (arg.rfind("--file-cache=", 0) == 0) {
+        options->file_cache_bytes = size << 20;
+      } else {
+        options->file_cache_max_entry_bytes = size << 10;
+      }
+    } else if ((arg.rfind("--compress-cache=", 0) == 0) ||
+               (arg.rfind("--compress-file=", 0) == 0)) {
+      size_t size;
+      if (sscanf(value.c_str(), "%zu", &size) != 1) {
+        cerr << endl << value << " isn't a valid size." << endl;
+        Usage(argv[0]);
+      }
+      if (arg.rfind("--compress-cache=", 0) == 0) {
+        options->compressed_files_bytes = size << 20;
+      } else {
+        options->compressed_file_max_bytes = size << 10;
+      }
+    } else if (arg.rfind("--open-files=", 0) == 0) {
+      if (sscanf(value.c_str(), "%zu", &options->open_files) != 1) {
+        cerr << endl << value << " isn't a valid number of files." << endl;
+        Usage(argv[0]);
+      }
+    } else if (arg == "--no-watch") {
+      options->watch_files = false;
+    } else if (arg == "--no-dns") {
+      options->reverse_dns = false;
+    } else if (arg.rfind("--listeners=", 0) == 0) {
+      if (sscanf(value.c_str(), "%u", &options->num_listeners) != 1) {
+        cerr << endl << value << " isn't a valid number of listeners." << endl;
+        Usage(argv[0]);
+      }
+    } else {
+      cerr << endl << "Unknown option " << arg << endl;
+      Usage(argv[0]);
+    }
+  }
+}
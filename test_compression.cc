@@ -0,0 +1,224 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "./Compression.h"
+#include "./HttpUtils.h"
+#include "./test_suite.h"
+
+using std::string;
+
+namespace searchserver {
+
+// Returns the gunzipped "data", or "<corrupt>" if it isn't valid gzip.
+static string Gunzip(const string &data) {
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if (inflateInit2(&strm, 15 + 16) != Z_OK) {
+    return "<corrupt>";
+  }
+  strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+  strm.avail_in = data.size();
+  string out;
+  int res;
+  do {
+    char buf[4096];
+    strm.next_out = reinterpret_cast<Bytef *>(buf);
+    strm.avail_out = sizeof(buf);
+    res = inflate(&strm, Z_NO_FLUSH);
+    out.append(buf, sizeof(buf) - strm.avail_out);
+  } while (res == Z_OK);
+  inflateEnd(&strm);
+  return (res == Z_STREAM_END) ? out : "<corrupt>";
+}
+
+static string Text(size_t len) {
+  string text;
+  for (int i = 0; text.size() < len; i++) {
+    text += "<li> result number " + std::to_string(i) + "</li>\n";
+  }
+  text.resize(len);
+  return text;
+}
+
+// Gives back the pieces it was made with.
+class PiecesStream : public BodyStream {
+ public:
+  explicit PiecesStream(std::vector<string> pieces) : pieces_(pieces) { }
+
+  bool Next(string *out) override {
+    if (next_ == pieces_.size()) {
+      return false;
+    }
+    out->append(pieces_[next_++]);
+    return true;
+  }
+
+ private:
+  std::vector<string> pieces_;
+  size_t next_ = 0;
+};
+
+TEST(Test_Compression, Gzip) {
+  ProjectEnvironment::OpenTestCase();
+  // Several buffers are compressed as one, and each call starts afresh
+  // on the thread's reused stream.
+  string a = Text(100000), b = "and the rest";
+  struct iovec iov[3] = {
+    { &a[0], a.size() }, { &b[0], b.size() }, { nullptr, 0 },
+  };
+  for (int i = 0; i < 3; i++) {
+    string out = "kept";
+    ASSERT_TRUE(gzip_compress(iov, 3, &out));
+    ASSERT_EQ("kept", out.substr(0, 4));
+    ASSERT_LT(out.size(), a.size() / 4);
+    ASSERT_EQ(a + b, Gunzip(out.substr(4)));
+  }
+  string empty;
+  ASSERT_TRUE(gzip_compress(iov + 2, 1, &empty));
+  ASSERT_EQ("", Gunzip(empty));
+
+  string br;
+  ASSERT_TRUE(brotli_compress(a.data(), a.size(), 5, &br));
+  ASSERT_LT(br.size(), a.size() / 4);
+}
+
+TEST(Test_Compression, GzipBodyStream) {
+  ProjectEnvironment::OpenTestCase();
+  std::vector<string> pieces = { "<html>", Text(50000), "", Text(70000) };
+  GzipBodyStream stream(std::make_shared<PiecesStream>(pieces));
+
+  // The first piece comes out on its own, so it can be sent at once.
+  string first;
+  ASSERT_TRUE(stream.Next(&first));
+  ASSERT_FALSE(first.empty());
+
+  string compressed = first;
+  while (stream.Next(&compressed)) { }
+  ASSERT_FALSE(stream.Next(&compressed));
+  ASSERT_EQ(pieces[0] + pieces[1] + pieces[3], Gunzip(compressed));
+}
+
+// Asks "cache" for the "encoding" of "file", waits for it to be made,
+// and asks again, returning what that gets.
+static std::shared_ptr<const string> GetMade(
+    CompressedFileCache *cache, const char *name,
+    const std::shared_ptr<const BodyFile> &file, ContentEncoding encoding) {
+  struct stat st;
+  if (fstat(file->fd(), &st) == -1) {
+    return nullptr;
+  }
+  bool in_progress;
+  cache->get(name, file, st, encoding, &in_progress);
+  while (cache->pending() > 0) {
+    usleep(1000);
+  }
+  std::shared_ptr<const string> data =
+      cache->get(name, file, st, encoding, &in_progress);
+  return in_progress ? nullptr : data;
+}
+
+TEST(Test_Compression, CompressedFileCache) {
+  ProjectEnvironment::OpenTestCase();
+  char file_name[] = "/tmp/test_compression_XXXXXX";
+  int fd = mkstemp(file_name);
+  ASSERT_NE(-1, fd);
+  auto file = std::make_shared<const BodyFile>(fd);
+  string text = Text(20000);
+  ASSERT_EQ(static_cast<int>(text.size()), wrapped_write(fd, text));
+  struct stat st;
+  ASSERT_EQ(0, fstat(fd, &st));
+
+  // The first to ask is told to send the file as it is while a copy is
+  // made; so is anyone who asks before it is ready, and it is only
+  // made once.
+  CompressedFileCache cache(100000, 50000);
+  bool in_progress;
+  ASSERT_EQ(nullptr, cache.get(file_name, file, st, ContentEncoding::kGzip,
+                               &in_progress));
+  ASSERT_TRUE(in_progress);
+  cache.get(file_name, file, st, ContentEncoding::kGzip, &in_progress);
+  ASSERT_LE(cache.pending(), 1U);
+
+  // However many files are asked for at once, none is taken for one
+  // that isn't worth compressing; those the queue has no room for are
+  // queued later.
+  for (int i = 0; i < 200; i++) {
+    string name = string(file_name) + std::to_string(i);
+    cache.get(name, file, st, ContentEncoding::kBrotli, &in_progress);
+    ASSERT_TRUE(in_progress);
+  }
+  while (cache.pending() > 0) {
+    usleep(1000);
+  }
+
+  // Once made, the copy is handed out while the file is unchanged.
+  auto gz = GetMade(&cache, file_name, file, ContentEncoding::kGzip);
+  ASSERT_TRUE(gz != nullptr);
+  ASSERT_EQ(text, Gunzip(*gz));
+  ASSERT_EQ(gz, cache.get(file_name, file, st, ContentEncoding::kGzip,
+                          &in_progress));
+  ASSERT_FALSE(in_progress);
+  auto br = GetMade(&cache, file_name, file, ContentEncoding::kBrotli);
+  ASSERT_TRUE(br != nullptr);
+  ASSERT_NE(*gz, *br);
+  ASSERT_EQ(nullptr, cache.get(file_name, file, st,
+                               ContentEncoding::kIdentity, &in_progress));
+  ASSERT_FALSE(in_progress);
+
+  // A new version of the file is compressed again.
+  ASSERT_EQ(1, wrapped_write(fd, "!"));
+  auto gz2 = GetMade(&cache, file_name, file, ContentEncoding::kGzip);
+  ASSERT_TRUE(gz2 != nullptr);
+  ASSERT_NE(gz, gz2);
+  ASSERT_EQ(text + "!", Gunzip(*gz2));
+
+  // Files over the limit, or that don't get smaller, aren't compressed.
+  ASSERT_EQ(0, ftruncate(fd, 60000));
+  ASSERT_EQ(0, fstat(fd, &st));
+  ASSERT_EQ(nullptr, cache.get(file_name, file, st, ContentEncoding::kGzip,
+                               &in_progress));
+  ASSERT_FALSE(in_progress);
+  string noise;
+  srand(5950);
+  for (int i = 0; i < 40000; i++) {
+    noise += static_cast<char>(rand());
+  }
+  ASSERT_EQ(0, ftruncate(fd, 0));
+  ASSERT_EQ(static_cast<ssize_t>(noise.size()),
+            pwrite(fd, noise.data(), noise.size(), 0));
+  ASSERT_EQ(nullptr, GetMade(&cache, file_name, file, ContentEncoding::kGzip));
+  ASSERT_EQ(0, fstat(fd, &st));
+  cache.get(file_name, file, st, ContentEncoding::kGzip, &in_progress);
+  ASSERT_FALSE(in_progress);
+
+  // The cache stays within its budget; a copy too big for it isn't
+  // kept, and the file is sent as it is.
+  ASSERT_LE(cache.size(), 100000U);
+  CompressedFileCache tiny(1000, 50000);
+  ASSERT_EQ(0, ftruncate(fd, 0));
+  ASSERT_EQ(static_cast<ssize_t>(text.size()),
+            pwrite(fd, text.data(), text.size(), 0));
+  ASSERT_EQ(nullptr, GetMade(&tiny, file_name, file, ContentEncoding::kGzip));
+  ASSERT_LE(tiny.size(), 1000U);
+  unlink(file_name);
+}
+
+}  // namespace searchserver
@@ -0,0 +1,117 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+
+#include "gtest/gtest.h"
+#include "./ConnectionPoller.h"
+#include "./ThreadPool.h"
+#include "./test_suite.h"
+
+namespace searchserver {
+
+// Counts how often it is run and how often deleted.
+static std::atomic<int> runs{0};
+static std::atomic<int> deletes{0};
+
+class CountingTask : public ThreadPool::Task {
+ public:
+  CountingTask() : ThreadPool::Task(&CountingTask_ThrFn) { }
+  virtual ~CountingTask() { deletes++; }
+
+ private:
+  static void CountingTask_ThrFn(ThreadPool::Task *t) {
+    runs++;
+    delete t;
+  }
+};
+
+static void WaitFor(const std::atomic<int> &counter, int value) {
+  for (int i = 0; (i < 500) && (counter < value); i++) {
+    usleep(10000);
+  }
+}
+
+TEST(Test_ConnectionPoller, Basic) {
+  ProjectEnvironment::OpenTestCase();
+  runs = 0;
+  deletes = 0;
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+  TimeoutOptions timeouts;
+  ConnectionStats stats;
+  ThreadPool tp(2);
+  ConnectionPoller poller(timeouts, &stats);
+  ASSERT_TRUE(poller.start(&tp));
+
+  // Nothing happens until the connection has something to read.
+  poller.park(new CountingTask(), fds[0], TimeoutKind::kIdle,
+              TimerWheel::NowMs(), true);
+  usleep(100000);
+  ASSERT_EQ(0, runs);
+  ASSERT_EQ(1U, poller.size());
+
+  ASSERT_EQ(1, write(fds[1], "x", 1));
+  WaitFor(runs, 1);
+  ASSERT_EQ(1, runs);
+  ASSERT_EQ(0U, poller.size());
+
+  // Parking the connection again works too.
+  poller.park(new CountingTask(), fds[0], TimeoutKind::kIdle,
+              TimerWheel::NowMs(), true);
+  WaitFor(runs, 2);
+  ASSERT_EQ(2, runs);
+  ASSERT_EQ(0U, stats.timeouts(TimeoutKind::kIdle));
+
+  poller.stop();
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST(Test_ConnectionPoller, Timeout) {
+  ProjectEnvironment::OpenTestCase();
+  runs = 0;
+  deletes = 0;
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+  TimeoutOptions timeouts;
+  timeouts.header_ms = 200;
+  ConnectionStats stats;
+  ThreadPool tp(2);
+  ConnectionPoller poller(timeouts, &stats);
+  ASSERT_TRUE(poller.start(&tp));
+
+  // The deadline counts from "since", not from when it was parked.
+  poller.park(new CountingTask(), fds[0], TimeoutKind::kHeader,
+              TimerWheel::NowMs() - 100, true);
+  WaitFor(deletes, 1);
+  ASSERT_EQ(1, deletes);
+  ASSERT_EQ(0, runs);
+  ASSERT_EQ(0U, poller.size());
+  ASSERT_EQ(1U, stats.timeouts(TimeoutKind::kHeader));
+  ASSERT_EQ(1U, stats.closed());
+
+  // Once stopped, parked tasks are just deleted.
+  poller.stop();
+  poller.park(new CountingTask(), fds[0], TimeoutKind::kIdle,
+              TimerWheel::NowMs(), true);
+  ASSERT_EQ(2, deletes);
+  ASSERT_EQ(0, runs);
+
+  close(fds[0]);
+  close(fds[1]);
+}
+
+}  // namespace searchserver
@@ -0,0 +1,74 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <cstring>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "./DnsResolver.h"
+#include "./test_suite.h"
+
+using std::string;
+
+namespace searchserver {
+
+static struct sockaddr_in LoopbackAddr() {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(5950);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  return addr;
+}
+
+TEST(Test_DnsResolver, Basic) {
+  ProjectEnvironment::OpenTestCase();
+  DnsResolver resolver(16, 60);
+  struct sockaddr_in addr = LoopbackAddr();
+  const struct sockaddr *sa = reinterpret_cast<struct sockaddr *>(&addr);
+
+  // The first lookup can't have an answer yet; it only queues one.
+  string name = "untouched";
+  ASSERT_FALSE(resolver.lookup(sa, sizeof(addr), &name));
+  ASSERT_EQ("untouched", name);
+
+  // Once the lookup thread has been at it, the answer (or the
+  // failure, if there is no resolver here) is cached.
+  bool found = false;
+  for (int i = 0; i < 100 && !found; i++) {
+    usleep(50000);  // 0.05s
+    found = resolver.lookup(sa, sizeof(addr), &name);
+  }
+  ASSERT_TRUE(found);
+  ASSERT_NE("untouched", name);
+  ASSERT_EQ(1U, resolver.size());
+}
+
+TEST(Test_DnsResolver, Evict) {
+  ProjectEnvironment::OpenTestCase();
+  DnsResolver resolver(4, 60);
+  struct sockaddr_in addr = LoopbackAddr();
+  string name;
+
+  // Ask about more addresses than fit; the oldest are dropped.
+  for (int i = 1; i <= 10; i++) {
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK + i);
+    resolver.lookup(reinterpret_cast<struct sockaddr *>(&addr),
+                    sizeof(addr), &name);
+    ASSERT_GE(4U, resolver.size());
+  }
+  ASSERT_EQ(4U, resolver.size());
+}
+
+}  // namespace searchserver
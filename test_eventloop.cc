@@ -0,0 +1,207 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "./EventLoop.h"
+#include "./StaticFileCache.h"
+#include "./WordIndex.h"
+#include "./test_suite.h"
+
+using std::string;
+
+namespace searchserver {
+
+// Returns a socket listening on a free port of 127.0.0.1, and sets
+// "*port" to the port.
+static int ListenOnLoopback(uint16_t *port) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  if ((fd == -1) ||
+      (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), len) == -1) ||
+      (listen(fd, 16) == -1) ||
+      (getsockname(fd, reinterpret_cast<struct sockaddr *>(&addr),
+                   &len) == -1)) {
+    return -1;
+  }
+  *port = ntohs(addr.sin_port);
+  return fd;
+}
+
+// Connects to "port" on 127.0.0.1, sends "request", and returns all
+// that comes back until the server closes the connection.
+static string Exchange(uint16_t port, const string &request) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr),
+              sizeof(addr)) == -1) {
+    close(fd);
+    return "";
+  }
+  // The server may hang up before it has read it all.
+  send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+  string reply;
+  char buf[4096];
+  ssize_t res;
+  while ((res = read(fd, buf, sizeof(buf))) > 0) {
+    reply.append(buf, res);
+  }
+  close(fd);
+  return reply;
+}
+
+static int CountOf(const string &haystack, const string &needle) {
+  int count = 0;
+  for (size_t pos = haystack.find(needle); pos != string::npos;
+       pos = haystack.find(needle, pos + 1)) {
+    count++;
+  }
+  return count;
+}
+
+TEST(Test_EventLoop, Basic) {
+  ProjectEnvironment::OpenTestCase();
+  uint16_t port;
+  int listen_fd = ListenOnLoopback(&port);
+  ASSERT_NE(-1, listen_fd);
+
+  WordIndex index;
+  index.record("hello", "test_files/hextext.txt");
+  TimeoutOptions timeouts;
+  ConnectionStats stats;
+  StaticFileCache file_cache(1 << 20, 1 << 16, 60000);
+  EventLoop loop(listen_fd, -1, "test_files", &index, &file_cache, nullptr,
+                 nullptr, 2, timeouts, &stats);
+  std::thread loop_thread([&loop]() { loop.run(); });
+
+  // A pipelined batch of file and query requests is answered in order.
+  string file_request = "GET /static/test_files/hextext.txt HTTP/1.1\r\n"
+                        "Host: x\r\n\r\n";
+  string reply = Exchange(port, file_request +
+                          "GET /query?terms=hello HTTP/1.1\r\n\r\n" +
+                          "GET /static/test_files/ok/bar HTTP/1.1\r\n"
+                          "Connection: close\r\n\r\n");
+  ASSERT_EQ(3, CountOf(reply, "HTTP/1.1 200"));
+  size_t query_pos = reply.find("test_files/hextext.txt</a>");
+  ASSERT_NE(string::npos, query_pos);
+  ASSERT_LT(reply.find("Content-length: 4800\r\n"), query_pos);
+
+  // Now that the file is cached, the loop answers it by itself.
+  uint64_t hits = file_cache.hits();
+  reply = Exchange(port, file_request + "GET /static/test_files/hextext.txt "
+                   "HTTP/1.1\r\nConnection: close\r\n\r\n");
+  ASSERT_EQ(2, CountOf(reply, "Content-length: 4800\r\n"));
+  ASSERT_EQ(hits + 2, file_cache.hits());
+
+  // A malformed request is answered with a 400, after the requests
+  // before it (here, one a worker answers), and the connection closed.
+  reply = Exchange(port, "GET /query?terms=hello HTTP/1.1\r\n\r\n"
+                   "GET / HTTP/1.1\r\nBad Name: x\r\n\r\n" + file_request);
+  ASSERT_EQ(1, CountOf(reply, "HTTP/1.1 200"));
+  ASSERT_EQ(1, CountOf(reply, "HTTP/1.1 400"));
+  ASSERT_LT(reply.find("HTTP/1.1 200"), reply.find("HTTP/1.1 400"));
+
+  // A client that sends far more than a request header could be is
+  // cut off, unanswered.
+  ASSERT_EQ("", Exchange(port, "GET /" + string(4 << 20, 'a')));
+  ASSERT_EQ(stats.open(), 0U);
+
+  loop.stop();
+  loop_thread.join();
+  close(listen_fd);
+}
+
+TEST(Test_EventLoop, SlowReader) {
+  ProjectEnvironment::OpenTestCase();
+  uint16_t port;
+  int listen_fd = ListenOnLoopback(&port);
+  ASSERT_NE(-1, listen_fd);
+
+  char dir_template[] = "/tmp/test_eventloop.XXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(dir_template));
+  string dir(dir_template);
+  string path = dir + "/big.bin";
+  const size_t kFileSize = 16 << 20;
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0600);
+  ASSERT_NE(-1, fd);
+  ASSERT_EQ(static_cast<ssize_t>(kFileSize),
+            write(fd, string(kFileSize, 'x').data(), kFileSize));
+  close(fd);
+
+  // The whole response takes several times the body timeout to read
+  // (more than the socket buffers hold), but the client never stops
+  // reading for long.
+  WordIndex index;
+  TimeoutOptions timeouts;
+  timeouts.body_ms = 300;
+  ConnectionStats stats;
+  EventLoop loop(listen_fd, -1, dir, &index, nullptr, nullptr, nullptr,
+                 2, timeouts, &stats);
+  std::thread loop_thread([&loop]() { loop.run(); });
+
+  int client = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int rcvbuf = 16 * 1024;
+  ASSERT_EQ(0, setsockopt(client, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+                          sizeof(rcvbuf)));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  ASSERT_EQ(0, connect(client, reinterpret_cast<struct sockaddr *>(&addr),
+                       sizeof(addr)));
+  string request = "GET /static/" + path + " HTTP/1.1\r\n"
+                   "Connection: close\r\n\r\n";
+  ASSERT_EQ(static_cast<ssize_t>(request.size()),
+            write(client, request.data(), request.size()));
+  auto start = std::chrono::steady_clock::now();
+  string reply;
+  char buf[64 * 1024];
+  ssize_t res;
+  while ((res = read(client, buf, sizeof(buf))) > 0) {
+    reply.append(buf, res);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  close(client);
+  auto took = std::chrono::steady_clock::now() - start;
+
+  ASSERT_GT(took, std::chrono::milliseconds(2 * timeouts.body_ms));
+  size_t body_pos = reply.find("\r\n\r\n");
+  ASSERT_NE(string::npos, body_pos);
+  ASSERT_EQ(kFileSize, reply.size() - body_pos - 4);
+  ASSERT_EQ(0U, stats.timeouts(TimeoutKind::kBody));
+
+  loop.stop();
+  loop_thread.join();
+  close(listen_fd);
+  unlink(path.c_str());
+  rmdir(dir.c_str());
+}
+
+}  // namespace searchserver
@@ -9,9 +9,14 @@
  * author.
  */
 
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+
 #include "./FileReader.h"
 
 #include "gtest/gtest.h"
+#include "./HttpUtils.h"
 #include "./test_suite.h"
 
 using std::string;
@@ -47,4 +52,43 @@ TEST(Test_FileReader, Basic) {
   ProjectEnvironment::AddPoints(5);
 }
 
+TEST(Test_FileReader, SizesAndViews) {
+  ProjectEnvironment::OpenTestCase();
+  char file_name[] = "/tmp/test_filereader_XXXXXX";
+  int fd = mkstemp(file_name);
+  ASSERT_NE(-1, fd);
+  string big;
+  for (int i = 0; big.size() < 3 * FileReader::kMinMappedBytes; i++) {
+    big += std::to_string(i) + " ";
+  }
+  ASSERT_EQ(static_cast<int>(big.size()), wrapped_write(fd, big));
+  close(fd);
+
+  // A big file is read whole, and viewed without being copied.
+  FileReader reader(file_name);
+  string contents;
+  ASSERT_TRUE(reader.read_file(&contents));
+  ASSERT_EQ(big, contents);
+  FileView view;
+  ASSERT_TRUE(reader.read_view(&view));
+  ASSERT_TRUE(view.mapped());
+  ASSERT_EQ(big, view.data());
+
+  // Moving a view hands the mapping over.
+  FileView moved(std::move(view));
+  ASSERT_TRUE(moved.mapped());
+  ASSERT_EQ(big, moved.data());
+  ASSERT_EQ("", view.data());
+
+  // A small file is copied instead, and one whose size fstat() can't
+  // tell is still read to the end.
+  ASSERT_TRUE(FileReader("./test_files/hextext.txt").read_view(&moved));
+  ASSERT_FALSE(moved.mapped());
+  ASSERT_EQ(4800U, moved.data().size());
+  ASSERT_TRUE(FileReader("/proc/self/status").read_file(&contents));
+  ASSERT_NE(string::npos, contents.find("Pid:"));
+  ASSERT_FALSE(FileReader("./non-existent").read_view(&moved));
+  unlink(file_name);
+}
+
 }  // namespace searchserver
@@ -0,0 +1,119 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+extern "C" {
+  #include <pthread.h>
+}
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "./FileWatcher.h"
+#include "./test_suite.h"
+
+using std::string;
+using std::vector;
+
+namespace searchserver {
+
+// Gathers the batches a FileWatcher reports.
+class Batches {
+ public:
+  Batches() { pthread_mutex_init(&lock_, nullptr); }
+  ~Batches() { pthread_mutex_destroy(&lock_); }
+
+  void add(const vector<string> &paths) {
+    pthread_mutex_lock(&lock_);
+    batches_.push_back(paths);
+    pthread_mutex_unlock(&lock_);
+  }
+
+  // Waits up to two seconds for "path" to be reported, and returns
+  // how many times it was, in all.
+  int wait_for(const string &path) {
+    for (int i = 0; i < 200; i++) {
+      int count = 0;
+      pthread_mutex_lock(&lock_);
+      for (const vector<string> &batch : batches_) {
+        for (const string &p : batch) {
+          count += (p == path);
+        }
+      }
+      pthread_mutex_unlock(&lock_);
+      if (count > 0) {
+        return count;
+      }
+      usleep(10000);
+    }
+    return 0;
+  }
+
+ private:
+  pthread_mutex_t lock_;
+  vector<vector<string>> batches_;
+};
+
+static void Write(const string &path, const string &contents) {
+  std::ofstream out(path, std::ios::app);
+  out << contents;
+}
+
+TEST(Test_FileWatcher, Basic) {
+  ProjectEnvironment::OpenTestCase();
+  char dir_name[] = "/tmp/test_filewatcher_XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir_name) != nullptr);
+  string dir = dir_name;
+  ASSERT_EQ(0, mkdir((dir + "/sub").c_str(), 0700));
+
+  Batches batches;
+  FileWatcher watcher(dir + "/sub/..", 20);
+  watcher.add_listener([&batches](const vector<string> &paths) {
+    batches.add(paths);
+  });
+  ASSERT_TRUE(watcher.start());
+  char *real = realpath(dir_name, nullptr);
+  string root = real;
+  free(real);
+  ASSERT_EQ(root, watcher.root());
+
+  // Many writes to one file, close together, are one change.
+  for (int i = 0; i < 20; i++) {
+    Write(root + "/sub/a.txt", "hello\n");
+  }
+  ASSERT_EQ(1, batches.wait_for(root + "/sub/a.txt"));
+
+  // Directories made after the watcher started are watched too.
+  ASSERT_EQ(0, mkdir((root + "/new").c_str(), 0700));
+  ASSERT_EQ(1, batches.wait_for(root + "/new"));
+  Write(root + "/new/b.txt", "hi\n");
+  ASSERT_EQ(1, batches.wait_for(root + "/new/b.txt"));
+
+  // Renaming a directory is a change to it, under both names.
+  ASSERT_EQ(0, rename((root + "/new").c_str(), (root + "/old").c_str()));
+  ASSERT_EQ(1, batches.wait_for(root + "/old"));
+  ASSERT_EQ(2, batches.wait_for(root + "/new"));
+  Write(root + "/old/b.txt", "hi\n");
+  ASSERT_EQ(1, batches.wait_for(root + "/old/b.txt"));
+  watcher.stop();
+
+  unlink((root + "/old/b.txt").c_str());
+  unlink((root + "/sub/a.txt").c_str());
+  rmdir((root + "/old").c_str());
+  rmdir((root + "/sub").c_str());
+  rmdir(root.c_str());
+}
+
+}  // namespace searchserver
@@ -13,10 +13,18 @@ extern "C" {
   #include <pthread.h>  // for the pthread threading/mutex functions
 }
 
+#include <fcntl.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "./HttpConnection.h"
 
@@ -24,6 +32,7 @@ extern "C" {
 #include "./HttpRequest.h"
 #include "./HttpResponse.h"
 #include "./HttpUtils.h"
+#include "./Timeouts.h"
 #include "./test_suite.h"
 
 using std::string;
@@ -370,4 +379,525 @@ TEST(Test_HttpConnection, write_response) {
   ProjectEnvironment::AddPoints(10);
 }
 
+TEST(Test_HttpConnection, write_response_segments) {
+  ProjectEnvironment::OpenTestCase();
+  string expected = "HTTP/1.1 200 OK\r\nContent-length: 11\r\n\r\n";
+  expected += "hello world";
+
+  HttpResponse response;
+  response.set_protocol("HTTP/1.1");
+  response.set_response_code(200);
+  response.set_message("OK");
+  response.AppendStaticToBody("hello");
+  response.AppendToBody(" wor");
+  response.AppendToBody("ld");
+  ASSERT_EQ(expected, response.GenerateResponseString());
+
+  // The header block, the static segment and the (merged) copied one.
+  string header;
+  std::vector<struct iovec> iov;
+  response.GenerateIovecs(&header, &iov);
+  ASSERT_EQ(3U, iov.size());
+  ASSERT_EQ(header.size(), iov[0].iov_len);
+
+  int pipefds[2];
+  ASSERT_EQ(0, pipe(pipefds));
+  {
+    HttpConnection connection(pipefds[1]);
+    ASSERT_TRUE(connection.write_response(response));
+  }
+
+  string actual;
+  while (wrapped_read(pipefds[0], &actual) > 0) { }
+  ASSERT_EQ(expected, actual);
+  close(pipefds[0]);
+}
+
+TEST(Test_HttpConnection, write_response_file) {
+  ProjectEnvironment::OpenTestCase();
+  string expected = "HTTP/1.1 200 OK\r\nContent-type: text/plain\r\n";
+  expected += "Content-length: 5\r\n\r\nllo, ";
+
+  // The body is bytes 2-6 of a file.
+  char file_name[] = "/tmp/test_httpconnection_XXXXXX";
+  int file_fd = mkstemp(file_name);
+  ASSERT_NE(-1, file_fd);
+  unlink(file_name);
+  ASSERT_EQ(13, wrapped_write(file_fd, "hello, world!"));
+
+  HttpResponse response;
+  response.set_protocol("HTTP/1.1");
+  response.set_response_code(200);
+  response.set_message("OK");
+  response.set_content_type("text/plain");
+  response.SetBodyFile(std::make_shared<BodyFile>(file_fd), 2, 5);
+  ASSERT_EQ(expected, response.GenerateResponseString());
+
+  int pipefds[2];
+  ASSERT_EQ(0, pipe(pipefds));
+  {
+    HttpConnection connection(pipefds[1]);
+    ASSERT_TRUE(connection.write_response(response));
+
+    // The same response again, through the non-blocking output queue.
+    connection.queue_response(response);
+    ASSERT_TRUE(connection.has_pending_output());
+    ASSERT_TRUE(connection.flush_output());
+    ASSERT_FALSE(connection.has_pending_output());
+  }
+
+  string actual;
+  while (wrapped_read(pipefds[0], &actual) > 0) { }
+  ASSERT_EQ(expected + expected, actual);
+  close(pipefds[0]);
+}
+
+TEST(Test_HttpConnection, queue_response_prebuilt) {
+  ProjectEnvironment::OpenTestCase();
+  // A cache hit: the header and body are shared, not the response's.
+  auto header = std::make_shared<const string>(
+      "HTTP/1.1 200 OK\r\nContent-length: 300\r\n\r\n");
+  auto body = std::make_shared<const string>(string(300, 'y'));
+  HttpResponse response;
+  response.SetPrebuilt(header, body);
+  string expected = *header + *body;
+  ASSERT_EQ(expected, response.GenerateResponseString());
+
+  // More pipelined responses than one writev() takes iovecs, through
+  // a pipe too small to take them all at once.
+  const int kResponses = 1000;
+  int pipefds[2];
+  ASSERT_EQ(0, pipe(pipefds));
+  ASSERT_EQ(0, fcntl(pipefds[1], F_SETFL, O_NONBLOCK));
+  HttpConnection connection(pipefds[1]);
+  for (int i = 0; i < kResponses; i++) {
+    connection.queue_response(response);
+  }
+  string actual;
+  while (connection.has_pending_output()) {
+    ASSERT_TRUE(connection.flush_output());
+    ASSERT_GT(wrapped_read(pipefds[0], &actual), 0);
+  }
+  ASSERT_EQ(expected.size() * kResponses, connection.bytes_written());
+  while (actual.size() < expected.size() * kResponses) {
+    ASSERT_GT(wrapped_read(pipefds[0], &actual), 0);
+  }
+  for (int i = 0; i < kResponses; i++) {
+    ASSERT_EQ(expected, actual.substr(i * expected.size(), expected.size()));
+  }
+  close(pipefds[0]);
+}
+
+TEST(Test_HttpConnection, queue_response_segments) {
+  ProjectEnvironment::OpenTestCase();
+  // A big page built in many segments, as a query result is: more
+  // than one writev() takes, and more than the socket takes at once.
+  HttpResponse response;
+  response.set_protocol("HTTP/1.1");
+  response.set_response_code(200);
+  response.set_message("OK");
+  response.set_content_type("text/html");
+  for (int i = 0; i < 3000; i++) {
+    response.AppendStaticToBody("<li>");
+    response.AppendToBody(string(100 + i % 7, 'a' + i % 26));
+  }
+  string expected = response.GenerateResponseString();
+
+  int spair[2] = {-1, -1};
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, spair));
+  ASSERT_EQ(0, fcntl(spair[0], F_SETFL, O_NONBLOCK));
+  HttpConnection connection(spair[0]);
+  connection.queue_response(response);
+  connection.queue_response(response);
+  string actual;
+  while (connection.has_pending_output()) {
+    ASSERT_TRUE(connection.flush_output());
+    ASSERT_GT(wrapped_read(spair[1], &actual), 0);
+  }
+  while (actual.size() < 2 * expected.size()) {
+    ASSERT_GT(wrapped_read(spair[1], &actual), 0);
+  }
+  ASSERT_EQ(expected + expected, actual);
+  close(spair[1]);
+}
+
+TEST(Test_HttpConnection, write_responses) {
+  ProjectEnvironment::OpenTestCase();
+  char file_name[] = "/tmp/test_httpconnection_XXXXXX";
+  int file_fd = mkstemp(file_name);
+  ASSERT_NE(-1, file_fd);
+  unlink(file_name);
+  ASSERT_EQ(13, wrapped_write(file_fd, "hello, world!"));
+
+  // A pipelined batch: two in-memory responses around a file one.
+  HttpResponse responses[3];
+  for (HttpResponse &response : responses) {
+    response.set_protocol("HTTP/1.1");
+    response.set_response_code(200);
+    response.set_message("OK");
+    response.set_content_type("text/plain");
+  }
+  responses[0].AppendToBody("first");
+  responses[1].SetBodyFile(std::make_shared<BodyFile>(file_fd), 7, 5);
+  responses[2].AppendStaticToBody("third");
+  string expected;
+  for (const HttpResponse &response : responses) {
+    expected += response.GenerateResponseString();
+  }
+
+  int pipefds[2];
+  ASSERT_EQ(0, pipe(pipefds));
+  {
+    HttpConnection connection(pipefds[1]);
+    ASSERT_TRUE(connection.write_responses(responses, 3));
+    ASSERT_TRUE(connection.write_responses(responses, 0));
+  }
+
+  string actual;
+  while (wrapped_read(pipefds[0], &actual) > 0) { }
+  ASSERT_EQ(expected, actual);
+  ASSERT_NE(string::npos, actual.find("world"));
+  close(pipefds[0]);
+}
+
+TEST(Test_HttpConnection, write_responses_progress) {
+  ProjectEnvironment::OpenTestCase();
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds));
+
+  HttpResponse response;
+  response.set_protocol("HTTP/1.1");
+  response.set_response_code(200);
+  response.set_message("OK");
+  response.AppendToBody(string(8 << 20, 'x'));
+  string expected = response.GenerateResponseString();
+
+  // A reader that takes several body timeouts to read the response,
+  // but never stops for long, isn't cut off: every write restarts the
+  // deadline.
+  TimeoutOptions timeouts;
+  timeouts.body_ms = 300;
+  ConnectionStats stats;
+  Watchdog watchdog(timeouts, &stats);
+  string actual;
+  std::thread reader([&actual, &fds]() {
+    char buf[16 * 1024];
+    ssize_t res;
+    while ((res = read(fds[0], buf, sizeof(buf))) > 0) {
+      actual.append(buf, res);
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+  });
+  auto start = std::chrono::steady_clock::now();
+  bool written;
+  {
+    HttpConnection connection(fds[1]);
+    Watchdog::Deadline deadline(&watchdog, fds[1]);
+    deadline.arm(TimeoutKind::kBody);
+    written = connection.write_responses(&response, 1,
+                                         [&deadline]() { deadline.touch(); });
+  }
+  auto took = std::chrono::steady_clock::now() - start;
+  reader.join();
+  close(fds[0]);
+
+  ASSERT_TRUE(written);
+  ASSERT_GT(took, std::chrono::milliseconds(2 * timeouts.body_ms));
+  ASSERT_TRUE(expected == actual);
+  ASSERT_EQ(0U, stats.timeouts(TimeoutKind::kBody));
+}
+
+TEST(Test_HttpConnection, BufferedRequests) {
+  ProjectEnvironment::OpenTestCase();
+  // Enough pipelined requests that the connection has to cut consumed
+  // ones off the front of its buffer as it goes, with the last one
+  // still arriving.
+  HttpConnection connection(-1);
+  const int kNumRequests = 500;
+  string input;
+  for (int i = 0; i < kNumRequests; i++) {
+    input += "GET /r" + std::to_string(i) + " HTTP/1.1\r\nHost: x\r\n\r\n";
+  }
+  const string partial = "GET /last HTTP/1.1\r\nHo";
+  input += partial;
+
+  // Feed it in slices that don't line up with the requests.
+  size_t fed = 0;
+  for (int i = 0; i < kNumRequests; i++) {
+    while (!connection.has_buffered_request()) {
+      ASSERT_LT(fed, input.size());
+      size_t len = std::min<size_t>(7, input.size() - fed);
+      connection.append_input(input.data() + fed, len);
+      fed += len;
+    }
+    HttpRequest request;
+    ASSERT_TRUE(connection.next_buffered_request(&request));
+    ASSERT_EQ("/r" + std::to_string(i), request.uri());
+  }
+  connection.append_input(input.data() + fed, input.size() - fed);
+  ASSERT_FALSE(connection.has_buffered_request());
+  ASSERT_EQ(partial.size(), connection.buffered_bytes());
+
+  connection.append_input("st: x\r\n\r\n", 9);
+  HttpRequest request;
+  ASSERT_TRUE(connection.has_buffered_request());
+  ASSERT_TRUE(connection.next_buffered_request(&request));
+  ASSERT_EQ("/last", request.uri());
+  ASSERT_EQ(0U, connection.buffered_bytes());
+}
+
+TEST(Test_HttpConnection, read_available) {
+  ProjectEnvironment::OpenTestCase();
+  int spair[2] = {-1, -1};
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, spair));
+  HttpConnection connection(spair[0]);
+
+  // However much the client has sent, a read stops soon after the
+  // limit, and picks up from there next time.
+  string sent;
+  ssize_t res;
+  while ((res = write(spair[1], string(4096, 'a').data(), 4096)) > 0) {
+    sent.append(res, 'a');
+  }
+  ASSERT_GT(sent.size(), 100000U);
+  bool eof;
+  ASSERT_TRUE(connection.read_available(&eof, 10000));
+  ASSERT_FALSE(eof);
+  ASSERT_GT(connection.buffered_bytes(), 10000U);
+  ASSERT_LT(connection.buffered_bytes(), sent.size());
+  ASSERT_TRUE(connection.read_available(&eof, sent.size()));
+  ASSERT_EQ(sent.size(), connection.buffered_bytes());
+
+  close(spair[1]);
+  ASSERT_TRUE(connection.read_available(&eof, sent.size()));
+  ASSERT_TRUE(eof);
+}
+
+TEST(Test_HttpConnection, buffer_overflowed) {
+  ProjectEnvironment::OpenTestCase();
+  HttpConnection connection(-1);
+
+  // A header may run up to the limit, but no further.
+  string header = "GET / HTTP/1.1\r\nX-Long: ";
+  header.append(kMaxBufferedBytes - header.size(), 'a');
+  connection.append_input(header.data(), header.size());
+  ASSERT_FALSE(connection.buffer_overflowed());
+  connection.append_input("a", 1);
+  ASSERT_TRUE(connection.buffer_overflowed());
+
+  // The body of a request whose header is in doesn't count against it.
+  HttpConnection post(-1);
+  string request = "POST /query HTTP/1.1\r\nContent-Length: 100000\r\n"
+                   "\r\n";
+  request.append(kMaxBufferedBytes + 50000, 'q');
+  post.append_input(request.data(), request.size());
+  ASSERT_FALSE(post.buffer_overflowed());
+}
+
+TEST(Test_HttpConnection, RequestHeaders) {
+  ProjectEnvironment::OpenTestCase();
+  HttpConnection connection(-1);
+  string input = "GET /Mixed/Case HTTP/1.1\r\n"
+                 "HOST: example.com:5950\r\n"
+                 "Connection: keep-alive\r\n"
+                 "X-Thing: one\r\n"
+                 "Accept-Encoding: gzip, br\r\n"
+                 "X-Thing: two\r\n"
+                 "Connection: Close\r\n"
+                 "\r\n";
+  connection.append_input(input.data(), input.size());
+
+  HttpRequest request;
+  ASSERT_TRUE(connection.has_buffered_request());
+  ASSERT_TRUE(connection.next_buffered_request(&request));
+
+  // The request owns its bytes, so a copy outlives both the original
+  // and the connection's buffer.
+  HttpRequest copy(request);
+  request = HttpRequest("/other");
+  connection.append_input("garbage", 7);
+
+  ASSERT_EQ("/Mixed/Case", copy.uri());
+  ASSERT_EQ("example.com:5950",
+            copy.GetHeaderValue(HttpRequest::KnownHeader::kHost));
+  ASSERT_EQ("gzip, br", copy.GetHeaderValue("accept-encoding"));
+  ASSERT_EQ("", copy.GetHeaderValue(HttpRequest::KnownHeader::kRange));
+  ASSERT_EQ("", copy.GetHeaderValue("x-missing"));
+
+  // The first of a repeated header counts, whether the server knows it
+  // or not, and it is that one AddHeader() replaces.
+  ASSERT_EQ("one", copy.GetHeaderValue("x-thing"));
+  ASSERT_EQ("keep-alive", copy.GetHeaderValue("connection"));
+  ASSERT_FALSE(copy.WantsClose());
+  copy.AddHeader("x-thing", "three");
+  ASSERT_EQ("three", copy.GetHeaderValue("x-thing"));
+  copy.AddHeader("connection", "close");
+  ASSERT_TRUE(copy.WantsClose());
+
+  ASSERT_EQ("/other", request.uri());
+  ASSERT_EQ(0, request.GetHeaderCount());
+  request.AddHeader("connection", "keep-alive");
+  request.AddHeader("connection", "CLOSE");
+  ASSERT_EQ(1, request.GetHeaderCount());
+  ASSERT_TRUE(request.WantsClose());
+}
+
+TEST(Test_HttpConnection, RequestBodies) {
+  ProjectEnvironment::OpenTestCase();
+  HttpConnection connection(-1);
+  string body(100000, 'x');
+  string input = "POST /batch HTTP/1.1\r\n"
+                 "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                 "\r\n" + body +
+                 "GET /next HTTP/1.1\r\n\r\n";
+
+  // The request isn't complete until all of its body is in.
+  size_t header_len = input.find("\r\n\r\n") + 4;
+  connection.append_input(input.data(), header_len + 10);
+  ASSERT_FALSE(connection.has_buffered_request());
+  ASSERT_EQ(body.size(), connection.pending_body_length());
+  connection.append_input(input.data() + header_len + 10,
+                          input.size() - header_len - 10);
+
+  HttpRequest request;
+  ASSERT_TRUE(connection.has_buffered_request());
+  ASSERT_TRUE(connection.next_buffered_request(&request));
+  ASSERT_EQ("POST", request.method());
+  ASSERT_EQ("/batch", request.uri());
+  ASSERT_EQ(body, request.body());
+  ASSERT_EQ(0U, connection.pending_body_length());
+
+  // What follows the body is the next request.
+  ASSERT_TRUE(connection.has_buffered_request());
+  ASSERT_TRUE(connection.next_buffered_request(&request));
+  ASSERT_EQ("GET", request.method());
+  ASSERT_EQ("/next", request.uri());
+  ASSERT_EQ("", request.body());
+  ASSERT_EQ(0U, connection.buffered_bytes());
+
+  // Bodies that aren't framed by one Content-Length, or are too long,
+  // are refused.
+  const char *bad[] = {
+    "POST /batch HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n",
+    "POST /batch HTTP/1.1\r\nContent-Length: 12x\r\n\r\n",
+    "POST /batch HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n",
+    "POST /batch HTTP/1.1\r\nContent-Length: 1000000000\r\n\r\n",
+    "PUT /batch HTTP/1.1\r\n\r\n",
+  };
+  for (const char *b : bad) {
+    HttpConnection refused(-1);
+    refused.append_input(b, strlen(b));
+    ASSERT_TRUE(refused.has_buffered_request()) << b;
+    ASSERT_FALSE(refused.next_buffered_request(&request)) << b;
+  }
+}
+
+TEST(Test_HttpConnection, ResponseSerialization) {
+  ProjectEnvironment::OpenTestCase();
+  HttpResponse response;
+  response.set_protocol("HTTP/1.1");
+  response.set_response_code(404);
+  response.set_message("Not Found");
+  response.set_content_type("text/html");
+  response.ReserveBody(100);
+  response.AppendToBody("rank ");
+  response.AppendNumberToBody(-42);
+  response.AppendToBody(string(" of "));
+  response.AppendNumberToBody(9000000000LL);
+  string expected = "HTTP/1.1 404 Not Found\r\n"
+                    "Content-type: text/html\r\n"
+                    "Content-length: 22\r\n\r\n"
+                    "rank -42 of 9000000000";
+  ASSERT_EQ(expected, response.GenerateResponseString());
+
+  // Appending keeps what the buffer already holds.
+  string out = "previous";
+  response.AppendResponseTo(&out);
+  ASSERT_EQ("previous" + expected, out);
+
+  out.clear();
+  response.AppendHeaderTo(&out, 12345678901234ULL);
+  ASSERT_EQ("HTTP/1.1 404 Not Found\r\nContent-type: text/html\r\n"
+            "Content-length: 12345678901234\r\n\r\n", out);
+  ASSERT_EQ(out, response.GenerateHeaderString(12345678901234ULL));
+}
+
+// A stream of the pieces it is given, with an empty one in between
+// that must not end the body.
+class TestStream : public BodyStream {
+ public:
+  explicit TestStream(std::vector<string> pieces) : pieces_(pieces) { }
+
+  bool Next(string *out) override {
+    if (next_ == pieces_.size()) {
+      return false;
+    }
+    out->append(pieces_[next_++]);
+    return true;
+  }
+
+ private:
+  std::vector<string> pieces_;
+  size_t next_ = 0;
+};
+
+TEST(Test_HttpConnection, StreamedResponse) {
+  ProjectEnvironment::OpenTestCase();
+  auto make_response = []() {
+    HttpResponse response;
+    response.set_protocol("HTTP/1.1");
+    response.set_response_code(200);
+    response.set_message("OK");
+    response.set_content_type("text/plain");
+    response.AppendToBody("replaced by the stream");
+    response.SetBodyStream(std::make_shared<TestStream>(
+        std::vector<string>{ "hello", "", string(300, 'x') }));
+    return response;
+  };
+  string expected = "HTTP/1.1 200 OK\r\nContent-type: text/plain\r\n"
+                    "Transfer-Encoding: chunked\r\n\r\n"
+                    "00000005\r\nhello\r\n"
+                    "0000012c\r\n" + string(300, 'x') + "\r\n"
+                    "0\r\n\r\n";
+  ASSERT_EQ(expected, make_response().GenerateResponseString());
+
+  // A stream is used up by sending it.
+  HttpResponse once = make_response();
+  once.GenerateResponseString();
+  string chunk;
+  ASSERT_FALSE(once.body_stream()->NextChunk(&chunk));
+  ASSERT_EQ("", chunk);
+
+  // Written directly between two other responses, and through the
+  // non-blocking output queue.
+  HttpResponse responses[3];
+  for (HttpResponse &response : responses) {
+    response.set_protocol("HTTP/1.1");
+    response.set_response_code(200);
+    response.set_message("OK");
+  }
+  responses[0].AppendToBody("before");
+  responses[1] = make_response();
+  responses[2].AppendToBody("after");
+  string before = responses[0].GenerateResponseString();
+  string after = responses[2].GenerateResponseString();
+
+  int pipefds[2];
+  ASSERT_EQ(0, pipe(pipefds));
+  {
+    HttpConnection connection(pipefds[1]);
+    ASSERT_TRUE(connection.write_responses(responses, 3));
+    connection.queue_response(responses[0]);
+    connection.queue_response(make_response());
+    connection.queue_response(responses[2]);
+    ASSERT_TRUE(connection.flush_output());
+    ASSERT_FALSE(connection.has_pending_output());
+  }
+
+  string actual;
+  while (wrapped_read(pipefds[0], &actual) > 0) { }
+  ASSERT_EQ(before + expected + after + before + expected + after, actual);
+  close(pipefds[0]);
+}
+
 }  // namespace searchserver
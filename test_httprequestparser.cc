@@ -0,0 +1,176 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "./HttpRequestParser.h"
+#include "./test_suite.h"
+
+using std::string;
+
+namespace searchserver {
+
+typedef HttpRequestParser::Status Status;
+
+TEST(Test_HttpRequestParser, Basic) {
+  ProjectEnvironment::OpenTestCase();
+  string buf = "GET /Query?Terms=Foo HTTP/1.1\r\n"
+               "Host: localhost:5950\r\n"
+               "X-Mixed-Case:  Some Value \r\n"
+               "Empty:\r\n"
+               "\r\n"
+               "GET /next";
+  HttpRequestParser parser;
+  ASSERT_EQ(Status::kDone, parser.parse(&buf[0], buf.size()));
+  ASSERT_EQ(buf.size() - 9, parser.length());
+
+  HttpRequestView view;
+  parser.view(buf.data(), &view);
+  ASSERT_EQ("GET", view.method);
+  ASSERT_EQ("/Query?Terms=Foo", view.uri);
+  ASSERT_EQ("HTTP/1.1", view.protocol);
+  ASSERT_EQ(3U, view.headers.size());
+
+  // Only the names are lowercased, in place; a value keeps its case,
+  // any ':' in it, and whitespace inside it.
+  ASSERT_EQ("host", view.headers[0].first);
+  ASSERT_EQ("localhost:5950", view.headers[0].second);
+  ASSERT_EQ("x-mixed-case", view.headers[1].first);
+  ASSERT_EQ("Some Value", view.headers[1].second);
+  ASSERT_EQ("empty", view.headers[2].first);
+  ASSERT_EQ("", view.headers[2].second);
+  ASSERT_EQ(0U, buf.find("GET /Query?Terms=Foo HTTP/1.1\r\nhost:"));
+}
+
+TEST(Test_HttpRequestParser, Incremental) {
+  ProjectEnvironment::OpenTestCase();
+  const string request = "\r\nGET /a HTTP/1.0\nAccept: */*\r\n\r\n";
+
+  // Feed the request in one byte at a time, as if every read returned
+  // a single byte; the buffer grows (and may move) between calls.
+  HttpRequestParser parser;
+  string buf;
+  for (size_t i = 0; i < request.size() - 1; i++) {
+    buf += request[i];
+    ASSERT_EQ(Status::kIncomplete, parser.parse(&buf[0], buf.size()));
+  }
+  buf += request.back();
+  ASSERT_EQ(Status::kDone, parser.parse(&buf[0], buf.size()));
+  ASSERT_EQ(request.size(), parser.length());
+
+  HttpRequestView view;
+  parser.view(buf.data(), &view);
+  ASSERT_EQ("/a", view.uri);
+  ASSERT_EQ("HTTP/1.0", view.protocol);
+  ASSERT_EQ(1U, view.headers.size());
+  ASSERT_EQ("*/*", view.headers[0].second);
+
+  // Once reset, the parser starts on the next request.
+  parser.reset();
+  buf = "GET /b\r\n\r\n";
+  ASSERT_EQ(Status::kDone, parser.parse(&buf[0], buf.size()));
+  parser.view(buf.data(), &view);
+  ASSERT_EQ("/b", view.uri);
+  ASSERT_EQ("", view.protocol);
+  ASSERT_EQ(0U, view.headers.size());
+}
+
+TEST(Test_HttpRequestParser, LongLines) {
+  ProjectEnvironment::OpenTestCase();
+  // Lines long enough to be scanned a vector at a time, with their
+  // ends at every offset within a vector, arriving in chunks of every
+  // size up to a little more than a vector.
+  for (size_t extra = 0; extra < 33; extra++) {
+    string uri = "/" + string(100 + extra, 'u');
+    string cookie = string(300 + extra, 'c') + " ; x=y";
+    string request = "GET " + uri + " HTTP/1.1\r\n"
+                     "Cookie: " + cookie + "  \r\n"
+                     "\r\n";
+    for (size_t chunk = 1; chunk < 40; chunk += 3) {
+      HttpRequestParser parser;
+      string buf;
+      Status status = Status::kIncomplete;
+      for (size_t i = 0; i < request.size(); i += chunk) {
+        ASSERT_EQ(Status::kIncomplete, status);
+        buf += request.substr(i, chunk);
+        status = parser.parse(&buf[0], buf.size());
+      }
+      ASSERT_EQ(Status::kDone, status);
+      ASSERT_EQ(request.size(), parser.length());
+
+      HttpRequestView view;
+      parser.view(buf.data(), &view);
+      ASSERT_EQ(uri, view.uri);
+      ASSERT_EQ(1U, view.headers.size());
+      ASSERT_EQ(cookie, view.headers[0].second);
+    }
+  }
+}
+
+TEST(Test_HttpRequestParser, Malformed) {
+  ProjectEnvironment::OpenTestCase();
+  const char *bad[] = {
+    "GET\r\n\r\n",                          // no URI
+    "GET /\r\nno colon here\r\n\r\n",
+    "GET /\r\n: no name\r\n\r\n",
+    "GET /\r\nA: b\r\n folded\r\n\r\n",     // obsolete line folding
+    "GET /\rX\n\r\n",                       // '\r' not followed by '\n'
+    "GET /a\x01 HTTP/1.1\r\n\r\n",
+    "GET /a\x7f\r\n\r\n",
+  };
+  for (const char *request : bad) {
+    string buf = request;
+    HttpRequestParser parser;
+    ASSERT_EQ(Status::kError, parser.parse(&buf[0], buf.size())) << request;
+  }
+
+  // An error is reported as soon as it is seen, without waiting for the
+  // rest of the header, and sticks.
+  string buf = "GET /\r\nbroken\r";
+  HttpRequestParser parser;
+  ASSERT_EQ(Status::kError, parser.parse(&buf[0], buf.size()));
+  buf += "\n\r\n";
+  ASSERT_EQ(Status::kError, parser.parse(&buf[0], buf.size()));
+}
+
+TEST(Test_HttpRequestParser, HeaderNames) {
+  ProjectEnvironment::OpenTestCase();
+  // A name is a token: nothing but letters, digits and a few symbols,
+  // with no whitespace, even just before the colon.
+  const char *bad[] = {
+    "GET /\r\nX-Mixed-Case : v\r\n\r\n",
+    "GET /\r\nX-Mixed-Case\t: v\r\n\r\n",
+    "GET /\r\nTwo Words: v\r\n\r\n",
+    "GET /\r\nA(b): v\r\n\r\n",
+    "GET /\r\nA\"b\": v\r\n\r\n",
+    "GET /\r\nA/b: v\r\n\r\n",
+    "GET /\r\n\xc3\xa9: v\r\n\r\n",
+    "GET /\r\n@a: v\r\n\r\n",
+  };
+  for (const char *request : bad) {
+    string buf = request;
+    HttpRequestParser parser;
+    ASSERT_EQ(Status::kError, parser.parse(&buf[0], buf.size())) << request;
+  }
+
+  string buf = "GET / HTTP/1.1\r\n"
+               "X-Odd!#$%&'*+-.^_`|~09: v\r\n"
+               "\r\n";
+  HttpRequestParser parser;
+  ASSERT_EQ(Status::kDone, parser.parse(&buf[0], buf.size()));
+  HttpRequestView view;
+  parser.view(buf.data(), &view);
+  ASSERT_EQ(1U, view.headers.size());
+  ASSERT_EQ("x-odd!#$%&'*+-.^_`|~09", view.headers[0].first);
+}
+
+}  // namespace searchserver
@@ -9,11 +9,17 @@
  * author.
  */
 
+#include <errno.h>
 #include <fcntl.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <cstring>
+#include <iterator>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "./HttpUtils.h"
 #include "./FileReader.h"
@@ -21,7 +27,9 @@
 #include "gtest/gtest.h"
 #include "./test_suite.h"
 
+using std::pair;
 using std::string;
+using std::vector;
 
 namespace searchserver {
 
@@ -47,6 +55,129 @@ TEST(Test_HttpUtils, is_path_safe) {
   ProjectEnvironment::AddPoints(20);
 }
 
+TEST(Test_HttpUtils, open_beneath) {
+  ProjectEnvironment::OpenTestCase();
+  char dir_name[] = "/tmp/test_openbeneath_XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir_name) != nullptr);
+  string root = string(dir_name) + "/root";
+  ASSERT_EQ(0, mkdir(root.c_str(), 0700));
+  string inside = root + "/in.txt";
+  string outside = string(dir_name) + "/out.txt";
+  close(open(inside.c_str(), O_WRONLY | O_CREAT, 0600));
+  close(open(outside.c_str(), O_WRONLY | O_CREAT, 0600));
+  string link = root + "/link.txt";
+  ASSERT_EQ(0, symlink(outside.c_str(), link.c_str()));
+
+  // The real path is the root's, then the rest of the name, with "."
+  // and ".." resolved; the file need not exist.
+  string real_path;
+  ASSERT_TRUE(is_path_safe(root, root + "/./x/../in.txt", &real_path));
+  ASSERT_EQ(inside, real_path);
+  int fd = open_beneath(root, real_path);
+  ASSERT_NE(-1, fd);
+  close(fd);
+  ASSERT_TRUE(is_path_safe(root, root + "/missing.txt", &real_path));
+  ASSERT_EQ(-1, open_beneath(root, real_path));
+  ASSERT_EQ(ENOENT, errno);
+
+  // A link that leads out of the root looks safe by name, but can't be
+  // opened.
+  ASSERT_TRUE(is_path_safe(root, link, &real_path));
+  ASSERT_EQ(-1, open_beneath(root, real_path));
+  ASSERT_EQ(EXDEV, errno);
+  ASSERT_EQ(-1, open_beneath(root, outside));
+  ASSERT_EQ(EXDEV, errno);
+
+  unlink(link.c_str());
+  unlink(inside.c_str());
+  unlink(outside.c_str());
+  rmdir(root.c_str());
+  rmdir(dir_name);
+}
+
+TEST(Test_HttpUtils, walk_beneath) {
+  ProjectEnvironment::OpenTestCase();
+  char dir_name[] = "/tmp/test_walkbeneath_XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir_name) != nullptr);
+  string root = string(dir_name) + "/root";
+  ASSERT_EQ(0, mkdir(root.c_str(), 0700));
+  ASSERT_EQ(0, mkdir((root + "/sub").c_str(), 0700));
+  close(open((root + "/in.txt").c_str(), O_WRONLY | O_CREAT, 0600));
+  close(open((root + "/sub/deep.txt").c_str(), O_WRONLY | O_CREAT, 0600));
+  close(open((string(dir_name) + "/out.txt").c_str(),
+             O_WRONLY | O_CREAT, 0600));
+
+  // Links of every kind, and what opening through each should give:
+  // 0 if it opens, or else the errno.
+  struct Fixture {
+    string name;
+    string target;
+    int expected;
+  };
+  const Fixture fixtures[] = {
+    { "rel_in", "in.txt", 0 },
+    { "rel_deep", "sub/deep.txt", 0 },
+    { "sub/up", "../in.txt", 0 },
+    { "dir_link", "sub", 0 },
+    { "chain", "rel_in", 0 },
+    { "abs_in", root + "/in.txt", EXDEV },
+    { "abs_out", string(dir_name) + "/out.txt", EXDEV },
+    { "rel_out", "../out.txt", EXDEV },
+    { "sub/climb", "../../root/in.txt", EXDEV },
+    { "loop", "loop", ELOOP },
+  };
+  for (const Fixture &fixture : fixtures) {
+    ASSERT_EQ(0, symlink(fixture.target.c_str(),
+                         (root + "/" + fixture.name).c_str()));
+  }
+  vector<pair<string, int>> cases = {
+    { "in.txt", 0 },
+    { "dir_link/deep.txt", 0 },
+    { "missing.txt", ENOENT },
+    { "in.txt/x", ENOTDIR },
+  };
+  for (const Fixture &fixture : fixtures) {
+    cases.emplace_back(fixture.name, fixture.expected);
+  }
+
+  // openat2() (where the kernel has it) and the walk open the same
+  // files, and refuse the rest for the same reasons.
+  for (const auto &c : cases) {
+    string real_path;
+    ASSERT_TRUE(is_path_safe(root, root + "/" + c.first, &real_path));
+    int fds[2] = { open_beneath(root, real_path), -1 };
+    int errnos[2] = { errno, 0 };
+    fds[1] = walk_beneath(root, real_path);
+    errnos[1] = errno;
+    for (int i = 0; i < 2; i++) {
+      if (c.second == 0) {
+        ASSERT_NE(-1, fds[i]) << c.first;
+      } else {
+        ASSERT_EQ(-1, fds[i]) << c.first;
+        ASSERT_EQ(c.second, errnos[i]) << c.first;
+      }
+    }
+    if (c.second == 0) {
+      struct stat st[2];
+      ASSERT_EQ(0, fstat(fds[0], &st[0]));
+      ASSERT_EQ(0, fstat(fds[1], &st[1]));
+      ASSERT_EQ(st[0].st_ino, st[1].st_ino) << c.first;
+      close(fds[0]);
+      close(fds[1]);
+    }
+  }
+
+  for (auto it = std::rbegin(fixtures); it != std::rend(fixtures); ++it) {
+    unlink((root + "/" + it->name).c_str());
+  }
+  unlink((root + "/sub/deep.txt").c_str());
+  unlink((root + "/in.txt").c_str());
+  unlink((string(dir_name) + "/out.txt").c_str());
+  rmdir((root + "/sub").c_str());
+  rmdir(root.c_str());
+  rmdir(dir_name);
+}
+
 TEST(Test_HttpUtils, escape_html) {
   ProjectEnvironment::OpenTestCase();
 
@@ -154,4 +285,102 @@ TEST(Test_HttpUtils, URLParser) {
   ASSERT_EQ("baz", p.args()["bam"]);
 }
 
+TEST(Test_HttpUtils, conditional_get) {
+  ProjectEnvironment::OpenTestCase();
+
+  // Dates go out in the preferred format, and all three formats that
+  // clients may send are understood.
+  ASSERT_EQ("Sun, 06 Nov 1994 08:49:37 GMT", format_http_date(784111777));
+  time_t t = 0;
+  ASSERT_TRUE(parse_http_date("Sun, 06 Nov 1994 08:49:37 GMT", &t));
+  ASSERT_EQ(784111777, t);
+  ASSERT_TRUE(parse_http_date("Sunday, 06-Nov-94 08:49:37 GMT", &t));
+  ASSERT_EQ(784111777, t);
+  ASSERT_TRUE(parse_http_date("Sun Nov  6 08:49:37 1994", &t));
+  ASSERT_EQ(784111777, t);
+  ASSERT_FALSE(parse_http_date("yesterday", &t));
+  ASSERT_FALSE(parse_http_date("Sun, 06 Nov 1994 08:49:37 GMT junk", &t));
+
+  // The tag follows the file's identity, size and modification time.
+  struct stat st;
+  memset(&st, 0, sizeof(st));
+  st.st_ino = 0x1234;
+  st.st_size = 100;
+  st.st_mtim.tv_sec = 1;
+  st.st_mtim.tv_nsec = 5;
+  string etag = make_etag(st);
+  ASSERT_EQ("\"1234-64-3b9aca05\"", etag);
+  st.st_mtim.tv_nsec = 6;
+  ASSERT_NE(etag, make_etag(st));
+
+  ASSERT_TRUE(etag_matches(etag, etag));
+  ASSERT_TRUE(etag_matches("*", etag));
+  ASSERT_TRUE(etag_matches("\"a\", W/" + etag + " ,\"b\"", etag));
+  ASSERT_FALSE(etag_matches("\"a\", \"b\"", etag));
+  ASSERT_FALSE(etag_matches("\"1234-64-3b9aca0\"", etag));
+}
+
+TEST(Test_HttpUtils, parse_byte_ranges) {
+  ProjectEnvironment::OpenTestCase();
+  std::vector<ByteRange> r;
+
+  ASSERT_TRUE(parse_byte_ranges("bytes=0-499", 1000, &r));
+  ASSERT_EQ(1U, r.size());
+  ASSERT_EQ(0U, r[0].offset);
+  ASSERT_EQ(500U, r[0].length);
+
+  // Open-ended and suffix ranges, clipped to the file, in the order
+  // asked for; empty list elements and whitespace are allowed.
+  ASSERT_TRUE(parse_byte_ranges("bytes=900-, ,-300,  10-2000", 1000, &r));
+  ASSERT_EQ(3U, r.size());
+  ASSERT_EQ(900U, r[0].offset);
+  ASSERT_EQ(100U, r[0].length);
+  ASSERT_EQ(700U, r[1].offset);
+  ASSERT_EQ(300U, r[1].length);
+  ASSERT_EQ(10U, r[2].offset);
+  ASSERT_EQ(990U, r[2].length);
+  ASSERT_TRUE(parse_byte_ranges("bytes=-5000", 1000, &r));
+  ASSERT_EQ(0U, r[0].offset);
+  ASSERT_EQ(1000U, r[0].length);
+
+  // Ranges past the end are dropped; if none are left, the request
+  // can't be satisfied.
+  ASSERT_TRUE(parse_byte_ranges("bytes=1000-,5-5", 1000, &r));
+  ASSERT_EQ(1U, r.size());
+  ASSERT_EQ(5U, r[0].offset);
+  ASSERT_EQ(1U, r[0].length);
+  ASSERT_TRUE(parse_byte_ranges("bytes=1000-1999", 1000, &r));
+  ASSERT_TRUE(r.empty());
+  ASSERT_TRUE(parse_byte_ranges("bytes=-0", 1000, &r));
+  ASSERT_TRUE(r.empty());
+
+  // Anything malformed means the header is ignored.
+  const char *bad[] = {
+    "bytes=", "bytes=,", "items=0-1", "bytes=5-4", "bytes=a-b", "bytes=1",
+    "bytes=1-2-3", "bytes=--1", "bytes=0-1,x", "bytes=99999999999999999999-",
+  };
+  for (const char *range : bad) {
+    ASSERT_FALSE(parse_byte_ranges(range, 1000, &r)) << range;
+  }
+}
+
+TEST(Test_HttpUtils, accepts_encoding) {
+  ProjectEnvironment::OpenTestCase();
+  ASSERT_TRUE(accepts_encoding("gzip", "gzip"));
+  ASSERT_TRUE(accepts_encoding("deflate, GZIP;q=0.5 , br", "gzip"));
+  ASSERT_TRUE(accepts_encoding("deflate, gzip;q=0.5 , br", "br"));
+  ASSERT_FALSE(accepts_encoding("", "gzip"));
+  ASSERT_FALSE(accepts_encoding("deflate", "gzip"));
+  ASSERT_FALSE(accepts_encoding("gzipped", "gzip"));
+  ASSERT_FALSE(accepts_encoding("gzip;q=0", "gzip"));
+  ASSERT_FALSE(accepts_encoding("gzip; q=0.000", "gzip"));
+  ASSERT_TRUE(accepts_encoding("gzip;q=0.001", "gzip"));
+
+  // "*" covers whatever isn't named.
+  ASSERT_TRUE(accepts_encoding("*", "br"));
+  ASSERT_FALSE(accepts_encoding("*;q=0", "br"));
+  ASSERT_FALSE(accepts_encoding("br;q=0, *", "br"));
+  ASSERT_TRUE(accepts_encoding("*;q=0, br", "br"));
+}
+
 }  // namespace searchserver
@@ -0,0 +1,93 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "./InputBuffer.h"
+#include "./HttpUtils.h"
+#include "./test_suite.h"
+
+using std::string;
+
+namespace searchserver {
+
+TEST(Test_InputBuffer, Basic) {
+  ProjectEnvironment::OpenTestCase();
+  InputBuffer buf;
+  ASSERT_TRUE(buf.empty());
+  ASSERT_EQ(0U, buf.size());
+
+  buf.append("hello, ", 7);
+  buf.append("world", 5);
+  ASSERT_EQ("hello, world", string(buf.data(), buf.size()));
+  buf.consume(7);
+  ASSERT_EQ("world", string(buf.data(), buf.size()));
+
+  // Filling the block moves what is left down to make room rather
+  // than growing.
+  string fill(kInputBlockSize - 5, 'x');
+  buf.append(fill.data(), fill.size());
+  ASSERT_EQ(kInputBlockSize, buf.size());
+  ASSERT_EQ("world" + fill, string(buf.data(), buf.size()));
+
+  // Beyond a block it grows, keeping the contents.
+  buf.append("!", 1);
+  ASSERT_EQ("world" + fill + "!", string(buf.data(), buf.size()));
+
+  // Consuming everything empties it, and it can be used again.
+  buf.consume(buf.size());
+  ASSERT_TRUE(buf.empty());
+  buf.append("again", 5);
+  ASSERT_EQ("again", string(buf.data(), buf.size()));
+}
+
+TEST(Test_InputBuffer, ReadFrom) {
+  ProjectEnvironment::OpenTestCase();
+  int pipefds[2];
+  ASSERT_EQ(0, pipe(pipefds));
+  ASSERT_EQ(0, fcntl(pipefds[0], F_SETFL, O_NONBLOCK));
+
+  // More than a block, but little enough to fit in the pipe, so that
+  // the first read_from() spills into its scratch space.
+  string sent;
+  for (int i = 0; sent.size() < 50000; i++) {
+    sent += std::to_string(i) + ",";
+  }
+  ASSERT_EQ(static_cast<int>(sent.size()), wrapped_write(pipefds[1], sent));
+  close(pipefds[1]);
+
+  InputBuffer buf;
+  ssize_t res;
+  size_t total = 0;
+  while ((res = buf.read_from(pipefds[0])) > 0) {
+    total += res;
+  }
+  ASSERT_EQ(0, res);
+  ASSERT_EQ(sent.size(), total);
+  ASSERT_EQ(sent, string(buf.data(), buf.size()));
+
+  // With nothing to read, the buffer is left as it was.
+  InputBuffer empty;
+  int again[2];
+  ASSERT_EQ(0, pipe(again));
+  ASSERT_EQ(0, fcntl(again[0], F_SETFL, O_NONBLOCK));
+  ASSERT_EQ(-1, empty.read_from(again[0]));
+  ASSERT_EQ(EAGAIN, errno);
+  ASSERT_TRUE(empty.empty());
+  close(again[0]);
+  close(again[1]);
+  close(pipefds[0]);
+}
+
+}  // namespace searchserver
@@ -0,0 +1,111 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "./HttpUtils.h"
+#include "./ListenerHandoff.h"
+#include "./test_suite.h"
+
+using std::string;
+using std::vector;
+
+namespace searchserver {
+
+TEST(Test_ListenerHandoff, SendReceive) {
+  ProjectEnvironment::OpenTestCase();
+  int sock[2], pipefds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sock));
+  ASSERT_EQ(0, pipe(pipefds));
+
+  // What comes out is a new descriptor for the same pipe.
+  ASSERT_TRUE(SendFds(sock[0], vector<int>{ pipefds[1] }));
+  vector<int> fds;
+  ASSERT_TRUE(ReceiveFds(sock[1], &fds));
+  ASSERT_EQ(1U, fds.size());
+  ASSERT_NE(pipefds[1], fds[0]);
+  ASSERT_EQ(5, wrapped_write(fds[0], "hello"));
+  string read_back;
+  ASSERT_EQ(5, wrapped_read(pipefds[0], &read_back));
+  ASSERT_EQ("hello", read_back);
+
+  // Nothing to send, or nothing received.
+  ASSERT_FALSE(SendFds(sock[0], vector<int>()));
+  close(sock[0]);
+  ASSERT_FALSE(ReceiveFds(sock[1], &fds));
+  ASSERT_TRUE(fds.empty());
+
+  close(sock[1]);
+  close(pipefds[0]);
+  close(pipefds[1]);
+}
+
+TEST(Test_ListenerHandoff, TakeListeners) {
+  ProjectEnvironment::OpenTestCase();
+  char dir[] = "/tmp/test_listenerhandoff_XXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(dir));
+  string path = string(dir) + "/handoff.sock";
+
+  // No one to take over from yet.
+  vector<int> fds;
+  ASSERT_FALSE(TakeListeners(path, &fds));
+  ASSERT_TRUE(fds.empty());
+
+  int pipefds[2];
+  ASSERT_EQ(0, pipe(pipefds));
+  std::atomic<int> handoffs{0};
+  {
+    HandoffListener listener(path, vector<int>{ pipefds[0], pipefds[1] },
+                             [&handoffs]() { handoffs++; });
+    ASSERT_TRUE(listener.start());
+    ASSERT_FALSE(listener.handed_off());
+
+    // Only our own user may connect.
+    struct stat st;
+    ASSERT_EQ(0, stat(path.c_str(), &st));
+    ASSERT_EQ(static_cast<mode_t>(S_IRUSR | S_IWUSR), st.st_mode & 0777);
+
+    ASSERT_TRUE(TakeListeners(path, &fds));
+    ASSERT_EQ(2U, fds.size());
+    for (int i = 0; (i < 500) && (handoffs == 0); i++) {
+      usleep(10000);
+    }
+    ASSERT_EQ(1, handoffs);
+    ASSERT_TRUE(listener.handed_off());
+
+    // There is only ever one handoff.
+    vector<int> again;
+    ASSERT_FALSE(TakeListeners(path, &again));
+  }
+
+  // The path now belongs to whoever took over, so it is left alone.
+  ASSERT_EQ(0, access(path.c_str(), F_OK));
+  ASSERT_EQ(2, wrapped_write(fds[1], "ok"));
+  string read_back;
+  ASSERT_EQ(2, wrapped_read(pipefds[0], &read_back));
+
+  for (int fd : fds) {
+    close(fd);
+  }
+  close(pipefds[0]);
+  close(pipefds[1]);
+  unlink(path.c_str());
+  rmdir(dir);
+}
+
+}  // namespace searchserver
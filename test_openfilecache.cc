@@ -0,0 +1,125 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "./HttpUtils.h"
+#include "./OpenFileCache.h"
+#include "./test_suite.h"
+
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace searchserver {
+
+// Makes the file "path" hold "contents", replacing any that is there
+// with a new file, as an editor saving it would.
+static void Replace(const string &path, const string &contents) {
+  string tmp = path + ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  ASSERT_NE(-1, fd);
+  ASSERT_EQ(static_cast<int>(contents.size()), wrapped_write(fd, contents));
+  close(fd);
+  ASSERT_EQ(0, rename(tmp.c_str(), path.c_str()));
+}
+
+static string ReadAll(const shared_ptr<const BodyFile> &file) {
+  char buf[64];
+  ssize_t len = pread(file->fd(), buf, sizeof(buf), 0);
+  return string(buf, (len > 0) ? len : 0);
+}
+
+TEST(Test_OpenFileCache, Basic) {
+  ProjectEnvironment::OpenTestCase();
+  char dir_name[] = "/tmp/test_openfilecache_XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir_name) != nullptr);
+  string a = string(dir_name) + "/a.txt";
+  Replace(a, "hello");
+
+  // The file is opened once, and shared by everyone who asks for it.
+  OpenFileCache cache(1000, 60000);
+  struct stat st;
+  shared_ptr<const BodyFile> file = cache.open(a, &st);
+  ASSERT_TRUE(file != nullptr);
+  ASSERT_EQ(5, st.st_size);
+  ASSERT_EQ(file, cache.open(a, &st));
+  ASSERT_EQ(1U, cache.hits());
+  ASSERT_EQ(1U, cache.misses());
+
+  // Its stat is always current, even while the old file is kept open
+  // after it was replaced.
+  Replace(a, "hello, world");
+  ASSERT_EQ(file, cache.open(a, &st));
+  ASSERT_EQ(5, st.st_size);
+  ASSERT_EQ("hello", ReadAll(file));
+
+  // Until a change to it, or to a directory above it, is reported.
+  cache.invalidate({ string(dir_name) });
+  shared_ptr<const BodyFile> file2 = cache.open(a, &st);
+  ASSERT_NE(file, file2);
+  ASSERT_EQ(12, st.st_size);
+  ASSERT_EQ("hello, world", ReadAll(file2));
+
+  // A file that isn't there is remembered as such, too.
+  string b = string(dir_name) + "/b.txt";
+  ASSERT_EQ(nullptr, cache.open(b, &st));
+  Replace(b, "bee");
+  ASSERT_EQ(nullptr, cache.open(b, &st));
+  cache.invalidate({ b });
+  ASSERT_TRUE(cache.open(b, &st) != nullptr);
+
+  // Files are opened again once they have been open long enough.
+  OpenFileCache short_lived(1000, 0);
+  file = short_lived.open(a, &st);
+  ASSERT_NE(file, short_lived.open(a, &st));
+
+  // Beyond the limit, files are let go, but they stay open for anyone
+  // still using them.
+  OpenFileCache small(16, 60000);
+  file = small.open(a, &st);
+  for (int i = 0; i < 100; i++) {
+    small.open(string(dir_name) + "/missing" + std::to_string(i), &st);
+  }
+  ASSERT_LE(small.size(), 16U);
+  ASSERT_EQ("hello, world", ReadAll(file));
+  file.reset();
+  file2.reset();
+
+  // A file opened through a symbolic link is forgotten when a change
+  // is reported where it really is, as well as to the link.
+  string link = string(dir_name) + "/link.txt";
+  ASSERT_EQ(0, symlink("a.txt", link.c_str()));
+  file = cache.open(link, &st);
+  ASSERT_EQ("hello, world", ReadAll(file));
+  Replace(a, "changed");
+  ASSERT_EQ(file, cache.open(link, &st));
+  char *real_a = realpath(a.c_str(), nullptr);
+  ASSERT_TRUE(real_a != nullptr);
+  cache.invalidate({ real_a });
+  free(real_a);
+  ASSERT_EQ("changed", ReadAll(cache.open(link, &st)));
+  file.reset();
+
+  unlink(link.c_str());
+  unlink(a.c_str());
+  unlink(b.c_str());
+  rmdir(dir_name);
+}
+
+}  // namespace searchserver
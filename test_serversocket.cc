@@ -9,11 +9,14 @@
  * author.
  */
 
+#include <poll.h>
+#include <sys/socket.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <iostream>
 #include <string>
 #include <cstdlib>
+#include <vector>
 
 #include "gtest/gtest.h"
 #include "./ServerSocket.h"
@@ -134,4 +137,56 @@ TEST(Test_ServerSocket, Basic) {
   ProjectEnvironment::AddPoints(15);
 }
 
+TEST(Test_ServerSocket, ReusePort) {
+  // Bind two server sockets with reuse_port set to the same port; a
+  // third without it can't join them.
+  ProjectEnvironment::OpenTestCase();
+  uint16_t port = rand_port();
+  ServerSocket ss1(port, true);
+  ServerSocket ss2(port, true);
+  int listen_fds[2];
+  ASSERT_TRUE(ss1.bind_and_listen(&listen_fds[0]));
+  ASSERT_TRUE(ss2.bind_and_listen(&listen_fds[1]));
+  int other_fd;
+  ServerSocket other(port);
+  ASSERT_FALSE(other.bind_and_listen(&other_fd));
+
+  // Connect a batch of clients.  The kernel spreads them over both
+  // accept queues by the hash of their addresses, so with this many
+  // each socket gets some.
+  const int kClients = 32;
+  std::vector<int> client_fds;
+  for (int i = 0; i < kClients; i++) {
+    int cfd = -1;
+    ASSERT_TRUE(connect_to_server("127.0.0.1", port, &cfd));
+    client_fds.push_back(cfd);
+  }
+
+  // Accept them all, counting which socket each came in on.
+  int accepted[2] = { 0, 0 };
+  while (accepted[0] + accepted[1] < kClients) {
+    struct pollfd fds[2];
+    for (int i = 0; i < 2; i++) {
+      fds[i].fd = listen_fds[i];
+      fds[i].events = POLLIN;
+    }
+    ASSERT_LT(0, poll(fds, 2, 5000));
+    for (int i = 0; i < 2; i++) {
+      if (fds[i].revents & POLLIN) {
+        int fd = accept(listen_fds[i], nullptr, nullptr);
+        ASSERT_LE(0, fd);
+        close(fd);
+        accepted[i]++;
+      }
+    }
+  }
+  cout << "Accepted " << accepted[0] << " and " << accepted[1] << endl;
+  ASSERT_LT(0, accepted[0]);
+  ASSERT_LT(0, accepted[1]);
+
+  for (int cfd : client_fds) {
+    close(cfd);
+  }
+}
+
 }  // namespace searchserver
@@ -0,0 +1,156 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "./HttpRequest.h"
+#include "./HttpResponse.h"
+#include "./HttpServer.h"
+#include "./HttpUtils.h"
+#include "./StaticFileCache.h"
+#include "./test_suite.h"
+
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+
+namespace searchserver {
+
+// Returns an entry made from the file "file_name" as it is now, with
+// "body" as its body.
+static shared_ptr<StaticFileCache::Entry> MakeEntry(const char *file_name,
+                                                    const string &body) {
+  auto entry = make_shared<StaticFileCache::Entry>();
+  struct stat st;
+  EXPECT_EQ(0, stat(file_name, &st));
+  entry->header = "HTTP/1.1 200 OK\r\nContent-length: " +
+                  std::to_string(body.size()) + "\r\n\r\n";
+  entry->body = make_shared<const string>(body);
+  entry->sources.push_back(StaticFileCache::SourceOf(file_name, st));
+  return entry;
+}
+
+TEST(Test_StaticFileCache, Basic) {
+  ProjectEnvironment::OpenTestCase();
+  char file_name[] = "/tmp/test_staticfilecache_XXXXXX";
+  int fd = mkstemp(file_name);
+  ASSERT_NE(-1, fd);
+  ASSERT_EQ(5, wrapped_write(fd, "hello"));
+
+  // Misses until something is put, then hits, and counts both.  Its
+  // sources are checked every time, since revalidate_ms is 0.
+  StaticFileCache cache(1 << 20, 1000, 0);
+  ASSERT_EQ(nullptr, cache.get("a"));
+  auto entry = MakeEntry(file_name, "hello");
+  cache.put("a", entry);
+  ASSERT_EQ(entry, cache.get("a"));
+  ASSERT_EQ(entry, cache.get("a"));
+  ASSERT_EQ(nullptr, cache.get("b"));
+  ASSERT_EQ(2U, cache.hits());
+  ASSERT_EQ(2U, cache.misses());
+
+  // A prebuilt response is sent exactly as it was cached.
+  HttpResponse response;
+  response.SetPrebuilt(shared_ptr<const string>(entry, &entry->header),
+                       entry->body);
+  ASSERT_EQ(entry->header + "hello", response.GenerateResponseString());
+
+  // Once the file changes, the entry is stale and dropped.
+  ASSERT_EQ(1, wrapped_write(fd, "!"));
+  ASSERT_EQ(nullptr, cache.get("a"));
+  ASSERT_EQ(0U, cache.size());
+
+  // A change reported for the file, or for a directory above it, drops
+  // the entry without its file being looked at.
+  entry = MakeEntry(file_name, "hello!");
+  cache.put("a", entry);
+  cache.invalidate({ "/tmp/elsewhere", string(file_name) + "x" });
+  ASSERT_EQ(entry, cache.get("a"));
+  cache.invalidate({ file_name });
+  ASSERT_EQ(nullptr, cache.get("a"));
+  cache.put("a", entry);
+  cache.invalidate({ "/tmp" });
+  ASSERT_EQ(nullptr, cache.get("a"));
+
+  // An entry whose response is over the per-entry cap isn't kept.
+  cache.put("big", MakeEntry(file_name, string(2000, 'x')));
+  ASSERT_EQ(nullptr, cache.get("big"));
+
+  // The cache stays within its budget, dropping the least recently
+  // used entries first; the one just added is always there.
+  StaticFileCache small(16 * 4000, 1000, 60000);
+  shared_ptr<StaticFileCache::Entry> last;
+  for (int i = 0; i < 1000; i++) {
+    last = MakeEntry(file_name, string(900, 'y'));
+    small.put(std::to_string(i), last);
+    ASSERT_LE(small.size(), 16U * 4000);
+  }
+  ASSERT_GT(small.size(), 0U);
+  ASSERT_EQ(last, small.get("999"));
+  ASSERT_EQ(nullptr, small.get("0"));
+  close(fd);
+  unlink(file_name);
+}
+
+TEST(Test_StaticFileCache, AbsentSources) {
+  ProjectEnvironment::OpenTestCase();
+  char dir[] = "/tmp/test_staticfilecache_XXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(dir));
+  string text_name = string(dir) + "/a.txt";
+  string gz_name = text_name + ".gz";
+  int fd = open(text_name.c_str(), O_WRONLY | O_CREAT, 0644);
+  ASSERT_NE(-1, fd);
+  ASSERT_EQ(5, wrapped_write(fd, "hello"));
+  close(fd);
+
+  // An entry that depends on a file not being there is current until
+  // it appears, or a change is reported for its name.
+  StaticFileCache cache(1 << 20, 1000, 0);
+  auto entry = MakeEntry(text_name.c_str(), "hello");
+  entry->sources.push_back(StaticFileCache::AbsenceOf(gz_name));
+  cache.put("a", entry);
+  ASSERT_EQ(entry, cache.get("a"));
+  cache.invalidate({ gz_name });
+  ASSERT_EQ(nullptr, cache.get("a"));
+
+  // A text file sent as it is depends on its precompressed siblings
+  // being missing: once one turns up, it is sent instead.
+  HttpRequest req("/static/" + text_name);
+  req.set_method("GET");
+  req.AddHeader("accept-encoding", "gzip");
+  HttpResponse response =
+      ProcessRequest(req, dir, nullptr, nullptr, &cache);
+  string identity = response.GenerateResponseString();
+  ASSERT_EQ(string::npos, identity.find("Content-Encoding"));
+  ASSERT_TRUE(AnswerFromFileCache(req, dir, &cache, &response));
+  ASSERT_EQ(identity, response.GenerateResponseString());
+
+  fd = open(gz_name.c_str(), O_WRONLY | O_CREAT, 0644);
+  ASSERT_NE(-1, fd);
+  ASSERT_EQ(4, wrapped_write(fd, "gzip"));
+  close(fd);
+  ASSERT_FALSE(AnswerFromFileCache(req, dir, &cache, &response));
+  response = ProcessRequest(req, dir, nullptr, nullptr, &cache);
+  ASSERT_NE(string::npos,
+            response.GenerateResponseString().find("Content-Encoding: gzip"));
+
+  unlink(gz_name.c_str());
+  unlink(text_name.c_str());
+  rmdir(dir);
+}
+
+}  // namespace searchserver
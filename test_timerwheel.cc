@@ -0,0 +1,87 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "./TimerWheel.h"
+#include "./test_suite.h"
+
+using std::vector;
+
+namespace searchserver {
+
+TEST(Test_TimerWheel, Basic) {
+  ProjectEnvironment::OpenTestCase();
+  TimerWheel wheel(0, 10);
+  TimerWheel::Timer a, b, c;
+  a.data = 1;
+  b.data = 2;
+  c.data = 3;
+
+  ASSERT_EQ(-1, wheel.next_timeout_ms(0));
+  wheel.schedule(&a, 55);
+  wheel.schedule(&b, 100);
+  wheel.schedule(&c, 30);
+  ASSERT_EQ(3U, wheel.size());
+  ASSERT_TRUE(a.armed());
+
+  // Deadlines round up to a whole tick.
+  ASSERT_EQ(30, wheel.next_timeout_ms(0));
+
+  vector<TimerWheel::Timer *> expired;
+  wheel.advance(29, &expired);
+  ASSERT_TRUE(expired.empty());
+  wheel.advance(30, &expired);
+  ASSERT_EQ(1U, expired.size());
+  ASSERT_EQ(3U, expired[0]->data);
+  ASSERT_FALSE(c.armed());
+
+  // Cancelled and re-armed timers don't fire at their old deadline.
+  wheel.cancel(&b);
+  wheel.schedule(&a, 200);
+  expired.clear();
+  wheel.advance(150, &expired);
+  ASSERT_TRUE(expired.empty());
+  ASSERT_EQ(1U, wheel.size());
+  wheel.advance(200, &expired);
+  ASSERT_EQ(1U, expired.size());
+  ASSERT_EQ(1U, expired[0]->data);
+  ASSERT_EQ(0U, wheel.size());
+}
+
+TEST(Test_TimerWheel, Cascade) {
+  ProjectEnvironment::OpenTestCase();
+  // Deadlines far enough out to start in each of the coarser wheels,
+  // and one beyond the range of the coarsest.
+  const uint64_t deadlines[] = { 63, 64, 65, 4095, 4096, 4097, 300000,
+                                 16777215, 16777216, 40000000 };
+  const int num = sizeof(deadlines) / sizeof(deadlines[0]);
+  TimerWheel wheel(7, 1);
+  TimerWheel::Timer timers[num];
+  for (int i = 0; i < num; i++) {
+    timers[i].data = i;
+    wheel.schedule(&timers[i], 7 + deadlines[i]);
+  }
+
+  // Each must fire exactly on its tick, no earlier and no later.
+  for (int i = 0; i < num; i++) {
+    vector<TimerWheel::Timer *> expired;
+    wheel.advance(7 + deadlines[i] - 1, &expired);
+    ASSERT_TRUE(expired.empty());
+    wheel.advance(7 + deadlines[i], &expired);
+    ASSERT_EQ(1U, expired.size());
+    ASSERT_EQ(static_cast<uint64_t>(i), expired[0]->data);
+  }
+  ASSERT_EQ(0U, wheel.size());
+}
+
+}  // namespace searchserver
@@ -0,0 +1,217 @@
+/*
+ * Copyright ©2023 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2023 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "./StaticFileCache.h"
+#include "./UringLoop.h"
+#include "./WordIndex.h"
+#include "./test_suite.h"
+
+using std::string;
+
+namespace searchserver {
+
+// Returns a socket listening on a free port of 127.0.0.1, and sets
+// "*port" to the port.
+static int ListenOnLoopback(uint16_t *port) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  if ((fd == -1) ||
+      (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), len) == -1) ||
+      (listen(fd, 16) == -1) ||
+      (getsockname(fd, reinterpret_cast<struct sockaddr *>(&addr),
+                   &len) == -1)) {
+    return -1;
+  }
+  *port = ntohs(addr.sin_port);
+  return fd;
+}
+
+// Connects to "port" on 127.0.0.1 with a receive buffer of "rcvbuf"
+// bytes (or the default, if 0) and sends "request".  Returns the
+// socket, or -1.
+static int SendRequest(uint16_t port, const string &request, int rcvbuf) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if ((rcvbuf > 0) &&
+      (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+                  sizeof(rcvbuf)) == -1)) {
+    close(fd);
+    return -1;
+  }
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr),
+              sizeof(addr)) == -1) {
+    close(fd);
+    return -1;
+  }
+  // The server may hang up before it has read it all.
+  send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+  return fd;
+}
+
+// Reads from "fd" until the server closes the connection, appending
+// to "*reply", then closes "fd".
+static void ReadToEnd(int fd, string *reply) {
+  char buf[4096];
+  ssize_t res;
+  while ((res = read(fd, buf, sizeof(buf))) > 0) {
+    reply->append(buf, res);
+  }
+  close(fd);
+}
+
+static int CountOf(const string &haystack, const string &needle) {
+  int count = 0;
+  for (size_t pos = haystack.find(needle); pos != string::npos;
+       pos = haystack.find(needle, pos + 1)) {
+    count++;
+  }
+  return count;
+}
+
+TEST(Test_UringLoop, Basic) {
+  ProjectEnvironment::OpenTestCase();
+  if (!UringLoop::IsSupported()) {
+    GTEST_SKIP() << "io_uring isn't available";
+  }
+  uint16_t port;
+  int listen_fd = ListenOnLoopback(&port);
+  ASSERT_NE(-1, listen_fd);
+
+  WordIndex index;
+  index.record("hello", "test_files/hextext.txt");
+  TimeoutOptions timeouts;
+  ConnectionStats stats;
+  StaticFileCache file_cache(1 << 20, 1 << 16, 60000);
+  UringLoop loop(listen_fd, -1, "test_files", &index, &file_cache, nullptr,
+                 nullptr, 2, timeouts, &stats);
+  std::thread loop_thread([&loop]() { loop.run(); });
+
+  // A pipelined batch of file and query requests is answered in order.
+  string file_request = "GET /static/test_files/hextext.txt HTTP/1.1\r\n"
+                        "Host: x\r\n\r\n";
+  string reply;
+  ReadToEnd(SendRequest(port, file_request +
+                        "GET /query?terms=hello HTTP/1.1\r\n\r\n" +
+                        "GET /static/test_files/ok/bar HTTP/1.1\r\n"
+                        "Connection: close\r\n\r\n", 0), &reply);
+  ASSERT_EQ(3, CountOf(reply, "HTTP/1.1 200"));
+  size_t query_pos = reply.find("test_files/hextext.txt</a>");
+  ASSERT_NE(string::npos, query_pos);
+  ASSERT_LT(reply.find("Content-length: 4800\r\n"), query_pos);
+
+  // Now that the file is cached, the loop answers it by itself.
+  uint64_t hits = file_cache.hits();
+  reply.clear();
+  ReadToEnd(SendRequest(port, file_request +
+                        "GET /static/test_files/hextext.txt HTTP/1.1\r\n"
+                        "Connection: close\r\n\r\n", 0), &reply);
+  ASSERT_EQ(2, CountOf(reply, "Content-length: 4800\r\n"));
+  ASSERT_EQ(hits + 2, file_cache.hits());
+
+  // A client that sends far more than a request header could be is
+  // cut off, unanswered.
+  reply.clear();
+  ReadToEnd(SendRequest(port, "GET /" + string(4 << 20, 'a'), 0), &reply);
+  ASSERT_EQ("", reply);
+  ASSERT_EQ(stats.open(), 0U);
+
+  loop.stop();
+  loop_thread.join();
+  close(listen_fd);
+}
+
+TEST(Test_UringLoop, ShortRead) {
+  ProjectEnvironment::OpenTestCase();
+  if (!UringLoop::IsSupported()) {
+    GTEST_SKIP() << "io_uring isn't available";
+  }
+  uint16_t port;
+  int listen_fd = ListenOnLoopback(&port);
+  ASSERT_NE(-1, listen_fd);
+
+  // A file whose every chunk differs from the last, so that bytes
+  // left over from an earlier chunk can't pass for the real thing.
+  char dir_template[] = "/tmp/test_uringloop.XXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(dir_template));
+  string dir(dir_template);
+  string path = dir + "/big.bin";
+  const size_t kFileSize = 16 << 20;
+  const size_t kTruncatedSize = (8 << 20) + 1000;
+  string contents(kFileSize, '\0');
+  srand(5950);
+  for (char &ch : contents) {
+    ch = static_cast<char>(rand());
+  }
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0600);
+  ASSERT_NE(-1, fd);
+  ASSERT_EQ(static_cast<ssize_t>(kFileSize),
+            write(fd, contents.data(), contents.size()));
+  close(fd);
+
+  WordIndex index;
+  TimeoutOptions timeouts;
+  ConnectionStats stats;
+  UringLoop loop(listen_fd, -1, dir, &index, nullptr, nullptr, nullptr,
+                 2, timeouts, &stats);
+  std::thread loop_thread([&loop]() { loop.run(); });
+
+  // A slow reader, so that the file shrinks while the server is still
+  // sending its first half.
+  int client = SendRequest(port, "GET /static/" + path + " HTTP/1.1\r\n"
+                           "Connection: close\r\n\r\n", 16 * 1024);
+  ASSERT_NE(-1, client);
+  string reply;
+  char buf[4096];
+  while (reply.size() < 64 * 1024) {
+    ssize_t res = read(client, buf, sizeof(buf));
+    ASSERT_GT(res, 0);
+    reply.append(buf, res);
+  }
+  ASSERT_EQ(0, truncate(path.c_str(), kTruncatedSize));
+  ReadToEnd(client, &reply);
+
+  // The response is cut off where the file now ends, and every byte
+  // of body that did go out is the file's.
+  size_t body_pos = reply.find("\r\n\r\n");
+  ASSERT_NE(string::npos, body_pos);
+  ASSERT_NE(string::npos, reply.find("Content-length: 16777216\r\n"));
+  string body = reply.substr(body_pos + 4);
+  ASSERT_EQ(kTruncatedSize, body.size());
+  ASSERT_TRUE(body == contents.substr(0, kTruncatedSize));
+
+  loop.stop();
+  loop_thread.join();
+  close(listen_fd);
+  unlink(path.c_str());
+  rmdir(dir.c_str());
+}
+
+}  // namespace searchserver